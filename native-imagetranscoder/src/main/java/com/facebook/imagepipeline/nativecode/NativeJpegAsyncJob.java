@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.DoNotStrip;
+import com.facebook.common.internal.Preconditions;
+import com.facebook.common.memory.PooledByteBuffer;
+import java.util.concurrent.CancellationException;
+import java.util.concurrent.ExecutionException;
+import javax.annotation.Nullable;
+
+/**
+ * Native jpeg operation running on the {@link NativeTaskPool} instead of a java thread.
+ *
+ * <p>Returned by the async methods of {@link NativeJpegTranscoder}, {@link NativeJpegEncryptor}
+ * and {@link NativeJpegDecryptor}. The pool runs as many operations at once as it has workers,
+ * starting the ones of the most urgent priority first. Either wait for the result with {@link
+ * #get}, or pass a {@link Callback} and take it from there.
+ *
+ * <p>The input buffer is read until the job is done, it must not be closed before.
+ */
+@DoNotStrip
+public class NativeJpegAsyncJob {
+
+  /** Needed for what is on screen right now */
+  public static final int PRIORITY_VISIBLE = NativeTaskPool.PRIORITY_VISIBLE;
+
+  /** Likely needed soon */
+  public static final int PRIORITY_PREFETCH = NativeTaskPool.PRIORITY_PREFETCH;
+
+  /** May wait for all other jobs */
+  public static final int PRIORITY_BACKGROUND = NativeTaskPool.PRIORITY_BACKGROUND;
+
+  /** Notified once a job is done. */
+  public interface Callback {
+
+    /**
+     * Called on a native pool thread, so it should only hand the job over to another thread. {@link
+     * NativeJpegAsyncJob#get} does not block anymore.
+     */
+    void onComplete(NativeJpegAsyncJob job);
+  }
+
+  static {
+    NativeJpegTranscoderSoLoader.ensure();
+  }
+
+  /** Kept reachable while the native side reads it */
+  private final PooledByteBuffer mInput;
+
+  @Nullable private final Callback mCallback;
+
+  private final NativeJpegCancellationToken mCancellationToken;
+
+  /** @GuardedBy("this") */
+  private boolean mIsDone;
+
+  /** @GuardedBy("this") */
+  private boolean mIsCancelled;
+
+  /** @GuardedBy("this") */
+  @Nullable private PooledByteBuffer mResult;
+
+  /** @GuardedBy("this") */
+  @Nullable private Throwable mError;
+
+  NativeJpegAsyncJob(final PooledByteBuffer input, @Nullable final Callback callback) {
+    mInput = Preconditions.checkNotNull(input);
+    mCallback = callback;
+    mCancellationToken = new NativeJpegCancellationToken();
+  }
+
+  /**
+   * Asks the job to stop. It completes with a {@link CancellationException} soon after, unless it
+   * is already done.
+   */
+  public synchronized void cancel() {
+    if (!mIsDone && !mIsCancelled) {
+      mIsCancelled = true;
+      mCancellationToken.cancel();
+    }
+  }
+
+  public synchronized boolean isDone() {
+    return mIsDone;
+  }
+
+  /**
+   * Waits for the job to be done and returns its result, to be closed by the caller. Can only be
+   * called once the job succeeded.
+   *
+   * @throws CancellationException if the job got cancelled
+   * @throws ExecutionException wrapping what the operation threw
+   */
+  public synchronized PooledByteBuffer get() throws InterruptedException, ExecutionException {
+    while (!mIsDone) {
+      wait();
+    }
+    if (mError instanceof CancellationException) {
+      throw (CancellationException) mError;
+    }
+    if (mError != null) {
+      throw new ExecutionException(mError);
+    }
+    final PooledByteBuffer result = Preconditions.checkNotNull(mResult, "result already taken");
+    mResult = null;
+    return result;
+  }
+
+  long getCancellationTokenPtr() {
+    return NativeJpegCancellationToken.getNativePtr(mCancellationToken);
+  }
+
+  static void checkPriority(final int priority) {
+    Preconditions.checkArgument(priority >= PRIORITY_VISIBLE && priority <= PRIORITY_BACKGROUND);
+  }
+
+  /** Called by native code on a pool thread, with either the result or the error. */
+  @DoNotStrip
+  private void onNativeComplete(
+      @Nullable final NativeJpegBuffer result, @Nullable final Throwable error) {
+    synchronized (this) {
+      if (mIsCancelled && result != null) {
+        // finished before it noticed
+        result.close();
+        mError = new CancellationException("Operation cancelled");
+      } else {
+        mResult = result;
+        mError = error;
+      }
+      mIsDone = true;
+      mCancellationToken.close();
+      notifyAll();
+    }
+    if (mCallback != null) {
+      mCallback.onComplete(this);
+    }
+  }
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.DoNotStrip;
+import com.facebook.common.internal.Preconditions;
+import com.facebook.common.memory.PooledByteBuffer;
+import java.nio.ByteBuffer;
+import javax.annotation.Nullable;
+
+/**
+ * Encoded image written by native jpeg code straight into native memory.
+ *
+ * <p>Returned by the buffer based methods of {@link NativeJpegTranscoder}, {@link
+ * NativeJpegEncryptor} and {@link NativeJpegDecryptor}. The memory is released on {@link #close}.
+ */
+@DoNotStrip
+public class NativeJpegBuffer implements PooledByteBuffer {
+
+  static {
+    NativeJpegTranscoderSoLoader.ensure();
+  }
+
+  /** Address of the encoded bytes, allocated by native code */
+  private final long mNativePtr;
+
+  private final int mSize;
+
+  /** Direct buffer over the same memory */
+  private final ByteBuffer mByteBuffer;
+
+  /** flag indicating if this object was closed @GuardedBy("this") */
+  private boolean mIsClosed;
+
+  @DoNotStrip
+  private NativeJpegBuffer(final long nativePtr, final int size, final ByteBuffer byteBuffer) {
+    mNativePtr = nativePtr;
+    mSize = size;
+    mByteBuffer = byteBuffer;
+    mIsClosed = false;
+  }
+
+  @Override
+  public synchronized int size() {
+    ensureValid();
+    return mSize;
+  }
+
+  @Override
+  public synchronized byte read(final int offset) {
+    ensureValid();
+    Preconditions.checkArgument(offset >= 0);
+    Preconditions.checkArgument(offset < mSize);
+    return mByteBuffer.get(offset);
+  }
+
+  @Override
+  public synchronized int read(
+      final int offset, final byte[] buffer, final int bufferOffset, final int length) {
+    ensureValid();
+    Preconditions.checkArgument(offset >= 0 && offset <= mSize);
+    final int count = Math.min(length, mSize - offset);
+    final ByteBuffer view = mByteBuffer.duplicate();
+    view.position(offset);
+    view.get(buffer, bufferOffset, count);
+    return count;
+  }
+
+  @Override
+  public synchronized long getNativePtr() {
+    ensureValid();
+    return mNativePtr;
+  }
+
+  @Override
+  @Nullable
+  public synchronized ByteBuffer getByteBuffer() {
+    ensureValid();
+    return mByteBuffer;
+  }
+
+  @Override
+  public synchronized boolean isClosed() {
+    return mIsClosed;
+  }
+
+  @Override
+  public synchronized void close() {
+    if (!mIsClosed) {
+      mIsClosed = true;
+      nativeFree(mNativePtr);
+    }
+  }
+
+  @Override
+  protected void finalize() throws Throwable {
+    try {
+      close();
+    } finally {
+      super.finalize();
+    }
+  }
+
+  private synchronized void ensureValid() {
+    if (isClosed()) {
+      throw new ClosedException();
+    }
+  }
+
+  /**
+   * Returns the direct ByteBuffer backing given buffer, or null if the buffer is only reachable
+   * through {@link PooledByteBuffer#getNativePtr}.
+   */
+  @Nullable
+  static ByteBuffer getDirectByteBuffer(final PooledByteBuffer buffer) {
+    final ByteBuffer byteBuffer = buffer.getByteBuffer();
+    return byteBuffer != null && byteBuffer.isDirect() ? byteBuffer : null;
+  }
+
+  /** Returns the address of the bytes of given buffer, 0 if it is backed by a direct ByteBuffer. */
+  static long getNativePtr(final PooledByteBuffer buffer) {
+    return getDirectByteBuffer(buffer) != null ? 0 : buffer.getNativePtr();
+  }
+
+  @DoNotStrip
+  private static native void nativeFree(long nativePtr);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.DoNotStrip;
+import java.io.Closeable;
+import javax.annotation.Nullable;
+
+/**
+ * Cancels native jpeg operations from another thread.
+ *
+ * <p>Pass the token to the methods of {@link NativeJpegTranscoder}, {@link NativeJpegEncryptor}
+ * and {@link NativeJpegDecryptor} taking one, then call {@link #cancel} to make them stop at their
+ * next check, about once per row of the image. A cancelled operation frees what it allocated and
+ * throws a {@link java.util.concurrent.CancellationException}; its output is incomplete.
+ *
+ * <p>Operations already running keep the native token alive, but the token must not be closed
+ * before the operations it is passed to were started.
+ */
+@DoNotStrip
+public class NativeJpegCancellationToken implements Closeable {
+
+  static {
+    NativeJpegTranscoderSoLoader.ensure();
+  }
+
+  /** Handle of the native token */
+  private final long mNativePtr;
+
+  /** flag indicating if this object was closed @GuardedBy("this") */
+  private boolean mIsClosed;
+
+  public NativeJpegCancellationToken() {
+    mNativePtr = nativeCreate();
+    mIsClosed = false;
+  }
+
+  /** Asks the operations given this token to stop. Can be called from any thread. */
+  public synchronized void cancel() {
+    ensureValid();
+    nativeCancel(mNativePtr);
+  }
+
+  public synchronized boolean isCancelled() {
+    ensureValid();
+    return nativeIsCancelled(mNativePtr);
+  }
+
+  @Override
+  public synchronized void close() {
+    if (!mIsClosed) {
+      mIsClosed = true;
+      nativeRelease(mNativePtr);
+    }
+  }
+
+  @Override
+  protected void finalize() throws Throwable {
+    try {
+      close();
+    } finally {
+      super.finalize();
+    }
+  }
+
+  private synchronized void ensureValid() {
+    if (mIsClosed) {
+      throw new IllegalStateException("Cancellation token is closed");
+    }
+  }
+
+  /** Returns the handle passed to native methods for given token, 0 if there is none. */
+  static long getNativePtr(@Nullable final NativeJpegCancellationToken token) {
+    if (token == null) {
+      return 0;
+    }
+    synchronized (token) {
+      token.ensureValid();
+      return token.mNativePtr;
+    }
+  }
+
+  @DoNotStrip
+  private static native long nativeCreate();
+
+  @DoNotStrip
+  private static native void nativeCancel(long nativePtr);
+
+  @DoNotStrip
+  private static native boolean nativeIsCancelled(long nativePtr);
+
+  @DoNotStrip
+  private static native void nativeRelease(long nativePtr);
+}
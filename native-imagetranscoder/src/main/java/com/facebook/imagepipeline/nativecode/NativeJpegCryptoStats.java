@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.Preconditions;
+
+/**
+ * Timings and counters of a single encryption or decryption, filled in by native code.
+ *
+ * <p>Pass a new instance to the methods of {@link NativeJpegEncryptor} and {@link
+ * NativeJpegDecryptor} taking one. Reading and writing the streams happens from within the other
+ * stages, so the time of {@link #STAGE_STREAM_IO} is also part of the stage it happened in.
+ */
+public class NativeJpegCryptoStats {
+
+  /** Reading the markers up to the first scan */
+  public static final int STAGE_READ_HEADER = 0;
+
+  /** Entropy decoding the DCT coefficients */
+  public static final int STAGE_READ_COEFFICIENTS = 1;
+
+  /** Encoding and encrypting the embedded thumbnail */
+  public static final int STAGE_THUMBNAIL = 2;
+
+  /** Permuting the DC coefficients */
+  public static final int STAGE_DC_PERMUTATION = 3;
+
+  /** Flipping the signs of AC coefficients, not run by {@code EncryptionLevel.DC} */
+  public static final int STAGE_AC_SIGNS = 4;
+
+  /** Permuting the blocks, only run by {@code EncryptionLevel.FULL} */
+  public static final int STAGE_BLOCK_PERMUTATION = 5;
+
+  /** Entropy coding the DCT coefficients and writing the markers */
+  public static final int STAGE_WRITE_COEFFICIENTS = 6;
+
+  /** Reading from the input and writing to the output */
+  public static final int STAGE_STREAM_IO = 7;
+
+  public static final int STAGE_COUNT = 8;
+
+  private static final int BYTES_IN = 2 * STAGE_COUNT;
+  private static final int BYTES_OUT = BYTES_IN + 1;
+  private static final int BLOCK_COUNT = BYTES_IN + 2;
+  private static final int PEAK_MEMORY = BYTES_IN + 3;
+
+  /** Wall times of the stages, their cpu times and the counters, as written by native code */
+  final long[] mValues = new long[2 * STAGE_COUNT + 4];
+
+  /** Wall clock time spent in given stage */
+  public long getWallTimeNanos(int stage) {
+    Preconditions.checkArgument(stage >= 0 && stage < STAGE_COUNT);
+    return mValues[stage];
+  }
+
+  /** Cpu time of the calling thread spent in given stage */
+  public long getCpuTimeNanos(int stage) {
+    Preconditions.checkArgument(stage >= 0 && stage < STAGE_COUNT);
+    return mValues[STAGE_COUNT + stage];
+  }
+
+  /** Bytes of the input image read by libjpeg */
+  public long getBytesIn() {
+    return mValues[BYTES_IN];
+  }
+
+  /** Bytes of the output image */
+  public long getBytesOut() {
+    return mValues[BYTES_OUT];
+  }
+
+  /** 8x8 DCT blocks of all components of the image */
+  public long getBlockCount() {
+    return mValues[BLOCK_COUNT];
+  }
+
+  /** Most memory held by the pools of libjpeg at once */
+  public long getPeakMemoryBytes() {
+    return mValues[PEAK_MEMORY];
+  }
+}
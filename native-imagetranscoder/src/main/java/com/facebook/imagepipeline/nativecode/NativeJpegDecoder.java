@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import android.graphics.Bitmap;
+import android.util.Pair;
+import com.facebook.common.internal.DoNotStrip;
+import com.facebook.common.internal.Preconditions;
+import com.facebook.common.memory.PooledByteBuffer;
+import java.nio.ByteBuffer;
+import javax.annotation.Nullable;
+
+/**
+ * Decoder for jpeg images, using native code and libjpeg-turbo library.
+ *
+ * <p>Decodes straight into the pixels of a {@link Bitmap} or a direct {@link ByteBuffer}, with the
+ * same fast decompress parameters as {@link NativeJpegTranscoder}. Images are downscaled by the
+ * IDCT to the smallest n/8 scale that is not smaller than the requested size, they are never
+ * upscaled.
+ *
+ * <p>The region methods decode only a rectangle of an image, e.g. one tile of a zoomable view.
+ * Memory and decode time are proportional to the region rather than the whole image.
+ *
+ * <p>Large images with restart markers, e.g. ones transcoded by {@link NativeJpegTranscoder} with
+ * a restartIntervalRows, can be decoded on multiple threads by passing maxThreads. Each thread decodes a horizontal band of the image between two restart markers.
+ */
+@DoNotStrip
+public class NativeJpegDecoder {
+
+  /** Value of pixelFormat for 4 bytes per pixel, in the byte order of ARGB_8888 bitmaps */
+  public static final int PIXEL_FORMAT_RGBA_8888 = 0;
+  /** Value of pixelFormat for 2 bytes per pixel, in the byte order of RGB_565 bitmaps */
+  public static final int PIXEL_FORMAT_RGB_565 = 1;
+
+  static {
+    NativeJpegTranscoderSoLoader.ensure();
+  }
+
+  /**
+   * Reads the header of an image held in native memory and returns the size it is decoded at.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param targetWidth 1 or more, the decoded width is not smaller unless the image is
+   * @param targetHeight 1 or more, the decoded height is not smaller unless the image is
+   * @return width and height of the decoded image
+   */
+  public static Pair<Integer, Integer> getDecodedSize(
+      final PooledByteBuffer input, final int targetWidth, final int targetHeight) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkTargetSize(targetWidth, targetHeight);
+    Preconditions.checkNotNull(input);
+    final int[] size =
+        nativeGetDecodedSizeBuffer(
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            targetWidth,
+            targetHeight);
+    return Pair.create(size[0], size[1]);
+  }
+
+  /**
+   * Decodes an image held in native memory into a new bitmap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param targetWidth 1 or more, the bitmap is not narrower unless the image is
+   * @param targetHeight 1 or more, the bitmap is not shorter unless the image is
+   * @param config ARGB_8888 or RGB_565
+   * @param dither whether to dither RGB_565 output
+   * @return the decoded image, sized as returned by {@link #getDecodedSize}
+   */
+  public static Bitmap decodeJpeg(
+      final PooledByteBuffer input,
+      final int targetWidth,
+      final int targetHeight,
+      final Bitmap.Config config,
+      final boolean dither) {
+    return decodeJpeg(input, targetWidth, targetHeight, config, dither, 1);
+  }
+
+  /**
+   * Decodes an image held in native memory into a new bitmap, on up to maxThreads threads.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param targetWidth 1 or more, the bitmap is not narrower unless the image is
+   * @param targetHeight 1 or more, the bitmap is not shorter unless the image is
+   * @param config ARGB_8888 or RGB_565
+   * @param dither whether to dither RGB_565 output
+   * @param maxThreads 1 or more, threads decoding the image including the calling one
+   * @return the decoded image, sized as returned by {@link #getDecodedSize}
+   */
+  public static Bitmap decodeJpeg(
+      final PooledByteBuffer input,
+      final int targetWidth,
+      final int targetHeight,
+      final Bitmap.Config config,
+      final boolean dither,
+      final int maxThreads) {
+    checkBitmapConfig(config);
+    final Pair<Integer, Integer> size = getDecodedSize(input, targetWidth, targetHeight);
+    final Bitmap bitmap = Bitmap.createBitmap(size.first, size.second, config);
+    try {
+      decodeJpeg(input, bitmap, targetWidth, targetHeight, dither, maxThreads);
+    } catch (RuntimeException e) {
+      bitmap.recycle();
+      throw e;
+    }
+    return bitmap;
+  }
+
+  /**
+   * Decodes an image held in native memory into an existing bitmap, e.g. one taken from a pool.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param bitmap mutable ARGB_8888 or RGB_565 bitmap, at least as large as returned by {@link
+   *     #getDecodedSize}. Pixels outside of the decoded image are left untouched
+   * @param targetWidth 1 or more, the decoded width is not smaller unless the image is
+   * @param targetHeight 1 or more, the decoded height is not smaller unless the image is
+   * @param dither whether to dither RGB_565 output
+   */
+  public static void decodeJpeg(
+      final PooledByteBuffer input,
+      final Bitmap bitmap,
+      final int targetWidth,
+      final int targetHeight,
+      final boolean dither) {
+    decodeJpeg(input, bitmap, targetWidth, targetHeight, dither, 1);
+  }
+
+  /**
+   * Decodes an image held in native memory into an existing bitmap, on up to maxThreads threads.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param bitmap mutable ARGB_8888 or RGB_565 bitmap, at least as large as returned by {@link
+   *     #getDecodedSize}. Pixels outside of the decoded image are left untouched
+   * @param targetWidth 1 or more, the decoded width is not smaller unless the image is
+   * @param targetHeight 1 or more, the decoded height is not smaller unless the image is
+   * @param dither whether to dither RGB_565 output
+   * @param maxThreads 1 or more, threads decoding the image including the calling one
+   */
+  public static void decodeJpeg(
+      final PooledByteBuffer input,
+      final Bitmap bitmap,
+      final int targetWidth,
+      final int targetHeight,
+      final boolean dither,
+      final int maxThreads) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkTargetSize(targetWidth, targetHeight);
+    Preconditions.checkArgument(maxThreads > 0);
+    Preconditions.checkArgument(bitmap.isMutable());
+    checkBitmapConfig(bitmap.getConfig());
+    Preconditions.checkNotNull(input);
+    nativeDecodeJpegBufferIntoBitmap(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        bitmap,
+        targetWidth,
+        targetHeight,
+        dither,
+        maxThreads);
+  }
+
+  /**
+   * Decodes an image held in native memory into a direct buffer, without going through a bitmap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param output direct buffer of at least stride * height bytes
+   * @param width pixels available in each row of the output
+   * @param height rows available in the output
+   * @param stride bytes between the starts of subsequent rows
+   * @param pixelFormat one of the PIXEL_FORMAT_* constants
+   * @param targetWidth 1 or more, the decoded width is not smaller unless the image is
+   * @param targetHeight 1 or more, the decoded height is not smaller unless the image is
+   * @param dither whether to dither RGB_565 output
+   */
+  public static void decodeJpeg(
+      final PooledByteBuffer input,
+      final ByteBuffer output,
+      final int width,
+      final int height,
+      final int stride,
+      final int pixelFormat,
+      final int targetWidth,
+      final int targetHeight,
+      final boolean dither) {
+    decodeJpeg(
+        input, output, width, height, stride, pixelFormat, targetWidth, targetHeight, dither, 1);
+  }
+
+  /**
+   * Decodes an image held in native memory into a direct buffer, on up to maxThreads threads.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param output direct buffer of at least stride * height bytes
+   * @param width pixels available in each row of the output
+   * @param height rows available in the output
+   * @param stride bytes between the starts of subsequent rows
+   * @param pixelFormat one of the PIXEL_FORMAT_* constants
+   * @param targetWidth 1 or more, the decoded width is not smaller unless the image is
+   * @param targetHeight 1 or more, the decoded height is not smaller unless the image is
+   * @param dither whether to dither RGB_565 output
+   * @param maxThreads 1 or more, threads decoding the image including the calling one
+   */
+  public static void decodeJpeg(
+      final PooledByteBuffer input,
+      final ByteBuffer output,
+      final int width,
+      final int height,
+      final int stride,
+      final int pixelFormat,
+      final int targetWidth,
+      final int targetHeight,
+      final boolean dither,
+      final int maxThreads) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkTargetSize(targetWidth, targetHeight);
+    Preconditions.checkArgument(maxThreads > 0);
+    Preconditions.checkArgument(output.isDirect());
+    Preconditions.checkArgument(width > 0);
+    Preconditions.checkArgument(height > 0);
+    Preconditions.checkArgument(
+        pixelFormat == PIXEL_FORMAT_RGBA_8888 || pixelFormat == PIXEL_FORMAT_RGB_565);
+    Preconditions.checkNotNull(input);
+    nativeDecodeJpegBufferIntoBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        output,
+        width,
+        height,
+        stride,
+        pixelFormat,
+        targetWidth,
+        targetHeight,
+        dither,
+        maxThreads);
+  }
+
+  /**
+   * Reads the header of an image held in native memory and returns the size it is decoded at with
+   * the given scale, which region decodes are relative to.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param scaleNumerator 1 - 8, image is scaled using scaleNumerator/8 factor
+   * @return width and height of the decoded image
+   */
+  public static Pair<Integer, Integer> getDecodedSize(
+      final PooledByteBuffer input, final int scaleNumerator) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkScaleNumerator(scaleNumerator);
+    Preconditions.checkNotNull(input);
+    final int[] size =
+        nativeGetDecodedSizeAtScaleBuffer(
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            scaleNumerator);
+    return Pair.create(size[0], size[1]);
+  }
+
+  /**
+   * Decodes a region of an image held in native memory into a new bitmap of the region's size.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param scaleNumerator 1 - 8, image is scaled using scaleNumerator/8 factor
+   * @param regionX left edge of the region in the scaled image, 0 or more
+   * @param regionY top edge of the region in the scaled image, 0 or more
+   * @param regionWidth 1 or more, has to fit into the scaled image
+   * @param regionHeight 1 or more, has to fit into the scaled image
+   * @param config ARGB_8888 or RGB_565
+   * @param dither whether to dither RGB_565 output
+   * @return the decoded region
+   */
+  public static Bitmap decodeJpegRegion(
+      final PooledByteBuffer input,
+      final int scaleNumerator,
+      final int regionX,
+      final int regionY,
+      final int regionWidth,
+      final int regionHeight,
+      final Bitmap.Config config,
+      final boolean dither) {
+    checkBitmapConfig(config);
+    checkRegion(regionX, regionY, regionWidth, regionHeight);
+    final Bitmap bitmap = Bitmap.createBitmap(regionWidth, regionHeight, config);
+    try {
+      decodeJpegRegion(
+          input, bitmap, scaleNumerator, regionX, regionY, regionWidth, regionHeight, dither);
+    } catch (RuntimeException e) {
+      bitmap.recycle();
+      throw e;
+    }
+    return bitmap;
+  }
+
+  /**
+   * Decodes a region of an image held in native memory into the top left corner of an existing
+   * bitmap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param bitmap mutable ARGB_8888 or RGB_565 bitmap, at least as large as the region
+   * @param scaleNumerator 1 - 8, image is scaled using scaleNumerator/8 factor
+   * @param regionX left edge of the region in the scaled image, 0 or more
+   * @param regionY top edge of the region in the scaled image, 0 or more
+   * @param regionWidth 1 or more, has to fit into the scaled image
+   * @param regionHeight 1 or more, has to fit into the scaled image
+   * @param dither whether to dither RGB_565 output
+   */
+  public static void decodeJpegRegion(
+      final PooledByteBuffer input,
+      final Bitmap bitmap,
+      final int scaleNumerator,
+      final int regionX,
+      final int regionY,
+      final int regionWidth,
+      final int regionHeight,
+      final boolean dither) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkScaleNumerator(scaleNumerator);
+    checkRegion(regionX, regionY, regionWidth, regionHeight);
+    Preconditions.checkArgument(bitmap.isMutable());
+    checkBitmapConfig(bitmap.getConfig());
+    Preconditions.checkNotNull(input);
+    nativeDecodeJpegRegionBufferIntoBitmap(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        bitmap,
+        scaleNumerator,
+        regionX,
+        regionY,
+        regionWidth,
+        regionHeight,
+        dither);
+  }
+
+  /**
+   * Decodes a region of an image held in native memory into the start of a direct buffer.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param output direct buffer of at least stride * height bytes
+   * @param width pixels available in each row of the output, at least regionWidth
+   * @param height rows available in the output, at least regionHeight
+   * @param stride bytes between the starts of subsequent rows
+   * @param pixelFormat one of the PIXEL_FORMAT_* constants
+   * @param scaleNumerator 1 - 8, image is scaled using scaleNumerator/8 factor
+   * @param regionX left edge of the region in the scaled image, 0 or more
+   * @param regionY top edge of the region in the scaled image, 0 or more
+   * @param regionWidth 1 or more, has to fit into the scaled image
+   * @param regionHeight 1 or more, has to fit into the scaled image
+   * @param dither whether to dither RGB_565 output
+   */
+  public static void decodeJpegRegion(
+      final PooledByteBuffer input,
+      final ByteBuffer output,
+      final int width,
+      final int height,
+      final int stride,
+      final int pixelFormat,
+      final int scaleNumerator,
+      final int regionX,
+      final int regionY,
+      final int regionWidth,
+      final int regionHeight,
+      final boolean dither) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkScaleNumerator(scaleNumerator);
+    checkRegion(regionX, regionY, regionWidth, regionHeight);
+    Preconditions.checkArgument(output.isDirect());
+    Preconditions.checkArgument(width > 0);
+    Preconditions.checkArgument(height > 0);
+    Preconditions.checkArgument(
+        pixelFormat == PIXEL_FORMAT_RGBA_8888 || pixelFormat == PIXEL_FORMAT_RGB_565);
+    Preconditions.checkNotNull(input);
+    nativeDecodeJpegRegionBufferIntoBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        output,
+        width,
+        height,
+        stride,
+        pixelFormat,
+        scaleNumerator,
+        regionX,
+        regionY,
+        regionWidth,
+        regionHeight,
+        dither);
+  }
+
+  private static void checkScaleNumerator(final int scaleNumerator) {
+    Preconditions.checkArgument(scaleNumerator >= 1);
+    Preconditions.checkArgument(scaleNumerator <= 8);
+  }
+
+  private static void checkRegion(
+      final int regionX, final int regionY, final int regionWidth, final int regionHeight) {
+    Preconditions.checkArgument(regionX >= 0);
+    Preconditions.checkArgument(regionY >= 0);
+    Preconditions.checkArgument(regionWidth > 0);
+    Preconditions.checkArgument(regionHeight > 0);
+  }
+
+  private static void checkTargetSize(final int targetWidth, final int targetHeight) {
+    Preconditions.checkArgument(targetWidth > 0);
+    Preconditions.checkArgument(targetHeight > 0);
+  }
+
+  private static void checkBitmapConfig(final Bitmap.Config config) {
+    Preconditions.checkArgument(
+        config == Bitmap.Config.ARGB_8888 || config == Bitmap.Config.RGB_565,
+        "Unsupported bitmap config");
+  }
+
+  @DoNotStrip
+  private static native int[] nativeGetDecodedSizeBuffer(
+      @Nullable ByteBuffer byteBuffer, long nativePtr, int size, int targetWidth, int targetHeight);
+
+  @DoNotStrip
+  private static native void nativeDecodeJpegBufferIntoBitmap(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      Bitmap bitmap,
+      int targetWidth,
+      int targetHeight,
+      boolean dither,
+      int maxThreads);
+
+  @DoNotStrip
+  private static native void nativeDecodeJpegBufferIntoBuffer(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      ByteBuffer output,
+      int width,
+      int height,
+      int stride,
+      int pixelFormat,
+      int targetWidth,
+      int targetHeight,
+      boolean dither,
+      int maxThreads);
+
+  @DoNotStrip
+  private static native int[] nativeGetDecodedSizeAtScaleBuffer(
+      @Nullable ByteBuffer byteBuffer, long nativePtr, int size, int scaleNumerator);
+
+  @DoNotStrip
+  private static native void nativeDecodeJpegRegionBufferIntoBitmap(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      Bitmap bitmap,
+      int scaleNumerator,
+      int regionX,
+      int regionY,
+      int regionWidth,
+      int regionHeight,
+      boolean dither);
+
+  @DoNotStrip
+  private static native void nativeDecodeJpegRegionBufferIntoBuffer(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      ByteBuffer output,
+      int width,
+      int height,
+      int stride,
+      int pixelFormat,
+      int scaleNumerator,
+      int regionX,
+      int regionY,
+      int regionWidth,
+      int regionHeight,
+      boolean dither);
+}
@@ -4,6 +4,7 @@ import com.facebook.common.internal.Closeables;
 import com.facebook.common.internal.DoNotStrip;
 import com.facebook.common.internal.Preconditions;
 import com.facebook.common.internal.VisibleForTesting;
+import com.facebook.common.memory.PooledByteBuffer;
 import com.facebook.imageformat.DefaultImageFormats;
 import com.facebook.imageformat.ImageFormat;
 import com.facebook.imagepipeline.common.JpegCryptoKey;
@@ -15,6 +16,8 @@ import com.facebook.imagepipeline.image.EncodedImage;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import javax.annotation.Nullable;
 
 /**
  * Decryptor for jpeg images, using native code and libjpeg-turbo library.
@@ -45,6 +48,26 @@ public class NativeJpegDecryptor implements ImageDecryptor {
     return new ImageDecryptResult(DecryptStatus.DECRYPTING_SUCCESS);
   }
 
+  /**
+   * Decrypts only the thumbnail embedded by {@link NativeJpegEncryptor}, without touching the
+   * full size image data.
+   *
+   * @return false if the image does not carry a thumbnail
+   */
+  public boolean decryptThumbnail(
+          final EncodedImage encodedImage,
+          final OutputStream outputStream,
+          final JpegCryptoKey key)
+          throws IOException {
+    InputStream is = null;
+    try {
+      is = encodedImage.getInputStream();
+      return decryptJpegThumbnail(is, outputStream, key);
+    } finally {
+      Closeables.closeQuietly(is);
+    }
+  }
+
   @Override
   public ImageDecryptResult decryptEtc(
           EncodedImage encodedImageRed,
@@ -91,8 +114,124 @@ public class NativeJpegDecryptor implements ImageDecryptor {
           final OutputStream outputStream,
           final JpegCryptoKey key)
           throws IOException {
+    decryptJpeg(inputStream, outputStream, key, null);
+  }
+
+  /**
+   * Same as above, also measuring the decryption.
+   *
+   * @param stats if not null, filled with the timings and counters of the decryption
+   */
+  @VisibleForTesting
+  public static void decryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key,
+          @Nullable final NativeJpegCryptoStats stats)
+          throws IOException {
+    decryptJpeg(inputStream, outputStream, key, stats, null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the decryption with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  @VisibleForTesting
+  public static void decryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key,
+          @Nullable final NativeJpegCryptoStats stats,
+          @Nullable final NativeJpegCancellationToken cancellationToken)
+          throws IOException {
     NativeJpegTranscoderSoLoader.ensure();
     nativeDecryptJpeg(
+            Preconditions.checkNotNull(inputStream),
+            Preconditions.checkNotNull(outputStream),
+            key.getX0(),
+            key.getMu(),
+            stats != null ? stats.mValues : null,
+            NativeJpegCancellationToken.getNativePtr(cancellationToken));
+  }
+
+  /**
+   * Decrypts a JPEG held in native memory. Neither the input nor the output goes through java
+   * streams or the java heap.
+   *
+   * @param input encrypted image, has to be backed by native memory or a direct ByteBuffer
+   * @return the decrypted image, to be closed by the caller
+   */
+  public static PooledByteBuffer decryptJpeg(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key) {
+    return decryptJpeg(input, key, null);
+  }
+
+  /**
+   * Same as above, also measuring the decryption.
+   *
+   * @param stats if not null, filled with the timings and counters of the decryption
+   */
+  public static PooledByteBuffer decryptJpeg(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key,
+          @Nullable final NativeJpegCryptoStats stats) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkNotNull(input);
+    return nativeDecryptJpegBuffer(
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            key.getX0(),
+            key.getMu(),
+            stats != null ? stats.mValues : null);
+  }
+
+  /**
+   * Same as {@link #decryptJpeg(PooledByteBuffer, JpegCryptoKey)}, but runs on the native thread
+   * pool and returns right away.
+   *
+   * @param priority one of the {@link NativeJpegAsyncJob} PRIORITY_* constants
+   * @param callback if not null, notified on a pool thread once the job is done
+   * @return the job, its result is the decrypted image
+   */
+  public static NativeJpegAsyncJob decryptJpegAsync(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key,
+          final int priority,
+          @Nullable final NativeJpegAsyncJob.Callback callback) {
+    NativeJpegTranscoderSoLoader.ensure();
+    NativeJpegAsyncJob.checkPriority(priority);
+    final NativeJpegAsyncJob job = new NativeJpegAsyncJob(input, callback);
+    nativeDecryptJpegBufferAsync(
+            job,
+            priority,
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            key.getX0(),
+            key.getMu(),
+            job.getCancellationTokenPtr());
+    return job;
+  }
+
+  /**
+   * Decrypts the thumbnail embedded in an encrypted JPEG.
+   *
+   * @param inputStream  The {@link InputStream} of the encrypted image.
+   * @param outputStream The {@link OutputStream} where the decrypted thumbnail is written to.
+   * @return false if the image does not carry a thumbnail
+   */
+  @VisibleForTesting
+  public static boolean decryptJpegThumbnail(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key)
+          throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    return nativeDecryptJpegThumbnail(
             Preconditions.checkNotNull(inputStream),
             Preconditions.checkNotNull(outputStream),
             key.getX0(),
@@ -119,6 +258,36 @@ public class NativeJpegDecryptor implements ImageDecryptor {
 
   @DoNotStrip
   private static native void nativeDecryptJpeg(
+          InputStream inputStream,
+          OutputStream outputStream,
+          String x0,
+          String mu,
+          @Nullable long[] stats,
+          long cancellationToken)
+          throws IOException;
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeDecryptJpegBuffer(
+          @Nullable ByteBuffer byteBuffer,
+          long nativePtr,
+          int size,
+          String x0,
+          String mu,
+          @Nullable long[] stats);
+
+  @DoNotStrip
+  private static native void nativeDecryptJpegBufferAsync(
+          NativeJpegAsyncJob job,
+          int priority,
+          @Nullable ByteBuffer byteBuffer,
+          long nativePtr,
+          int size,
+          String x0,
+          String mu,
+          long cancellationToken);
+
+  @DoNotStrip
+  private static native boolean nativeDecryptJpegThumbnail(
           InputStream inputStream,
           OutputStream outputStream,
           String x0,
@@ -4,6 +4,7 @@ import com.facebook.common.internal.Closeables;
 import com.facebook.common.internal.DoNotStrip;
 import com.facebook.common.internal.Preconditions;
 import com.facebook.common.internal.VisibleForTesting;
+import com.facebook.common.memory.PooledByteBuffer;
 import com.facebook.imageformat.DefaultImageFormats;
 import com.facebook.imageformat.ImageFormat;
 import com.facebook.imagepipeline.common.JpegCryptoKey;
@@ -15,6 +16,8 @@ import com.facebook.imagepipeline.image.EncodedImage;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
+import javax.annotation.Nullable;
 
 /** Encryptor for jpeg images, using native code and libjpeg-turbo library. */
 @DoNotStrip
@@ -22,12 +25,60 @@ public class NativeJpegEncryptor implements ImageEncryptor {
 
   public static final String TAG = "NativeJpegEncryptor";
 
+  /**
+   * How much of the image gets encrypted. Lower levels are faster and inflate the output less, but
+   * leave more of the image structure visible. The level is recorded in the encrypted image, so
+   * decrypting does not need to know it.
+   */
+  public enum EncryptionLevel {
+    /* Permute DCT blocks and flip DC signs */
+    DC(1),
+
+    /* In addition, flip signs of AC coefficients */
+    DC_SIGNS(2),
+
+    /* In addition, permute AC coefficients independently of DCs */
+    FULL(3);
+
+    private int mValue;
+
+    private EncryptionLevel(int value) {
+      mValue = value;
+    }
+
+    public int getValue() {
+      return mValue;
+    }
+  }
+
   static {
     NativeJpegTranscoderSoLoader.ensure();
   }
 
+  private final EncryptionLevel mLevel;
+  private final int mThumbnailMaxDimension;
+
   public NativeJpegEncryptor() {
+    this(EncryptionLevel.FULL, 0);
+  }
+
+  /**
+   * @param thumbnailMaxDimension if positive, an encrypted thumbnail whose longer side does not
+   *     exceed this value is embedded in every encrypted jpeg
+   */
+  public NativeJpegEncryptor(int thumbnailMaxDimension) {
+    this(EncryptionLevel.FULL, thumbnailMaxDimension);
+  }
 
+  /**
+   * @param level how much of every image gets encrypted
+   * @param thumbnailMaxDimension if positive, an encrypted thumbnail whose longer side does not
+   *     exceed this value is embedded in every encrypted jpeg
+   */
+  public NativeJpegEncryptor(EncryptionLevel level, int thumbnailMaxDimension) {
+    Preconditions.checkArgument(thumbnailMaxDimension >= 0);
+    mLevel = Preconditions.checkNotNull(level);
+    mThumbnailMaxDimension = thumbnailMaxDimension;
   }
 
   @Override
@@ -39,7 +90,27 @@ public class NativeJpegEncryptor implements ImageEncryptor {
     InputStream is = null;
     try {
       is = encodedImage.getInputStream();
-      encryptJpeg(is, outputStream, key);
+      encryptJpeg(is, outputStream, key, mLevel, mThumbnailMaxDimension);
+    } finally {
+      Closeables.closeQuietly(is);
+    }
+    return new ImageEncryptResult(EncryptStatus.ENCRYPTING_SUCCESS);
+  }
+
+  /**
+   * Re-encrypts an image encrypted with {@code oldKey} so that it can be decrypted with
+   * {@code newKey}, without an intermediate plain image.
+   */
+  public ImageEncryptResult transcrypt(
+          final EncodedImage encodedImage,
+          final OutputStream outputStream,
+          final JpegCryptoKey oldKey,
+          final JpegCryptoKey newKey)
+          throws IOException {
+    InputStream is = null;
+    try {
+      is = encodedImage.getInputStream();
+      transcryptJpeg(is, outputStream, oldKey, newKey);
     } finally {
       Closeables.closeQuietly(is);
     }
@@ -87,12 +158,172 @@ public class NativeJpegEncryptor implements ImageEncryptor {
           final OutputStream outputStream,
           final JpegCryptoKey key)
           throws IOException {
+    encryptJpeg(inputStream, outputStream, key, EncryptionLevel.FULL, 0);
+  }
+
+  /**
+   * Encrypts a JPEG and optionally embeds an encrypted thumbnail of it.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be encrypted.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param level how much of the image gets encrypted
+   * @param thumbnailMaxDimension upper bound of the thumbnail width and height, 0 for no thumbnail
+   */
+  @VisibleForTesting
+  public static void encryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension)
+          throws IOException {
+    encryptJpeg(inputStream, outputStream, key, level, thumbnailMaxDimension, null);
+  }
+
+  /**
+   * Same as above, also measuring the encryption.
+   *
+   * @param stats if not null, filled with the timings and counters of the encryption
+   */
+  @VisibleForTesting
+  public static void encryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension,
+          @Nullable final NativeJpegCryptoStats stats)
+          throws IOException {
+    encryptJpeg(inputStream, outputStream, key, level, thumbnailMaxDimension, stats, null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the encryption with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  @VisibleForTesting
+  public static void encryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension,
+          @Nullable final NativeJpegCryptoStats stats,
+          @Nullable final NativeJpegCancellationToken cancellationToken)
+          throws IOException {
     NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkArgument(thumbnailMaxDimension >= 0);
     nativeEncryptJpeg(
             Preconditions.checkNotNull(inputStream),
             Preconditions.checkNotNull(outputStream),
             key.getX0(),
-            key.getMu());
+            key.getMu(),
+            Preconditions.checkNotNull(level).getValue(),
+            thumbnailMaxDimension,
+            stats != null ? stats.mValues : null,
+            NativeJpegCancellationToken.getNativePtr(cancellationToken));
+  }
+
+  /**
+   * Encrypts a JPEG held in native memory. Neither the input nor the output goes through java
+   * streams or the java heap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param level how much of the image gets encrypted
+   * @param thumbnailMaxDimension upper bound of the thumbnail width and height, 0 for no thumbnail
+   * @return the encrypted image, to be closed by the caller
+   */
+  public static PooledByteBuffer encryptJpeg(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension) {
+    return encryptJpeg(input, key, level, thumbnailMaxDimension, null);
+  }
+
+  /**
+   * Same as above, also measuring the encryption.
+   *
+   * @param stats if not null, filled with the timings and counters of the encryption
+   */
+  public static PooledByteBuffer encryptJpeg(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension,
+          @Nullable final NativeJpegCryptoStats stats) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkArgument(thumbnailMaxDimension >= 0);
+    Preconditions.checkNotNull(input);
+    return nativeEncryptJpegBuffer(
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            key.getX0(),
+            key.getMu(),
+            Preconditions.checkNotNull(level).getValue(),
+            thumbnailMaxDimension,
+            stats != null ? stats.mValues : null);
+  }
+
+  /**
+   * Same as {@link #encryptJpeg(PooledByteBuffer, JpegCryptoKey, EncryptionLevel, int)}, but runs
+   * on the native thread pool and returns right away.
+   *
+   * @param priority one of the {@link NativeJpegAsyncJob} PRIORITY_* constants
+   * @param callback if not null, notified on a pool thread once the job is done
+   * @return the job, its result is the encrypted image
+   */
+  public static NativeJpegAsyncJob encryptJpegAsync(
+          final PooledByteBuffer input,
+          final JpegCryptoKey key,
+          final EncryptionLevel level,
+          final int thumbnailMaxDimension,
+          final int priority,
+          @Nullable final NativeJpegAsyncJob.Callback callback) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkArgument(thumbnailMaxDimension >= 0);
+    NativeJpegAsyncJob.checkPriority(priority);
+    final NativeJpegAsyncJob job = new NativeJpegAsyncJob(input, callback);
+    nativeEncryptJpegBufferAsync(
+            job,
+            priority,
+            NativeJpegBuffer.getDirectByteBuffer(input),
+            NativeJpegBuffer.getNativePtr(input),
+            input.size(),
+            key.getX0(),
+            key.getMu(),
+            Preconditions.checkNotNull(level).getValue(),
+            thumbnailMaxDimension,
+            job.getCancellationTokenPtr());
+    return job;
+  }
+
+  /**
+   * Re-encrypts a JPEG with a new key in a single pass over its coefficients. The result is the
+   * same as decrypting with the old key and encrypting again with the new one.
+   *
+   * @param inputStream The {@link InputStream} of the image encrypted with oldKey.
+   * @param outputStream The {@link OutputStream} where the image encrypted with newKey is written
+   *     to.
+   */
+  @VisibleForTesting
+  public static void transcryptJpeg(
+          final InputStream inputStream,
+          final OutputStream outputStream,
+          final JpegCryptoKey oldKey,
+          final JpegCryptoKey newKey)
+          throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    nativeTranscryptJpeg(
+            Preconditions.checkNotNull(inputStream),
+            Preconditions.checkNotNull(outputStream),
+            oldKey.getX0(),
+            oldKey.getMu(),
+            newKey.getX0(),
+            newKey.getMu());
   }
 
   @VisibleForTesting
@@ -104,6 +335,26 @@ public class NativeJpegEncryptor implements ImageEncryptor {
           final JpegCryptoKey key,
           final int quality)
           throws IOException {
+    encryptJpegEtc(
+            inputStream, outputStreamRed, outputStreamGreen, outputStreamBlue, key, quality, null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the encryption with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  @VisibleForTesting
+  public static void encryptJpegEtc(
+          final InputStream inputStream,
+          final OutputStream outputStreamRed,
+          final OutputStream outputStreamGreen,
+          final OutputStream outputStreamBlue,
+          final JpegCryptoKey key,
+          final int quality,
+          @Nullable final NativeJpegCancellationToken cancellationToken)
+          throws IOException {
     NativeJpegTranscoderSoLoader.ensure();
     nativeEncryptJpegEtc(
             Preconditions.checkNotNull(inputStream),
@@ -112,7 +363,8 @@ public class NativeJpegEncryptor implements ImageEncryptor {
             Preconditions.checkNotNull(outputStreamBlue),
             key.getX0(),
             key.getMu(),
-            quality);
+            quality,
+            NativeJpegCancellationToken.getNativePtr(cancellationToken));
   }
 
   @DoNotStrip
@@ -120,7 +372,45 @@ public class NativeJpegEncryptor implements ImageEncryptor {
           InputStream inputStream,
           OutputStream outputStream,
           String x0,
-          String mu)
+          String mu,
+          int level,
+          int thumbnailMaxDimension,
+          @Nullable long[] stats,
+          long cancellationToken)
+          throws IOException;
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeEncryptJpegBuffer(
+          @Nullable ByteBuffer byteBuffer,
+          long nativePtr,
+          int size,
+          String x0,
+          String mu,
+          int level,
+          int thumbnailMaxDimension,
+          @Nullable long[] stats);
+
+  @DoNotStrip
+  private static native void nativeEncryptJpegBufferAsync(
+          NativeJpegAsyncJob job,
+          int priority,
+          @Nullable ByteBuffer byteBuffer,
+          long nativePtr,
+          int size,
+          String x0,
+          String mu,
+          int level,
+          int thumbnailMaxDimension,
+          long cancellationToken);
+
+  @DoNotStrip
+  private static native void nativeTranscryptJpeg(
+          InputStream inputStream,
+          OutputStream outputStream,
+          String oldX0,
+          String oldMu,
+          String newX0,
+          String newMu)
           throws IOException;
 
   @DoNotStrip
@@ -131,6 +421,7 @@ public class NativeJpegEncryptor implements ImageEncryptor {
           OutputStream outputStreamBlue,
           String x0,
           String mu,
-          int quality)
+          int quality,
+          long cancellationToken)
           throws IOException;
 }
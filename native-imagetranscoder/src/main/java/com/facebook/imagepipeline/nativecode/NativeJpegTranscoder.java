@@ -17,9 +17,11 @@ import static com.facebook.imagepipeline.transcoder.JpegTranscoderUtils.SCALE_DE
 
 import android.media.ExifInterface;
 import com.facebook.common.internal.Closeables;
+import com.facebook.common.internal.CountingOutputStream;
 import com.facebook.common.internal.DoNotStrip;
 import com.facebook.common.internal.Preconditions;
 import com.facebook.common.internal.VisibleForTesting;
+import com.facebook.common.memory.PooledByteBuffer;
 import com.facebook.imageformat.DefaultImageFormats;
 import com.facebook.imageformat.ImageFormat;
 import com.facebook.imagepipeline.common.ResizeOptions;
@@ -30,9 +32,11 @@ import com.facebook.imagepipeline.transcoder.ImageTranscodeResult;
 import com.facebook.imagepipeline.transcoder.ImageTranscoder;
 import com.facebook.imagepipeline.transcoder.JpegTranscoderUtils;
 import com.facebook.imagepipeline.transcoder.TranscodeStatus;
+import java.io.File;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
+import java.nio.ByteBuffer;
 import javax.annotation.Nullable;
 
 /** Transcoder for jpeg images, using native code and libjpeg-turbo library. */
@@ -40,6 +44,21 @@ import javax.annotation.Nullable;
 public class NativeJpegTranscoder implements ImageTranscoder {
   public static final String TAG = "NativeJpegTranscoder";
 
+  /** Drop all APPn and COM markers of the original image. */
+  public static final int MARKER_POLICY_NONE = 0;
+  /**
+   * Keep only the EXIF orientation of the original image, dropped if the rotation was applied to
+   * the pixels.
+   */
+  public static final int MARKER_POLICY_EXIF_ORIENTATION = 1;
+  /** Keep only the ICC profile of the original image. */
+  public static final int MARKER_POLICY_ICC_PROFILE = 2;
+  /**
+   * Keep all APPn and COM markers of the original image, the EXIF orientation is reset if the
+   * rotation was applied to the pixels.
+   */
+  public static final int MARKER_POLICY_ALL = 3;
+
   private boolean mResizingEnabled;
   private int mMaxBitmapSize;
   private boolean mUseDownsamplingRatio;
@@ -135,11 +154,14 @@ public class NativeJpegTranscoder implements ImageTranscoder {
   /**
    * Transcodes an image to match the specified rotation angle and the scale factor.
    *
+   * <p>No metadata of the original image is kept. The overloads taking a markerPolicy also return
+   * the quality the image was encoded with.
+   *
    * @param inputStream The {@link InputStream} of the image that will be transcoded.
    * @param outputStream The {@link OutputStream} where the newly created image is written to.
    * @param rotationAngle 0, 90, 180 or 270
    * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
-   * @param quality 1 - 100
+   * @param quality 1 - 100, lowered to the estimated quality of the original image if that is lower
    */
   @VisibleForTesting
   public static void transcodeJpeg(
@@ -149,7 +171,81 @@ public class NativeJpegTranscoder implements ImageTranscoder {
       final int scaleNumerator,
       final int quality)
       throws IOException {
+    transcodeJpeg(
+        inputStream, outputStream, rotationAngle, scaleNumerator, quality, MARKER_POLICY_NONE);
+  }
+
+  /**
+   * Transcodes an image to match the specified rotation angle and the scale factor.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param rotationAngle 0, 90, 180 or 270
+   * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
+   * @param quality 1 - 100, lowered to the estimated quality of the original image if that is lower
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return quality the image was encoded with, 0 if it was only rotated losslessly
+   */
+  @VisibleForTesting
+  public static int transcodeJpeg(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy)
+      throws IOException {
+    return transcodeJpeg(
+        inputStream, outputStream, rotationAngle, scaleNumerator, quality, markerPolicy, null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the transcoding with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  @VisibleForTesting
+  public static int transcodeJpeg(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
+    return transcodeJpeg(
+        inputStream,
+        outputStream,
+        rotationAngle,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        0,
+        cancellationToken);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static int transcodeJpeg(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
     NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
     Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
     Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
     Preconditions.checkArgument(quality >= MIN_QUALITY);
@@ -157,31 +253,711 @@ public class NativeJpegTranscoder implements ImageTranscoder {
     Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
     Preconditions.checkArgument(
         scaleNumerator != SCALE_DENOMINATOR || rotationAngle != 0, "no transformation requested");
-    nativeTranscodeJpeg(
+    return nativeTranscodeJpeg(
         Preconditions.checkNotNull(inputStream),
         Preconditions.checkNotNull(outputStream),
         rotationAngle,
         scaleNumerator,
-        quality);
+        quality,
+        markerPolicy,
+        restartIntervalRows,
+        NativeJpegCancellationToken.getNativePtr(cancellationToken));
+  }
+
+  /**
+   * Transcodes an image to exactly the specified size and rotates it.
+   *
+   * <p>Unlike {@link #transcodeJpeg(InputStream, OutputStream, int, int, int, int)} the size is not
+   * limited to multiples of 1/8 of the original one. The image is decoded at the closest larger
+   * scale and resampled to the target size.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param rotationAngle 0, 90, 180 or 270
+   * @param targetWidth width of the image before rotation, 1 - width of the original image
+   * @param targetHeight height of the image before rotation, 1 - height of the original image
+   * @param quality 1 - 100, lowered to the estimated quality of the original image if that is lower
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return quality the image was encoded with
+   */
+  public static int transcodeJpegToSize(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int targetWidth,
+      final int targetHeight,
+      final int quality,
+      final int markerPolicy)
+      throws IOException {
+    return transcodeJpegToSize(
+        inputStream,
+        outputStream,
+        rotationAngle,
+        targetWidth,
+        targetHeight,
+        quality,
+        markerPolicy,
+        null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the transcoding with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  public static int transcodeJpegToSize(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int targetWidth,
+      final int targetHeight,
+      final int quality,
+      final int markerPolicy,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
+    return transcodeJpegToSize(
+        inputStream,
+        outputStream,
+        rotationAngle,
+        targetWidth,
+        targetHeight,
+        quality,
+        markerPolicy,
+        0,
+        cancellationToken);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static int transcodeJpegToSize(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int targetWidth,
+      final int targetHeight,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    Preconditions.checkArgument(targetWidth > 0);
+    Preconditions.checkArgument(targetHeight > 0);
+    Preconditions.checkArgument(quality >= MIN_QUALITY);
+    Preconditions.checkArgument(quality <= MAX_QUALITY);
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+    return nativeTranscodeJpegToSize(
+        Preconditions.checkNotNull(inputStream),
+        Preconditions.checkNotNull(outputStream),
+        rotationAngle,
+        targetWidth,
+        targetHeight,
+        quality,
+        markerPolicy,
+        restartIntervalRows,
+        NativeJpegCancellationToken.getNativePtr(cancellationToken));
+  }
+
+  /**
+   * Transcodes an image to match the specified rotation angle and the scale factor, at the highest
+   * quality that keeps the output within a byte limit.
+   *
+   * <p>The image is decoded only once and encoded at most 8 times, which is much cheaper than
+   * retrying {@link #transcodeJpeg(InputStream, OutputStream, int, int, int, int)} with lower
+   * qualities. Only the final output is written to the output stream.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param rotationAngle 0, 90, 180 or 270
+   * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
+   * @param maxQuality 1 - 100, highest quality to try
+   * @param maxBytes the output is not larger than this
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return quality the image was encoded with
+   * @throws RuntimeException if the image does not fit even at quality 1
+   */
+  public static int transcodeJpegWithByteLimit(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int maxQuality,
+      final int maxBytes,
+      final int markerPolicy)
+      throws IOException {
+    return transcodeJpegWithByteLimit(
+        inputStream,
+        outputStream,
+        rotationAngle,
+        scaleNumerator,
+        maxQuality,
+        maxBytes,
+        markerPolicy,
+        0);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static int transcodeJpegWithByteLimit(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int maxQuality,
+      final int maxBytes,
+      final int markerPolicy,
+      final int restartIntervalRows)
+      throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
+    Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
+    Preconditions.checkArgument(maxQuality >= MIN_QUALITY);
+    Preconditions.checkArgument(maxQuality <= MAX_QUALITY);
+    Preconditions.checkArgument(maxBytes > 0);
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+    return nativeTranscodeJpegWithByteLimit(
+        Preconditions.checkNotNull(inputStream),
+        Preconditions.checkNotNull(outputStream),
+        rotationAngle,
+        scaleNumerator,
+        maxQuality,
+        maxBytes,
+        markerPolicy,
+        restartIntervalRows);
+  }
+
+  /**
+   * Transcodes an image to several sizes at once, decoding it only once. The outputs are encoded
+   * in parallel.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStreams one {@link OutputStream} per output
+   * @param rotationAngle 0, 90, 180 or 270, applied to all outputs
+   * @param targetWidths width of each output before rotation, 1 - width of the original image
+   * @param targetHeights height of each output before rotation, 1 - height of the original image
+   * @param qualities quality of each output, 1 - 100. Each is lowered to the estimated quality of
+   *     the original image if that is lower, so on return the array holds the quality each output
+   *     was encoded with
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   */
+  public static void transcodeJpegMulti(
+      final InputStream inputStream,
+      final OutputStream[] outputStreams,
+      final int rotationAngle,
+      final int[] targetWidths,
+      final int[] targetHeights,
+      final int[] qualities,
+      final int markerPolicy)
+      throws IOException {
+    transcodeJpegMulti(
+        inputStream,
+        outputStreams,
+        rotationAngle,
+        targetWidths,
+        targetHeights,
+        qualities,
+        markerPolicy,
+        0);
+  }
+
+  /**
+   * Same as above, emitting restart markers into each output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of each output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static void transcodeJpegMulti(
+      final InputStream inputStream,
+      final OutputStream[] outputStreams,
+      final int rotationAngle,
+      final int[] targetWidths,
+      final int[] targetHeights,
+      final int[] qualities,
+      final int markerPolicy,
+      final int restartIntervalRows)
+      throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    checkMultiArguments(
+        outputStreams.length, rotationAngle, targetWidths, targetHeights, qualities);
+    for (OutputStream outputStream : outputStreams) {
+      Preconditions.checkNotNull(outputStream);
+    }
+    nativeTranscodeJpegMulti(
+        Preconditions.checkNotNull(inputStream),
+        outputStreams,
+        rotationAngle,
+        targetWidths,
+        targetHeights,
+        qualities,
+        markerPolicy,
+        restartIntervalRows);
+  }
+
+  /**
+   * Transcodes an image held in native memory to several sizes at once, decoding it only once.
+   * Neither the input nor the outputs go through java streams or the java heap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param rotationAngle 0, 90, 180 or 270, applied to all outputs
+   * @param targetWidths width of each output before rotation, 1 - width of the original image
+   * @param targetHeights height of each output before rotation, 1 - height of the original image
+   * @param qualities quality of each output, 1 - 100, updated like in {@link
+   *     #transcodeJpegMulti(InputStream, OutputStream[], int, int[], int[], int[], int)}
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return the transcoded images in the order of targetWidths, to be closed by the caller
+   */
+  public static PooledByteBuffer[] transcodeJpegMulti(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int[] targetWidths,
+      final int[] targetHeights,
+      final int[] qualities,
+      final int markerPolicy) {
+    return transcodeJpegMulti(
+        input, rotationAngle, targetWidths, targetHeights, qualities, markerPolicy, 0);
+  }
+
+  /**
+   * Same as above, emitting restart markers into each output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of each output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static PooledByteBuffer[] transcodeJpegMulti(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int[] targetWidths,
+      final int[] targetHeights,
+      final int[] qualities,
+      final int markerPolicy,
+      final int restartIntervalRows) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    checkMultiArguments(targetWidths.length, rotationAngle, targetWidths, targetHeights, qualities);
+    Preconditions.checkNotNull(input);
+    return nativeTranscodeJpegBufferMulti(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        rotationAngle,
+        targetWidths,
+        targetHeights,
+        qualities,
+        markerPolicy,
+        restartIntervalRows);
+  }
+
+  /**
+   * Rotates an image and crops it without decoding it. Only the entropy coding is redone, so no
+   * quality is lost.
+   *
+   * <p>The crop is given in pixels of the rotated image. Its top left corner is moved up and left
+   * to the closest multiple of the 8 or 16 pixel block size of the image, keeping the right and
+   * bottom edges in place.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param rotationAngle 0, 90, 180 or 270
+   * @param cropX left edge of the crop, 0 or more
+   * @param cropY top edge of the crop, 0 or more
+   * @param cropWidth width of the crop, 1 or more, has to fit into the rotated image
+   * @param cropHeight height of the crop, 1 or more, has to fit into the rotated image
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   */
+  public static void cropJpeg(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int rotationAngle,
+      final int cropX,
+      final int cropY,
+      final int cropWidth,
+      final int cropHeight,
+      final int markerPolicy)
+      throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkCropArguments(rotationAngle, cropX, cropY, cropWidth, cropHeight);
+    nativeCropJpeg(
+        Preconditions.checkNotNull(inputStream),
+        Preconditions.checkNotNull(outputStream),
+        rotationAngle,
+        cropX,
+        cropY,
+        cropWidth,
+        cropHeight,
+        markerPolicy);
+  }
+
+  /**
+   * Rotates and crops an image held in native memory without decoding it. See {@link
+   * #cropJpeg(InputStream, OutputStream, int, int, int, int, int, int)}.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return the cropped image, to be closed by the caller
+   */
+  public static PooledByteBuffer cropJpeg(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int cropX,
+      final int cropY,
+      final int cropWidth,
+      final int cropHeight,
+      final int markerPolicy) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkCropArguments(rotationAngle, cropX, cropY, cropWidth, cropHeight);
+    Preconditions.checkNotNull(input);
+    return nativeCropJpegBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        rotationAngle,
+        cropX,
+        cropY,
+        cropWidth,
+        cropHeight,
+        markerPolicy);
+  }
+
+  /**
+   * Recompresses an image losslessly with optimized huffman tables, like jpegtran -optimize.
+   * Decoded pixels do not change. Camera images typically shrink by 5 - 15%.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be recompressed.
+   * @param outputStream The {@link OutputStream} where the recompressed image is written to.
+   * @param progressive whether to write a progressive jpeg
+   * @param stripMarkers whether to drop all metadata, including EXIF and ICC profiles
+   * @return number of bytes written, the bytes saved are the input size minus this count. Small
+   *     images may grow, callers should keep the original then.
+   */
+  public static long optimizeJpeg(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final boolean progressive,
+      final boolean stripMarkers)
+      throws IOException {
+    NativeJpegTranscoderSoLoader.ensure();
+    final CountingOutputStream countingOutputStream =
+        new CountingOutputStream(Preconditions.checkNotNull(outputStream));
+    nativeOptimizeJpeg(
+        Preconditions.checkNotNull(inputStream), countingOutputStream, progressive, stripMarkers);
+    return countingOutputStream.getCount();
+  }
+
+  /**
+   * Recompresses an image held in native memory losslessly. See {@link #optimizeJpeg(InputStream,
+   * OutputStream, boolean, boolean)}.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @return the recompressed image, to be closed by the caller. The bytes saved are the size of
+   *     input minus its size.
+   */
+  public static PooledByteBuffer optimizeJpeg(
+      final PooledByteBuffer input, final boolean progressive, final boolean stripMarkers) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkNotNull(input);
+    return nativeOptimizeJpegBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        progressive,
+        stripMarkers);
+  }
+
+  private static void checkMarkerPolicy(final int markerPolicy) {
+    Preconditions.checkArgument(markerPolicy >= MARKER_POLICY_NONE);
+    Preconditions.checkArgument(markerPolicy <= MARKER_POLICY_ALL);
+  }
+
+  private static void checkRestartIntervalRows(final int restartIntervalRows) {
+    Preconditions.checkArgument(restartIntervalRows >= 0);
+  }
+
+  private static void checkCropArguments(
+      final int rotationAngle,
+      final int cropX,
+      final int cropY,
+      final int cropWidth,
+      final int cropHeight) {
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+    Preconditions.checkArgument(cropX >= 0);
+    Preconditions.checkArgument(cropY >= 0);
+    Preconditions.checkArgument(cropWidth > 0);
+    Preconditions.checkArgument(cropHeight > 0);
+  }
+
+  private static void checkMultiArguments(
+      final int count,
+      final int rotationAngle,
+      final int[] targetWidths,
+      final int[] targetHeights,
+      final int[] qualities) {
+    Preconditions.checkArgument(count > 0, "no outputs requested");
+    Preconditions.checkArgument(targetWidths.length == count);
+    Preconditions.checkArgument(targetHeights.length == count);
+    Preconditions.checkArgument(qualities.length == count);
+    for (int i = 0; i < count; i++) {
+      Preconditions.checkArgument(targetWidths[i] > 0);
+      Preconditions.checkArgument(targetHeights[i] > 0);
+      Preconditions.checkArgument(qualities[i] >= MIN_QUALITY);
+      Preconditions.checkArgument(qualities[i] <= MAX_QUALITY);
+    }
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+  }
+
+  /**
+   * Transcodes an image held in native memory. Neither the input nor the output goes through java
+   * streams or the java heap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param rotationAngle 0, 90, 180 or 270
+   * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
+   * @param quality 1 - 100, lowered to {@link #estimateJpegQuality} of the input if that is lower
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return the transcoded image, to be closed by the caller
+   */
+  public static PooledByteBuffer transcodeJpeg(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy) {
+    return transcodeJpeg(input, rotationAngle, scaleNumerator, quality, markerPolicy, 0);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static PooledByteBuffer transcodeJpeg(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
+    Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
+    Preconditions.checkArgument(quality >= MIN_QUALITY);
+    Preconditions.checkArgument(quality <= MAX_QUALITY);
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+    Preconditions.checkArgument(
+        scaleNumerator != SCALE_DENOMINATOR || rotationAngle != 0, "no transformation requested");
+    Preconditions.checkNotNull(input);
+    return nativeTranscodeJpegBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        rotationAngle,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        restartIntervalRows);
+  }
+
+  /**
+   * Same as {@link #transcodeJpeg(PooledByteBuffer, int, int, int, int)}, but runs on the native
+   * thread pool and returns right away.
+   *
+   * @param priority one of the {@link NativeJpegAsyncJob} PRIORITY_* constants
+   * @param callback if not null, notified on a pool thread once the job is done
+   * @return the job, its result is the transcoded image
+   */
+  public static NativeJpegAsyncJob transcodeJpegAsync(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int priority,
+      @Nullable final NativeJpegAsyncJob.Callback callback) {
+    return transcodeJpegAsync(
+        input, rotationAngle, scaleNumerator, quality, markerPolicy, 0, priority, callback);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static NativeJpegAsyncJob transcodeJpegAsync(
+      final PooledByteBuffer input,
+      final int rotationAngle,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows,
+      final int priority,
+      @Nullable final NativeJpegAsyncJob.Callback callback) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    NativeJpegAsyncJob.checkPriority(priority);
+    Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
+    Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
+    Preconditions.checkArgument(quality >= MIN_QUALITY);
+    Preconditions.checkArgument(quality <= MAX_QUALITY);
+    Preconditions.checkArgument(JpegTranscoderUtils.isRotationAngleAllowed(rotationAngle));
+    Preconditions.checkArgument(
+        scaleNumerator != SCALE_DENOMINATOR || rotationAngle != 0, "no transformation requested");
+    final NativeJpegAsyncJob job = new NativeJpegAsyncJob(input, callback);
+    nativeTranscodeJpegBufferAsync(
+        job,
+        priority,
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        rotationAngle,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        restartIntervalRows,
+        job.getCancellationTokenPtr());
+    return job;
+  }
+
+  /**
+   * Estimates the quality an image held in native memory was encoded with, from its quantization
+   * tables. The transcode methods never encode at a higher quality than this.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @return 1 - 100, 0 if unknown
+   */
+  public static int estimateJpegQuality(final PooledByteBuffer input) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkNotNull(input);
+    return nativeEstimateJpegQualityBuffer(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size());
+  }
+
+  /**
+   * Bounds the memory libjpeg holds whole images in, e.g. the coefficients of lossless transforms
+   * and encryption, for operations started from now on. The part of an image over the limit is
+   * swapped to a temporary file, so very large images do not run out of memory.
+   *
+   * @param maxBytes 0 for no limit, the default
+   * @param backingStoreDirectory directory for the temporary files, e.g. the cache directory of
+   *     the app. If null, images exceeding the limit fail to transcode
+   */
+  public static void setMemoryLimit(
+      final long maxBytes, @Nullable final File backingStoreDirectory) {
+    NativeJpegTranscoderSoLoader.ensure();
+    Preconditions.checkArgument(maxBytes >= 0);
+    nativeSetMemoryLimit(
+        maxBytes, backingStoreDirectory == null ? null : backingStoreDirectory.getAbsolutePath());
   }
 
   @DoNotStrip
-  private static native void nativeTranscodeJpeg(
+  private static native int nativeTranscodeJpeg(
       InputStream inputStream,
       OutputStream outputStream,
       int rotationAngle,
       int scaleNominator,
-      int quality)
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows,
+      long cancellationToken)
+      throws IOException;
+
+  @DoNotStrip
+  private static native int nativeTranscodeJpegToSize(
+      InputStream inputStream,
+      OutputStream outputStream,
+      int rotationAngle,
+      int targetWidth,
+      int targetHeight,
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows,
+      long cancellationToken)
+      throws IOException;
+
+  @DoNotStrip
+  private static native int nativeTranscodeJpegWithByteLimit(
+      InputStream inputStream,
+      OutputStream outputStream,
+      int rotationAngle,
+      int scaleNumerator,
+      int maxQuality,
+      int maxBytes,
+      int markerPolicy,
+      int restartIntervalRows)
+      throws IOException;
+
+  @DoNotStrip
+  private static native void nativeTranscodeJpegMulti(
+      InputStream inputStream,
+      OutputStream[] outputStreams,
+      int rotationAngle,
+      int[] targetWidths,
+      int[] targetHeights,
+      int[] qualities,
+      int markerPolicy,
+      int restartIntervalRows)
+      throws IOException;
+
+  @DoNotStrip
+  private static native void nativeCropJpeg(
+      InputStream inputStream,
+      OutputStream outputStream,
+      int rotationAngle,
+      int cropX,
+      int cropY,
+      int cropWidth,
+      int cropHeight,
+      int markerPolicy)
+      throws IOException;
+
+  @DoNotStrip
+  private static native void nativeOptimizeJpeg(
+      InputStream inputStream,
+      OutputStream outputStream,
+      boolean progressive,
+      boolean stripMarkers)
       throws IOException;
 
   /**
    * Transcodes an image to match the specified exif orientation and the scale factor.
    *
+   * <p>No metadata of the original image is kept. The overloads taking a markerPolicy also return
+   * the quality the image was encoded with.
+   *
    * @param inputStream The {@link InputStream} of the image that will be transcoded.
    * @param outputStream The {@link OutputStream} where the newly created image is written to.
    * @param exifOrientation 0, 90, 180 or 270
    * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
-   * @param quality 1 - 100
+   * @param quality 1 - 100, lowered to the estimated quality of the original image if that is lower
    */
   @VisibleForTesting
   public static void transcodeJpegWithExifOrientation(
@@ -191,7 +967,81 @@ public class NativeJpegTranscoder implements ImageTranscoder {
       final int scaleNumerator,
       final int quality)
       throws IOException {
+    transcodeJpegWithExifOrientation(
+        inputStream, outputStream, exifOrientation, scaleNumerator, quality, MARKER_POLICY_NONE);
+  }
+
+  /**
+   * Transcodes an image to match the specified exif orientation and the scale factor.
+   *
+   * @param inputStream The {@link InputStream} of the image that will be transcoded.
+   * @param outputStream The {@link OutputStream} where the newly created image is written to.
+   * @param exifOrientation 0, 90, 180 or 270
+   * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
+   * @param quality 1 - 100, lowered to the estimated quality of the original image if that is lower
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return quality the image was encoded with, 0 if it was only rotated losslessly
+   */
+  @VisibleForTesting
+  public static int transcodeJpegWithExifOrientation(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy)
+      throws IOException {
+    return transcodeJpegWithExifOrientation(
+        inputStream, outputStream, exifOrientation, scaleNumerator, quality, markerPolicy, null);
+  }
+
+  /**
+   * Same as above, stopping early once cancellationToken is cancelled.
+   *
+   * @param cancellationToken if not null, cancels the transcoding with a {@link
+   *     java.util.concurrent.CancellationException}
+   */
+  @VisibleForTesting
+  public static int transcodeJpegWithExifOrientation(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
+    return transcodeJpegWithExifOrientation(
+        inputStream,
+        outputStream,
+        exifOrientation,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        0,
+        cancellationToken);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static int transcodeJpegWithExifOrientation(
+      final InputStream inputStream,
+      final OutputStream outputStream,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows,
+      @Nullable final NativeJpegCancellationToken cancellationToken)
+      throws IOException {
     NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
     Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
     Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
     Preconditions.checkArgument(quality >= MIN_QUALITY);
@@ -200,20 +1050,238 @@ public class NativeJpegTranscoder implements ImageTranscoder {
     Preconditions.checkArgument(
         scaleNumerator != SCALE_DENOMINATOR || exifOrientation != ExifInterface.ORIENTATION_NORMAL,
         "no transformation requested");
-    nativeTranscodeJpegWithExifOrientation(
+    return nativeTranscodeJpegWithExifOrientation(
         Preconditions.checkNotNull(inputStream),
         Preconditions.checkNotNull(outputStream),
         exifOrientation,
         scaleNumerator,
-        quality);
+        quality,
+        markerPolicy,
+        restartIntervalRows,
+        NativeJpegCancellationToken.getNativePtr(cancellationToken));
+  }
+
+  /**
+   * Transcodes an image held in native memory to match the specified exif orientation and the
+   * scale factor. Neither the input nor the output goes through java streams or the java heap.
+   *
+   * @param input encoded image, has to be backed by native memory or a direct ByteBuffer
+   * @param exifOrientation one of the ExifInterface orientations
+   * @param scaleNumerator 1 - 16, image will be scaled using scaleNumerator/8 factor
+   * @param quality 1 - 100, lowered to {@link #estimateJpegQuality} of the input if that is lower
+   * @param markerPolicy one of the MARKER_POLICY_* constants, metadata to keep
+   * @return the transcoded image, to be closed by the caller
+   */
+  public static PooledByteBuffer transcodeJpegWithExifOrientation(
+      final PooledByteBuffer input,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy) {
+    return transcodeJpegWithExifOrientation(
+        input, exifOrientation, scaleNumerator, quality, markerPolicy, 0);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static PooledByteBuffer transcodeJpegWithExifOrientation(
+      final PooledByteBuffer input,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
+    Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
+    Preconditions.checkArgument(quality >= MIN_QUALITY);
+    Preconditions.checkArgument(quality <= MAX_QUALITY);
+    Preconditions.checkArgument(JpegTranscoderUtils.isExifOrientationAllowed(exifOrientation));
+    Preconditions.checkArgument(
+        scaleNumerator != SCALE_DENOMINATOR || exifOrientation != ExifInterface.ORIENTATION_NORMAL,
+        "no transformation requested");
+    Preconditions.checkNotNull(input);
+    return nativeTranscodeJpegBufferWithExifOrientation(
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        exifOrientation,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        restartIntervalRows);
+  }
+
+  /**
+   * Same as {@link #transcodeJpegWithExifOrientation(PooledByteBuffer, int, int, int, int)}, but
+   * runs on the native thread pool and returns right away.
+   *
+   * @param priority one of the {@link NativeJpegAsyncJob} PRIORITY_* constants
+   * @param callback if not null, notified on a pool thread once the job is done
+   * @return the job, its result is the transcoded image
+   */
+  public static NativeJpegAsyncJob transcodeJpegWithExifOrientationAsync(
+      final PooledByteBuffer input,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int priority,
+      @Nullable final NativeJpegAsyncJob.Callback callback) {
+    return transcodeJpegWithExifOrientationAsync(
+        input, exifOrientation, scaleNumerator, quality, markerPolicy, 0, priority, callback);
+  }
+
+  /**
+   * Same as above, emitting restart markers into the output.
+   *
+   * @param restartIntervalRows 0 for no restart markers, or MCU rows between the restart markers
+   *     of the output, which let {@link NativeJpegDecoder} decode it on multiple threads. An MCU
+   *     row is 8 or 16 pixel rows
+   */
+  public static NativeJpegAsyncJob transcodeJpegWithExifOrientationAsync(
+      final PooledByteBuffer input,
+      final int exifOrientation,
+      final int scaleNumerator,
+      final int quality,
+      final int markerPolicy,
+      final int restartIntervalRows,
+      final int priority,
+      @Nullable final NativeJpegAsyncJob.Callback callback) {
+    NativeJpegTranscoderSoLoader.ensure();
+    checkMarkerPolicy(markerPolicy);
+    checkRestartIntervalRows(restartIntervalRows);
+    NativeJpegAsyncJob.checkPriority(priority);
+    Preconditions.checkArgument(scaleNumerator >= MIN_SCALE_NUMERATOR);
+    Preconditions.checkArgument(scaleNumerator <= MAX_SCALE_NUMERATOR);
+    Preconditions.checkArgument(quality >= MIN_QUALITY);
+    Preconditions.checkArgument(quality <= MAX_QUALITY);
+    Preconditions.checkArgument(JpegTranscoderUtils.isExifOrientationAllowed(exifOrientation));
+    Preconditions.checkArgument(
+        scaleNumerator != SCALE_DENOMINATOR || exifOrientation != ExifInterface.ORIENTATION_NORMAL,
+        "no transformation requested");
+    final NativeJpegAsyncJob job = new NativeJpegAsyncJob(input, callback);
+    nativeTranscodeJpegBufferWithExifOrientationAsync(
+        job,
+        priority,
+        NativeJpegBuffer.getDirectByteBuffer(input),
+        NativeJpegBuffer.getNativePtr(input),
+        input.size(),
+        exifOrientation,
+        scaleNumerator,
+        quality,
+        markerPolicy,
+        restartIntervalRows,
+        job.getCancellationTokenPtr());
+    return job;
   }
 
   @DoNotStrip
-  private static native void nativeTranscodeJpegWithExifOrientation(
+  private static native int nativeTranscodeJpegWithExifOrientation(
       InputStream inputStream,
       OutputStream outputStream,
       int exifOrientation,
       int scaleNominator,
-      int quality)
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows,
+      long cancellationToken)
       throws IOException;
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeTranscodeJpegBuffer(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int rotationAngle,
+      int scaleNominator,
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows);
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeTranscodeJpegBufferWithExifOrientation(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int exifOrientation,
+      int scaleNominator,
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows);
+
+  @DoNotStrip
+  private static native void nativeTranscodeJpegBufferAsync(
+      NativeJpegAsyncJob job,
+      int priority,
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int rotationAngle,
+      int scaleNominator,
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows,
+      long cancellationToken);
+
+  @DoNotStrip
+  private static native void nativeTranscodeJpegBufferWithExifOrientationAsync(
+      NativeJpegAsyncJob job,
+      int priority,
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int exifOrientation,
+      int scaleNominator,
+      int quality,
+      int markerPolicy,
+      int restartIntervalRows,
+      long cancellationToken);
+
+  @DoNotStrip
+  private static native NativeJpegBuffer[] nativeTranscodeJpegBufferMulti(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int rotationAngle,
+      int[] targetWidths,
+      int[] targetHeights,
+      int[] qualities,
+      int markerPolicy,
+      int restartIntervalRows);
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeCropJpegBuffer(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      int rotationAngle,
+      int cropX,
+      int cropY,
+      int cropWidth,
+      int cropHeight,
+      int markerPolicy);
+
+  @DoNotStrip
+  private static native NativeJpegBuffer nativeOptimizeJpegBuffer(
+      @Nullable ByteBuffer byteBuffer,
+      long nativePtr,
+      int size,
+      boolean progressive,
+      boolean stripMarkers);
+
+  @DoNotStrip
+  private static native int nativeEstimateJpegQualityBuffer(
+      @Nullable ByteBuffer byteBuffer, long nativePtr, int size);
+
+  @DoNotStrip
+  private static native void nativeSetMemoryLimit(
+      long maxBytes, @Nullable String backingStoreDirectory);
 }
@@ -26,6 +26,7 @@ public class NativeJpegTranscoderSoLoader {
           // Head in the sand
         }
       }
+      NativeTaskPoolSoLoader.ensure();
       NativeLoader.loadLibrary("native-imagetranscoder");
       sInitialized = true;
     }
@@ -9,6 +9,8 @@ APP_ABI := armeabi-v7a arm64-v8a x86 x86_64
 
 APP_MK_DIR := $(dir $(lastword $(MAKEFILE_LIST)))
 NDK_MODULE_PATH := $(APP_MK_DIR)$(HOST_DIRSEP)$(APP_MK_DIR)../../../nativedeps/merge
+# libfresco-taskpool.so is linked against, native-taskpool ships it
+NDK_MODULE_PATH := $(NDK_MODULE_PATH)$(HOST_DIRSEP)$(APP_MK_DIR)../../../../native-taskpool/src/main/jni
 
 APP_STL := c++_static
 
@@ -0,0 +1,768 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Benchmarks of the jpeg crypto: encryptJpeg/decryptJpeg at every cipher
+ * level, the encryptJpegEtc/decryptJpegEtc pair, and each pass they are
+ * made of in isolation, over a corpus of 0.3 to 50 MP images.
+ *
+ *   crypto_benchmark [--benchmark_filter=<regex>] \
+ *       [--benchmark_out=crypto.json --benchmark_out_format=json] \
+ *       [image.jpg ...]
+ *
+ * The synthetic corpus is generated deterministically, so that runs on
+ * different machines and revisions are comparable. Images given on the
+ * command line are benchmarked in addition to it. Besides the timings every
+ * benchmark reports these counters:
+ *
+ *   MP/s         megapixels of the image processed per second
+ *   peak_rss_MB  high water mark of the resident set while it ran
+ *
+ * and the encryptJpeg, decryptJpeg and etc benchmarks additionally:
+ *
+ *   jpeg_mem_MB  peak memory of the jpeg memory manager (encryptJpeg and
+ *                decryptJpeg only)
+ *   inflation    ciphertext bytes over plaintext bytes
+ *   psnr_dB      PSNR of the decrypted image against the plaintext, 99 when
+ *                the round trip is lossless
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include <benchmark/benchmark.h>
+#include <gmp.h>
+#include <jpeglib.h>
+
+#include "decoded_image.h"
+#include "transformations.h"
+#include "jpeg/crypto/jpeg_crypto.h"
+#include "jpeg/crypto/jpeg_crypto_stats.h"
+#include "jpeg/crypto/jpeg_decrypt.h"
+#include "jpeg/crypto/jpeg_encrypt.h"
+#include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_error_handler.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+
+using facebook::imagepipeline::DecodedImage;
+using facebook::imagepipeline::PixelFormat;
+using facebook::imagepipeline::TargetSize;
+using facebook::imagepipeline::pixels_t;
+using namespace facebook::imagepipeline::jpeg;
+using namespace facebook::imagepipeline::jpeg::crypto;
+
+namespace {
+
+const CryptoKey kKey{"5.55555555555555555556e-1", "3.577777777777777777e0"};
+
+const int kSyntheticQuality = 90;
+const int kEtcQuality = 90;
+
+// reported for lossless round trips, where the PSNR is infinite
+const double kLosslessPsnr = 99.0;
+
+/**
+ * An image of the corpus. Synthetic images are encoded on first use, so that
+ * filtering out the large ones also skips generating them.
+ */
+struct CorpusImage {
+  std::string name;
+  std::string path;
+  unsigned int width;
+  unsigned int height;
+  std::vector<uint8_t> jpeg;
+
+  double megapixels() const {
+    return width * (double) height / 1e6;
+  }
+};
+
+/**
+ * Smooth gradients with some texture and hard edges, so that the blocks
+ * have the mix of zero and non zero ACs of a photo rather than of a flat
+ * test card.
+ */
+std::vector<uint8_t> encodeSyntheticJpeg(
+    JpegStatus& status,
+    unsigned int width,
+    unsigned int height) {
+  uint8_t* pixels = new uint8_t[(size_t) width * height * 3];
+  uint32_t noise = 2463534242u;
+  uint8_t* pixel = pixels;
+  for (unsigned int y = 0; y < height; ++y) {
+    for (unsigned int x = 0; x < width; ++x) {
+      noise ^= noise << 13;
+      noise ^= noise >> 17;
+      noise ^= noise << 5;
+      int grain = (int) (noise & 15) - 8;
+      int edge = ((x / 96 + y / 64) & 1) ? 40 : 0;
+      double ring = sin((x * (double) x + y * (double) y) / (width * 24.0));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (x * 200 / width) + edge + grain));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (y * 200 / height) + grain));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (128 + 100 * ring) - edge + grain));
+    }
+  }
+  DecodedImage image{
+      pixels_t{pixels, [](uint8_t* pixels) { delete[] pixels; }},
+      PixelFormat::RGB,
+      width,
+      height,
+      std::vector<uint8_t>()};
+  JpegMemoryDestination destination;
+  encodeJpeg(status, image, destination.public_fields, kSyntheticQuality, 0);
+  return std::move(destination.buffer);
+}
+
+/**
+ * Returns the encoded image, loading or generating it on first use.
+ * Fails status if that is not possible.
+ */
+const std::vector<uint8_t>& getJpeg(JpegStatus& status, CorpusImage& image) {
+  if (!image.jpeg.empty()) {
+    return image.jpeg;
+  }
+  if (image.path.empty()) {
+    image.jpeg = encodeSyntheticJpeg(status, image.width, image.height);
+    return image.jpeg;
+  }
+  std::ifstream file{image.path, std::ios::binary};
+  image.jpeg.assign(
+      std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  if (image.jpeg.empty()) {
+    status.fail(kJpegErrorFailed, ("cannot read " + image.path).c_str());
+  }
+  return image.jpeg;
+}
+
+/**
+ * Starts a new high water mark of the resident set, on Linux. Elsewhere
+ * peak_rss_MB is the peak of the whole process.
+ */
+void resetPeakRss() {
+  FILE* clear_refs = fopen("/proc/self/clear_refs", "w");
+  if (clear_refs != nullptr) {
+    fputs("5", clear_refs);
+    fclose(clear_refs);
+  }
+}
+
+double getPeakRssMB() {
+  FILE* proc_status = fopen("/proc/self/status", "r");
+  if (proc_status != nullptr) {
+    char line[256];
+    long kilobytes = -1;
+    while (fgets(line, sizeof(line), proc_status) != nullptr) {
+      if (sscanf(line, "VmHWM: %ld kB", &kilobytes) == 1) {
+        break;
+      }
+    }
+    fclose(proc_status);
+    if (kilobytes >= 0) {
+      return kilobytes / 1024.0;
+    }
+  }
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // kilobytes on Linux, bytes on macOS
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+/**
+ * Decodes jpeg into RGBA at its full size.
+ */
+bool decodeRgba(
+    JpegStatus& status,
+    const uint8_t* jpeg,
+    size_t size,
+    std::vector<uint8_t>& pixels,
+    unsigned int& width,
+    unsigned int& height) {
+  const TargetSize full_size{1 << 16, 1 << 16};
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg, size);
+  if (!getDecodedJpegSize(status, source.public_fields, full_size, width, height)) {
+    return false;
+  }
+  pixels.resize((size_t) width * height * 4);
+  source.setExternalBuffer(jpeg, size);
+  decodeJpeg(
+      status,
+      source.public_fields,
+      full_size,
+      PixelFormat::RGBA,
+      false,
+      pixels.data(),
+      width,
+      height,
+      (size_t) width * 4);
+  return !status.failed;
+}
+
+/**
+ * PSNR of the RGB channels of decrypted against plaintext, over the area
+ * they have in common: encryptJpegEtc pads the image to whole blocks.
+ */
+double computePsnr(
+    JpegStatus& status,
+    const std::vector<uint8_t>& plaintext,
+    const uint8_t* decrypted,
+    size_t decrypted_size) {
+  std::vector<uint8_t> expected;
+  std::vector<uint8_t> actual;
+  unsigned int expected_width, expected_height, actual_width, actual_height;
+  if (!decodeRgba(status, plaintext.data(), plaintext.size(), expected,
+          expected_width, expected_height) ||
+      !decodeRgba(status, decrypted, decrypted_size, actual,
+          actual_width, actual_height)) {
+    return 0;
+  }
+  unsigned int width = std::min(expected_width, actual_width);
+  unsigned int height = std::min(expected_height, actual_height);
+  double squared_error = 0;
+  for (unsigned int y = 0; y < height; ++y) {
+    const uint8_t* expected_row = &expected[(size_t) y * expected_width * 4];
+    const uint8_t* actual_row = &actual[(size_t) y * actual_width * 4];
+    for (unsigned int x = 0; x < width * 4; ++x) {
+      if ((x & 3) != 3) {
+        double difference = expected_row[x] - (double) actual_row[x];
+        squared_error += difference * difference;
+      }
+    }
+  }
+  double mean_squared_error = squared_error / ((double) width * height * 3);
+  if (mean_squared_error == 0) {
+    return kLosslessPsnr;
+  }
+  return std::min(
+      kLosslessPsnr, 10 * log10(255.0 * 255.0 / mean_squared_error));
+}
+
+void setCommonCounters(benchmark::State& state, const CorpusImage& image) {
+  state.counters["MP/s"] = benchmark::Counter(
+      image.megapixels(), benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["peak_rss_MB"] = getPeakRssMB();
+}
+
+/**
+ * Ciphertext of an image and the counters of its round trip, computed once
+ * outside of the timed loops.
+ */
+struct RoundTrip {
+  std::vector<uint8_t> plaintext;
+  std::vector<uint8_t> ciphertext;
+  std::vector<uint8_t> ciphertext_green;
+  std::vector<uint8_t> ciphertext_blue;
+  double inflation;
+  double psnr;
+};
+
+std::vector<uint8_t> copyOf(const JpegNativeBufferDestination& destination) {
+  return std::vector<uint8_t>(
+      destination.data, destination.data + destination.size);
+}
+
+bool encryptRoundTrip(
+    JpegStatus& status,
+    CorpusImage& image,
+    int level,
+    RoundTrip& round_trip) {
+  round_trip.plaintext = getJpeg(status, image);
+  if (status.failed) {
+    return false;
+  }
+  JpegMemorySource source;
+  source.setExternalBuffer(
+      round_trip.plaintext.data(), round_trip.plaintext.size());
+  JpegNativeBufferDestination encrypted{round_trip.plaintext.size()};
+  encryptJpeg(
+      status,
+      source.public_fields,
+      encrypted.public_fields,
+      kKey,
+      level,
+      0,
+      nullptr);
+  if (status.failed) {
+    return false;
+  }
+  round_trip.ciphertext = copyOf(encrypted);
+
+  source.setExternalBuffer(
+      round_trip.ciphertext.data(), round_trip.ciphertext.size());
+  JpegNativeBufferDestination decrypted{round_trip.plaintext.size()};
+  decryptJpeg(status, source.public_fields, decrypted.public_fields, kKey, nullptr);
+  if (status.failed) {
+    return false;
+  }
+  round_trip.inflation =
+      round_trip.ciphertext.size() / (double) round_trip.plaintext.size();
+  round_trip.psnr = computePsnr(
+      status, round_trip.plaintext, decrypted.data, decrypted.size);
+  return !status.failed;
+}
+
+bool encryptEtcRoundTrip(
+    JpegStatus& status,
+    CorpusImage& image,
+    RoundTrip& round_trip) {
+  round_trip.plaintext = getJpeg(status, image);
+  if (status.failed) {
+    return false;
+  }
+  JpegMemorySource source;
+  source.setExternalBuffer(
+      round_trip.plaintext.data(), round_trip.plaintext.size());
+  JpegNativeBufferDestination red{round_trip.plaintext.size()};
+  JpegNativeBufferDestination green{round_trip.plaintext.size()};
+  JpegNativeBufferDestination blue{round_trip.plaintext.size()};
+  encryptJpegEtc(
+      status,
+      source.public_fields,
+      red.public_fields,
+      green.public_fields,
+      blue.public_fields,
+      kKey,
+      kEtcQuality);
+  if (status.failed) {
+    return false;
+  }
+  round_trip.ciphertext = copyOf(red);
+  round_trip.ciphertext_green = copyOf(green);
+  round_trip.ciphertext_blue = copyOf(blue);
+
+  JpegMemorySource source_red;
+  JpegMemorySource source_green;
+  JpegMemorySource source_blue;
+  source_red.setExternalBuffer(red.data, red.size);
+  source_green.setExternalBuffer(green.data, green.size);
+  source_blue.setExternalBuffer(blue.data, blue.size);
+  JpegNativeBufferDestination decrypted{round_trip.plaintext.size()};
+  decryptJpegEtc(
+      status,
+      source_red.public_fields,
+      source_green.public_fields,
+      source_blue.public_fields,
+      decrypted.public_fields,
+      kKey);
+  if (status.failed) {
+    return false;
+  }
+  round_trip.inflation = (red.size + green.size + blue.size) /
+      (double) round_trip.plaintext.size();
+  round_trip.psnr = computePsnr(
+      status, round_trip.plaintext, decrypted.data, decrypted.size);
+  return !status.failed;
+}
+
+void setRoundTripCounters(
+    benchmark::State& state,
+    const CorpusImage& image,
+    const RoundTrip& round_trip) {
+  setCommonCounters(state, image);
+  state.counters["inflation"] = round_trip.inflation;
+  state.counters["psnr_dB"] = round_trip.psnr;
+}
+
+void BM_EncryptJpeg(benchmark::State& state, CorpusImage* image, int level) {
+  JpegStatus status;
+  RoundTrip round_trip;
+  if (!encryptRoundTrip(status, *image, level, round_trip)) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  const std::vector<uint8_t>& plaintext = round_trip.plaintext;
+  CryptoStats stats;
+  resetPeakRss();
+  for (auto _ : state) {
+    JpegMemorySource source;
+    source.setExternalBuffer(plaintext.data(), plaintext.size());
+    JpegNativeBufferDestination destination{round_trip.ciphertext.size()};
+    stats = CryptoStats();
+    encryptJpeg(
+        status,
+        source.public_fields,
+        destination.public_fields,
+        kKey,
+        level,
+        0,
+        &stats);
+    if (status.failed) {
+      state.SkipWithError(status.message);
+      return;
+    }
+  }
+  setRoundTripCounters(state, *image, round_trip);
+  state.counters["jpeg_mem_MB"] = stats.peak_memory / (1024.0 * 1024.0);
+}
+
+void BM_DecryptJpeg(benchmark::State& state, CorpusImage* image, int level) {
+  JpegStatus status;
+  RoundTrip round_trip;
+  if (!encryptRoundTrip(status, *image, level, round_trip)) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  const std::vector<uint8_t>& ciphertext = round_trip.ciphertext;
+  CryptoStats stats;
+  resetPeakRss();
+  for (auto _ : state) {
+    JpegMemorySource source;
+    source.setExternalBuffer(ciphertext.data(), ciphertext.size());
+    JpegNativeBufferDestination destination{round_trip.plaintext.size()};
+    stats = CryptoStats();
+    decryptJpeg(
+        status, source.public_fields, destination.public_fields, kKey, &stats);
+    if (status.failed) {
+      state.SkipWithError(status.message);
+      return;
+    }
+  }
+  setRoundTripCounters(state, *image, round_trip);
+  state.counters["jpeg_mem_MB"] = stats.peak_memory / (1024.0 * 1024.0);
+}
+
+void BM_EncryptJpegEtc(benchmark::State& state, CorpusImage* image) {
+  JpegStatus status;
+  RoundTrip round_trip;
+  if (!encryptEtcRoundTrip(status, *image, round_trip)) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  const std::vector<uint8_t>& plaintext = round_trip.plaintext;
+  resetPeakRss();
+  for (auto _ : state) {
+    JpegMemorySource source;
+    source.setExternalBuffer(plaintext.data(), plaintext.size());
+    JpegNativeBufferDestination red{round_trip.ciphertext.size()};
+    JpegNativeBufferDestination green{round_trip.ciphertext_green.size()};
+    JpegNativeBufferDestination blue{round_trip.ciphertext_blue.size()};
+    encryptJpegEtc(
+        status,
+        source.public_fields,
+        red.public_fields,
+        green.public_fields,
+        blue.public_fields,
+        kKey,
+        kEtcQuality);
+    if (status.failed) {
+      state.SkipWithError(status.message);
+      return;
+    }
+  }
+  setRoundTripCounters(state, *image, round_trip);
+}
+
+void BM_DecryptJpegEtc(benchmark::State& state, CorpusImage* image) {
+  JpegStatus status;
+  RoundTrip round_trip;
+  if (!encryptEtcRoundTrip(status, *image, round_trip)) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  resetPeakRss();
+  for (auto _ : state) {
+    JpegMemorySource source_red;
+    JpegMemorySource source_green;
+    JpegMemorySource source_blue;
+    source_red.setExternalBuffer(
+        round_trip.ciphertext.data(), round_trip.ciphertext.size());
+    source_green.setExternalBuffer(
+        round_trip.ciphertext_green.data(), round_trip.ciphertext_green.size());
+    source_blue.setExternalBuffer(
+        round_trip.ciphertext_blue.data(), round_trip.ciphertext_blue.size());
+    JpegNativeBufferDestination destination{round_trip.plaintext.size()};
+    decryptJpegEtc(
+        status,
+        source_red.public_fields,
+        source_green.public_fields,
+        source_blue.public_fields,
+        destination.public_fields,
+        kKey);
+    if (status.failed) {
+      state.SkipWithError(status.message);
+      return;
+    }
+  }
+  setRoundTripCounters(state, *image, round_trip);
+}
+
+/**
+ * The key parsed the way encryptCoefficients parses it.
+ */
+struct ParsedKey {
+  mpf_t x_0;
+  mpf_t mu;
+  mpf_t alpha;
+  mpf_t beta;
+
+  explicit ParsedKey(const CryptoKey& key) {
+    mpf_inits(x_0, mu, alpha, beta, NULL);
+    mpf_set_str(x_0, key.x_0.c_str(), 10);
+    mpf_set_str(mu, key.mu.c_str(), 10);
+    construct_alpha_beta(
+        alpha, key.x_0.c_str() + (key.x_0.size() - 2 - 16 - 1), 16);
+    construct_alpha_beta(
+        beta, key.mu.c_str() + (key.mu.size() - 1 - 16 - 1), 16);
+  }
+
+  ~ParsedKey() {
+    mpf_clears(x_0, mu, alpha, beta, NULL);
+  }
+
+  ParsedKey(const ParsedKey& other) = delete;
+  ParsedKey& operator=(const ParsedKey& other) = delete;
+};
+
+typedef void (*CoefficientPass)(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* coefs,
+    ParsedKey& key);
+
+/**
+ * The chaotic sequence of every component, which each of the passes below
+ * generates before moving any coefficient.
+ */
+void chaoticSequencePass(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* /* coefs */,
+    ParsedKey& key) {
+  for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    jpeg_component_info* comp_info = dinfo->comp_info + comp_i;
+    int n_blocks = comp_info->width_in_blocks * comp_info->height_in_blocks;
+    struct chaos_dc* chaotic_seq =
+        (struct chaos_dc*) malloc(n_blocks * sizeof(struct chaos_dc));
+    gen_chaotic_sequence(chaotic_seq, n_blocks, key.x_0, key.mu);
+    for (int i = 0; i < n_blocks; i++) {
+      mpf_clear(chaotic_seq[i].chaos_gmp);
+    }
+    free(chaotic_seq);
+  }
+}
+
+void permuteDCsSimplePass(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* coefs,
+    ParsedKey& key) {
+  permuteDCsSimple(dinfo, coefs, key.x_0, key.mu);
+}
+
+void diffuseACsFlipSignsPass(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* coefs,
+    ParsedKey& key) {
+  diffuseACsFlipSigns(dinfo, coefs, key.x_0, key.mu, key.alpha, key.beta);
+}
+
+void permuteMCUsPass(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* coefs,
+    ParsedKey& key) {
+  permuteMCUs(dinfo, coefs, key.x_0, key.mu);
+}
+
+/**
+ * Runs pass over the coefficients of image, read once up front. The passes
+ * work in place, so each iteration scrambles the output of the previous one,
+ * which costs the same.
+ */
+void BM_CoefficientPass(
+    benchmark::State& state,
+    CorpusImage* image,
+    CoefficientPass pass) {
+  JpegStatus status;
+  const std::vector<uint8_t>& jpeg = getJpeg(status, *image);
+  if (status.failed) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  ParsedKey key{kKey};
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    state.SkipWithError(status.message);
+    return;
+  }
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(dinfo, error_handler, source.public_fields);
+  jvirt_barray_ptr* coefs = jpeg_read_coefficients(&dinfo);
+
+  resetPeakRss();
+  for (auto _ : state) {
+    pass(&dinfo, coefs, key);
+  }
+  setCommonCounters(state, *image);
+
+  jpeg_destroy_decompress(&dinfo);
+}
+
+/**
+ * Runs scramble_rgb over the pixel blocks of image, laid out the way
+ * encryptJpegEtc lays them out.
+ */
+void BM_ScrambleRgb(benchmark::State& state, CorpusImage* image) {
+  unsigned int rows = (image->height + BLOCK_HEIGHT - 1) / BLOCK_HEIGHT;
+  unsigned int columns = (image->width + BLOCK_WIDTH - 1) / BLOCK_WIDTH;
+  std::vector<std::unique_ptr<struct rgb_block[]>> row_blocks;
+  std::vector<struct rgb_block*> blocks;
+  for (unsigned int y = 0; y < rows; ++y) {
+    row_blocks.emplace_back(new struct rgb_block[columns]);
+    blocks.push_back(row_blocks.back().get());
+    for (unsigned int x = 0; x < columns; ++x) {
+      struct rgb_block& block = blocks[y][x];
+      memset(block.red, x, sizeof(block.red));
+      memset(block.green, y, sizeof(block.green));
+      memset(block.blue, x ^ y, sizeof(block.blue));
+    }
+  }
+
+  resetPeakRss();
+  for (auto _ : state) {
+    scramble_rgb(blocks.data(), rows, columns);
+  }
+  setCommonCounters(state, *image);
+}
+
+std::string formatMegapixels(double megapixels) {
+  char name[32];
+  snprintf(name, sizeof(name), megapixels < 1 ? "%.1fMP" : "%.0fMP", megapixels);
+  return name;
+}
+
+/**
+ * 0.3, 2, 12 and 50 MP, from a VGA thumbnail to the largest camera images.
+ */
+std::vector<CorpusImage> createSyntheticCorpus() {
+  const unsigned int sizes[][2] = {
+    {640, 480},
+    {1920, 1080},
+    {4000, 3000},
+    {8192, 6144},
+  };
+  std::vector<CorpusImage> corpus;
+  for (const auto& size : sizes) {
+    CorpusImage image;
+    image.width = size[0];
+    image.height = size[1];
+    image.name = "synthetic_" + formatMegapixels(image.megapixels());
+    corpus.push_back(std::move(image));
+  }
+  return corpus;
+}
+
+bool addCorpusFile(const char* path, std::vector<CorpusImage>& corpus) {
+  CorpusImage image;
+  image.path = path;
+  JpegStatus status;
+  const std::vector<uint8_t>& jpeg = getJpeg(status, image);
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  if (status.failed || !getDecodedJpegSize(
+          status,
+          source.public_fields,
+          TargetSize{1 << 16, 1 << 16},
+          image.width,
+          image.height)) {
+    fprintf(stderr, "skipping %s: %s\n", path, status.message);
+    return false;
+  }
+  std::string name = path;
+  name = name.substr(name.find_last_of('/') + 1);
+  name = name.substr(0, name.find_last_of('.'));
+  image.name = name + "_" + formatMegapixels(image.megapixels());
+  corpus.push_back(std::move(image));
+  return true;
+}
+
+void registerBenchmarks(std::vector<CorpusImage>& corpus) {
+  const struct {
+    const char* name;
+    int level;
+  } levels[] = {
+    {"dc", CIPHER_LEVEL_DC},
+    {"dc_signs", CIPHER_LEVEL_DC_SIGNS},
+    {"full", CIPHER_LEVEL_FULL},
+  };
+  const struct {
+    const char* name;
+    CoefficientPass pass;
+  } passes[] = {
+    {"gen_chaotic_sequence", chaoticSequencePass},
+    {"permuteDCsSimple", permuteDCsSimplePass},
+    {"diffuseACsFlipSigns", diffuseACsFlipSignsPass},
+    {"permuteMCUs", permuteMCUsPass},
+  };
+
+  for (CorpusImage& image : corpus) {
+    std::string suffix = "/" + image.name;
+    for (const auto& level : levels) {
+      benchmark::RegisterBenchmark(
+          ("encryptJpeg/" + std::string(level.name) + suffix).c_str(),
+          BM_EncryptJpeg, &image, level.level)
+          ->Unit(benchmark::kMillisecond);
+      benchmark::RegisterBenchmark(
+          ("decryptJpeg/" + std::string(level.name) + suffix).c_str(),
+          BM_DecryptJpeg, &image, level.level)
+          ->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RegisterBenchmark(
+        ("encryptJpegEtc" + suffix).c_str(), BM_EncryptJpegEtc, &image)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark(
+        ("decryptJpegEtc" + suffix).c_str(), BM_DecryptJpegEtc, &image)
+        ->Unit(benchmark::kMillisecond);
+    for (const auto& pass : passes) {
+      benchmark::RegisterBenchmark(
+          ("stage/" + std::string(pass.name) + suffix).c_str(),
+          BM_CoefficientPass, &image, pass.pass)
+          ->Unit(benchmark::kMillisecond);
+    }
+    benchmark::RegisterBenchmark(
+        ("stage/scramble_rgb" + suffix).c_str(), BM_ScrambleRgb, &image)
+        ->Unit(benchmark::kMillisecond);
+  }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  // registered benchmarks point into corpus, which must not reallocate
+  std::vector<CorpusImage> corpus = createSyntheticCorpus();
+  corpus.reserve(corpus.size() + argc - 1);
+  for (int i = 1; i < argc; ++i) {
+    if (argv[i][0] == '-') {
+      fprintf(stderr, "unknown flag %s\n", argv[i]);
+      return 1;
+    }
+    addCorpusFile(argv[i], corpus);
+  }
+  registerBenchmarks(corpus);
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -11,16 +11,31 @@ LOCAL_SRC_FILES := \
 	decoded_image.cpp \
 	exceptions_handler.cpp \
 	init.cpp \
+	jpeg/jpeg_cancellation.cpp \
 	jpeg/jpeg_codec.cpp \
 	jpeg/jpeg_error_handler.cpp \
+	jpeg/jpeg_markers.cpp \
 	jpeg/jpeg_memory_io.cpp \
-	jpeg/jpeg_stream_wrappers.cpp \
+	jpeg/jpeg_memory_manager.cpp \
+	jpeg/jpeg_quality.cpp \
+	jpeg/jpeg_resampler.cpp \
+	jpeg/jpeg_restart.cpp \
 	jpeg/crypto/rand.cpp \
 	jpeg/crypto/jpeg_crypto.cpp \
+	jpeg/crypto/jpeg_crypto_stats.cpp \
 	jpeg/crypto/jpeg_encrypt.cpp \
 	jpeg/crypto/jpeg_decrypt.cpp \
+	jpeg/crypto/jpeg_thumbnail.cpp \
+	jpeg/crypto/jpeg_cipher_header.cpp \
+	jpeg/crypto/jpeg_transcrypt.cpp \
+	jpeg_stream_wrappers.cpp \
 	transformations.cpp \
+	JpegAsync.cpp \
+	JpegBuffer.cpp \
+	JpegCancellationToken.cpp \
+	JpegCrypto.cpp \
 	JpegTranscoder.cpp \
+	JpegDecoder.cpp \
 	JpegEncryptor.cpp \
 	JpegDecryptor.cpp
 
@@ -31,10 +46,11 @@ LOCAL_CFLAGS += -fvisibility=hidden
 LOCAL_CFLAGS += $(FRESCO_CPP_CFLAGS)
 LOCAL_EXPORT_CPPFLAGS := $(CXX11_FLAGS)
 LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
-LOCAL_LDLIBS := -llog
+LOCAL_LDLIBS := -llog -ljnigraphics
 LOCAL_LDFLAGS += $(FRESCO_CPP_LDFLAGS)
 
 LOCAL_SHARED_LIBRARIES += gmp
+LOCAL_SHARED_LIBRARIES += fresco-taskpool
 
 LOCAL_STATIC_LIBRARIES += fb_jpegturbo
 LOCAL_LDFLAGS += -Wl,--exclude-libs,libfb_jpegturbo.a
@@ -42,3 +58,4 @@ LOCAL_LDFLAGS += -Wl,--exclude-libs,libfb_jpegturbo.a
 include $(BUILD_SHARED_LIBRARY)
 $(call import-module,libjpeg-turbo-1.5.3)
 $(call import-module,gmp)
+$(call import-module,taskpool)
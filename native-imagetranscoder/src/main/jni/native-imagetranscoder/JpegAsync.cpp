@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <initializer_list>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <jni.h>
+
+#include "exceptions_handler.h"
+#include "jpeg/jpeg_cancellation.h"
+#include "logging.h"
+#include "task_pool.h"
+#include "JpegAsync.h"
+#include "JpegCancellationToken.h"
+
+using facebook::imagepipeline::jpeg::JpegCancellationToken;
+using facebook::imagepipeline::kTaskPriorityCount;
+using facebook::imagepipeline::submitTask;
+using facebook::imagepipeline::TaskPriority;
+
+static JavaVM* gJavaVM;
+static jmethodID midNativeJpegAsyncJobOnNativeComplete;
+
+/**
+ * Local refs one task creates besides its result, e.g. the ones of
+ * NativeJpegBuffer creation
+ */
+static const jint kTaskLocalFrameCapacity = 16;
+
+/**
+ * Returns the env of the calling pool thread, attaching it to the VM on
+ * first use. Pool threads run until the process exits, so they are never
+ * detached.
+ */
+static JNIEnv* attachPoolThread() {
+  static thread_local JNIEnv* tEnv = nullptr;
+  if (tEnv == nullptr &&
+      gJavaVM->AttachCurrentThreadAsDaemon(&tEnv, nullptr) != JNI_OK) {
+    LOGE("could not attach pool thread to the VM");
+    tEnv = nullptr;
+  }
+  return tEnv;
+}
+
+static void runJpegAsyncJob(
+    jobject job,
+    const std::vector<jobject>& refs,
+    const std::shared_ptr<JpegCancellationToken>& token,
+    const JpegAsyncTask& task) {
+  JNIEnv* env = attachPoolThread();
+  if (env == nullptr) {
+    return;
+  }
+
+  if (env->PushLocalFrame(kTaskLocalFrameCapacity) == JNI_OK) {
+    jobject result;
+    {
+      JpegCancellationScope cancellation_scope{env, token};
+      result = task(env, refs);
+    }
+    jthrowable error = env->ExceptionOccurred();
+    if (error != nullptr) {
+      env->ExceptionClear();
+      result = nullptr;
+    }
+    env->CallVoidMethod(job, midNativeJpegAsyncJobOnNativeComplete, result, error);
+    if (env->ExceptionCheck()) {
+      LOGE("NativeJpegAsyncJob completion threw an exception");
+      env->ExceptionClear();
+    }
+    env->PopLocalFrame(nullptr);
+  } else {
+    LOGE("could not allocate local refs of async job");
+    env->ExceptionClear();
+  }
+
+  for (jobject ref : refs) {
+    env->DeleteGlobalRef(ref);
+  }
+  env->DeleteGlobalRef(job);
+}
+
+void submitJpegAsyncJob(
+    JNIEnv* env,
+    jobject job,
+    jint priority,
+    jlong cancellation_token,
+    std::initializer_list<jobject> refs,
+    JpegAsyncTask task) {
+  THROW_AND_RETURN_IF(
+      priority < 0 || priority >= kTaskPriorityCount,
+      "Unknown job priority");
+
+  jobject global_job = env->NewGlobalRef(job);
+  std::vector<jobject> global_refs;
+  global_refs.reserve(refs.size());
+  for (jobject ref : refs) {
+    global_refs.push_back(ref != nullptr ? env->NewGlobalRef(ref) : nullptr);
+  }
+  // taken now, the java token may be closed before the job runs
+  std::shared_ptr<JpegCancellationToken> token =
+      getJpegCancellationToken(cancellation_token);
+
+  submitTask(
+      (TaskPriority) priority,
+      [global_job, global_refs, token, task] {
+        runJpegAsyncJob(global_job, global_refs, token, task);
+      });
+}
+
+bool registerJpegAsyncMethods(JNIEnv* env) {
+  if (env->GetJavaVM(&gJavaVM) != JNI_OK) {
+    LOGE("could not get JavaVM");
+    return false;
+  }
+
+  auto nativeJpegAsyncJobClass = env->FindClass(
+      "com/facebook/imagepipeline/nativecode/NativeJpegAsyncJob");
+  if (nativeJpegAsyncJobClass == nullptr) {
+    LOGE("could not find NativeJpegAsyncJob class");
+    return false;
+  }
+
+  // looked up here, FindClass does not see app classes on pool threads
+  midNativeJpegAsyncJobOnNativeComplete = env->GetMethodID(
+      nativeJpegAsyncJobClass,
+      "onNativeComplete",
+      "(Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;Ljava/lang/Throwable;)V");
+  if (midNativeJpegAsyncJobOnNativeComplete == nullptr) {
+    LOGE("could not find NativeJpegAsyncJob.onNativeComplete");
+    return false;
+  }
+
+  return true;
+}
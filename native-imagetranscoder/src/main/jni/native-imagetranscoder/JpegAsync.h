@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_ASYNC_H_
+#define _JPEG_ASYNC_H_
+
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+#include <jni.h>
+
+/**
+ * Work of an async job, run on a pool thread attached to the VM.
+ *
+ * <p> Gets the global refs passed to submitJpegAsyncJob, in the same order.
+ * Returns the result as a local ref, or nullptr with a java exception
+ * pending.
+ */
+typedef std::function<jobject(JNIEnv* env, const std::vector<jobject>& refs)>
+    JpegAsyncTask;
+
+/**
+ * Runs task on the shared native task pool and completes the
+ * NativeJpegAsyncJob with its result or exception.
+ *
+ * <p> The job and refs are held as global refs until the job completed, so
+ * the task can use them from the pool thread, e.g. a direct ByteBuffer
+ * holding the input or the key strings. The task runs with the cancellation
+ * token of the job current.
+ *
+ * @param priority one of the PRIORITY_* constants of NativeJpegAsyncJob
+ * @param cancellation_token native handle of the token of the job
+ */
+void submitJpegAsyncJob(
+    JNIEnv* env,
+    jobject job,
+    jint priority,
+    jlong cancellation_token,
+    std::initializer_list<jobject> refs,
+    JpegAsyncTask task);
+
+bool registerJpegAsyncMethods(JNIEnv* env);
+
+#endif /* _JPEG_ASYNC_H_ */
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <type_traits>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <jni.h>
+
+#include "exceptions_handler.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "logging.h"
+#include "JpegBuffer.h"
+
+using facebook::imagepipeline::jpeg::JpegMemorySource;
+using facebook::imagepipeline::jpeg::JpegNativeBufferDestination;
+
+static jclass jNativeJpegBufferClass;
+static jmethodID midNativeJpegBufferInit;
+
+bool setNativeJpegInput(
+    JNIEnv* env,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    JpegMemorySource& source) {
+  const uint8_t* data = byte_buffer != nullptr
+      ? (const uint8_t*) env->GetDirectBufferAddress(byte_buffer)
+      : (const uint8_t*) (intptr_t) native_ptr;
+  THROW_AND_RETURNVAL_IF(data == nullptr, "Input is not in native memory", false);
+  THROW_AND_RETURNVAL_IF(size <= 0, "Input is empty", false);
+  if (byte_buffer != nullptr) {
+    THROW_AND_RETURNVAL_IF(
+        size > env->GetDirectBufferCapacity(byte_buffer),
+        "Input size exceeds buffer capacity",
+        false);
+  }
+
+  source.setExternalBuffer(data, size);
+  return true;
+}
+
+jobject newNativeJpegBuffer(
+    JNIEnv* env,
+    JpegNativeBufferDestination& destination) {
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  jobject byte_buffer = env->NewDirectByteBuffer(
+      destination.data,
+      destination.size);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  jobject jpeg_buffer = env->NewObject(
+      jNativeJpegBufferClass,
+      midNativeJpegBufferInit,
+      (jlong) (intptr_t) destination.data,
+      (jint) destination.size,
+      byte_buffer);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  // the java object owns the memory from now on
+  destination.release();
+  return jpeg_buffer;
+}
+
+jobjectArray newNativeJpegBufferArray(
+    JNIEnv* env,
+    std::vector<std::unique_ptr<JpegNativeBufferDestination>>& destinations) {
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  jobjectArray jpeg_buffers = env->NewObjectArray(
+      destinations.size(),
+      jNativeJpegBufferClass,
+      nullptr);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  for (size_t i = 0; i < destinations.size(); i++) {
+    jobject jpeg_buffer = newNativeJpegBuffer(env, *destinations[i]);
+    RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+    env->SetObjectArrayElement(jpeg_buffers, i, jpeg_buffer);
+    env->DeleteLocalRef(jpeg_buffer);
+  }
+  return jpeg_buffers;
+}
+
+static void NativeJpegBuffer_nativeFree(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlong native_ptr) {
+  free((void*) (intptr_t) native_ptr);
+}
+
+static JNINativeMethod gJpegBufferMethods[] = {
+  { "nativeFree",
+      "(J)V",
+      (void*) NativeJpegBuffer_nativeFree },
+};
+
+bool registerJpegBufferMethods(JNIEnv* env) {
+  auto nativeJpegBufferClass = env->FindClass(
+      "com/facebook/imagepipeline/nativecode/NativeJpegBuffer");
+  if (nativeJpegBufferClass == nullptr) {
+    LOGE("could not find NativeJpegBuffer class");
+    return false;
+  }
+
+  midNativeJpegBufferInit = env->GetMethodID(
+      nativeJpegBufferClass,
+      "<init>",
+      "(JILjava/nio/ByteBuffer;)V");
+  if (midNativeJpegBufferInit == nullptr) {
+    LOGE("could not find NativeJpegBuffer constructor");
+    return false;
+  }
+  jNativeJpegBufferClass =
+    reinterpret_cast<jclass>(env->NewGlobalRef(nativeJpegBufferClass));
+
+  auto result = env->RegisterNatives(
+      nativeJpegBufferClass,
+      gJpegBufferMethods,
+      std::extent<decltype(gJpegBufferMethods)>::value);
+
+  if (result != 0) {
+    LOGE("could not register JpegBuffer methods");
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_BUFFER_H_
+#define _JPEG_BUFFER_H_
+
+#include <memory>
+#include <vector>
+
+#include <jni.h>
+
+#include "jpeg/jpeg_memory_io.h"
+
+/**
+ * Points source at encoded bytes living outside of the java heap, without
+ * copying them.
+ *
+ * @param byte_buffer direct ByteBuffer holding the bytes, or null
+ * @param native_ptr address of the bytes, used if byte_buffer is null
+ * @param size number of bytes
+ * @return false if a java exception was thrown
+ */
+bool setNativeJpegInput(
+    JNIEnv* env,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    facebook::imagepipeline::jpeg::JpegMemorySource& source);
+
+/**
+ * Hands the bytes written to destination over to a new NativeJpegBuffer.
+ * The java object frees them when closed.
+ *
+ * @return nullptr if a java exception is pending
+ */
+jobject newNativeJpegBuffer(
+    JNIEnv* env,
+    facebook::imagepipeline::jpeg::JpegNativeBufferDestination& destination);
+
+/**
+ * Hands the bytes written to each of destinations over to a new
+ * NativeJpegBuffer and returns them as an array, in the same order.
+ *
+ * @return nullptr if a java exception is pending
+ */
+jobjectArray newNativeJpegBufferArray(
+    JNIEnv* env,
+    std::vector<std::unique_ptr<
+        facebook::imagepipeline::jpeg::JpegNativeBufferDestination>>&
+        destinations);
+
+bool registerJpegBufferMethods(JNIEnv* env);
+
+#endif /* _JPEG_BUFFER_H_ */
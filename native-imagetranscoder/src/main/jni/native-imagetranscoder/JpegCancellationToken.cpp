@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include <stdint.h>
+
+#include <jni.h>
+
+#include "jpeg/jpeg_cancellation.h"
+#include "logging.h"
+#include "JpegCancellationToken.h"
+
+using facebook::imagepipeline::jpeg::JpegCancellationToken;
+using facebook::imagepipeline::jpeg::setCurrentCancellationToken;
+
+static jclass jCancellationExceptionClass;
+
+/**
+ * The handle of a java token is the address of a shared_ptr owning the
+ * native token, so calls running with it can hold on to the token after
+ * the java token is closed.
+ */
+static std::shared_ptr<JpegCancellationToken>* fromHandle(jlong handle) {
+  return (std::shared_ptr<JpegCancellationToken>*) (intptr_t) handle;
+}
+
+std::shared_ptr<JpegCancellationToken> getJpegCancellationToken(
+    jlong token_handle) {
+  if (token_handle == 0) {
+    return nullptr;
+  }
+  return *fromHandle(token_handle);
+}
+
+JpegCancellationScope::JpegCancellationScope(JNIEnv* env, jlong token_handle)
+    : JpegCancellationScope(env, getJpegCancellationToken(token_handle)) {}
+
+JpegCancellationScope::JpegCancellationScope(
+    JNIEnv* env,
+    std::shared_ptr<JpegCancellationToken> token)
+    : env_(env), token_(std::move(token)) {
+  previous_ = setCurrentCancellationToken(token_.get());
+}
+
+JpegCancellationScope::~JpegCancellationScope() {
+  setCurrentCancellationToken(previous_);
+  if (token_ && token_->isCancelled() && env_->ExceptionCheck()) {
+    env_->ExceptionClear();
+    env_->ThrowNew(jCancellationExceptionClass, "Operation cancelled");
+  }
+}
+
+static jlong NativeJpegCancellationToken_nativeCreate(
+    JNIEnv* env,
+    jclass /* clzz */) {
+  return (jlong) (intptr_t) new std::shared_ptr<JpegCancellationToken>(
+      std::make_shared<JpegCancellationToken>());
+}
+
+static void NativeJpegCancellationToken_nativeCancel(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlong handle) {
+  (*fromHandle(handle))->cancel();
+}
+
+static jboolean NativeJpegCancellationToken_nativeIsCancelled(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlong handle) {
+  return (*fromHandle(handle))->isCancelled();
+}
+
+static void NativeJpegCancellationToken_nativeRelease(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlong handle) {
+  delete fromHandle(handle);
+}
+
+static JNINativeMethod gJpegCancellationTokenMethods[] = {
+  { "nativeCreate",
+      "()J",
+      (void*) NativeJpegCancellationToken_nativeCreate },
+  { "nativeCancel",
+      "(J)V",
+      (void*) NativeJpegCancellationToken_nativeCancel },
+  { "nativeIsCancelled",
+      "(J)Z",
+      (void*) NativeJpegCancellationToken_nativeIsCancelled },
+  { "nativeRelease",
+      "(J)V",
+      (void*) NativeJpegCancellationToken_nativeRelease },
+};
+
+bool registerJpegCancellationTokenMethods(JNIEnv* env) {
+  auto cancellationExceptionClass = env->FindClass(
+      "java/util/concurrent/CancellationException");
+  if (cancellationExceptionClass == nullptr) {
+    LOGE("could not find CancellationException class");
+    return false;
+  }
+  jCancellationExceptionClass =
+    reinterpret_cast<jclass>(env->NewGlobalRef(cancellationExceptionClass));
+
+  auto nativeJpegCancellationTokenClass = env->FindClass(
+      "com/facebook/imagepipeline/nativecode/NativeJpegCancellationToken");
+  if (nativeJpegCancellationTokenClass == nullptr) {
+    LOGE("could not find NativeJpegCancellationToken class");
+    return false;
+  }
+
+  auto result = env->RegisterNatives(
+      nativeJpegCancellationTokenClass,
+      gJpegCancellationTokenMethods,
+      std::extent<decltype(gJpegCancellationTokenMethods)>::value);
+
+  if (result != 0) {
+    LOGE("could not register JpegCancellationToken methods");
+    return false;
+  }
+
+  return true;
+}
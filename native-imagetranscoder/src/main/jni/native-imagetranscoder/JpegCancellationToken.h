@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_CANCELLATION_TOKEN_H_
+#define _JPEG_CANCELLATION_TOKEN_H_
+
+#include <memory>
+
+#include <jni.h>
+
+#include "jpeg/jpeg_cancellation.h"
+
+/**
+ * Makes the token of a NativeJpegCancellationToken the current one of the
+ * calling thread for the duration of a native call.
+ *
+ * <p> If the token got cancelled and the call failed, the pending exception
+ * is replaced by a CancellationException when the scope ends.
+ */
+class JpegCancellationScope {
+ public:
+  /**
+   * @param token_handle native handle of the java token, or 0 for none
+   */
+  JpegCancellationScope(JNIEnv* env, jlong token_handle);
+
+  /**
+   * @param token the token, or null for none
+   */
+  JpegCancellationScope(
+      JNIEnv* env,
+      std::shared_ptr<facebook::imagepipeline::jpeg::JpegCancellationToken>
+          token);
+  ~JpegCancellationScope();
+
+  JpegCancellationScope(const JpegCancellationScope&) = delete;
+  JpegCancellationScope& operator=(const JpegCancellationScope&) = delete;
+
+ private:
+  JNIEnv* env_;
+  // keeps the token alive even if the java token is closed meanwhile
+  std::shared_ptr<facebook::imagepipeline::jpeg::JpegCancellationToken> token_;
+  const facebook::imagepipeline::jpeg::JpegCancellationToken* previous_;
+};
+
+/**
+ * Returns the token of a NativeJpegCancellationToken, keeping it alive after
+ * the java token is closed.
+ *
+ * @param token_handle native handle of the java token, or 0 for none
+ * @return the token, or null for none
+ */
+std::shared_ptr<facebook::imagepipeline::jpeg::JpegCancellationToken>
+getJpegCancellationToken(jlong token_handle);
+
+bool registerJpegCancellationTokenMethods(JNIEnv* env);
+
+#endif /* _JPEG_CANCELLATION_TOKEN_H_ */
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <string>
+
+#include <jni.h>
+
+#include "exceptions_handler.h"
+#include "jpeg/crypto/jpeg_crypto.h"
+#include "jpeg/crypto/jpeg_crypto_stats.h"
+#include "JpegCrypto.h"
+
+using facebook::imagepipeline::jpeg::crypto::CRYPTO_STAGE_COUNT;
+using facebook::imagepipeline::jpeg::crypto::CryptoKey;
+using facebook::imagepipeline::jpeg::crypto::CryptoStats;
+
+/**
+ * Copies the modified UTF-8 bytes of a java string.
+ *
+ * @return false if a java exception was thrown
+ */
+static bool getStringBytes(JNIEnv* env, jstring jstr, std::string& bytes) {
+  THROW_AND_RETURNVAL_IF(jstr == nullptr, "key cannot be null", false);
+  const jsize length = env->GetStringUTFLength(jstr);
+  const char* chars = env->GetStringUTFChars(jstr, nullptr);
+  RETURNVAL_IF_EXCEPTION_PENDING(false);
+  bytes.assign(chars, length);
+  env->ReleaseStringUTFChars(jstr, chars);
+  return true;
+}
+
+bool getCryptoKey(
+    JNIEnv* env,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    CryptoKey& key) {
+  return getStringBytes(env, x_0_jstr, key.x_0) &&
+      getStringBytes(env, mu_jstr, key.mu);
+}
+
+void copyCryptoStats(JNIEnv* env, const CryptoStats& stats, jlongArray array) {
+  if (array == nullptr) {
+    return;
+  }
+  jlong values[2 * CRYPTO_STAGE_COUNT + 4];
+  for (int stage = 0; stage < CRYPTO_STAGE_COUNT; stage++) {
+    values[stage] = stats.wall_ns[stage];
+    values[CRYPTO_STAGE_COUNT + stage] = stats.cpu_ns[stage];
+  }
+  values[2 * CRYPTO_STAGE_COUNT] = stats.bytes_in;
+  values[2 * CRYPTO_STAGE_COUNT + 1] = stats.bytes_out;
+  values[2 * CRYPTO_STAGE_COUNT + 2] = stats.blocks;
+  values[2 * CRYPTO_STAGE_COUNT + 3] = stats.peak_memory;
+  env->SetLongArrayRegion(array, 0, 2 * CRYPTO_STAGE_COUNT + 4, values);
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_CRYPTO_JNI_H_
+#define _JPEG_CRYPTO_JNI_H_
+
+#include <jni.h>
+
+#include "jpeg/crypto/jpeg_crypto.h"
+#include "jpeg/crypto/jpeg_crypto_stats.h"
+
+/**
+ * Copies the two java strings making up a key.
+ *
+ * @return false if a java exception was thrown
+ */
+bool getCryptoKey(
+    JNIEnv* env,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    facebook::imagepipeline::jpeg::crypto::CryptoKey& key);
+
+/**
+ * Copies stats to a java long[] laid out as NativeJpegCryptoStats expects:
+ * the wall times of every stage, their cpu times, bytes in, bytes out,
+ * blocks and peak memory. Does nothing if the array is null.
+ */
+void copyCryptoStats(
+    JNIEnv* env,
+    const facebook::imagepipeline::jpeg::crypto::CryptoStats& stats,
+    jlongArray array);
+
+#endif /* _JPEG_CRYPTO_JNI_H_ */
@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <type_traits>
+
+#include <stdint.h>
+
+#include <android/bitmap.h>
+#include <jni.h>
+
+#include "decoded_image.h"
+#include "exceptions_handler.h"
+#include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+#include "logging.h"
+#include "transformations.h"
+#include "JpegBuffer.h"
+
+using facebook::imagepipeline::throwIfJpegFailed;
+using facebook::imagepipeline::bytesPerPixel;
+using facebook::imagepipeline::CropInfo;
+using facebook::imagepipeline::PixelFormat;
+using facebook::imagepipeline::ScaleFactor;
+using facebook::imagepipeline::TargetSize;
+using facebook::imagepipeline::jpeg::decodeJpegParallel;
+using facebook::imagepipeline::jpeg::decodeJpegRegion;
+using facebook::imagepipeline::jpeg::getDecodedJpegSize;
+using facebook::imagepipeline::jpeg::JpegMemorySource;
+using facebook::imagepipeline::jpeg::JpegStatus;
+
+/**
+ * Values of the PIXEL_FORMAT_* constants of NativeJpegDecoder
+ */
+static const jint PIXEL_FORMAT_RGBA_8888 = 0;
+static const jint PIXEL_FORMAT_RGB_565 = 1;
+
+/**
+ * Returns width and height as a java int[].
+ */
+static jintArray newSizeArray(
+    JNIEnv* env,
+    unsigned int width,
+    unsigned int height) {
+  jintArray decoded_size = env->NewIntArray(2);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  const jint values[] = {(jint) width, (jint) height};
+  env->SetIntArrayRegion(decoded_size, 0, 2, values);
+  return decoded_size;
+}
+
+static jintArray JpegDecoder_getDecodedSizeBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint target_width,
+    jint target_height) {
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  unsigned int width;
+  unsigned int height;
+  JpegStatus status;
+  if (!getDecodedJpegSize(
+          status,
+          source.public_fields,
+          TargetSize{target_width, target_height},
+          width,
+          height)) {
+    throwIfJpegFailed(env, status);
+    return nullptr;
+  }
+
+  return newSizeArray(env, width, height);
+}
+
+/**
+ * Output of a decode, either the locked pixels of a Bitmap or a direct
+ * ByteBuffer.
+ */
+struct DecodeOutput {
+  uint8_t* pixels;
+  unsigned int width;
+  unsigned int height;
+  size_t stride;
+  PixelFormat pixel_format;
+};
+
+/**
+ * Locks the pixels of bitmap, which has to be unlocked with
+ * AndroidBitmap_unlockPixels if this returns true.
+ */
+static bool lockBitmapOutput(
+    JNIEnv* env,
+    jobject bitmap,
+    DecodeOutput& output) {
+  AndroidBitmapInfo bitmap_info;
+  int rc = AndroidBitmap_getInfo(env, bitmap, &bitmap_info);
+  THROW_AND_RETURNVAL_IF(
+      rc != ANDROID_BITMAP_RESULT_SUCCESS,
+      "Failed to get Bitmap info",
+      false);
+  switch (bitmap_info.format) {
+  case ANDROID_BITMAP_FORMAT_RGBA_8888:
+    output.pixel_format = PixelFormat::RGBA;
+    break;
+  case ANDROID_BITMAP_FORMAT_RGB_565:
+    output.pixel_format = PixelFormat::RGB_565;
+    break;
+  default:
+    THROW_AND_RETURNVAL_IF(true, "Unexpected bitmap format", false);
+  }
+
+  void* pixels;
+  rc = AndroidBitmap_lockPixels(env, bitmap, &pixels);
+  THROW_AND_RETURNVAL_IF(
+      rc != ANDROID_BITMAP_RESULT_SUCCESS,
+      "Failed to lock Bitmap pixels",
+      false);
+  output.pixels = (uint8_t*) pixels;
+  output.width = bitmap_info.width;
+  output.height = bitmap_info.height;
+  output.stride = bitmap_info.stride;
+  return true;
+}
+
+/**
+ * Unlocks the pixels of bitmap, even if decoding failed. A pending
+ * exception is kept.
+ */
+static void unlockBitmapOutput(JNIEnv* env, jobject bitmap) {
+  int rc = AndroidBitmap_unlockPixels(env, bitmap);
+  RETURN_IF_EXCEPTION_PENDING;
+  THROW_AND_RETURN_IF(
+      rc != ANDROID_BITMAP_RESULT_SUCCESS,
+      "Failed to unlock Bitmap pixels");
+}
+
+static bool getBufferOutput(
+    JNIEnv* env,
+    jobject output_buffer,
+    jint width,
+    jint height,
+    jint stride,
+    jint pixel_format,
+    DecodeOutput& output) {
+  THROW_AND_RETURNVAL_IF(
+      pixel_format != PIXEL_FORMAT_RGBA_8888 &&
+          pixel_format != PIXEL_FORMAT_RGB_565,
+      "wrong pixel format",
+      false);
+  output.pixel_format = pixel_format == PIXEL_FORMAT_RGBA_8888
+      ? PixelFormat::RGBA
+      : PixelFormat::RGB_565;
+  output.pixels = (uint8_t*) env->GetDirectBufferAddress(output_buffer);
+  THROW_AND_RETURNVAL_IF(
+      output.pixels == nullptr,
+      "Output is not in native memory",
+      false);
+  THROW_AND_RETURNVAL_IF(
+      width <= 0 || height <= 0,
+      "Output is empty",
+      false);
+  THROW_AND_RETURNVAL_IF(
+      stride < width * bytesPerPixel(output.pixel_format),
+      "stride is too small for the output width",
+      false);
+  THROW_AND_RETURNVAL_IF(
+      (jlong) stride * height > env->GetDirectBufferCapacity(output_buffer),
+      "Output size exceeds buffer capacity",
+      false);
+  output.width = width;
+  output.height = height;
+  output.stride = stride;
+  return true;
+}
+
+static void JpegDecoder_decodeJpegBufferIntoBitmap(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jobject bitmap,
+    jint target_width,
+    jint target_height,
+    jboolean dither,
+    jint max_threads) {
+  JpegMemorySource source;
+  DecodeOutput output;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source) ||
+      !lockBitmapOutput(env, bitmap, output)) {
+    return;
+  }
+  JpegStatus status;
+  decodeJpegParallel(
+      status,
+      source.data,
+      source.size,
+      TargetSize{target_width, target_height},
+      output.pixel_format,
+      dither,
+      output.pixels,
+      output.width,
+      output.height,
+      output.stride,
+      max_threads);
+  throwIfJpegFailed(env, status);
+  unlockBitmapOutput(env, bitmap);
+}
+
+static void JpegDecoder_decodeJpegBufferIntoBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jobject output_buffer,
+    jint width,
+    jint height,
+    jint stride,
+    jint pixel_format,
+    jint target_width,
+    jint target_height,
+    jboolean dither,
+    jint max_threads) {
+  JpegMemorySource source;
+  DecodeOutput output;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source) ||
+      !getBufferOutput(
+          env,
+          output_buffer,
+          width,
+          height,
+          stride,
+          pixel_format,
+          output)) {
+    return;
+  }
+  JpegStatus status;
+  decodeJpegParallel(
+      status,
+      source.data,
+      source.size,
+      TargetSize{target_width, target_height},
+      output.pixel_format,
+      dither,
+      output.pixels,
+      output.width,
+      output.height,
+      output.stride,
+      max_threads);
+  throwIfJpegFailed(env, status);
+}
+
+static jintArray JpegDecoder_getDecodedSizeAtScaleBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint scale_numerator) {
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  unsigned int width;
+  unsigned int height;
+  JpegStatus status;
+  if (!getDecodedJpegSize(
+          status,
+          source.public_fields,
+          ScaleFactor{(uint8_t) scale_numerator, 8},
+          width,
+          height)) {
+    throwIfJpegFailed(env, status);
+    return nullptr;
+  }
+  return newSizeArray(env, width, height);
+}
+
+static void JpegDecoder_decodeJpegRegionBufferIntoBitmap(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jobject bitmap,
+    jint scale_numerator,
+    jint region_x,
+    jint region_y,
+    jint region_width,
+    jint region_height,
+    jboolean dither) {
+  JpegMemorySource source;
+  DecodeOutput output;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source) ||
+      !lockBitmapOutput(env, bitmap, output)) {
+    return;
+  }
+  JpegStatus status;
+  decodeJpegRegion(
+      status,
+      source.public_fields,
+      ScaleFactor{(uint8_t) scale_numerator, 8},
+      CropInfo{region_x, region_y, region_width, region_height},
+      output.pixel_format,
+      dither,
+      output.pixels,
+      output.width,
+      output.height,
+      output.stride);
+  throwIfJpegFailed(env, status);
+  unlockBitmapOutput(env, bitmap);
+}
+
+static void JpegDecoder_decodeJpegRegionBufferIntoBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jobject output_buffer,
+    jint width,
+    jint height,
+    jint stride,
+    jint pixel_format,
+    jint scale_numerator,
+    jint region_x,
+    jint region_y,
+    jint region_width,
+    jint region_height,
+    jboolean dither) {
+  JpegMemorySource source;
+  DecodeOutput output;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source) ||
+      !getBufferOutput(
+          env,
+          output_buffer,
+          width,
+          height,
+          stride,
+          pixel_format,
+          output)) {
+    return;
+  }
+  JpegStatus status;
+  decodeJpegRegion(
+      status,
+      source.public_fields,
+      ScaleFactor{(uint8_t) scale_numerator, 8},
+      CropInfo{region_x, region_y, region_width, region_height},
+      output.pixel_format,
+      dither,
+      output.pixels,
+      output.width,
+      output.height,
+      output.stride);
+  throwIfJpegFailed(env, status);
+}
+
+static JNINativeMethod gJpegDecoderMethods[] = {
+  { "nativeGetDecodedSizeBuffer",
+    "(Ljava/nio/ByteBuffer;JIII)[I",
+    (void*) JpegDecoder_getDecodedSizeBuffer },
+  { "nativeDecodeJpegBufferIntoBitmap",
+    "(Ljava/nio/ByteBuffer;JILandroid/graphics/Bitmap;IIZI)V",
+    (void*) JpegDecoder_decodeJpegBufferIntoBitmap },
+  { "nativeDecodeJpegBufferIntoBuffer",
+    "(Ljava/nio/ByteBuffer;JILjava/nio/ByteBuffer;IIIIIIZI)V",
+    (void*) JpegDecoder_decodeJpegBufferIntoBuffer },
+  { "nativeGetDecodedSizeAtScaleBuffer",
+    "(Ljava/nio/ByteBuffer;JII)[I",
+    (void*) JpegDecoder_getDecodedSizeAtScaleBuffer },
+  { "nativeDecodeJpegRegionBufferIntoBitmap",
+    "(Ljava/nio/ByteBuffer;JILandroid/graphics/Bitmap;IIIIIZ)V",
+    (void*) JpegDecoder_decodeJpegRegionBufferIntoBitmap },
+  { "nativeDecodeJpegRegionBufferIntoBuffer",
+    "(Ljava/nio/ByteBuffer;JILjava/nio/ByteBuffer;IIIIIIIIIZ)V",
+    (void*) JpegDecoder_decodeJpegRegionBufferIntoBuffer },
+};
+
+bool registerJpegDecoderMethods(JNIEnv* env) {
+  auto nativeJpegDecoderClass = env->FindClass(
+      "com/facebook/imagepipeline/nativecode/NativeJpegDecoder");
+  if (nativeJpegDecoderClass == nullptr) {
+    LOGE("could not find NativeJpegDecoder class");
+    return false;
+  }
+
+  auto result = env->RegisterNatives(
+      nativeJpegDecoderClass,
+      gJpegDecoderMethods,
+      std::extent<decltype(gJpegDecoderMethods)>::value);
+
+  if (result != 0) {
+    LOGE("could not register JpegDecoder methods");
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_DECODER_H_
+#define _JPEG_DECODER_H_
+
+#include <jni.h>
+
+bool registerJpegDecoderMethods(JNIEnv* env);
+
+#endif /* _JPEG_DECODER_H_ */
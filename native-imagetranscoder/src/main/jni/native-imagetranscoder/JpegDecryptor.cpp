@@ -1,15 +1,33 @@
 #include <type_traits>
+#include <vector>
 
 #include <stdint.h>
 
 #include <jni.h>
 
 #include "exceptions_handler.h"
+#include "jpeg/crypto/jpeg_crypto_stats.h"
 #include "jpeg/crypto/jpeg_decrypt.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+#include "jpeg_stream_wrappers.h"
 #include "logging.h"
+#include "JpegAsync.h"
+#include "JpegBuffer.h"
+#include "JpegCancellationToken.h"
+#include "JpegCrypto.h"
 
+using facebook::imagepipeline::throwIfJpegFailed;
+using facebook::imagepipeline::jpeg::crypto::CryptoKey;
+using facebook::imagepipeline::jpeg::crypto::CryptoStats;
 using facebook::imagepipeline::jpeg::crypto::decryptJpeg;
 using facebook::imagepipeline::jpeg::crypto::decryptJpegEtc;
+using facebook::imagepipeline::jpeg::crypto::decryptJpegThumbnail;
+using facebook::imagepipeline::jpeg::JpegInputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegMemorySource;
+using facebook::imagepipeline::jpeg::JpegNativeBufferDestination;
+using facebook::imagepipeline::jpeg::JpegOutputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegStatus;
 
 static void JpegDecryptor_decryptJpeg(
     JNIEnv* env,
@@ -17,14 +35,114 @@ static void JpegDecryptor_decryptJpeg(
     jobject is,
     jobject os,
     jstring x_0_jstr,
-    jstring mu_jstr) {
+    jstring mu_jstr,
+    jlongArray stats_array,
+    jlong cancellation_token) {
   RETURN_IF_EXCEPTION_PENDING;
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
+  CryptoKey key;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key)) {
+    return;
+  }
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  CryptoStats stats;
   decryptJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      key,
+      stats_array != nullptr ? &stats : nullptr);
+  throwIfJpegFailed(env, status);
+  RETURN_IF_EXCEPTION_PENDING;
+  copyCryptoStats(env, stats, stats_array);
+}
+
+static jobject JpegDecryptor_decryptJpegBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    jlongArray stats_array) {
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  CryptoKey key;
+  JpegMemorySource source;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key) ||
+      !setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  // decrypted images are smaller than their input
+  JpegNativeBufferDestination destination{(size_t) size};
+  JpegStatus status;
+  CryptoStats stats;
+  decryptJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      key,
+      stats_array != nullptr ? &stats : nullptr);
+  throwIfJpegFailed(env, status);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  copyCryptoStats(env, stats, stats_array);
+  return newNativeJpegBuffer(env, destination);
+}
+
+static void JpegDecryptor_decryptJpegBufferAsync(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject job,
+    jint priority,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    jlong cancellation_token) {
+  submitJpegAsyncJob(
       env,
-      is,
-      os,
-      x_0_jstr,
-      mu_jstr);
+      job,
+      priority,
+      cancellation_token,
+      {byte_buffer, x_0_jstr, mu_jstr},
+      [=](JNIEnv* env, const std::vector<jobject>& refs) {
+        return JpegDecryptor_decryptJpegBuffer(
+            env,
+            nullptr,
+            refs[0],
+            native_ptr,
+            size,
+            (jstring) refs[1],
+            (jstring) refs[2],
+            nullptr);
+      });
+}
+
+static jboolean JpegDecryptor_decryptJpegThumbnail(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jstring x_0_jstr,
+    jstring mu_jstr) {
+  RETURNVAL_IF_EXCEPTION_PENDING(JNI_FALSE);
+  CryptoKey key;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key)) {
+    return JNI_FALSE;
+  }
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  const bool found = decryptJpegThumbnail(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      key);
+  throwIfJpegFailed(env, status);
+  return found ? JNI_TRUE : JNI_FALSE;
 }
 
 static void JpegDecryptor_decryptJpegEtc(
@@ -37,20 +155,38 @@ static void JpegDecryptor_decryptJpegEtc(
     jstring x_0_jstr,
     jstring mu_jstr) {
   RETURN_IF_EXCEPTION_PENDING;
+  CryptoKey key;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key)) {
+    return;
+  }
+  JpegInputStreamWrapper is_red_wrapper{env, is_red};
+  JpegInputStreamWrapper is_green_wrapper{env, is_green};
+  JpegInputStreamWrapper is_blue_wrapper{env, is_blue};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
   decryptJpegEtc(
-      env,
-      is_red,
-      is_green,
-      is_blue,
-      os,
-      x_0_jstr,
-      mu_jstr);
+      status,
+      is_red_wrapper.public_fields,
+      is_green_wrapper.public_fields,
+      is_blue_wrapper.public_fields,
+      os_wrapper.public_fields,
+      key);
+  throwIfJpegFailed(env, status);
 }
 
 static JNINativeMethod gJpegDecryptorMethods[] = {
   { "nativeDecryptJpeg",
-      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;)V",
+      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;[JJ)V",
       (void*) JpegDecryptor_decryptJpeg },
+  { "nativeDecryptJpegBuffer",
+      "(Ljava/nio/ByteBuffer;JILjava/lang/String;Ljava/lang/String;[J)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+      (void*) JpegDecryptor_decryptJpegBuffer },
+  { "nativeDecryptJpegBufferAsync",
+      "(Lcom/facebook/imagepipeline/nativecode/NativeJpegAsyncJob;ILjava/nio/ByteBuffer;JILjava/lang/String;Ljava/lang/String;J)V",
+      (void*) JpegDecryptor_decryptJpegBufferAsync },
+  { "nativeDecryptJpegThumbnail",
+      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;)Z",
+      (void*) JpegDecryptor_decryptJpegThumbnail },
   { "nativeDecryptJpegEtc",
       "(Ljava/io/InputStream;Ljava/io/InputStream;Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;)V",
       (void*) JpegDecryptor_decryptJpegEtc },
@@ -1,15 +1,34 @@
 #include <type_traits>
+#include <vector>
 
 #include <stdint.h>
 
 #include <jni.h>
 
 #include "exceptions_handler.h"
+#include "jpeg/crypto/jpeg_crypto_stats.h"
 #include "jpeg/crypto/jpeg_encrypt.h"
+#include "jpeg/crypto/jpeg_transcrypt.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+#include "jpeg_stream_wrappers.h"
 #include "logging.h"
+#include "JpegAsync.h"
+#include "JpegBuffer.h"
+#include "JpegCancellationToken.h"
+#include "JpegCrypto.h"
 
+using facebook::imagepipeline::throwIfJpegFailed;
+using facebook::imagepipeline::jpeg::crypto::CryptoKey;
+using facebook::imagepipeline::jpeg::crypto::CryptoStats;
 using facebook::imagepipeline::jpeg::crypto::encryptJpeg;
 using facebook::imagepipeline::jpeg::crypto::encryptJpegEtc;
+using facebook::imagepipeline::jpeg::crypto::transcryptJpeg;
+using facebook::imagepipeline::jpeg::JpegInputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegMemorySource;
+using facebook::imagepipeline::jpeg::JpegNativeBufferDestination;
+using facebook::imagepipeline::jpeg::JpegOutputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegStatus;
 
 static void JpegEncryptor_encryptJpeg(
     JNIEnv* env,
@@ -17,14 +36,102 @@ static void JpegEncryptor_encryptJpeg(
     jobject is,
     jobject os,
     jstring x_0_jstr,
-    jstring mu_jstr) {
+    jstring mu_jstr,
+    jint level,
+    jint thumbnail_max_dimension,
+    jlongArray stats_array,
+    jlong cancellation_token) {
+  RETURN_IF_EXCEPTION_PENDING;
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
+  CryptoKey key;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key)) {
+    return;
+  }
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  CryptoStats stats;
+  encryptJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      key,
+      level,
+      thumbnail_max_dimension,
+      stats_array != nullptr ? &stats : nullptr);
+  throwIfJpegFailed(env, status);
   RETURN_IF_EXCEPTION_PENDING;
+  copyCryptoStats(env, stats, stats_array);
+}
+
+static jobject JpegEncryptor_encryptJpegBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    jint level,
+    jint thumbnail_max_dimension,
+    jlongArray stats_array) {
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  CryptoKey key;
+  JpegMemorySource source;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key) ||
+      !setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  // encrypted images come out slightly larger than their input
+  JpegNativeBufferDestination destination{(size_t) size + size / 2};
+  JpegStatus status;
+  CryptoStats stats;
   encryptJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      key,
+      level,
+      thumbnail_max_dimension,
+      stats_array != nullptr ? &stats : nullptr);
+  throwIfJpegFailed(env, status);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  copyCryptoStats(env, stats, stats_array);
+  return newNativeJpegBuffer(env, destination);
+}
+
+static void JpegEncryptor_encryptJpegBufferAsync(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject job,
+    jint priority,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jstring x_0_jstr,
+    jstring mu_jstr,
+    jint level,
+    jint thumbnail_max_dimension,
+    jlong cancellation_token) {
+  submitJpegAsyncJob(
       env,
-      is,
-      os,
-      x_0_jstr,
-      mu_jstr);
+      job,
+      priority,
+      cancellation_token,
+      {byte_buffer, x_0_jstr, mu_jstr},
+      [=](JNIEnv* env, const std::vector<jobject>& refs) {
+        return JpegEncryptor_encryptJpegBuffer(
+            env,
+            nullptr,
+            refs[0],
+            native_ptr,
+            size,
+            (jstring) refs[1],
+            (jstring) refs[2],
+            level,
+            thumbnail_max_dimension,
+            nullptr);
+      });
 }
 
 static void JpegEncryptor_encryptJpegEtc(
@@ -36,26 +143,74 @@ static void JpegEncryptor_encryptJpegEtc(
     jobject os_blue,
     jstring x_0_jstr,
     jstring mu_jstr,
-    jint quality) {
+    jint quality,
+    jlong cancellation_token) {
   RETURN_IF_EXCEPTION_PENDING;
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
+  CryptoKey key;
+  if (!getCryptoKey(env, x_0_jstr, mu_jstr, key)) {
+    return;
+  }
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_red_wrapper{env, os_red};
+  JpegOutputStreamWrapper os_green_wrapper{env, os_green};
+  JpegOutputStreamWrapper os_blue_wrapper{env, os_blue};
+  JpegStatus status;
   encryptJpegEtc(
-      env,
-      is,
-      os_red,
-      os_green,
-      os_blue,
-      x_0_jstr,
-      mu_jstr,
+      status,
+      is_wrapper.public_fields,
+      os_red_wrapper.public_fields,
+      os_green_wrapper.public_fields,
+      os_blue_wrapper.public_fields,
+      key,
       quality);
+  throwIfJpegFailed(env, status);
+}
+
+static void JpegEncryptor_transcryptJpeg(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jstring old_x_0_jstr,
+    jstring old_mu_jstr,
+    jstring new_x_0_jstr,
+    jstring new_mu_jstr) {
+  RETURN_IF_EXCEPTION_PENDING;
+  CryptoKey old_key;
+  CryptoKey new_key;
+  if (!getCryptoKey(env, old_x_0_jstr, old_mu_jstr, old_key) ||
+      !getCryptoKey(env, new_x_0_jstr, new_mu_jstr, new_key)) {
+    return;
+  }
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  transcryptJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      old_key,
+      new_key);
+  throwIfJpegFailed(env, status);
 }
 
 static JNINativeMethod gJpegEncryptorMethods[] = {
   { "nativeEncryptJpeg",
-      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;)V",
+      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;II[JJ)V",
       (void*) JpegEncryptor_encryptJpeg },
+  { "nativeEncryptJpegBuffer",
+      "(Ljava/nio/ByteBuffer;JILjava/lang/String;Ljava/lang/String;II[J)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+      (void*) JpegEncryptor_encryptJpegBuffer },
+  { "nativeEncryptJpegBufferAsync",
+      "(Lcom/facebook/imagepipeline/nativecode/NativeJpegAsyncJob;ILjava/nio/ByteBuffer;JILjava/lang/String;Ljava/lang/String;IIJ)V",
+      (void*) JpegEncryptor_encryptJpegBufferAsync },
   { "nativeEncryptJpegEtc",
-      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/io/OutputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;I)V",
+      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/io/OutputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;IJ)V",
       (void*) JpegEncryptor_encryptJpegEtc },
+  { "nativeTranscryptJpeg",
+      "(Ljava/io/InputStream;Ljava/io/OutputStream;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;Ljava/lang/String;)V",
+      (void*) JpegEncryptor_transcryptJpeg },
 };
 
 bool registerJpegEncryptorMethods(JNIEnv* env) {
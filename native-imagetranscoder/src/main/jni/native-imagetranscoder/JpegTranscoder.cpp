@@ -5,7 +5,10 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <memory>
+#include <string>
 #include <type_traits>
+#include <vector>
 
 #include <stdint.h>
 
@@ -13,66 +16,754 @@
 
 #include "exceptions_handler.h"
 #include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_memory_manager.h"
+#include "jpeg/jpeg_status.h"
+#include "jpeg_stream_wrappers.h"
 #include "logging.h"
 #include "transformations.h"
+#include "JpegAsync.h"
+#include "JpegBuffer.h"
+#include "JpegCancellationToken.h"
 
-using facebook::imagepipeline::getRotationTypeFromDegrees;
-using facebook::imagepipeline::getRotationTypeFromRawExifOrientation;
+using facebook::imagepipeline::throwIfJpegFailed;
+using facebook::imagepipeline::CropInfo;
+using facebook::imagepipeline::MarkerPolicy;
 using facebook::imagepipeline::RotationType;
 using facebook::imagepipeline::ScaleFactor;
+using facebook::imagepipeline::TargetSize;
+using facebook::imagepipeline::jpeg::cropJpeg;
+using facebook::imagepipeline::jpeg::estimateJpegQuality;
+using facebook::imagepipeline::jpeg::JpegInputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegMemorySource;
+using facebook::imagepipeline::jpeg::JpegNativeBufferDestination;
+using facebook::imagepipeline::jpeg::JpegOutputStreamWrapper;
+using facebook::imagepipeline::jpeg::JpegResizeSink;
+using facebook::imagepipeline::jpeg::JpegStatus;
+using facebook::imagepipeline::jpeg::optimizeJpeg;
+using facebook::imagepipeline::jpeg::setJpegBackingStoreDirectory;
+using facebook::imagepipeline::jpeg::setJpegMemoryLimit;
 using facebook::imagepipeline::jpeg::transformJpeg;
+using facebook::imagepipeline::jpeg::transformJpegMulti;
+using facebook::imagepipeline::jpeg::transformJpegWithByteLimit;
 
-static void JpegTranscoder_transcodeJpeg(
+/**
+ * Converts the rotation_degrees argument of a native method, throws if it
+ * is not one of 0, 90, 180 and 270.
+ */
+static RotationType getRotationTypeFromDegrees(JNIEnv* env, jint degrees) {
+  RotationType rotation_type = RotationType::ROTATE_0;
+  THROW_AND_RETURNVAL_IF(
+      !facebook::imagepipeline::getRotationTypeFromDegrees(
+          degrees,
+          rotation_type),
+      "wrong rotation angle",
+      RotationType::ROTATE_0);
+  return rotation_type;
+}
+
+/**
+ * Converts the exif_orientation argument of a native method, throws if it
+ * is not one of the rotations without mirroring.
+ */
+static RotationType getRotationTypeFromRawExifOrientation(
+    JNIEnv* env,
+    jint exif_orientation) {
+  RotationType rotation_type = RotationType::ROTATE_0;
+  THROW_AND_RETURNVAL_IF(
+      !facebook::imagepipeline::getRotationTypeFromRawExifOrientation(
+          exif_orientation,
+          rotation_type),
+      "wrong exif orientation",
+      RotationType::ROTATE_0);
+  return rotation_type;
+}
+
+/**
+ * Converts the marker_policy argument of a native method, throws if it is
+ * none of the MARKER_POLICY_* constants.
+ */
+static MarkerPolicy getMarkerPolicy(JNIEnv* env, jint marker_policy) {
+  MarkerPolicy policy = MarkerPolicy::NONE;
+  THROW_AND_RETURNVAL_IF(
+      !facebook::imagepipeline::getMarkerPolicy(marker_policy, policy),
+      "wrong marker policy",
+      MarkerPolicy::NONE);
+  return policy;
+}
+
+static jint JpegTranscoder_transcodeJpeg(
     JNIEnv* env,
     jclass /* clzz */,
     jobject is,
     jobject os,
     jint rotation_degrees,
     jint downscale_numerator,
-    jint quality) {
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows,
+    jlong cancellation_token) {
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
   ScaleFactor scale_factor{(uint8_t) downscale_numerator, 8};
   RotationType rotation_type = getRotationTypeFromDegrees(
       env,
       rotation_degrees);
-  RETURN_IF_EXCEPTION_PENDING;
-  transformJpeg(
-      env,
-      is,
-      os,
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  const int output_quality = transformJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
       rotation_type,
       scale_factor,
-      quality);
+      quality,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  return output_quality;
 }
 
-static void JpegTranscoder_transcodeJpegWithExifOrientation(
+static jint JpegTranscoder_transcodeJpegWithExifOrientation(
     JNIEnv* env,
     jclass /* clzz */,
     jobject is,
     jobject os,
     jint exif_orientation,
     jint downscale_numerator,
-    jint quality) {
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows,
+    jlong cancellation_token) {
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
   ScaleFactor scale_factor{(uint8_t) downscale_numerator, 8};
   RotationType rotation_type = getRotationTypeFromRawExifOrientation(
       env,
       exif_orientation);
-  RETURN_IF_EXCEPTION_PENDING;
-  transformJpeg(
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  const int output_quality = transformJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      rotation_type,
+      scale_factor,
+      quality,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  return output_quality;
+}
+
+static jint JpegTranscoder_transcodeJpegToSize(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jint rotation_degrees,
+    jint target_width,
+    jint target_height,
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows,
+    jlong cancellation_token) {
+  JpegCancellationScope cancellation_scope{env, cancellation_token};
+  TargetSize target_size{target_width, target_height};
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  const int output_quality = transformJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      rotation_type,
+      target_size,
+      quality,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  return output_quality;
+}
+
+static jint JpegTranscoder_transcodeJpegWithByteLimit(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jint rotation_degrees,
+    jint downscale_numerator,
+    jint max_quality,
+    jint max_bytes,
+    jint marker_policy,
+    jint restart_interval_rows) {
+  ScaleFactor scale_factor{(uint8_t) downscale_numerator, 8};
+  RotationType rotation_type = getRotationTypeFromDegrees(
       env,
-      is,
-      os,
+      rotation_degrees);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(0);
+  THROW_AND_RETURNVAL_IF(max_bytes < 1, "byte limit cannot be lower than 1", 0);
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  const int output_quality = transformJpegWithByteLimit(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
       rotation_type,
       scale_factor,
-      quality);
+      max_quality,
+      (size_t) max_bytes,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  return output_quality;
+}
+
+/**
+ * Transforms encoded bytes held in native memory and returns the result as
+ * a NativeJpegBuffer, without any stream upcalls or java heap copies.
+ */
+static jobject transcodeJpegBuffer(
+    JNIEnv* env,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    RotationType rotation_type,
+    jint downscale_numerator,
+    jint quality,
+    MarkerPolicy marker_policy,
+    jint restart_interval_rows) {
+  ScaleFactor scale_factor{(uint8_t) downscale_numerator, 8};
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  // the output is usually not much larger than the input
+  JpegNativeBufferDestination destination{(size_t) size};
+  JpegStatus status;
+  transformJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      rotation_type,
+      scale_factor,
+      quality,
+      marker_policy,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  return newNativeJpegBuffer(env, destination);
+}
+
+static jobject JpegTranscoder_transcodeJpegBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint rotation_degrees,
+    jint downscale_numerator,
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows) {
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  return transcodeJpegBuffer(
+      env,
+      byte_buffer,
+      native_ptr,
+      size,
+      rotation_type,
+      downscale_numerator,
+      quality,
+      marker_policy_type,
+      restart_interval_rows);
+}
+
+static jobject JpegTranscoder_transcodeJpegBufferWithExifOrientation(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint exif_orientation,
+    jint downscale_numerator,
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows) {
+  RotationType rotation_type = getRotationTypeFromRawExifOrientation(
+      env,
+      exif_orientation);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  return transcodeJpegBuffer(
+      env,
+      byte_buffer,
+      native_ptr,
+      size,
+      rotation_type,
+      downscale_numerator,
+      quality,
+      marker_policy_type,
+      restart_interval_rows);
+}
+
+static void JpegTranscoder_transcodeJpegBufferAsync(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject job,
+    jint priority,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint rotation_degrees,
+    jint downscale_numerator,
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows,
+    jlong cancellation_token) {
+  submitJpegAsyncJob(
+      env,
+      job,
+      priority,
+      cancellation_token,
+      {byte_buffer},
+      [=](JNIEnv* env, const std::vector<jobject>& refs) {
+        return JpegTranscoder_transcodeJpegBuffer(
+            env,
+            nullptr,
+            refs[0],
+            native_ptr,
+            size,
+            rotation_degrees,
+            downscale_numerator,
+            quality,
+            marker_policy,
+            restart_interval_rows);
+      });
+}
+
+static void JpegTranscoder_transcodeJpegBufferWithExifOrientationAsync(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject job,
+    jint priority,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint exif_orientation,
+    jint downscale_numerator,
+    jint quality,
+    jint marker_policy,
+    jint restart_interval_rows,
+    jlong cancellation_token) {
+  submitJpegAsyncJob(
+      env,
+      job,
+      priority,
+      cancellation_token,
+      {byte_buffer},
+      [=](JNIEnv* env, const std::vector<jobject>& refs) {
+        return JpegTranscoder_transcodeJpegBufferWithExifOrientation(
+            env,
+            nullptr,
+            refs[0],
+            native_ptr,
+            size,
+            exif_orientation,
+            downscale_numerator,
+            quality,
+            marker_policy,
+            restart_interval_rows);
+      });
+}
+
+static void JpegTranscoder_cropJpeg(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jint rotation_degrees,
+    jint crop_x,
+    jint crop_y,
+    jint crop_width,
+    jint crop_height,
+    jint marker_policy) {
+  CropInfo crop_info{crop_x, crop_y, crop_width, crop_height};
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURN_IF_EXCEPTION_PENDING;
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURN_IF_EXCEPTION_PENDING;
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  cropJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      rotation_type,
+      crop_info,
+      marker_policy_type);
+  throwIfJpegFailed(env, status);
+}
+
+static jobject JpegTranscoder_cropJpegBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint rotation_degrees,
+    jint crop_x,
+    jint crop_y,
+    jint crop_width,
+    jint crop_height,
+    jint marker_policy) {
+  CropInfo crop_info{crop_x, crop_y, crop_width, crop_height};
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  // the output is never larger than the input by much
+  JpegNativeBufferDestination destination{(size_t) size};
+  JpegStatus status;
+  cropJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      rotation_type,
+      crop_info,
+      marker_policy_type);
+  throwIfJpegFailed(env, status);
+  return newNativeJpegBuffer(env, destination);
+}
+
+static void JpegTranscoder_optimizeJpeg(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobject os,
+    jboolean progressive,
+    jboolean strip_markers) {
+  JpegInputStreamWrapper is_wrapper{env, is};
+  JpegOutputStreamWrapper os_wrapper{env, os};
+  JpegStatus status;
+  optimizeJpeg(
+      status,
+      is_wrapper.public_fields,
+      os_wrapper.public_fields,
+      progressive,
+      strip_markers);
+  throwIfJpegFailed(env, status);
+}
+
+static jobject JpegTranscoder_optimizeJpegBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jboolean progressive,
+    jboolean strip_markers) {
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+  // the output is expected to be a bit smaller than the input
+  JpegNativeBufferDestination destination{(size_t) size};
+  JpegStatus status;
+  optimizeJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      progressive,
+      strip_markers);
+  throwIfJpegFailed(env, status);
+  return newNativeJpegBuffer(env, destination);
+}
+
+/**
+ * Reads target sizes and qualities of the outputs of a multi transcode.
+ *
+ * @return false if a java exception was thrown
+ */
+static bool getMultiTargets(
+    JNIEnv* env,
+    jsize count,
+    jintArray target_widths,
+    jintArray target_heights,
+    jintArray qualities,
+    std::vector<TargetSize>& target_sizes,
+    std::vector<int>& quality_values) {
+  THROW_AND_RETURNVAL_IF(count < 1, "no outputs to write", false);
+  THROW_AND_RETURNVAL_IF(
+      env->GetArrayLength(target_widths) != count ||
+          env->GetArrayLength(target_heights) != count ||
+          env->GetArrayLength(qualities) != count,
+      "one target size and quality per output required",
+      false);
+
+  std::vector<jint> widths(count);
+  std::vector<jint> heights(count);
+  std::vector<jint> values(count);
+  env->GetIntArrayRegion(target_widths, 0, count, widths.data());
+  env->GetIntArrayRegion(target_heights, 0, count, heights.data());
+  env->GetIntArrayRegion(qualities, 0, count, values.data());
+  RETURNVAL_IF_EXCEPTION_PENDING(false);
+
+  for (jsize i = 0; i < count; i++) {
+    target_sizes.emplace_back(widths[i], heights[i]);
+    quality_values.push_back(values[i]);
+  }
+  return true;
+}
+
+/**
+ * Writes the qualities the outputs of a multi transcode were encoded with
+ * back to the java array.
+ */
+static void setMultiQualities(
+    JNIEnv* env,
+    jintArray qualities,
+    const std::vector<int>& quality_values) {
+  RETURN_IF_EXCEPTION_PENDING;
+  std::vector<jint> values(quality_values.begin(), quality_values.end());
+  env->SetIntArrayRegion(qualities, 0, values.size(), values.data());
+}
+
+static void JpegTranscoder_transcodeJpegMulti(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject is,
+    jobjectArray output_streams,
+    jint rotation_degrees,
+    jintArray target_widths,
+    jintArray target_heights,
+    jintArray qualities,
+    jint marker_policy,
+    jint restart_interval_rows) {
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURN_IF_EXCEPTION_PENDING;
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURN_IF_EXCEPTION_PENDING;
+
+  const jsize count = env->GetArrayLength(output_streams);
+  std::vector<TargetSize> target_sizes;
+  std::vector<int> quality_values;
+  if (!getMultiTargets(
+      env,
+      count,
+      target_widths,
+      target_heights,
+      qualities,
+      target_sizes,
+      quality_values)) {
+    return;
+  }
+
+  JpegInputStreamWrapper is_wrapper{env, is};
+  std::vector<JpegOutputStreamWrapper> os_wrappers;
+  os_wrappers.reserve(count);
+  std::vector<JpegResizeSink> sinks;
+  for (jsize i = 0; i < count; i++) {
+    os_wrappers.emplace_back(
+        env,
+        env->GetObjectArrayElement(output_streams, i));
+    sinks.push_back(JpegResizeSink{
+        target_sizes[i],
+        quality_values[i],
+        &os_wrappers.back().public_fields});
+  }
+  JpegStatus status;
+  transformJpegMulti(
+      status,
+      is_wrapper.public_fields,
+      rotation_type,
+      sinks,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  for (size_t i = 0; i < sinks.size(); i++) {
+    quality_values[i] = sinks[i].quality;
+  }
+  setMultiQualities(env, qualities, quality_values);
+}
+
+static jobjectArray JpegTranscoder_transcodeJpegBufferMulti(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size,
+    jint rotation_degrees,
+    jintArray target_widths,
+    jintArray target_heights,
+    jintArray qualities,
+    jint marker_policy,
+    jint restart_interval_rows) {
+  RotationType rotation_type = getRotationTypeFromDegrees(
+      env,
+      rotation_degrees);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+  MarkerPolicy marker_policy_type = getMarkerPolicy(env, marker_policy);
+  RETURNVAL_IF_EXCEPTION_PENDING(nullptr);
+
+  std::vector<TargetSize> target_sizes;
+  std::vector<int> quality_values;
+  if (!getMultiTargets(
+      env,
+      env->GetArrayLength(target_widths),
+      target_widths,
+      target_heights,
+      qualities,
+      target_sizes,
+      quality_values)) {
+    return nullptr;
+  }
+
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return nullptr;
+  }
+
+  std::vector<std::unique_ptr<JpegNativeBufferDestination>> destinations;
+  std::vector<JpegResizeSink> sinks;
+  for (size_t i = 0; i < target_sizes.size(); i++) {
+    // the ratio to the input size is not known yet, grow as needed
+    destinations.emplace_back(new JpegNativeBufferDestination{0});
+    sinks.push_back(JpegResizeSink{
+        target_sizes[i],
+        quality_values[i],
+        &destinations.back()->public_fields});
+  }
+  JpegStatus status;
+  transformJpegMulti(
+      status,
+      source.public_fields,
+      rotation_type,
+      sinks,
+      marker_policy_type,
+      restart_interval_rows);
+  throwIfJpegFailed(env, status);
+  for (size_t i = 0; i < sinks.size(); i++) {
+    quality_values[i] = sinks[i].quality;
+  }
+  setMultiQualities(env, qualities, quality_values);
+  return newNativeJpegBufferArray(env, destinations);
+}
+
+static jint JpegTranscoder_estimateJpegQualityBuffer(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jobject byte_buffer,
+    jlong native_ptr,
+    jint size) {
+  JpegMemorySource source;
+  if (!setNativeJpegInput(env, byte_buffer, native_ptr, size, source)) {
+    return 0;
+  }
+  JpegStatus status;
+  const int quality = estimateJpegQuality(status, source.public_fields);
+  throwIfJpegFailed(env, status);
+  return quality;
+}
+
+static void JpegTranscoder_setMemoryLimit(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlong max_bytes,
+    jstring backing_store_directory) {
+  THROW_AND_RETURN_IF(max_bytes < 0, "memory limit cannot be negative");
+  std::string directory;
+  if (backing_store_directory != nullptr) {
+    const char* directory_chars =
+        env->GetStringUTFChars(backing_store_directory, nullptr);
+    RETURN_IF_EXCEPTION_PENDING;
+    directory = directory_chars;
+    env->ReleaseStringUTFChars(backing_store_directory, directory_chars);
+  }
+  setJpegBackingStoreDirectory(directory);
+  setJpegMemoryLimit((size_t) max_bytes);
 }
 
 static JNINativeMethod gJpegTranscoderMethods[] = {
   { "nativeTranscodeJpeg",
-    "(Ljava/io/InputStream;Ljava/io/OutputStream;III)V",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;IIIIIJ)I",
     (void*) JpegTranscoder_transcodeJpeg },
   { "nativeTranscodeJpegWithExifOrientation",
-    "(Ljava/io/InputStream;Ljava/io/OutputStream;III)V",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;IIIIIJ)I",
     (void*) JpegTranscoder_transcodeJpegWithExifOrientation },
+  { "nativeTranscodeJpegToSize",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;IIIIIIJ)I",
+    (void*) JpegTranscoder_transcodeJpegToSize },
+  { "nativeTranscodeJpegWithByteLimit",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;IIIIII)I",
+    (void*) JpegTranscoder_transcodeJpegWithByteLimit },
+  { "nativeTranscodeJpegMulti",
+    "(Ljava/io/InputStream;[Ljava/io/OutputStream;I[I[I[III)V",
+    (void*) JpegTranscoder_transcodeJpegMulti },
+  { "nativeCropJpeg",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;IIIIII)V",
+    (void*) JpegTranscoder_cropJpeg },
+  { "nativeOptimizeJpeg",
+    "(Ljava/io/InputStream;Ljava/io/OutputStream;ZZ)V",
+    (void*) JpegTranscoder_optimizeJpeg },
+  { "nativeTranscodeJpegBuffer",
+    "(Ljava/nio/ByteBuffer;JIIIIII)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+    (void*) JpegTranscoder_transcodeJpegBuffer },
+  { "nativeTranscodeJpegBufferWithExifOrientation",
+    "(Ljava/nio/ByteBuffer;JIIIIII)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+    (void*) JpegTranscoder_transcodeJpegBufferWithExifOrientation },
+  { "nativeTranscodeJpegBufferAsync",
+    "(Lcom/facebook/imagepipeline/nativecode/NativeJpegAsyncJob;ILjava/nio/ByteBuffer;JIIIIIIJ)V",
+    (void*) JpegTranscoder_transcodeJpegBufferAsync },
+  { "nativeTranscodeJpegBufferWithExifOrientationAsync",
+    "(Lcom/facebook/imagepipeline/nativecode/NativeJpegAsyncJob;ILjava/nio/ByteBuffer;JIIIIIIJ)V",
+    (void*) JpegTranscoder_transcodeJpegBufferWithExifOrientationAsync },
+  { "nativeTranscodeJpegBufferMulti",
+    "(Ljava/nio/ByteBuffer;JII[I[I[III)[Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+    (void*) JpegTranscoder_transcodeJpegBufferMulti },
+  { "nativeCropJpegBuffer",
+    "(Ljava/nio/ByteBuffer;JIIIIIII)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+    (void*) JpegTranscoder_cropJpegBuffer },
+  { "nativeOptimizeJpegBuffer",
+    "(Ljava/nio/ByteBuffer;JIZZ)Lcom/facebook/imagepipeline/nativecode/NativeJpegBuffer;",
+    (void*) JpegTranscoder_optimizeJpegBuffer },
+  { "nativeEstimateJpegQualityBuffer",
+    "(Ljava/nio/ByteBuffer;JI)I",
+    (void*) JpegTranscoder_estimateJpegQualityBuffer },
+  { "nativeSetMemoryLimit",
+    "(JLjava/lang/String;)V",
+    (void*) JpegTranscoder_setMemoryLimit },
 };
 
 bool registerJpegTranscoderMethods(JNIEnv* env) {
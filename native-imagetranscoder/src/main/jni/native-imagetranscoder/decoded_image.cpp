@@ -16,6 +16,8 @@ int bytesPerPixel(PixelFormat pixel_format) {
     return 3;
   case PixelFormat::RGBA:
     return 4;
+  case PixelFormat::RGB_565:
+    return 2;
   default:
     return 0;
   }
@@ -17,7 +17,7 @@ namespace imagepipeline {
 /**
  * Describes pixel formats of DecodedImage
  */
-  enum class PixelFormat {RGB, RGBA};
+  enum class PixelFormat {RGB, RGBA, RGB_565};
 
 /**
  * Returns number of bytes per pixel for given PixelFormat
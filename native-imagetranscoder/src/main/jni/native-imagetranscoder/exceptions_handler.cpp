@@ -16,4 +16,10 @@ void throwJavaException(JNIEnv* env, jclass exceptionCls, const char* msg) {
   }
 }
 
+void throwIfJpegFailed(JNIEnv* env, const jpeg::JpegStatus& status) {
+  if (status.failed) {
+    throwJavaException(env, jRuntimeExceptionclass, status.message);
+  }
+}
+
 } }
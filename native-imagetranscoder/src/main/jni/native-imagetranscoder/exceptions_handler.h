@@ -11,12 +11,20 @@
 #include <jni.h>
 
 #include "java_globals.h"
+#include "jpeg/jpeg_status.h"
 
 namespace facebook {
 namespace imagepipeline {
 
 void throwJavaException(JNIEnv*, jclass, const char*);
 
+/**
+ * Throws a RuntimeException carrying the message of a failed status of the
+ * jpeg core, unless an exception is pending already, e.g. one thrown by a
+ * java stream the operation read from.
+ */
+void throwIfJpegFailed(JNIEnv*, const jpeg::JpegStatus&);
+
 } }
 
 #define THROW_AND_RETURN_IF(condition, message)                         \
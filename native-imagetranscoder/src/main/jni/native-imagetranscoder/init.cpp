@@ -10,6 +10,10 @@
 #include "exceptions_handler.h"
 #include "java_globals.h"
 #include "logging.h"
+#include "JpegAsync.h"
+#include "JpegBuffer.h"
+#include "JpegCancellationToken.h"
+#include "JpegDecoder.h"
 #include "JpegTranscoder.h"
 #include "JpegEncryptor.h"
 #include "JpegDecryptor.h"
@@ -79,11 +83,31 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
       -1);
 
   // register native methods
+  THROW_AND_RETURNVAL_IF(
+      !registerJpegBufferMethods(env),
+      "Could not register JpegBuffer methods",
+      -1);
+
+  THROW_AND_RETURNVAL_IF(
+      !registerJpegCancellationTokenMethods(env),
+      "Could not register JpegCancellationToken methods",
+      -1);
+
+  THROW_AND_RETURNVAL_IF(
+      !registerJpegAsyncMethods(env),
+      "Could not register JpegAsync methods",
+      -1);
+
   THROW_AND_RETURNVAL_IF(
       !registerJpegTranscoderMethods(env),
       "Could not register JpegTranscoder methods",
       -1);
 
+  THROW_AND_RETURNVAL_IF(
+      !registerJpegDecoderMethods(env),
+      "Could not register JpegDecoder methods",
+      -1);
+
   THROW_AND_RETURNVAL_IF(
       !registerJpegEncryptorMethods(env),
       "Could not register JpegEncryptor methods",
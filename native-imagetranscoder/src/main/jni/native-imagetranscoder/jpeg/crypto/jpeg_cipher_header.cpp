@@ -0,0 +1,185 @@
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include "logging.h"
+#include "jpeg/jpeg_error_handler.h"
+#include "jpeg_cipher_header.h"
+#include "sha512.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Size of the header fields following CIPHER_MARKER_ID
+ */
+static const unsigned int kCipherHeaderV1Length = 4 + CIPHER_KEY_CHECK_LENGTH;
+static const unsigned int kCipherHeaderV2Length = kCipherHeaderV1Length + 1;
+static const unsigned int kCipherHeaderLength =
+    kCipherHeaderV2Length + CIPHER_KEY_CHECK_SALT_LENGTH;
+
+/**
+ * Prefix keeping the key check unrelated to hashes the cipher itself derives
+ * from the key. Replaced by the random salt of the header since version 3.
+ */
+static const char* const kKeyCheckSalt = "FBCRYPTO-KEYCHECK";
+
+static void computeKeyCheck(
+    const CipherHeader& header,
+    const CryptoKey& key,
+    char *key_check) {
+  std::string input;
+  if (header.version >= 3) {
+    input.assign((const char*) header.salt, CIPHER_KEY_CHECK_SALT_LENGTH);
+  } else {
+    input.assign(kKeyCheckSalt);
+  }
+  input.append(key.x_0);
+  input.push_back('/');
+  input.append(key.mu);
+
+  const std::string hash = sw::sha512::calculate(input);
+  memcpy(key_check, hash.data(), CIPHER_KEY_CHECK_LENGTH);
+}
+
+/**
+ * The salt only has to differ between images, not to be secret. Should
+ * /dev/urandom be unavailable, the time and a counter still make it unique
+ * within the process.
+ */
+static void generateSalt(uint8_t* salt) {
+  FILE* urandom = fopen("/dev/urandom", "rb");
+  if (urandom != nullptr) {
+    const size_t read = fread(salt, 1, CIPHER_KEY_CHECK_SALT_LENGTH, urandom);
+    fclose(urandom);
+    if (read == CIPHER_KEY_CHECK_SALT_LENGTH) {
+      return;
+    }
+  }
+  LOGW("generateSalt cannot read /dev/urandom, deriving salt from the clock");
+  static std::atomic<uint64_t> counter{0};
+  const std::string hash = sw::sha512::calculate(
+      std::to_string(std::chrono::system_clock::now().time_since_epoch().count()) +
+      "/" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) +
+      "/" + std::to_string(counter++));
+  // hex digits, two per byte
+  for (unsigned int i = 0; i < CIPHER_KEY_CHECK_SALT_LENGTH; i++) {
+    salt[i] = (uint8_t) strtoul(hash.substr(2 * i, 2).c_str(), nullptr, 16);
+  }
+}
+
+void initCipherHeader(
+    CipherHeader& header,
+    CipherEngine engine,
+    CipherLevel level,
+    const CryptoKey& key) {
+  header.version = CIPHER_VERSION;
+  header.engine = engine;
+  header.stripe_mcu_rows = 0;
+  header.level = level;
+  generateSalt(header.salt);
+  computeKeyCheck(header, key, header.key_check);
+}
+
+bool cipherHeaderMatchesKey(
+    const CipherHeader& header,
+    const CryptoKey& key) {
+  char key_check[CIPHER_KEY_CHECK_LENGTH];
+  computeKeyCheck(header, key, key_check);
+  return memcmp(key_check, header.key_check, CIPHER_KEY_CHECK_LENGTH) == 0;
+}
+
+void writeCipherHeader(j_compress_ptr cinfo, const CipherHeader& header) {
+  jpeg_write_m_header(
+      cinfo,
+      CIPHER_MARKER,
+      CIPHER_MARKER_ID_LENGTH + kCipherHeaderLength);
+
+  for (unsigned int i = 0; i < CIPHER_MARKER_ID_LENGTH; i++) {
+    jpeg_write_m_byte(cinfo, CIPHER_MARKER_ID[i]);
+  }
+  jpeg_write_m_byte(cinfo, header.version);
+  jpeg_write_m_byte(cinfo, header.engine);
+  jpeg_write_m_byte(cinfo, header.stripe_mcu_rows >> 8);
+  jpeg_write_m_byte(cinfo, header.stripe_mcu_rows & 0xFF);
+  for (unsigned int i = 0; i < CIPHER_KEY_CHECK_LENGTH; i++) {
+    jpeg_write_m_byte(cinfo, header.key_check[i]);
+  }
+  jpeg_write_m_byte(cinfo, header.level);
+  for (unsigned int i = 0; i < CIPHER_KEY_CHECK_SALT_LENGTH; i++) {
+    jpeg_write_m_byte(cinfo, header.salt[i]);
+  }
+}
+
+void saveCipherHeader(j_decompress_ptr dinfo) {
+  jpeg_save_markers(dinfo, CIPHER_MARKER, CIPHER_MARKER_ID_LENGTH + kCipherHeaderLength);
+}
+
+bool extractCipherHeader(j_decompress_ptr dinfo, CipherHeader& header) {
+  jpeg_saved_marker_ptr* link = &dinfo->marker_list;
+
+  while (*link != nullptr) {
+    jpeg_saved_marker_ptr marker = *link;
+    if (marker->marker == CIPHER_MARKER &&
+        marker->data_length >= CIPHER_MARKER_ID_LENGTH + kCipherHeaderV1Length &&
+        memcmp(marker->data, CIPHER_MARKER_ID, CIPHER_MARKER_ID_LENGTH) == 0) {
+      const JOCTET* data = marker->data + CIPHER_MARKER_ID_LENGTH;
+      const unsigned int length = marker->data_length - CIPHER_MARKER_ID_LENGTH;
+      header.version = data[0];
+      header.engine = data[1];
+      header.stripe_mcu_rows = (data[2] << 8) | data[3];
+      memcpy(header.key_check, data + 4, CIPHER_KEY_CHECK_LENGTH);
+      header.level = header.version >= 2 && length >= kCipherHeaderV2Length
+          ? data[kCipherHeaderV1Length]
+          : (uint8_t) CIPHER_LEVEL_FULL;
+      // a truncated salt fails the key check
+      memset(header.salt, 0, CIPHER_KEY_CHECK_SALT_LENGTH);
+      if (header.version >= 3 && length >= kCipherHeaderLength) {
+        memcpy(header.salt, data + kCipherHeaderV2Length, CIPHER_KEY_CHECK_SALT_LENGTH);
+      }
+
+      // marker memory belongs to the decompress struct pool, unlinking is enough
+      *link = marker->next;
+      return true;
+    }
+    link = &marker->next;
+  }
+  return false;
+}
+
+void checkCipherHeader(
+    j_decompress_ptr dinfo,
+    CipherHeader& header,
+    const CryptoKey& key) {
+  if (!extractCipherHeader(dinfo, header)) {
+    LOGW("checkCipherHeader no cipher header, assuming legacy image");
+    header.version = 0;
+    header.engine = CIPHER_ENGINE_CHAOTIC_GMP;
+    header.stripe_mcu_rows = 0;
+    header.level = CIPHER_LEVEL_FULL;
+    return;
+  }
+
+  if (header.version > CIPHER_VERSION) {
+    jpegFail((j_common_ptr) dinfo, "Unsupported cipher version");
+  }
+  if (header.level < CIPHER_LEVEL_DC || header.level > CIPHER_LEVEL_FULL) {
+    jpegFail((j_common_ptr) dinfo, "Unsupported cipher level");
+  }
+  if (header.stripe_mcu_rows != 0) {
+    jpegFail((j_common_ptr) dinfo, "Unsupported cipher stripe layout");
+  }
+  if (!cipherHeaderMatchesKey(header, key)) {
+    jpegFail((j_common_ptr) dinfo, "Wrong key for encrypted image");
+  }
+}
+
+} } } }
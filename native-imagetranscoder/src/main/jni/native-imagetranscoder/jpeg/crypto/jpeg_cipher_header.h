@@ -0,0 +1,95 @@
+#ifndef FRESCO_JPEG_CIPHER_HEADER_H
+#define FRESCO_JPEG_CIPHER_HEADER_H
+
+#include <stdint.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_crypto.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Describes how the coefficients of an image were encrypted.
+ *
+ * <p> Stored as CIPHER_MARKER, right after the CIPHER_MARKER_ID:
+ * <pre>
+ *   1 byte   version
+ *   1 byte   engine
+ *   2 bytes  stripe height in MCU rows, big endian, 0 for a single stripe
+ *   16 bytes key check, hex digits
+ *   1 byte   level, since version 2. Version 1 implies CIPHER_LEVEL_FULL
+ *   16 bytes salt of the key check, since version 3
+ * </pre>
+ *
+ * <p> Since version 3 the key check hashes a random salt of each image with
+ * the key, so images encrypted with the same key cannot be linked through
+ * their headers. Earlier versions used a fixed salt.
+ */
+struct CipherHeader {
+  uint8_t version;
+  uint8_t engine;
+  uint16_t stripe_mcu_rows;
+  char key_check[CIPHER_KEY_CHECK_LENGTH];
+  uint8_t level;
+  uint8_t salt[CIPHER_KEY_CHECK_SALT_LENGTH];
+};
+
+/**
+ * Fills the header for an image encrypted by given engine and level with
+ * given key, with a fresh salt.
+ */
+void initCipherHeader(
+    CipherHeader& header,
+    CipherEngine engine,
+    CipherLevel level,
+    const CryptoKey& key);
+
+/**
+ * Tells whether the header was produced with given key. This is a cheap
+ * test that does not touch any coefficients.
+ */
+bool cipherHeaderMatchesKey(
+    const CipherHeader& header,
+    const CryptoKey& key);
+
+/**
+ * Writes the header as CIPHER_MARKER. Has to be called after
+ * jpeg_write_coefficients.
+ */
+void writeCipherHeader(j_compress_ptr cinfo, const CipherHeader& header);
+
+/**
+ * Makes jpeg_read_header keep CIPHER_MARKER so it can be found by
+ * extractCipherHeader. Has to be called before jpeg_read_header.
+ */
+void saveCipherHeader(j_decompress_ptr dinfo);
+
+/**
+ * Looks up CIPHER_MARKER among saved markers and parses it. The marker is
+ * removed from the saved markers list so it is not copied to decrypted
+ * output.
+ *
+ * @return false if the image does not carry a valid cipher header
+ */
+bool extractCipherHeader(j_decompress_ptr dinfo, CipherHeader& header);
+
+/**
+ * Extracts the cipher header and validates it against the key, before any
+ * coefficient is read. Images encrypted before the header was introduced
+ * are assumed to use CIPHER_ENGINE_CHAOTIC_GMP.
+ *
+ * <p> Fails (via the error handler of dinfo) on a key mismatch or on a
+ * header this code does not understand.
+ */
+void checkCipherHeader(
+    j_decompress_ptr dinfo,
+    CipherHeader& header,
+    const CryptoKey& key);
+
+} } } }
+
+#endif //FRESCO_JPEG_CIPHER_HEADER_H
@@ -1,24 +1,24 @@
 #include <algorithm>
 #include <iterator>
+#include <vector>
 
 #include <stdio.h>
 #include <setjmp.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 extern "C" {
   #include "transupp.h"
 }
 #include <gmp.h>
+#include <limits.h>
 #include <math.h>
 #include <bitset>
 
 #include "decoded_image.h"
-#include "exceptions_handler.h"
 #include "logging.h"
+#include "jpeg/jpeg_cancellation.h"
 #include "jpeg/jpeg_error_handler.h"
 #include "jpeg/jpeg_memory_io.h"
-#include "jpeg/jpeg_stream_wrappers.h"
 #include "jpeg/jpeg_codec.h"
 #include "jpeg_crypto.h"
 #include "sha512.h"
@@ -75,6 +75,19 @@ void generateChaoticSequence(
   std::sort(chaotic_seq, chaotic_seq + n, &chaos_sorter);
 }
 
+static void next_logistic_map_val(
+    mpf_t output,
+    mpf_t x_n,
+    mpf_t mu,
+    mpf_t subtraction_part,
+    mpf_t multiplication_part) {
+  mpf_ui_sub(subtraction_part, 1, x_n);
+  mpf_mul(multiplication_part, mu, x_n);
+
+  //Performs: output = mu * x_n * (1 - x_n);
+  mpf_mul(output, multiplication_part, subtraction_part);
+}
+
 static void next_logistic_map_val(mpf_t output, mpf_t x_n, mpf_t mu) {
   mpf_t subtraction_part;
   mpf_t multiplication_part;
@@ -82,15 +95,72 @@ static void next_logistic_map_val(mpf_t output, mpf_t x_n, mpf_t mu) {
   mpf_init(subtraction_part);
   mpf_init(multiplication_part);
 
-  mpf_ui_sub(subtraction_part, 1, x_n);
-  mpf_mul(multiplication_part, mu, x_n);
-
-  //Performs: output = mu * x_n * (1 - x_n);
-  mpf_mul(output, multiplication_part, subtraction_part);
+  next_logistic_map_val(output, x_n, mu, subtraction_part, multiplication_part);
 
   mpf_clears(subtraction_part, multiplication_part, NULL);
 }
 
+/**
+ * Sorts the sequence like std::sort with chaos_gmp_sorter would, without
+ * calling mpf_cmp on scattered limbs for every comparison.
+ *
+ * <p> For non negative values mpf_cmp reduces to comparing exponents and
+ * then limbs, most significant first. Those are copied once into fixed width
+ * keys laid out next to each other, an index array is sorted on them and the
+ * entries are then moved into place. Ties are broken on chaos_pos, so the
+ * order is exactly the one of chaos_gmp_sorter.
+ */
+static void sort_chaotic_sequence(struct chaos_dc *chaotic_seq, int n) {
+  int key_limbs = 0;
+  for (int i = 0; i < n; i++) {
+    const int size = chaotic_seq[i].chaos_gmp->_mp_size;
+    if (size < 0) {
+      // logistic map values stay in [0, 1], this is not expected
+      std::sort(chaotic_seq, chaotic_seq + n, &chaos_gmp_sorter);
+      return;
+    }
+    if (size > key_limbs) {
+      key_limbs = size;
+    }
+  }
+
+  std::vector<mp_exp_t> exponents(n);
+  std::vector<mp_limb_t> limbs((size_t) n * key_limbs, 0);
+  std::vector<unsigned int> positions(n);
+  std::vector<int> order(n);
+  for (int i = 0; i < n; i++) {
+    const __mpf_struct *value = chaotic_seq[i].chaos_gmp;
+    mp_limb_t *key = &limbs[(size_t) i * key_limbs];
+    // zero has no limbs and has to come before every positive value
+    exponents[i] = value->_mp_size == 0 ? LONG_MIN : value->_mp_exp;
+    for (int l = 0; l < value->_mp_size; l++) {
+      key[l] = value->_mp_d[value->_mp_size - 1 - l];
+    }
+    positions[i] = chaotic_seq[i].chaos_pos;
+    order[i] = i;
+  }
+
+  std::sort(order.begin(), order.end(), [&](int left, int right) {
+    if (exponents[left] != exponents[right]) {
+      return exponents[left] < exponents[right];
+    }
+    const mp_limb_t *left_key = &limbs[(size_t) left * key_limbs];
+    const mp_limb_t *right_key = &limbs[(size_t) right * key_limbs];
+    for (int l = 0; l < key_limbs; l++) {
+      if (left_key[l] != right_key[l]) {
+        return left_key[l] < right_key[l];
+      }
+    }
+    return positions[left] < positions[right];
+  });
+
+  std::vector<struct chaos_dc> sorted(n);
+  for (int i = 0; i < n; i++) {
+    sorted[i] = chaotic_seq[order[i]];
+  }
+  std::copy(sorted.begin(), sorted.end(), chaotic_seq);
+}
+
 static bool should_flip_sign(mpf_t chaos_gmp) {
   mp_exp_t exponent;
   char *mpf_val;
@@ -125,8 +195,16 @@ static void generate_sign_flips(mpf_t x_0, mpf_t mu, bool *sign_flips, int n) {
   free(mpf_val_x_0);
   free(mpf_val_mu);
 
+  // Every new hash covers everything appended so far. Keep a running
+  // digest of concat_hashes and finalize copies of it, instead of hashing
+  // the whole (ever growing) string again each time
+  sw::sha512 running_hash;
+  running_hash.update(concat_hashes.data(), concat_hashes.size());
   while (concat_hashes.size() < n) {
-    concat_hashes.append(sw::sha512::calculate(concat_hashes));
+    sw::sha512 prefix_hash(running_hash);
+    const std::string next_hash = prefix_hash.final_data();
+    running_hash.update(next_hash.data(), next_hash.size());
+    concat_hashes.append(next_hash);
   }
 
   for (int i = 0; i < n; i++) {
@@ -150,10 +228,17 @@ void gen_chaotic_sequence(
   }
   generate_sign_flips(x_0, mu, sign_flips, n);
 
+  // temporaries of the logistic map, shared by the whole sequence
+  mpf_t subtraction_part;
+  mpf_t multiplication_part;
+  mpf_init(subtraction_part);
+  mpf_init(multiplication_part);
+
   mpf_init(chaotic_seq[0].chaos_gmp);
 
   // chaotic_seq[0].chaos_gmp = mu * x_0 * (1 - x_0);
-  next_logistic_map_val(chaotic_seq[0].chaos_gmp, x_0, mu);
+  next_logistic_map_val(
+      chaotic_seq[0].chaos_gmp, x_0, mu, subtraction_part, multiplication_part);
   chaotic_seq[0].chaos_pos = 0;
 
   chaotic_seq[0].flip_sign = sign_flips[0];
@@ -161,17 +246,24 @@ void gen_chaotic_sequence(
   for (int i = 1; i < n; i++) {
     // x_n = chaotic_seq[i - 1].chaos_gmp
     mpf_init(chaotic_seq[i].chaos_gmp);
-    next_logistic_map_val(chaotic_seq[i].chaos_gmp, chaotic_seq[i - 1].chaos_gmp, mu);
+    next_logistic_map_val(
+        chaotic_seq[i].chaos_gmp,
+        chaotic_seq[i - 1].chaos_gmp,
+        mu,
+        subtraction_part,
+        multiplication_part);
 
     chaotic_seq[i].chaos_pos = i;
 
     chaotic_seq[i].flip_sign = sign_flips[i];
   }
 
+  mpf_clears(subtraction_part, multiplication_part, NULL);
+
   // Order the sequence in ascending order based on the chaotic value
   // Each value's original position is maintained via the chaotic_pos member
   if (sort)
-    std::sort(chaotic_seq, chaotic_seq + n, &chaos_gmp_sorter);
+    sort_chaotic_sequence(chaotic_seq, n);
   free(sign_flips);
 }
 
@@ -363,13 +455,11 @@ void diffuseACs(
   mpf_clears(dc_coeff, alpha_part, dc_alpha_part, beta_part, xor_component_mpf, NULL);
 }
 
-void diffuseACsFlipSigns(
+void generateACSignFlips(
     j_decompress_ptr dinfo,
-    jvirt_barray_ptr* src_coefs,
     mpf_t x_0,
     mpf_t mu,
-    mpf_t alpha,
-    mpf_t beta) {
+    std::vector<std::vector<uint64_t>>& sign_flips) {
 
   char *mpf_val_x_0;
   char *mpf_val_mu;
@@ -380,7 +470,7 @@ void diffuseACsFlipSigns(
   mpf_val_x_0 = mpf_get_str(NULL, &exponent, 10, 500, x_0);
   mpf_val_mu = mpf_get_str(NULL, &exponent, 10, 500, mu);
 
-  LOGD("diffuseACsFlipSigns x_0=%s, mu=%s", mpf_val_x_0, mpf_val_mu);
+  LOGD("generateACSignFlips x_0=%s, mu=%s", mpf_val_x_0, mpf_val_mu);
   // 256 bytes
   concat_hashes.append(sw::sha512::calculate(mpf_val_x_0));
   concat_hashes.append(sw::sha512::calculate(mpf_val_mu));
@@ -390,16 +480,12 @@ void diffuseACsFlipSigns(
   free(mpf_val_x_0);
   free(mpf_val_mu);
 
-  LOGD("diffuseACsFlipSigns alpha=%lf, beta=%lf", mpf_get_d(alpha), mpf_get_d(beta));
+  sign_flips.resize(dinfo->num_components);
 
   for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
     jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
-    unsigned int width = comp_info->width_in_blocks;
-    unsigned int height = comp_info->height_in_blocks;
-    unsigned int n_coefficients = comp_info->width_in_blocks * DCTSIZE2;
-
-    unsigned int non_zero_ac_count = 0;
-    unsigned int ac_flips = 0;
+    unsigned int n_blocks = comp_info->width_in_blocks * comp_info->height_in_blocks;
+    std::vector<uint64_t>& comp_flips = sign_flips[comp_i];
     randctx ctx;
 
     // Initialize ISAAC seed
@@ -409,6 +495,47 @@ void diffuseACsFlipSigns(
     }
     randinit(&ctx, 1);
 
+    comp_flips.assign(n_blocks, 0);
+
+    // Note: isaac_i carries over from one component to the next
+    for (unsigned int block_i = 0; block_i < n_blocks; block_i++) {
+      if (isaac_i % 2048 == 0) {
+        isaac(&ctx);
+      }
+
+      for (int i = 1; i < DCTSIZE2; i++) {
+        isaac_i++;
+        if (std::bitset<8>(ctx.randrsl[isaac_i % 256]).test(isaac_i % 8)) {
+          comp_flips[block_i] |= (uint64_t) 1 << i;
+        }
+      }
+    }
+  }
+}
+
+void diffuseACsFlipSigns(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    mpf_t x_0,
+    mpf_t mu,
+    mpf_t alpha,
+    mpf_t beta) {
+  std::vector<std::vector<uint64_t>> sign_flips;
+
+  LOGD("diffuseACsFlipSigns alpha=%lf, beta=%lf", mpf_get_d(alpha), mpf_get_d(beta));
+
+  generateACSignFlips(dinfo, x_0, mu, sign_flips);
+
+  for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    if (isCurrentOperationCancelled()) {
+      return;
+    }
+    jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
+    const uint64_t *comp_flips = sign_flips[comp_i].data();
+
+    unsigned int non_zero_ac_count = 0;
+    unsigned int ac_flips = 0;
+
     LOGD("diffuseACsFlipSigns iterating over image component %d (comp_info->height_in_blocks=%d)", comp_i, comp_info->height_in_blocks);
 
     for (int y = 0; y < comp_info->height_in_blocks; y++) {
@@ -421,21 +548,14 @@ void diffuseACsFlipSigns(
       mcu_buff = (dinfo->mem->access_virt_barray)((j_common_ptr)dinfo, src_coefs[comp_i], y, (JDIMENSION) 1, TRUE);
 
       for (int x = 0; x < comp_info->width_in_blocks; x++) {
-        JCOEFPTR mcu_ptr; // Pointer to 8x8 block of coefficients (I think)
-
-        mcu_ptr = mcu_buff[0][x];
-
-        if (isaac_i % 2048 == 0) {
-          isaac(&ctx);
-        }
+        JCOEFPTR mcu_ptr = mcu_buff[0][x];
+        const uint64_t block_flips = *comp_flips++;
 
         for (int i = 1; i < DCTSIZE2; i++) {
-          isaac_i++;
           if (mcu_ptr[i] == 0)
            continue;
 
-          //LOGD("diffuseACsFlipSigns %d / %d", isaac_i % 256, isaac_i % 8);
-          if (std::bitset<8>(ctx.randrsl[isaac_i % 256]).test(isaac_i % 8)) {
+          if ((block_flips >> i) & 1) {
             mcu_ptr[i] *= -1;
             ac_flips++;
           }
@@ -1,6 +1,11 @@
 #ifndef FRESCO_JPEG_CRYPTO_H
 #define FRESCO_JPEG_CRYPTO_H
 
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
 #include <gmp.h>
 
 namespace facebook {
@@ -8,11 +13,85 @@ namespace imagepipeline {
 namespace jpeg {
 namespace crypto {
 
+/**
+ * Key of the chaotic cipher: the initial value x_0 and the control parameter
+ * mu of the logistic map, as the bytes of their decimal representations.
+ * The AC sign diffusion is seeded from 16 digits near the end of each, so
+ * both are expected to be at least 19 bytes long.
+ */
+struct CryptoKey {
+  std::string x_0;
+  std::string mu;
+};
+
 const float SCALE_MIN_X = 0.0;
 const float SCALE_MAX_X = 1.0;
 const float SCALE_MIN_MU = 3.57;
 const float SCALE_MAX_MU = 4.0;
 
+/**
+ * APPn marker holding the encrypted thumbnail written by encryptJpeg.
+ * The marker payload starts with THUMBNAIL_MARKER_ID (including its
+ * trailing 0 character) followed by the encrypted thumbnail jpeg.
+ */
+const int THUMBNAIL_MARKER = JPEG_APP0 + 10;
+const char* const THUMBNAIL_MARKER_ID = "FBCRYPTO-THUMB";
+const unsigned int THUMBNAIL_MARKER_ID_LENGTH = 15;
+
+/**
+ * The upper bound for the encrypted thumbnail stored in a single marker
+ */
+const unsigned int THUMBNAIL_MARKER_LIMIT =
+    0xFFFF - 2 - THUMBNAIL_MARKER_ID_LENGTH;
+
+/**
+ * APPn marker describing how an image was encrypted, see CipherHeader.
+ * The marker payload starts with CIPHER_MARKER_ID (including its trailing
+ * 0 character).
+ */
+const int CIPHER_MARKER = JPEG_APP0 + 11;
+const char* const CIPHER_MARKER_ID = "FBCRYPTO-CIPHER";
+const unsigned int CIPHER_MARKER_ID_LENGTH = 16;
+
+/**
+ * Version of the cipher header layout. Images encrypted before the header
+ * was introduced do not carry a header at all.
+ */
+const uint8_t CIPHER_VERSION = 3;
+
+/**
+ * Number of sha512 hex digits of the key stored in the cipher header
+ */
+const unsigned int CIPHER_KEY_CHECK_LENGTH = 16;
+
+/**
+ * Number of random bytes hashed with the key into the key check, since
+ * version 3
+ */
+const unsigned int CIPHER_KEY_CHECK_SALT_LENGTH = 16;
+
+/**
+ * Coefficient pipelines the decryptor knows how to invert
+ */
+enum CipherEngine : uint8_t {
+  // permuteDCsSimple, diffuseACsFlipSigns, permuteMCUs over the whole image
+  CIPHER_ENGINE_CHAOTIC_GMP = 1,
+};
+
+/**
+ * How much of the coefficient pipeline is run. Each level is a prefix of
+ * the next one: cheaper levels leave more of the image structure visible
+ * but encrypt faster and inflate the output less.
+ */
+enum CipherLevel : uint8_t {
+  // permuteDCsSimple
+  CIPHER_LEVEL_DC = 1,
+  // permuteDCsSimple, diffuseACsFlipSigns
+  CIPHER_LEVEL_DC_SIGNS = 2,
+  // permuteDCsSimple, diffuseACsFlipSigns, permuteMCUs
+  CIPHER_LEVEL_FULL = 3,
+};
+
 #define BLOCK_WIDTH 8
 #define BLOCK_HEIGHT 8
 #define PIXELS_PER_BLOCK 64
@@ -81,6 +160,17 @@ void diffuseACs(
     mpf_t beta,
     bool encrypt);
 
+/**
+ * Computes the AC signs flipped by diffuseACsFlipSigns, one 64 bit mask per
+ * block (bit i set when coefficient i is flipped), one vector per component.
+ * The masks only depend on the key and on the block position.
+ */
+void generateACSignFlips(
+    j_decompress_ptr dinfo,
+    mpf_t x_0,
+    mpf_t mu,
+    std::vector<std::vector<uint64_t>>& sign_flips);
+
 void diffuseACsFlipSigns(
     j_decompress_ptr dinfo,
     jvirt_barray_ptr* src_coefs,
@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_crypto_stats.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+static int64_t readClockNanos(clockid_t clock) {
+  struct timespec now;
+  clock_gettime(clock, &now);
+  return (int64_t) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+CryptoStageTimer::CryptoStageTimer(CryptoStats* stats, CryptoStage stage)
+    : stats_(stats), stage_(stage), wall_start_ns_(0), cpu_start_ns_(0) {
+  if (stats_ != nullptr) {
+    wall_start_ns_ = readClockNanos(CLOCK_MONOTONIC);
+    cpu_start_ns_ = readClockNanos(CLOCK_THREAD_CPUTIME_ID);
+  }
+}
+
+CryptoStageTimer::~CryptoStageTimer() {
+  if (stats_ != nullptr) {
+    stats_->wall_ns[stage_] += readClockNanos(CLOCK_MONOTONIC) - wall_start_ns_;
+    stats_->cpu_ns[stage_] += readClockNanos(CLOCK_THREAD_CPUTIME_ID) - cpu_start_ns_;
+  }
+}
+
+/**
+ * Hands the read position over to the wrapped source and makes it the
+ * source of dinfo, as its callbacks expect.
+ *
+ * <p> libjpeg does not update the read position before asking for more
+ * data, so bytes are counted as they are handed to libjpeg instead.
+ */
+static StatsSource* enterWrappedSource(j_decompress_ptr dinfo) {
+  StatsSource* src = (StatsSource*) dinfo->src;
+  src->wrapped->next_input_byte = src->public_fields.next_input_byte;
+  src->wrapped->bytes_in_buffer = src->public_fields.bytes_in_buffer;
+  dinfo->src = src->wrapped;
+  return src;
+}
+
+static void leaveWrappedSource(j_decompress_ptr dinfo, StatsSource* src) {
+  dinfo->src = &src->public_fields;
+  src->public_fields.next_input_byte = src->wrapped->next_input_byte;
+  src->public_fields.bytes_in_buffer = src->wrapped->bytes_in_buffer;
+}
+
+static void statsInitSource(j_decompress_ptr dinfo) {
+  StatsSource* src = enterWrappedSource(dinfo);
+  CryptoStageTimer timer{src->stats, CRYPTO_STAGE_STREAM_IO};
+  src->wrapped->init_source(dinfo);
+  leaveWrappedSource(dinfo, src);
+  src->delivered = src->public_fields.bytes_in_buffer;
+}
+
+static boolean statsFillInputBuffer(j_decompress_ptr dinfo) {
+  StatsSource* src = enterWrappedSource(dinfo);
+  CryptoStageTimer timer{src->stats, CRYPTO_STAGE_STREAM_IO};
+  const boolean result = src->wrapped->fill_input_buffer(dinfo);
+  leaveWrappedSource(dinfo, src);
+  src->delivered += src->public_fields.bytes_in_buffer;
+  return result;
+}
+
+static void statsSkipInputData(j_decompress_ptr dinfo, long num_bytes) {
+  StatsSource* src = enterWrappedSource(dinfo);
+  CryptoStageTimer timer{src->stats, CRYPTO_STAGE_STREAM_IO};
+  const size_t bytes_in_buffer = src->public_fields.bytes_in_buffer;
+  src->wrapped->skip_input_data(dinfo, num_bytes);
+  leaveWrappedSource(dinfo, src);
+  // bytes skipped past the buffer, plus any the source read in
+  if (num_bytes > 0) {
+    src->delivered += num_bytes - bytes_in_buffer + src->public_fields.bytes_in_buffer;
+  }
+}
+
+/**
+ * Unlike the other callbacks, resync_to_restart is generic code reading
+ * through dinfo->src, e.g. jpeg_resync_to_restart, so it runs on this
+ * source to count the data it reads.
+ */
+static boolean statsResyncToRestart(j_decompress_ptr dinfo, int desired) {
+  StatsSource* src = (StatsSource*) dinfo->src;
+  return src->wrapped->resync_to_restart(dinfo, desired);
+}
+
+static void statsTermSource(j_decompress_ptr dinfo) {
+  StatsSource* src = enterWrappedSource(dinfo);
+  CryptoStageTimer timer{src->stats, CRYPTO_STAGE_STREAM_IO};
+  src->wrapped->term_source(dinfo);
+  leaveWrappedSource(dinfo, src);
+}
+
+StatsSource::StatsSource(
+    struct jpeg_source_mgr& wrapped,
+    CryptoStats* stats)
+    : wrapped(&wrapped), stats(stats), delivered(wrapped.bytes_in_buffer) {
+  public_fields.init_source = statsInitSource;
+  public_fields.fill_input_buffer = statsFillInputBuffer;
+  public_fields.skip_input_data = statsSkipInputData;
+  public_fields.resync_to_restart = statsResyncToRestart;
+  public_fields.term_source = statsTermSource;
+  public_fields.next_input_byte = wrapped.next_input_byte;
+  public_fields.bytes_in_buffer = wrapped.bytes_in_buffer;
+}
+
+size_t StatsSource::bytesConsumed() const {
+  return delivered - public_fields.bytes_in_buffer;
+}
+
+/**
+ * Hands the write position over to the wrapped destination and makes it
+ * the destination of cinfo, as its callbacks expect.
+ */
+static StatsDestination* enterWrappedDestination(j_compress_ptr cinfo) {
+  StatsDestination* dest = (StatsDestination*) cinfo->dest;
+  dest->wrapped->next_output_byte = dest->public_fields.next_output_byte;
+  dest->wrapped->free_in_buffer = dest->public_fields.free_in_buffer;
+  cinfo->dest = dest->wrapped;
+  return dest;
+}
+
+static void leaveWrappedDestination(j_compress_ptr cinfo, StatsDestination* dest) {
+  cinfo->dest = &dest->public_fields;
+  dest->public_fields.next_output_byte = dest->wrapped->next_output_byte;
+  dest->public_fields.free_in_buffer = dest->wrapped->free_in_buffer;
+  dest->buffer_size = dest->public_fields.free_in_buffer;
+}
+
+static void statsInitDestination(j_compress_ptr cinfo) {
+  StatsDestination* dest = enterWrappedDestination(cinfo);
+  CryptoStageTimer timer{dest->stats, CRYPTO_STAGE_STREAM_IO};
+  dest->wrapped->init_destination(cinfo);
+  leaveWrappedDestination(cinfo, dest);
+}
+
+/**
+ * The whole buffer is written out, libjpeg does not update the write
+ * position before it asks to.
+ */
+static boolean statsEmptyOutputBuffer(j_compress_ptr cinfo) {
+  StatsDestination* dest = enterWrappedDestination(cinfo);
+  dest->written += dest->buffer_size;
+  CryptoStageTimer timer{dest->stats, CRYPTO_STAGE_STREAM_IO};
+  const boolean result = dest->wrapped->empty_output_buffer(cinfo);
+  leaveWrappedDestination(cinfo, dest);
+  return result;
+}
+
+static void statsTermDestination(j_compress_ptr cinfo) {
+  StatsDestination* dest = enterWrappedDestination(cinfo);
+  dest->written += dest->buffer_size - dest->public_fields.free_in_buffer;
+  CryptoStageTimer timer{dest->stats, CRYPTO_STAGE_STREAM_IO};
+  dest->wrapped->term_destination(cinfo);
+  leaveWrappedDestination(cinfo, dest);
+}
+
+StatsDestination::StatsDestination(
+    struct jpeg_destination_mgr& wrapped,
+    CryptoStats* stats)
+    : wrapped(&wrapped), stats(stats), written(0), buffer_size(0) {
+  public_fields.init_destination = statsInitDestination;
+  public_fields.empty_output_buffer = statsEmptyOutputBuffer;
+  public_fields.term_destination = statsTermDestination;
+  public_fields.next_output_byte = nullptr;
+  public_fields.free_in_buffer = 0;
+}
+
+size_t StatsDestination::bytesWritten() const {
+  return written;
+}
+
+int64_t countBlocks(j_decompress_ptr dinfo) {
+  int64_t blocks = 0;
+  for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
+    blocks += (int64_t) comp_info->width_in_blocks * comp_info->height_in_blocks;
+  }
+  return blocks;
+}
+
+} } } }
@@ -0,0 +1,136 @@
+#ifndef FRESCO_JPEG_CRYPTO_STATS_H
+#define FRESCO_JPEG_CRYPTO_STATS_H
+
+#include <type_traits>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Stages of encrypting / decrypting an image. Keep in sync with the STAGE_*
+ * constants of NativeJpegCryptoStats.
+ */
+enum CryptoStage {
+  CRYPTO_STAGE_READ_HEADER = 0,
+  CRYPTO_STAGE_READ_COEFFICIENTS = 1,
+  CRYPTO_STAGE_THUMBNAIL = 2,
+  CRYPTO_STAGE_DC_PERMUTATION = 3,
+  CRYPTO_STAGE_AC_SIGNS = 4,
+  CRYPTO_STAGE_BLOCK_PERMUTATION = 5,
+  CRYPTO_STAGE_WRITE_COEFFICIENTS = 6,
+  CRYPTO_STAGE_STREAM_IO = 7,
+  CRYPTO_STAGE_COUNT = 8,
+};
+
+/**
+ * Timings and counters of one encryption / decryption.
+ *
+ * <p> libjpeg reads and writes the stream from within the other stages, so
+ * the time spent in CRYPTO_STAGE_STREAM_IO is also part of the stage it
+ * happened in.
+ */
+struct CryptoStats {
+  int64_t wall_ns[CRYPTO_STAGE_COUNT] = {};
+  int64_t cpu_ns[CRYPTO_STAGE_COUNT] = {};
+  int64_t bytes_in = 0;
+  int64_t bytes_out = 0;
+  int64_t blocks = 0;
+  int64_t peak_memory = 0;
+};
+
+/**
+ * Adds the wall and thread cpu time of its scope to a stage. Does nothing
+ * if stats is null.
+ */
+class CryptoStageTimer {
+ public:
+  CryptoStageTimer(CryptoStats* stats, CryptoStage stage);
+  ~CryptoStageTimer();
+
+ private:
+  CryptoStats* stats_;
+  CryptoStage stage_;
+  int64_t wall_start_ns_;
+  int64_t cpu_start_ns_;
+};
+
+/**
+ * Source manager forwarding to another one, counting the bytes libjpeg
+ * consumes and timing the reads as CRYPTO_STAGE_STREAM_IO.
+ *
+ * <p> This is not a c++ class because the only purpose of the handler is to
+ * be used with libjpeg which is a c library.
+ */
+struct StatsSource {
+  struct jpeg_source_mgr public_fields;
+  struct jpeg_source_mgr* wrapped;
+  CryptoStats* stats;
+  size_t delivered;
+
+  /**
+   * Wraps given source, which must outlive this one.
+   */
+  StatsSource(struct jpeg_source_mgr& wrapped, CryptoStats* stats);
+
+  /**
+   * Returns the bytes libjpeg consumed so far.
+   */
+  size_t bytesConsumed() const;
+};
+
+static_assert(
+    std::is_standard_layout<StatsSource>::value,
+    "StatsSource has to be type of standard layout");
+static_assert(
+    offsetof(StatsSource, public_fields) == 0,
+    "offset of StatsSource.public_fields should be 0");
+
+/**
+ * Destination manager forwarding to another one, counting the bytes libjpeg
+ * writes and timing the writes as CRYPTO_STAGE_STREAM_IO.
+ *
+ * <p> This is not a c++ class because the only purpose of the handler is to
+ * be used with libjpeg which is a c library.
+ */
+struct StatsDestination {
+  struct jpeg_destination_mgr public_fields;
+  struct jpeg_destination_mgr* wrapped;
+  CryptoStats* stats;
+  size_t written;
+  size_t buffer_size;
+
+  /**
+   * Wraps given destination, which must outlive this one.
+   */
+  StatsDestination(struct jpeg_destination_mgr& wrapped, CryptoStats* stats);
+
+  /**
+   * Returns the bytes handed to the wrapped destination, all of them once
+   * jpeg_finish_compress returned.
+   */
+  size_t bytesWritten() const;
+};
+
+static_assert(
+    std::is_standard_layout<StatsDestination>::value,
+    "StatsDestination has to be type of standard layout");
+static_assert(
+    offsetof(StatsDestination, public_fields) == 0,
+    "offset of StatsDestination.public_fields should be 0");
+
+/**
+ * Returns the 8x8 blocks of all components of the image.
+ */
+int64_t countBlocks(j_decompress_ptr dinfo);
+
+} } } }
+
+#endif //FRESCO_JPEG_CRYPTO_STATS_H
@@ -1,12 +1,13 @@
 #include <algorithm>
 #include <iterator>
 #include <random>
+#include <vector>
 
 #include <stdio.h>
+#include <string.h>
 #include <setjmp.h>
 #include <math.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 extern "C" {
   #include "transupp.h"
@@ -14,14 +15,17 @@ extern "C" {
 #include <gmp.h>
 
 #include "decoded_image.h"
-#include "exceptions_handler.h"
 #include "logging.h"
+#include "jpeg/jpeg_cancellation.h"
 #include "jpeg/jpeg_error_handler.h"
 #include "jpeg/jpeg_memory_io.h"
-#include "jpeg/jpeg_stream_wrappers.h"
+#include "jpeg/jpeg_memory_manager.h"
 #include "jpeg/jpeg_codec.h"
 #include "jpeg_crypto.h"
+#include "jpeg_cipher_header.h"
+#include "jpeg_crypto_stats.h"
 #include "jpeg_decrypt.h"
+#include "jpeg_thumbnail.h"
 
 namespace facebook {
 namespace imagepipeline {
@@ -202,12 +206,16 @@ static void decryptDCs(
 
   // Iterate over every DCT coefficient in the image, for every color component
   for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    if (isCurrentOperationCancelled()) {
+      return;
+    }
     jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
     struct chaos_dc *chaotic_seq;
     unsigned int width = comp_info->width_in_blocks;
     unsigned int height = comp_info->height_in_blocks;
     unsigned int n_blocks = width * height;
     struct chaos_pos_jcoefptr *chaos_op;
+    std::vector<JCOEF> blocks(n_blocks * DCTSIZE2);
     int block_i = 0;
 
     chaotic_seq = (struct chaos_dc *) malloc(n_blocks * sizeof(struct chaos_dc));
@@ -232,7 +240,7 @@ static void decryptDCs(
       mcu_buff = (dinfo->mem->access_virt_barray)((j_common_ptr) dinfo, src_coefs[comp_i], y, (JDIMENSION) 1, TRUE);
 
       for (int x = 0; x < width; x++) {
-        chaos_op[block_i].dc = mcu_buff[0][x][0];
+        std::copy(mcu_buff[0][x], mcu_buff[0][x] + DCTSIZE2, &blocks[block_i * DCTSIZE2]);
         chaos_op[block_i].chaos_pos = chaotic_seq[block_i].chaos_pos;
 
         block_i++;
@@ -248,7 +256,11 @@ static void decryptDCs(
 
       for (int x = 0; x < width; x++) {
         unsigned int dest_pos = chaos_op[block_i].chaos_pos;
-        mcu_buff[0][x][0] = chaos_op[dest_pos].dc;
+        // permuteDCsSimple moves whole blocks, so the ACs have to come back too
+        std::copy(
+            &blocks[dest_pos * DCTSIZE2],
+            &blocks[dest_pos * DCTSIZE2] + DCTSIZE2,
+            mcu_buff[0][x]);
 
         if (chaotic_seq[dest_pos].flip_sign)
           mcu_buff[0][x][0] *= -1;
@@ -263,7 +275,7 @@ end_loop:
       free(chaos_op);
     }
 
-    for (int i; i < n_blocks; i++) {
+    for (int i = 0; i < n_blocks; i++) {
       mpf_clear(chaotic_seq[i].chaos_gmp);
     }
 
@@ -279,6 +291,9 @@ static void decryptMCUs(
 
   // Iterate over every DCT coefficient in the image, for every color component
   for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    if (isCurrentOperationCancelled()) {
+      return;
+    }
     jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
     struct chaos_dc *chaotic_seq;
     unsigned int width = comp_info->width_in_blocks;
@@ -356,7 +371,7 @@ end_loop:
       free(chaos_op);
     }
 
-    for (int i; i < n_blocks; i++) {
+    for (int i = 0; i < n_blocks; i++) {
       mpf_clear(chaotic_seq[i].chaos_gmp);
     }
 
@@ -508,81 +523,248 @@ end_row:
   }
 }
 
-void decryptJpeg(
-    JNIEnv *env,
-    jobject is,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr) {
-  JpegInputStreamWrapper is_wrapper{env, is};
-  JpegOutputStreamWrapper os_wrapper{env, os};
-  JpegErrorHandler error_handler{env};
-  struct jpeg_source_mgr& source = is_wrapper.public_fields;
-  struct jpeg_destination_mgr& destination = os_wrapper.public_fields;
+/**
+ * Inverts encryptCoefficients: undoes the block permutation, the AC sign
+ * diffusion and the DC permutation that were run for given level, using
+ * the key given as its decimal string form. Adds the time of every pass
+ * to stats, if not null.
+ *
+ * <p> Fails (via the error handler of dinfo) if the key cannot be parsed,
+ * or if the current cancellation token got cancelled. The passes only
+ * check it per image component.
+ */
+static void decryptCoefficients(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    CipherLevel level,
+    const CryptoKey& key,
+    CryptoStats* stats) {
   mpf_t x_0;
   mpf_t mu;
   mpf_t alpha;
   mpf_t beta;
-  jsize x_0_len = env->GetStringUTFLength(x_0_jstr);
-  jsize mu_len = env->GetStringUTFLength(mu_jstr);
-  const char *x_0_char = env->GetStringUTFChars(x_0_jstr, (jboolean *) 0);
-  const char *mu_char = env->GetStringUTFChars(mu_jstr, (jboolean *) 0);
+
+  jpegThrowIfCancelled((j_common_ptr) dinfo);
+  mpf_inits(x_0, mu, alpha, beta, NULL);
+
+  if (mpf_set_str(x_0, key.x_0.c_str(), 10) || mpf_set_str(mu, key.mu.c_str(), 10)) {
+    mpf_clears(x_0, mu, alpha, beta, NULL);
+    jpegFail((j_common_ptr) dinfo, "decryptCoefficients failed to parse key");
+  }
+
+  if (level >= CIPHER_LEVEL_FULL) {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_BLOCK_PERMUTATION};
+    decryptMCUs(dinfo, src_coefs, x_0, mu);
+  }
+
+  if (level >= CIPHER_LEVEL_DC_SIGNS) {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_AC_SIGNS};
+    //decryptNonZeroACs(dinfo, src_coefs, x_0, mu);
+    //decryptAllACs(dinfo, src_coefs, x_0, mu);
+    construct_alpha_beta(alpha, key.x_0.c_str() + (key.x_0.size() - 2 - 16 - 1), 16);
+    construct_alpha_beta(beta, key.mu.c_str() + (key.mu.size() - 1 - 16 - 1), 16);
+    //diffuseACs(dinfo, src_coefs, x_0, mu, alpha, beta, false);
+    diffuseACsFlipSigns(dinfo, src_coefs, x_0, mu, alpha, beta);
+  }
+
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_DC_PERMUTATION};
+    decryptDCs(dinfo, src_coefs, x_0, mu);
+  }
+
+  //decryptByColumn(dinfo, src_coefs, x_0, mu);
+  //decryptByRow(dinfo, src_coefs, x_0, mu);
+
+  mpf_clears(x_0, mu, alpha, beta, NULL);
+
+  // passes stop early once cancelled, the output is only thrown away here
+  // so the key is cleared first
+  jpegThrowIfCancelled((j_common_ptr) dinfo);
+}
+
+/**
+ * Runs the decryption pipeline matching the engine recorded in the header.
+ */
+static void decryptCoefficients(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    const CipherHeader& header,
+    const CryptoKey& key,
+    CryptoStats* stats) {
+  switch (header.engine) {
+    case CIPHER_ENGINE_CHAOTIC_GMP:
+      decryptCoefficients(
+          dinfo,
+          src_coefs,
+          (CipherLevel) header.level,
+          key,
+          stats);
+      break;
+    default:
+      jpegFail((j_common_ptr) dinfo, "Unsupported cipher engine");
+  }
+}
+
+/**
+ * Decrypts the coefficients read from source, adding timings and the block
+ * count to stats, if not null.
+ */
+static void decryptDCsACsMCUs(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    CryptoStats* stats) {
+  JpegErrorHandler error_handler{status};
+  CipherHeader header;
 
   if (setjmp(error_handler.setjmpBuffer)) {
     return;
   }
 
-  // prepare decompress struct
+  // prepare decompress struct, keeping the cipher header
   struct jpeg_decompress_struct dinfo;
-  initDecompressStruct(dinfo, error_handler, source);
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_READ_HEADER};
+    createDecompressStruct(dinfo, error_handler, source);
+    saveCipherHeader(&dinfo);
+    jpeg_read_header(&dinfo, true);
+  }
+
+  // reject a wrong key before doing any expensive work
+  checkCipherHeader(&dinfo, header, key);
 
   // create compress struct
   struct jpeg_compress_struct cinfo;
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
 
   // get DCT coefficients, 64 for 8x8 DCT blocks (first is DC, remaining 63 are AC?)
-  jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
+  jvirt_barray_ptr *src_coefs;
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_READ_COEFFICIENTS};
+    src_coefs = jpeg_read_coefficients(&dinfo);
+  }
+  if (stats != nullptr) {
+    stats->blocks = countBlocks(&dinfo);
+  }
 
   // initialize with default params, then copy the ones needed for lossless transcoding
   jpeg_copy_critical_parameters(&dinfo, &cinfo);
+
+  decryptCoefficients(&dinfo, src_coefs, header, key, stats);
+
+  CryptoStageTimer write_timer{stats, CRYPTO_STAGE_WRITE_COEFFICIENTS};
+  jpeg_write_coefficients(&cinfo, src_coefs);
+  // markers can only be written once jpeg_write_coefficients emitted SOI
   jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
 
-  if (mpf_init_set_str(x_0, x_0_char, 10)) {
-    LOGD("decryptJpeg failed to mpf_set_str(x_0)");
-    goto teardown;
+  LOGD("decryptJpeg finished");
+
+  // the entropy coding of the coefficients happens here
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+}
+
+void decryptJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    CryptoStats* stats) {
+  if (stats == nullptr) {
+    decryptDCsACsMCUs(status, source, destination, key, nullptr);
+    return;
   }
-  if (mpf_init_set_str(mu, mu_char, 10)) {
-    LOGD("decryptJpeg failed to mpf_set_str(mu)");
-    goto teardown;
+
+  StatsSource stats_source{source, stats};
+  StatsDestination stats_destination{destination, stats};
+  resetJpegMemoryPeak();
+  decryptDCsACsMCUs(
+      status,
+      stats_source.public_fields,
+      stats_destination.public_fields,
+      key,
+      stats);
+  stats->bytes_in = stats_source.bytesConsumed();
+  stats->bytes_out = stats_destination.bytesWritten();
+  stats->peak_memory = getJpegMemoryPeak();
+}
+
+/**
+ * Reads jpeg markers up to the first scan, checks the cipher header against
+ * the key and returns the payload of THUMBNAIL_MARKER, if present. The
+ * entropy coded data is never touched.
+ *
+ * @return false if it failed, with the error recorded in status
+ */
+static bool readThumbnailMarker(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    CipherHeader& header,
+    const CryptoKey& key,
+    std::vector<uint8_t>& thumbnail) {
+  JpegErrorHandler error_handler{status};
+
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
   }
 
-  mpf_inits(alpha, beta, NULL);
+  struct jpeg_decompress_struct dinfo;
+  createDecompressStruct(dinfo, error_handler, source);
+  saveCipherHeader(&dinfo);
+  jpeg_save_markers(&dinfo, THUMBNAIL_MARKER, 0xFFFF);
+  jpeg_read_header(&dinfo, true);
+
+  checkCipherHeader(&dinfo, header, key);
 
-  decryptMCUs(&dinfo, src_coefs, x_0, mu);
+  extractThumbnailMarker(&dinfo, thumbnail);
 
-  //decryptNonZeroACs(&dinfo, src_coefs, x_0, mu);
-  //decryptAllACs(&dinfo, src_coefs, x_0, mu);
-  construct_alpha_beta(alpha, x_0_char + (x_0_len - 2 - 16 - 1), 16);
-  construct_alpha_beta(beta, mu_char + (mu_len - 1 - 16 - 1), 16);
-  //diffuseACs(&dinfo, src_coefs, x_0, mu, alpha, beta, false);
-  diffuseACsFlipSigns(&dinfo, src_coefs, x_0, mu, alpha, beta);
+  jpeg_destroy_decompress(&dinfo);
+  return true;
+}
 
-  decryptDCs(&dinfo, src_coefs, x_0, mu);
+bool decryptJpegThumbnail(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key) {
+  JpegMemorySource mem_source;
+  JpegErrorHandler error_handler{status};
+  CipherHeader header;
+  std::vector<uint8_t> thumbnail;
 
-  //decryptByColumn(&dinfo, src_coefs, x_0, mu);
-  //decryptByRow(&dinfo, src_coefs, x_0, mu);
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
+  }
 
-  jpeg_write_coefficients(&cinfo, src_coefs);
+  if (!readThumbnailMarker(
+          status,
+          source,
+          header,
+          key,
+          thumbnail) ||
+      thumbnail.empty()) {
+    return false;
+  }
+  mem_source.setBuffer(std::move(thumbnail));
 
-  LOGD("decryptJpeg finished");
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(dinfo, error_handler, mem_source.public_fields);
 
-teardown:
-  env->ReleaseStringUTFChars(x_0_jstr, x_0_char);
-  env->ReleaseStringUTFChars(mu_jstr, mu_char);
-  mpf_clears(x_0, mu, alpha, beta, NULL);
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
+
+  jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
+  jpeg_copy_critical_parameters(&dinfo, &cinfo);
+
+  decryptCoefficients(&dinfo, src_coefs, header, key, nullptr);
+
+  jpeg_write_coefficients(&cinfo, src_coefs);
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
   jpeg_destroy_decompress(&dinfo);
+  return true;
 }
 
 static int unscramble_rgb(struct rgb_block **blocks,
@@ -738,22 +920,13 @@ static void do_decrypt_etc(
 }
 
 void decryptJpegEtc(
-    JNIEnv *env,
-    jobject is_red,
-    jobject is_green,
-    jobject is_blue,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr) {
-  JpegInputStreamWrapper is_wrapper_red{env, is_red};
-  JpegInputStreamWrapper is_wrapper_green{env, is_green};
-  JpegInputStreamWrapper is_wrapper_blue{env, is_blue};
-  JpegOutputStreamWrapper os_wrapper{env, os};
-  JpegErrorHandler error_handler{env};
-  struct jpeg_source_mgr& src_red = is_wrapper_red.public_fields;
-  struct jpeg_source_mgr& src_green = is_wrapper_green.public_fields;
-  struct jpeg_source_mgr& src_blue = is_wrapper_blue.public_fields;
-  struct jpeg_destination_mgr& dest = os_wrapper.public_fields;
+    JpegStatus& status,
+    struct jpeg_source_mgr& src_red,
+    struct jpeg_source_mgr& src_green,
+    struct jpeg_source_mgr& src_blue,
+    struct jpeg_destination_mgr& dest,
+    const CryptoKey& key) {
+  JpegErrorHandler error_handler{status};
   struct rgb_block **rgb_copy;
   struct jpeg_decompress_struct dinfo_red;
   struct jpeg_decompress_struct dinfo_green;
@@ -805,7 +978,7 @@ void decryptJpegEtc(
   do_decrypt_etc(&dinfo_red, &dinfo_green, &dinfo_blue, rgb_copy, rows, columns);
 
   // Decrypt done, write result out
-  initCompressStruct(cinfo, dinfo_red, error_handler, dest);
+  initCompressStruct(cinfo, dinfo_red, error_handler, dest, 0);
   cinfo.input_components = 3;
   cinfo.in_color_space = JCS_RGB;
   jpeg_set_defaults(&cinfo);
@@ -1,26 +1,55 @@
 #ifndef FRESCO_JPEG_DECRYPT_H
 #define FRESCO_JPEG_DECRYPT_H
 
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "jpeg/jpeg_status.h"
+#include "jpeg_crypto.h"
+#include "jpeg_crypto_stats.h"
+
 namespace facebook {
 namespace imagepipeline {
 namespace jpeg {
 namespace crypto {
 
+/**
+ * Decrypts a jpeg image encrypted by encryptJpeg, running the passes of the
+ * level recorded in its cipher header.
+ *
+ * @param status receives the error of a failed decryption, e.g. a wrong key
+ * @param stats if not null, filled with the timings and counters of the
+ *   decryption
+ */
 void decryptJpeg(
-    JNIEnv *env,
-    jobject is,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr);
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    CryptoStats* stats);
+
+/**
+ * Extracts and decrypts the thumbnail embedded by encryptJpeg.
+ *
+ * <p> Only the marker segments preceding the first scan are read from
+ * source.
+ *
+ * @return true if a thumbnail was found and written to destination
+ */
+bool decryptJpegThumbnail(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key);
 
 void decryptJpegEtc(
-    JNIEnv *env,
-    jobject is_red,
-    jobject is_green,
-    jobject is_blue,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr);
+    JpegStatus& status,
+    struct jpeg_source_mgr& src_red,
+    struct jpeg_source_mgr& src_green,
+    struct jpeg_source_mgr& src_blue,
+    struct jpeg_destination_mgr& dest,
+    const CryptoKey& key);
 
 } } } }
 #endif //FRESCO_JPEG_DECRYPT_H
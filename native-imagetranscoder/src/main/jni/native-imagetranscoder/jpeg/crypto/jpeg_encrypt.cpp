@@ -1,12 +1,12 @@
 #include <algorithm>
 #include <iterator>
 #include <random>
+#include <vector>
 
 #include <stdio.h>
 #include <setjmp.h>
 #include <math.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 extern "C" {
   #include "transupp.h"
@@ -14,14 +14,17 @@ extern "C" {
 #include <gmp.h>
 
 #include "decoded_image.h"
-#include "exceptions_handler.h"
 #include "logging.h"
+#include "jpeg/jpeg_cancellation.h"
 #include "jpeg/jpeg_error_handler.h"
 #include "jpeg/jpeg_memory_io.h"
-#include "jpeg/jpeg_stream_wrappers.h"
+#include "jpeg/jpeg_memory_manager.h"
 #include "jpeg/jpeg_codec.h"
 #include "jpeg_crypto.h"
+#include "jpeg_cipher_header.h"
+#include "jpeg_crypto_stats.h"
 #include "jpeg_encrypt.h"
+#include "jpeg_thumbnail.h"
 
 namespace facebook {
 namespace imagepipeline {
@@ -38,7 +41,7 @@ static void permuteDCGroup(
   struct chaos_dc chaos_dcs[num_blocks];
   int k = 0;
 
-  LOGD("permuteDCGroup num_blocks=%d, s_start=%d, s_end=%d", num_blocks, s_start, s_end);
+  LOGV("permuteDCGroup num_blocks=%d, s_start=%d, s_end=%d", num_blocks, s_start, s_end);
 
   // Permute the values in blocks mcu_buff[0][s_start, s_end]
   // according to the chaotic sequence.
@@ -50,13 +53,13 @@ static void permuteDCGroup(
     chaos_dcs[chaos_i].chaos = chaotic_seq[k].chaos;
     chaos_dcs[chaos_i].chaos_pos = chaotic_seq[k++].chaos_pos;
     chaos_dcs[chaos_i].dc = mcu_ptr[0];
-    LOGD("permuteDCGroup chaos_dc[%d].dc = %d", chaos_i, chaos_dcs[i].dc);
+    LOGV("permuteDCGroup chaos_dc[%d].dc = %d", chaos_i, chaos_dcs[i].dc);
   }
 
   std::sort(chaos_dcs, chaos_dcs + num_blocks, &chaos_pos_sorter);
 
   for (int i = 0; i < num_blocks; i++) {
-    LOGD("permuteDCGroup sorted chaos_dcs[%d]: pos=%u, chaos=%f, dc=%d", i, chaos_dcs[i].chaos_pos, chaos_dcs[i].chaos, chaos_dcs[i].dc);
+    LOGV("permuteDCGroup sorted chaos_dcs[%d]: pos=%u, chaos=%f, dc=%d", i, chaos_dcs[i].chaos_pos, chaos_dcs[i].chaos, chaos_dcs[i].dc);
     JCOEFPTR mcu_ptr = mcu_buff[0][i];
 
     mcu_ptr[0] = chaos_dcs[i].dc;
@@ -96,17 +99,17 @@ static void iterateDCs(
         JCOEFPTR mcu_ptr; // Pointer to 8x8 block of coefficients (I think)
 
         mcu_ptr = mcu_buff[0][x];
-        LOGD("iterateDCs horizontal_block_x=%d, DC=%d", x, mcu_ptr[0]);
+        LOGV("iterateDCs horizontal_block_x=%d, DC=%d", x, mcu_ptr[0]);
 
         if (s_end != 0 && !sameSign(mcu_ptr[0], mcu_buff[0][x - 1][0])) {
-          LOGD("iterateDCs sameSign inputs: %d, %d", mcu_ptr[0], mcu_buff[0][x - 1][0]);
+          LOGV("iterateDCs sameSign inputs: %d, %d", mcu_ptr[0], mcu_buff[0][x - 1][0]);
           // Permute same_sign_dcs then start the new group
           permuteDCGroup(mcu_buff, s_start, s_end, chaotic_seq, chaotic_seq_n);
 
           // Start the new group
           s_start = x;
           s_end = x;
-          LOGD("iterateDCs s_start=%d, s_end=%d", s_start, s_end);
+          LOGV("iterateDCs s_start=%d, s_end=%d", s_start, s_end);
         } else {
           s_end++;
         }
@@ -119,16 +122,12 @@ static void iterateDCs(
 }
 
 static void encryptJpegHe2018(
-    JNIEnv *env,
-    jobject is,
-    jobject os) {
-  JpegInputStreamWrapper is_wrapper{env, is};
-  JpegOutputStreamWrapper os_wrapper{env, os};
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination) {
   //JpegMemoryDestination mem_destination;
   //JpegMemorySource mem_source;
-  JpegErrorHandler error_handler{env};
-  struct jpeg_source_mgr& source = is_wrapper.public_fields;
-  struct jpeg_destination_mgr& destination = os_wrapper.public_fields;
+  JpegErrorHandler error_handler{status};
   struct chaos_dc *chaotic_seq;
   int n_blocks;
 
@@ -142,7 +141,7 @@ static void encryptJpegHe2018(
 
   // create compress struct
   struct jpeg_compress_struct cinfo;
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
 
   // get DCT coefficients, 64 for 8x8 DCT blocks (first is DC, remaining 63 are AC?)
   jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
@@ -368,13 +367,16 @@ static void permuteDCs(
   }
 }
 
-static void permuteDCsSimple(
+void permuteDCsSimple(
     j_decompress_ptr dinfo,
     jvirt_barray_ptr* src_coefs,
     mpf_t x_0,
     mpf_t mu) {
 
   for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    if (isCurrentOperationCancelled()) {
+      return;
+    }
     jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
     bool *sorted_blocks;
     struct chaos_dc *chaotic_seq;
@@ -465,7 +467,7 @@ static void permuteDCsSimple(
       }
     }
 
-    for (int i; i < n_blocks; i++) {
+    for (int i = 0; i < n_blocks; i++) {
       mpf_clear(chaotic_seq[i].chaos_gmp);
     }
 
@@ -474,13 +476,16 @@ static void permuteDCsSimple(
   }
 }
 
-static void permuteMCUs(
+void permuteMCUs(
     j_decompress_ptr dinfo,
     jvirt_barray_ptr* src_coefs,
     mpf_t x_0,
     mpf_t mu) {
 
   for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    if (isCurrentOperationCancelled()) {
+      return;
+    }
     jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
     bool *sorted_blocks;
     struct chaos_dc *chaotic_seq;
@@ -560,7 +565,7 @@ static void permuteMCUs(
       }
     }
 
-    for (int i; i < n_blocks; i++) {
+    for (int i = 0; i < n_blocks; i++) {
       mpf_clear(chaotic_seq[i].chaos_gmp);
     }
 
@@ -713,90 +718,187 @@ end_row:
   }
 }
 
-static void encryptDCsACsMCUs(
-    JNIEnv *env,
-    jobject is,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr) {
-  JpegInputStreamWrapper is_wrapper{env, is};
-  JpegOutputStreamWrapper os_wrapper{env, os};
-  JpegErrorHandler error_handler{env};
-  struct jpeg_source_mgr& source = is_wrapper.public_fields;
-  struct jpeg_destination_mgr& destination = os_wrapper.public_fields;
+/**
+ * Runs the DC permutation, AC sign diffusion and block permutation passes
+ * over the coefficients, up to given level, using the key given as its
+ * decimal string form. Adds the time of every pass to stats, if not null.
+ *
+ * <p> Fails (via the error handler of dinfo) if the key cannot be parsed,
+ * or if the current cancellation token got cancelled. The passes only
+ * check it per image component.
+ */
+static void encryptCoefficients(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    CipherLevel level,
+    const CryptoKey& key,
+    CryptoStats* stats) {
   mpf_t x_0;
   mpf_t mu;
   mpf_t alpha;
   mpf_t beta;
-  jsize x_0_len = env->GetStringUTFLength(x_0_jstr);
-  jsize mu_len = env->GetStringUTFLength(mu_jstr);
-  const char *x_0_char = env->GetStringUTFChars(x_0_jstr, (jboolean *) 0);
-  const char *mu_char = env->GetStringUTFChars(mu_jstr, (jboolean *) 0);
+
+  jpegThrowIfCancelled((j_common_ptr) dinfo);
+  mpf_inits(x_0, mu, alpha, beta, NULL);
+
+  if (mpf_set_str(x_0, key.x_0.c_str(), 10) || mpf_set_str(mu, key.mu.c_str(), 10)) {
+    mpf_clears(x_0, mu, alpha, beta, NULL);
+    jpegFail((j_common_ptr) dinfo, "encryptCoefficients failed to parse key");
+  }
+
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_DC_PERMUTATION};
+    permuteDCsSimple(dinfo, src_coefs, x_0, mu);
+    //permuteDCs(dinfo, src_coefs, x_0, mu);
+  }
+
+  //permuteNonZeroACs(dinfo, src_coefs, x_0, mu);
+  //permuteAllACs(dinfo, src_coefs, x_0, mu);
+
+  if (level >= CIPHER_LEVEL_DC_SIGNS) {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_AC_SIGNS};
+    construct_alpha_beta(alpha, key.x_0.c_str() + (key.x_0.size() - 2 - 16 - 1), 16);
+    construct_alpha_beta(beta, key.mu.c_str() + (key.mu.size() - 1 - 16 - 1), 16);
+    //diffuseACs(dinfo, src_coefs, x_0, mu, alpha, beta, true);
+    diffuseACsFlipSigns(dinfo, src_coefs, x_0, mu, alpha, beta);
+  }
+
+  if (level >= CIPHER_LEVEL_FULL) {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_BLOCK_PERMUTATION};
+    permuteMCUs(dinfo, src_coefs, x_0, mu);
+  }
+
+  //encryptByRow(dinfo, src_coefs, x_0, mu);
+  //encryptByColumn(dinfo, src_coefs, x_0, mu);
+
+  mpf_clears(x_0, mu, alpha, beta, NULL);
+
+  // passes stop early once cancelled, the output is only thrown away here
+  // so the key is cleared first
+  jpegThrowIfCancelled((j_common_ptr) dinfo);
+}
+
+/**
+ * Encrypts an in-memory jpeg with the same passes as the full image.
+ *
+ * @return false if it failed, with the error recorded in status
+ */
+static bool encryptJpegBuffer(
+    JpegStatus& status,
+    std::vector<uint8_t>&& input,
+    std::vector<uint8_t>& output,
+    CipherLevel level,
+    const CryptoKey& key) {
+  JpegMemorySource mem_source;
+  JpegMemoryDestination mem_destination;
+  JpegErrorHandler error_handler{status};
+
+  mem_source.setBuffer(std::move(input));
 
   if (setjmp(error_handler.setjmpBuffer)) {
-    return;
+    return false;
   }
 
-  // prepare decompress struct
   struct jpeg_decompress_struct dinfo;
-  initDecompressStruct(dinfo, error_handler, source);
+  initDecompressStruct(dinfo, error_handler, mem_source.public_fields);
 
-  // create compress struct
   struct jpeg_compress_struct cinfo;
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
+  initCompressStruct(
+      cinfo, dinfo, error_handler, mem_destination.public_fields, 0);
 
-  // get DCT coefficients, 64 for 8x8 DCT blocks (first is DC, remaining 63 are AC?)
   jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
-
-  // initialize with default params, then copy the ones needed for lossless transcoding
   jpeg_copy_critical_parameters(&dinfo, &cinfo);
-  jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
 
-  if (mpf_init_set_str(x_0, x_0_char, 10)) {
-    LOGD("encryptDCsACsMCUs failed to mpf_set_str(x_0)");
-    goto teardown;
-  }
-  if (mpf_init_set_str(mu, mu_char, 10)) {
-    LOGD("encryptDCsACsMCUs failed to mpf_set_str(mu)");
-    goto teardown;
+  encryptCoefficients(
+      &dinfo, src_coefs, level, key, nullptr);
+
+  jpeg_write_coefficients(&cinfo, src_coefs);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+
+  output = std::move(mem_destination.buffer);
+  return true;
+}
+
+static void encryptDCsACsMCUs(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    CipherLevel level,
+    int thumbnail_max_dimension,
+    CryptoStats* stats) {
+  JpegErrorHandler error_handler{status};
+  std::vector<uint8_t> thumbnail;
+
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
   }
 
-  mpf_inits(alpha, beta, NULL);
+  // prepare decompress struct
+  struct jpeg_decompress_struct dinfo;
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_READ_HEADER};
+    initDecompressStruct(dinfo, error_handler, source);
+  }
 
-  permuteDCsSimple(&dinfo, src_coefs, x_0, mu);
-  //permuteDCs(&dinfo, src_coefs, x_0, mu);
+  // create compress struct
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
 
-  //permuteNonZeroACs(&dinfo, src_coefs, x_0, mu);
-  //permuteAllACs(&dinfo, src_coefs, x_0, mu);
+  // get DCT coefficients, 64 for 8x8 DCT blocks (first is DC, remaining 63 are AC?)
+  jvirt_barray_ptr *src_coefs;
+  {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_READ_COEFFICIENTS};
+    src_coefs = jpeg_read_coefficients(&dinfo);
+  }
+  if (stats != nullptr) {
+    stats->blocks = countBlocks(&dinfo);
+  }
 
-  construct_alpha_beta(alpha, x_0_char + (x_0_len - 2 - 16 - 1), 16);
-  construct_alpha_beta(beta, mu_char + (mu_len - 1 - 16 - 1), 16);
-  //diffuseACs(&dinfo, src_coefs, x_0, mu, alpha, beta, true);
-  diffuseACsFlipSigns(&dinfo, src_coefs, x_0, mu, alpha, beta);
+  // initialize with default params, then copy the ones needed for lossless transcoding
+  jpeg_copy_critical_parameters(&dinfo, &cinfo);
 
-  permuteMCUs(&dinfo, src_coefs, x_0, mu);
+  // The thumbnail has to be taken while the DC plane is still in the clear
+  if (thumbnail_max_dimension > 0) {
+    CryptoStageTimer timer{stats, CRYPTO_STAGE_THUMBNAIL};
+    std::vector<uint8_t> plain_thumbnail;
+    if (encodeDCThumbnail(status, &dinfo, src_coefs, thumbnail_max_dimension, plain_thumbnail)) {
+      encryptJpegBuffer(
+          status,
+          std::move(plain_thumbnail),
+          thumbnail,
+          level,
+          key);
+    }
+    jpegJumpOnFailure((j_common_ptr) &dinfo);
+  }
 
-  //encryptByRow(&dinfo, src_coefs, x_0, mu);
-  //encryptByColumn(&dinfo, src_coefs, x_0, mu);
+  encryptCoefficients(&dinfo, src_coefs, level, key, stats);
 
+  CryptoStageTimer write_timer{stats, CRYPTO_STAGE_WRITE_COEFFICIENTS};
   jpeg_write_coefficients(&cinfo, src_coefs);
+  // markers can only be written once jpeg_write_coefficients emitted SOI
+  jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
+
+  CipherHeader header;
+  initCipherHeader(header, CIPHER_ENGINE_CHAOTIC_GMP, level, key);
+  writeCipherHeader(&cinfo, header);
+  writeThumbnailMarker(&cinfo, thumbnail);
 
   LOGD("encryptDCsACsMCUs finished");
 
-teardown:
-  env->ReleaseStringUTFChars(x_0_jstr, x_0_char);
-  env->ReleaseStringUTFChars(mu_jstr, mu_char);
-  mpf_clears(x_0, mu, alpha, beta, NULL);
+  // the entropy coding of the coefficients happens here
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
   jpeg_destroy_decompress(&dinfo);
-
 }
 
 /////////////
 /////////////
 /////////////
-static void scramble_rgb(struct rgb_block **blocks,
+void scramble_rgb(struct rgb_block **blocks,
     unsigned int rows,
     unsigned int columns) {
 
@@ -858,7 +960,12 @@ static void scramble_rgb(struct rgb_block **blocks,
   LOGD("scramble_rgb finished");
 }
 
-static void do_encrypt_etc(j_decompress_ptr dinfo,
+/**
+ * Reads the rows of the image into rgb_copy and scrambles them.
+ *
+ * @return false if cancelled before all of the rows were read
+ */
+static bool do_encrypt_etc(j_decompress_ptr dinfo,
     struct rgb_block **rgb_copy,
     unsigned int rows,
     unsigned int columns) {
@@ -882,6 +989,10 @@ static void do_encrypt_etc(j_decompress_ptr dinfo,
     int read_lines;
     int line = dinfo->output_scanline;
 
+    if (isCurrentOperationCancelled()) {
+      return false;
+    }
+
     read_lines = jpeg_read_scanlines(dinfo, buffer, 1);
 
     if (read_lines != 1)
@@ -896,7 +1007,7 @@ static void do_encrypt_etc(j_decompress_ptr dinfo,
       int pixel_x = (i / dinfo->output_components) % BLOCK_WIDTH;
 
       if (block_x >= columns || block_y >= rows)
-        LOGD("do_encrypt_etc 1 (%d, %d) output_scanline=%d, line=%d / (%d, %d)", block_x, block_y, dinfo->output_scanline, line, pixel_x, pixel_y);
+        LOGV("do_encrypt_etc 1 (%d, %d) output_scanline=%d, line=%d / (%d, %d)", block_x, block_y, dinfo->output_scanline, line, pixel_x, pixel_y);
 
       rgb_copy[block_y][block_x].red[pixel_y][pixel_x] = *pixels++;
       rgb_copy[block_y][block_x].green[pixel_y][pixel_x] = *pixels++;
@@ -904,7 +1015,7 @@ static void do_encrypt_etc(j_decompress_ptr dinfo,
       pixels += (dinfo->output_components - 3); // Might be using RGBX so there's an extra byte
 
       if (block_x >= columns || block_y >= rows)
-        LOGD("do_encrypt_etc 2 (%d, %d) output_scanline=%d / (%d, %d)", block_x, block_y, dinfo->output_scanline, pixel_x, pixel_y);
+        LOGV("do_encrypt_etc 2 (%d, %d) output_scanline=%d / (%d, %d)", block_x, block_y, dinfo->output_scanline, pixel_x, pixel_y);
     }
   }
 
@@ -912,6 +1023,7 @@ static void do_encrypt_etc(j_decompress_ptr dinfo,
   scramble_rgb(rgb_copy, rows, columns);
 
   LOGD("do_encrypt_etc finished");
+  return true;
 }
 
 static void initialize_grayscale_compress(struct jpeg_compress_struct& cinfo,
@@ -921,7 +1033,7 @@ static void initialize_grayscale_compress(struct jpeg_compress_struct& cinfo,
     int rounded_width,
     int rounded_height,
     int quality) {
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
   // initialize with default params, then copy the ones needed for lossless transcoding
   //jpeg_copy_critical_parameters(&dinfo, &cinfo);
   //jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
@@ -937,23 +1049,14 @@ static void initialize_grayscale_compress(struct jpeg_compress_struct& cinfo,
 }
 
 static void encrypt_etc(
-    JNIEnv *env,
-    jobject is,
-    jobject os_red,
-    jobject os_green,
-    jobject os_blue,
-    jstring x_0_jstr,
-    jstring mu_jstr,
-    jint quality) {
-  JpegInputStreamWrapper is_wrapper{env, is};
-  JpegOutputStreamWrapper os_wrapper_red{env, os_red};
-  JpegOutputStreamWrapper os_wrapper_green{env, os_green};
-  JpegOutputStreamWrapper os_wrapper_blue{env, os_blue};
-  JpegErrorHandler error_handler{env};
-  struct jpeg_source_mgr& source = is_wrapper.public_fields;
-  struct jpeg_destination_mgr& dest_red = os_wrapper_red.public_fields;
-  struct jpeg_destination_mgr& dest_green = os_wrapper_green.public_fields;
-  struct jpeg_destination_mgr& dest_blue = os_wrapper_blue.public_fields;
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& dest_red,
+    struct jpeg_destination_mgr& dest_green,
+    struct jpeg_destination_mgr& dest_blue,
+    const CryptoKey& key,
+    int quality) {
+  JpegErrorHandler error_handler{status};
   struct rgb_block **rgb_copy;
   struct jpeg_decompress_struct dinfo;
   struct jpeg_compress_struct cinfo_red;
@@ -968,6 +1071,7 @@ static void encrypt_etc(
   JSAMPROW row_pointer[1];
   int rounded_width;
   int rounded_height;
+  bool cancelled = false;
 
   if (setjmp(error_handler.setjmpBuffer)) {
     return;
@@ -978,6 +1082,9 @@ static void encrypt_etc(
   dinfo.out_color_space = JCS_EXT_RGBX;
 
   jpeg_start_decompress(&dinfo);
+  // from here on cancellation is checked once per row instead, where the
+  // row buffers can be freed
+  dinfo.progress = nullptr;
 
   rounded_height = round_up_to_multiple(dinfo.output_height, 8);
   rounded_width = round_up_to_multiple(dinfo.output_width, 8);
@@ -998,13 +1105,21 @@ static void encrypt_etc(
     }
   }
 
-  do_encrypt_etc(&dinfo, rgb_copy, rows, columns);
+  if (!do_encrypt_etc(&dinfo, rgb_copy, rows, columns)) {
+    for (int i = 0; i < rows; ++i)
+      delete[] rgb_copy[i];
+    delete[] rgb_copy;
+    jpegThrowIfCancelled((j_common_ptr) &dinfo);
+  }
 
   // Now ready to write the output compressed JPEG
   // create compress struct
   initialize_grayscale_compress(cinfo_red, dinfo, error_handler, dest_red, rounded_width, rounded_height, quality);
   initialize_grayscale_compress(cinfo_green, dinfo, error_handler, dest_green, rounded_width, rounded_height, quality);
   initialize_grayscale_compress(cinfo_blue, dinfo, error_handler, dest_blue, rounded_width, rounded_height, quality);
+  cinfo_red.progress = nullptr;
+  cinfo_green.progress = nullptr;
+  cinfo_blue.progress = nullptr;
   jpeg_start_compress(&cinfo_red, TRUE);
   jpeg_start_compress(&cinfo_green, TRUE);
   jpeg_start_compress(&cinfo_blue, TRUE);
@@ -1027,6 +1142,11 @@ static void encrypt_etc(
     int block_y = cinfo_red.next_scanline / BLOCK_HEIGHT;
     int pixel_y = cinfo_red.next_scanline % BLOCK_HEIGHT;
 
+    if (isCurrentOperationCancelled()) {
+      cancelled = true;
+      break;
+    }
+
     for (int i = 0; i < row_stride; i++) {
       block_x = i / BLOCK_WIDTH;
       pixel_x = i % BLOCK_WIDTH;
@@ -1057,6 +1177,13 @@ teardown:
     free(g_row);
   if (b_row != NULL)
     free(b_row);
+  if (cancelled) {
+    jpeg_destroy_compress(&cinfo_red);
+    jpeg_destroy_compress(&cinfo_green);
+    jpeg_destroy_compress(&cinfo_blue);
+    // also destroys the decompress struct
+    jpegThrowIfCancelled((j_common_ptr) &dinfo);
+  }
   jpeg_finish_decompress(&dinfo);
   jpeg_destroy_decompress(&dinfo);
   jpeg_finish_compress(&cinfo_red);
@@ -1069,25 +1196,54 @@ teardown:
 
 
 void encryptJpeg(
-    JNIEnv *env,
-    jobject is,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr) {
-  //encryptJpegByRowAndColumn(env, is, os, x_0_jstr, mu_jstr);
-  encryptDCsACsMCUs(env, is, os, x_0_jstr, mu_jstr);
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    int level,
+    int thumbnail_max_dimension,
+    CryptoStats* stats) {
+  FAIL_AND_RETURN_IF(
+      level < CIPHER_LEVEL_DC || level > CIPHER_LEVEL_FULL,
+      "Unsupported encryption level");
+  if (stats == nullptr) {
+    //encryptJpegByRowAndColumn(status, is, os, key);
+    encryptDCsACsMCUs(
+        status,
+        source,
+        destination,
+        key,
+        (CipherLevel) level,
+        thumbnail_max_dimension,
+        nullptr);
+    return;
+  }
+
+  StatsSource stats_source{source, stats};
+  StatsDestination stats_destination{destination, stats};
+  resetJpegMemoryPeak();
+  encryptDCsACsMCUs(
+      status,
+      stats_source.public_fields,
+      stats_destination.public_fields,
+      key,
+      (CipherLevel) level,
+      thumbnail_max_dimension,
+      stats);
+  stats->bytes_in = stats_source.bytesConsumed();
+  stats->bytes_out = stats_destination.bytesWritten();
+  stats->peak_memory = getJpegMemoryPeak();
 }
 
 void encryptJpegEtc(
-    JNIEnv *env,
-    jobject is,
-    jobject os_red,
-    jobject os_green,
-    jobject os_blue,
-    jstring x_0_jstr,
-    jstring mu_jstr,
-    jint quality) {
-  encrypt_etc(env, is, os_red, os_green, os_blue, x_0_jstr, mu_jstr, quality);
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& dest_red,
+    struct jpeg_destination_mgr& dest_green,
+    struct jpeg_destination_mgr& dest_blue,
+    const CryptoKey& key,
+    int quality) {
+  encrypt_etc(status, source, dest_red, dest_green, dest_blue, key, quality);
 }
 
 } } } }
\ No newline at end of file
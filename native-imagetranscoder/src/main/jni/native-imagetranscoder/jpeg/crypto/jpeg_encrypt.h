@@ -2,29 +2,87 @@
 // Created by mauzel on 12/12/2019.
 //
 
-#ifndef FRESCO_JPEG_CRYPTO_H
-#define FRESCO_JPEG_CRYPTO_H
+#ifndef FRESCO_JPEG_ENCRYPT_H
+#define FRESCO_JPEG_ENCRYPT_H
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "jpeg/jpeg_status.h"
+#include "jpeg_crypto.h"
+#include "jpeg_crypto_stats.h"
+
 namespace facebook {
 namespace imagepipeline {
 namespace jpeg {
 namespace crypto {
 
+/**
+ * Encrypts jpeg image read from source in the DCT domain and writes it to
+ * destination.
+ *
+ * @param status receives the error of a failed encryption
+ * @param key key the coefficients are permuted and diffused with
+ * @param level one of CipherLevel, recorded in the cipher header so that
+ *   decryptJpeg runs the matching passes
+ * @param thumbnail_max_dimension if positive, a thumbnail no larger than
+ *   this is derived from the DC coefficients, encrypted with the same key
+ *   and stored in THUMBNAIL_MARKER. See decryptJpegThumbnail.
+ * @param stats if not null, filled with the timings and counters of the
+ *   encryption
+ */
 void encryptJpeg(
-    JNIEnv *env,
-    jobject is,
-    jobject os,
-    jstring x_0_jstr,
-    jstring mu_jstr);
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& key,
+    int level,
+    int thumbnail_max_dimension,
+    CryptoStats* stats);
 
 void encryptJpegEtc(
-    JNIEnv *env,
-    jobject is,
-    jobject os_red,
-    jobject os_green,
-    jobject os_blue,
-    jstring x_0_jstr,
-    jstring mu_jstr,
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& dest_red,
+    struct jpeg_destination_mgr& dest_green,
+    struct jpeg_destination_mgr& dest_blue,
+    const CryptoKey& key,
     int quality);
 
+/*
+ * The passes below are what encryptJpeg and encryptJpegEtc are made of,
+ * exposed so they can be benchmarked in isolation.
+ */
+
+/**
+ * Moves every block of each component to its position in the chaotic
+ * sequence of the key and flips the sign of some of the DCs.
+ */
+void permuteDCsSimple(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    mpf_t x_0,
+    mpf_t mu);
+
+/**
+ * Moves the ACs of every block of each component to the block at its
+ * position in the chaotic sequence of the key, leaving the DCs in place.
+ */
+void permuteMCUs(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    mpf_t x_0,
+    mpf_t mu);
+
+/**
+ * Shuffles the 8x8 pixel blocks of each color channel independently and
+ * swaps channels within blocks, for encryptJpegEtc.
+ */
+void scramble_rgb(
+    struct rgb_block **blocks,
+    unsigned int rows,
+    unsigned int columns);
+
 } } } }
-#endif //FRESCO_JPEG_CRYPTO_H
+#endif //FRESCO_JPEG_ENCRYPT_H
@@ -0,0 +1,224 @@
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include <jpeglib.h>
+
+#include "logging.h"
+#include "jpeg/jpeg_error_handler.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg_crypto.h"
+#include "jpeg_thumbnail.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Quality used to encode the thumbnail before it gets encrypted
+ */
+static const int kThumbnailQuality = 75;
+
+/**
+ * The DC coefficient is 8 times the mean of the (level shifted) samples
+ * of its block.
+ */
+static JSAMPLE dcToSample(JCOEF dc, UINT16 quant) {
+  const int value = (dc * quant) / DCTSIZE + CENTERJSAMPLE;
+  return (JSAMPLE) std::min(std::max(value, 0), MAXJSAMPLE);
+}
+
+/**
+ * Averages the DC coefficients of src_coefs over a grid of at most
+ * max_dimension cells per side, giving one pixel per cell in the color space
+ * of the source.
+ */
+static void computeDCThumbnail(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    int max_dimension,
+    std::vector<JSAMPLE>& pixels,
+    JDIMENSION& thumb_width,
+    JDIMENSION& thumb_height) {
+  const int num_components = dinfo->num_components;
+
+  // The thumbnail grid follows the DC plane of the first component,
+  // cropped to the visible part of the image
+  jpeg_component_info* luma_info = dinfo->comp_info;
+  const JDIMENSION dc_width =
+      (luma_info->downsampled_width + DCTSIZE - 1) / DCTSIZE;
+  const JDIMENSION dc_height =
+      (luma_info->downsampled_height + DCTSIZE - 1) / DCTSIZE;
+  const JDIMENSION step = std::max<JDIMENSION>(
+      (std::max(dc_width, dc_height) + max_dimension - 1) / max_dimension,
+      1);
+  thumb_width = (dc_width + step - 1) / step;
+  thumb_height = (dc_height + step - 1) / step;
+  const size_t row_stride = thumb_width * num_components;
+
+  std::vector<uint32_t> sums(row_stride * thumb_height, 0);
+  std::vector<uint32_t> counts(thumb_width * thumb_height, 0);
+
+  for (JDIMENSION y = 0; y < dc_height; y++) {
+    const JDIMENSION thumb_y = y / step;
+
+    for (int comp_i = 0; comp_i < num_components; comp_i++) {
+      jpeg_component_info* comp_info = dinfo->comp_info + comp_i;
+      const UINT16 quant = comp_info->quant_table->quantval[0];
+      const JDIMENSION comp_y = std::min<JDIMENSION>(
+          y * comp_info->v_samp_factor / luma_info->v_samp_factor,
+          comp_info->height_in_blocks - 1);
+      JBLOCKARRAY mcu_buff = (dinfo->mem->access_virt_barray)(
+          (j_common_ptr) dinfo, src_coefs[comp_i], comp_y, (JDIMENSION) 1, FALSE);
+
+      for (JDIMENSION x = 0; x < dc_width; x++) {
+        const JDIMENSION comp_x = std::min<JDIMENSION>(
+            x * comp_info->h_samp_factor / luma_info->h_samp_factor,
+            comp_info->width_in_blocks - 1);
+        const size_t thumb_i = thumb_y * thumb_width + x / step;
+
+        sums[thumb_i * num_components + comp_i] +=
+            dcToSample(mcu_buff[0][comp_x][0], quant);
+        if (comp_i == 0) {
+          counts[thumb_i]++;
+        }
+      }
+    }
+  }
+
+  pixels.resize(row_stride * thumb_height);
+  for (size_t i = 0; i < pixels.size(); i++) {
+    const uint32_t count = counts[i / num_components];
+    pixels[i] = (JSAMPLE) ((sums[i] + count / 2) / count);
+  }
+
+  LOGD("encodeDCThumbnail %ux%u -> %ux%u", dc_width, dc_height, thumb_width, thumb_height);
+}
+
+/**
+ * Encodes the thumbnail pixels into output. Only libjpeg runs under the
+ * jump buffer, everything it needs is set up by the caller.
+ */
+static bool encodeThumbnailPixels(
+    JpegStatus& status,
+    const std::vector<JSAMPLE>& pixels,
+    JDIMENSION width,
+    JDIMENSION height,
+    int num_components,
+    std::vector<uint8_t>& output) {
+  JpegErrorHandler error_handler{status};
+  JpegMemoryDestination destination;
+  struct jpeg_compress_struct cinfo;
+
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
+  }
+
+  memset(&cinfo, 0, sizeof(struct jpeg_compress_struct));
+  error_handler.setCompressStruct(cinfo);
+  jpeg_create_compress(&cinfo);
+  cinfo.dest = &destination.public_fields;
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = num_components;
+  // Samples are taken straight from the DCT domain, so they are already
+  // in the color space of the source
+  cinfo.in_color_space = num_components == 3 ? JCS_YCbCr : JCS_GRAYSCALE;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, kThumbnailQuality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  const size_t row_stride = cinfo.image_width * cinfo.input_components;
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row_pointer =
+        (JSAMPROW) &pixels[cinfo.next_scanline * row_stride];
+    (void) jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+  }
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+
+  output = std::move(destination.buffer);
+  return true;
+}
+
+bool encodeDCThumbnail(
+    JpegStatus& status,
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    int max_dimension,
+    std::vector<uint8_t>& output) {
+  const int num_components = dinfo->num_components;
+  if (max_dimension <= 0 || (num_components != 1 && num_components != 3)) {
+    return false;
+  }
+
+  std::vector<JSAMPLE> pixels;
+  JDIMENSION thumb_width = 0;
+  JDIMENSION thumb_height = 0;
+  computeDCThumbnail(
+      dinfo,
+      src_coefs,
+      max_dimension,
+      pixels,
+      thumb_width,
+      thumb_height);
+  return encodeThumbnailPixels(
+      status,
+      pixels,
+      thumb_width,
+      thumb_height,
+      num_components,
+      output);
+}
+
+void writeThumbnailMarker(
+    j_compress_ptr cinfo,
+    const std::vector<uint8_t>& thumbnail) {
+  if (thumbnail.empty()) {
+    return;
+  }
+  if (thumbnail.size() > THUMBNAIL_MARKER_LIMIT) {
+    LOGW("writeThumbnailMarker skipping thumbnail of %zu bytes", thumbnail.size());
+    return;
+  }
+
+  jpeg_write_m_header(
+      cinfo,
+      THUMBNAIL_MARKER,
+      THUMBNAIL_MARKER_ID_LENGTH + thumbnail.size());
+
+  auto marker_writer = [&] (int c) { jpeg_write_m_byte(cinfo, c); };
+  std::for_each(
+      THUMBNAIL_MARKER_ID,
+      THUMBNAIL_MARKER_ID + THUMBNAIL_MARKER_ID_LENGTH,
+      marker_writer);
+  std::for_each(thumbnail.begin(), thumbnail.end(), marker_writer);
+}
+
+bool extractThumbnailMarker(
+    j_decompress_ptr dinfo,
+    std::vector<uint8_t>& thumbnail) {
+  jpeg_saved_marker_ptr* link = &dinfo->marker_list;
+
+  while (*link != nullptr) {
+    jpeg_saved_marker_ptr marker = *link;
+    if (marker->marker == THUMBNAIL_MARKER &&
+        marker->data_length > THUMBNAIL_MARKER_ID_LENGTH &&
+        memcmp(marker->data, THUMBNAIL_MARKER_ID, THUMBNAIL_MARKER_ID_LENGTH) == 0) {
+      thumbnail.assign(
+          marker->data + THUMBNAIL_MARKER_ID_LENGTH,
+          marker->data + marker->data_length);
+      *link = marker->next;
+      return true;
+    }
+    link = &marker->next;
+  }
+  return false;
+}
+
+} } } }
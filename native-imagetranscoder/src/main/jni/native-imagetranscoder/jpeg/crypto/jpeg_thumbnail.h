@@ -0,0 +1,62 @@
+#ifndef FRESCO_JPEG_THUMBNAIL_H
+#define FRESCO_JPEG_THUMBNAIL_H
+
+#include <vector>
+
+#include <stdint.h>
+
+#include <jpeglib.h>
+
+#include "jpeg/jpeg_status.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Encodes a small thumbnail of the image described by given coefficients.
+ *
+ * <p> Every 8x8 block contributes its DC coefficient only, so the thumbnail
+ * comes at no IDCT cost. The DC plane is further box-filtered so that
+ * the longer side does not exceed max_dimension.
+ *
+ * <p> Only grayscale and YCbCr images are supported.
+ *
+ * @param status
+ * @param dinfo decompress struct the coefficients were read with
+ * @param src_coefs coefficients returned by jpeg_read_coefficients
+ * @param max_dimension upper bound of thumbnail width and height
+ * @param output receives the encoded thumbnail
+ * @return false if no thumbnail was produced. If status failed the caller
+ *   should abort.
+ */
+bool encodeDCThumbnail(
+    JpegStatus& status,
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    int max_dimension,
+    std::vector<uint8_t>& output);
+
+/**
+ * Writes the encrypted thumbnail as THUMBNAIL_MARKER. Thumbnails that do
+ * not fit into a single marker are dropped. Has to be called after
+ * jpeg_write_coefficients.
+ */
+void writeThumbnailMarker(
+    j_compress_ptr cinfo,
+    const std::vector<uint8_t>& thumbnail);
+
+/**
+ * Looks up THUMBNAIL_MARKER among the markers saved with
+ * jpeg_save_markers and removes it from the saved markers list.
+ *
+ * @return false if the image does not carry a thumbnail
+ */
+bool extractThumbnailMarker(
+    j_decompress_ptr dinfo,
+    std::vector<uint8_t>& thumbnail);
+
+} } } }
+
+#endif //FRESCO_JPEG_THUMBNAIL_H
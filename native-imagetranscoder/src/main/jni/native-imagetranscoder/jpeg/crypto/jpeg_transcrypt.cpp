@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <vector>
+
+#include <stdio.h>
+#include <setjmp.h>
+
+#include <jpeglib.h>
+extern "C" {
+  #include "transupp.h"
+}
+#include <gmp.h>
+
+#include "logging.h"
+#include "jpeg/jpeg_error_handler.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_codec.h"
+#include "jpeg_crypto.h"
+#include "jpeg_cipher_header.h"
+#include "jpeg_thumbnail.h"
+#include "jpeg_transcrypt.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Where the coefficients of one output block come from.
+ *
+ * <p> Every stage of the cipher either moves whole blocks, moves the 63 ACs
+ * of a block together or flips signs, so any sequence of stages boils down
+ * to one BlockSource per block.
+ */
+struct BlockSource {
+  unsigned int dc_block;
+  unsigned int ac_block;
+  bool dc_flip;
+  uint64_t ac_flips; // bit i set when AC coefficient i is negated
+};
+
+/**
+ * The part of a sorted chaotic sequence the block stages depend on
+ */
+struct ChaoticEntry {
+  unsigned int chaos_pos;
+  bool flip_sign;
+};
+
+static bool buildChaoticEntries(
+    unsigned int n_blocks,
+    mpf_t x_0,
+    mpf_t mu,
+    std::vector<ChaoticEntry>& entries) {
+  struct chaos_dc *chaotic_seq =
+      (struct chaos_dc *) malloc(n_blocks * sizeof(struct chaos_dc));
+  if (chaotic_seq == NULL) {
+    LOGE("buildChaoticEntries failed to alloc memory for chaotic_seq");
+    return false;
+  }
+  gen_chaotic_sequence(chaotic_seq, n_blocks, x_0, mu);
+
+  entries.resize(n_blocks);
+  for (unsigned int i = 0; i < n_blocks; i++) {
+    entries[i].chaos_pos = chaotic_seq[i].chaos_pos;
+    entries[i].flip_sign = chaotic_seq[i].flip_sign;
+    mpf_clear(chaotic_seq[i].chaos_gmp);
+  }
+
+  free(chaotic_seq);
+  return true;
+}
+
+/**
+ * Mirrors the cycle walk of permuteDCsSimple (whole blocks) and permuteMCUs
+ * (ACs only).
+ */
+static void swapBlocks(
+    std::vector<BlockSource>& sources,
+    const std::vector<ChaoticEntry>& seq,
+    bool whole_blocks) {
+  const unsigned int n_blocks = sources.size();
+  std::vector<bool> sorted_blocks(n_blocks, false);
+  unsigned int k = 0;
+  unsigned int curr_block = 0;
+
+  while (k < n_blocks) {
+    if (sorted_blocks[k]) {
+      k += 1;
+      curr_block = k;
+      continue;
+    }
+
+    const unsigned int dst = seq[curr_block].chaos_pos;
+    if (dst != k) {
+      if (whole_blocks) {
+        std::swap(sources[k], sources[dst]);
+      } else {
+        std::swap(sources[k].ac_block, sources[dst].ac_block);
+        std::swap(sources[k].ac_flips, sources[dst].ac_flips);
+      }
+      sorted_blocks[dst] = true;
+      curr_block = dst;
+    } else {
+      sorted_blocks[k] = true;
+      k += 1;
+      curr_block = k;
+    }
+  }
+}
+
+/**
+ * Mirrors the sign flips at the end of permuteDCsSimple
+ */
+static void flipDCs(
+    std::vector<BlockSource>& sources,
+    const std::vector<ChaoticEntry>& seq) {
+  for (unsigned int i = 0; i < sources.size(); i++) {
+    sources[i].dc_flip ^= seq[i].flip_sign;
+  }
+}
+
+/**
+ * Mirrors diffuseACsFlipSigns
+ */
+static void flipACs(
+    std::vector<BlockSource>& sources,
+    const std::vector<uint64_t>& ac_sign_flips) {
+  for (unsigned int i = 0; i < sources.size(); i++) {
+    sources[i].ac_flips ^= ac_sign_flips[i];
+  }
+}
+
+/**
+ * Mirrors decryptMCUs
+ */
+static void gatherACs(
+    std::vector<BlockSource>& sources,
+    const std::vector<ChaoticEntry>& seq) {
+  const std::vector<BlockSource> previous(sources);
+
+  for (unsigned int i = 0; i < sources.size(); i++) {
+    const BlockSource& src = previous[seq[i].chaos_pos];
+    sources[i].ac_block = src.ac_block;
+    sources[i].ac_flips = src.ac_flips;
+  }
+}
+
+/**
+ * Mirrors decryptDCs
+ */
+static void gatherBlocks(
+    std::vector<BlockSource>& sources,
+    const std::vector<ChaoticEntry>& seq) {
+  const std::vector<BlockSource> previous(sources);
+
+  for (unsigned int i = 0; i < sources.size(); i++) {
+    const unsigned int src_pos = seq[i].chaos_pos;
+    sources[i] = previous[src_pos];
+    sources[i].dc_flip ^= seq[src_pos].flip_sign;
+  }
+}
+
+/**
+ * Moves and negates the coefficients of one component as described by
+ * sources, reading and writing every block exactly once.
+ */
+static void applyBlockSources(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    int comp_i,
+    const std::vector<BlockSource>& sources) {
+  jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
+  const unsigned int width = comp_info->width_in_blocks;
+  const unsigned int height = comp_info->height_in_blocks;
+  std::vector<JCOEF> original(sources.size() * DCTSIZE2);
+
+  for (unsigned int y = 0; y < height; y++) {
+    JBLOCKARRAY mcu_buff = (dinfo->mem->access_virt_barray)(
+        (j_common_ptr) dinfo, src_coefs[comp_i], y, (JDIMENSION) 1, FALSE);
+    std::copy(
+        mcu_buff[0][0],
+        mcu_buff[0][0] + width * DCTSIZE2,
+        original.begin() + y * width * DCTSIZE2);
+  }
+
+  for (unsigned int y = 0; y < height; y++) {
+    JBLOCKARRAY mcu_buff = (dinfo->mem->access_virt_barray)(
+        (j_common_ptr) dinfo, src_coefs[comp_i], y, (JDIMENSION) 1, TRUE);
+
+    for (unsigned int x = 0; x < width; x++) {
+      const BlockSource& src = sources[y * width + x];
+      const JCOEF* dc_block = &original[src.dc_block * DCTSIZE2];
+      const JCOEF* ac_block = &original[src.ac_block * DCTSIZE2];
+      JCOEFPTR dct_block = mcu_buff[0][x];
+
+      dct_block[0] = src.dc_flip ? dc_block[0] * -1 : dc_block[0];
+      for (int i = 1; i < DCTSIZE2; i++) {
+        dct_block[i] = ((src.ac_flips >> i) & 1) ? ac_block[i] * -1 : ac_block[i];
+      }
+    }
+  }
+}
+
+/**
+ * Composes decryptCoefficients with the old key and encryptCoefficients with
+ * the new key, both at given level, then applies the result in a single
+ * pass. Each chaotic sequence is built once per component size instead of
+ * once per stage.
+ *
+ * <p> Fails (via the error handler of dinfo) if a key cannot be parsed or a
+ * chaotic sequence cannot be allocated. Callers must not have started
+ * writing the coefficients, since some components may already be re-keyed.
+ */
+static void transcryptCoefficients(
+    j_decompress_ptr dinfo,
+    jvirt_barray_ptr* src_coefs,
+    CipherLevel level,
+    const CryptoKey& old_key,
+    const CryptoKey& new_key) {
+  mpf_t old_x_0;
+  mpf_t old_mu;
+  mpf_t new_x_0;
+  mpf_t new_mu;
+  std::vector<std::vector<uint64_t>> old_ac_flips;
+  std::vector<std::vector<uint64_t>> new_ac_flips;
+  std::vector<ChaoticEntry> old_seq;
+  std::vector<ChaoticEntry> new_seq;
+  unsigned int seq_blocks = 0;
+
+  mpf_inits(old_x_0, old_mu, new_x_0, new_mu, NULL);
+
+  if (mpf_set_str(old_x_0, old_key.x_0.c_str(), 10) || mpf_set_str(old_mu, old_key.mu.c_str(), 10) ||
+      mpf_set_str(new_x_0, new_key.x_0.c_str(), 10) || mpf_set_str(new_mu, new_key.mu.c_str(), 10)) {
+    mpf_clears(old_x_0, old_mu, new_x_0, new_mu, NULL);
+    jpegFail((j_common_ptr) dinfo, "transcryptCoefficients failed to parse key");
+  }
+
+  if (level >= CIPHER_LEVEL_DC_SIGNS) {
+    generateACSignFlips(dinfo, old_x_0, old_mu, old_ac_flips);
+    generateACSignFlips(dinfo, new_x_0, new_mu, new_ac_flips);
+  }
+
+  for (int comp_i = 0; comp_i < dinfo->num_components; comp_i++) {
+    jpeg_component_info *comp_info = dinfo->comp_info + comp_i;
+    const unsigned int n_blocks = comp_info->width_in_blocks * comp_info->height_in_blocks;
+
+    // chroma components usually share their size, and so their sequences
+    if (n_blocks != seq_blocks) {
+      if (!buildChaoticEntries(n_blocks, old_x_0, old_mu, old_seq) ||
+          !buildChaoticEntries(n_blocks, new_x_0, new_mu, new_seq)) {
+        // the earlier components are already re-keyed, the caller must not
+        // write any of them. jpegFail does not unwind, so free what we hold
+        std::vector<ChaoticEntry>().swap(old_seq);
+        std::vector<ChaoticEntry>().swap(new_seq);
+        std::vector<std::vector<uint64_t>>().swap(old_ac_flips);
+        std::vector<std::vector<uint64_t>>().swap(new_ac_flips);
+        mpf_clears(old_x_0, old_mu, new_x_0, new_mu, NULL);
+        jpegFail(
+            (j_common_ptr) dinfo,
+            "transcryptCoefficients failed to build chaotic sequence");
+      }
+      seq_blocks = n_blocks;
+    }
+
+    std::vector<BlockSource> sources(n_blocks);
+    for (unsigned int i = 0; i < n_blocks; i++) {
+      sources[i] = BlockSource{i, i, false, 0};
+    }
+
+    // decryptCoefficients with the old key
+    if (level >= CIPHER_LEVEL_FULL) {
+      gatherACs(sources, old_seq);
+    }
+    if (level >= CIPHER_LEVEL_DC_SIGNS) {
+      flipACs(sources, old_ac_flips[comp_i]);
+    }
+    gatherBlocks(sources, old_seq);
+
+    // encryptCoefficients with the new key
+    swapBlocks(sources, new_seq, true);
+    flipDCs(sources, new_seq);
+    if (level >= CIPHER_LEVEL_DC_SIGNS) {
+      flipACs(sources, new_ac_flips[comp_i]);
+    }
+    if (level >= CIPHER_LEVEL_FULL) {
+      swapBlocks(sources, new_seq, false);
+    }
+
+    applyBlockSources(dinfo, src_coefs, comp_i, sources);
+  }
+
+  mpf_clears(old_x_0, old_mu, new_x_0, new_mu, NULL);
+}
+
+/**
+ * Transcrypts an in-memory jpeg, used for the embedded thumbnail.
+ *
+ * @return false if it failed, with the error recorded in status
+ */
+static bool transcryptJpegBuffer(
+    JpegStatus& status,
+    std::vector<uint8_t>&& input,
+    std::vector<uint8_t>& output,
+    CipherLevel level,
+    const CryptoKey& old_key,
+    const CryptoKey& new_key) {
+  JpegMemorySource mem_source;
+  JpegMemoryDestination mem_destination;
+  JpegErrorHandler error_handler{status};
+
+  mem_source.setBuffer(std::move(input));
+
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(dinfo, error_handler, mem_source.public_fields);
+
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(
+      cinfo, dinfo, error_handler, mem_destination.public_fields, 0);
+
+  jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
+  jpeg_copy_critical_parameters(&dinfo, &cinfo);
+
+  transcryptCoefficients(&dinfo, src_coefs, level, old_key, new_key);
+
+  jpeg_write_coefficients(&cinfo, src_coefs);
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+
+  output = std::move(mem_destination.buffer);
+  return true;
+}
+
+void transcryptJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& old_key,
+    const CryptoKey& new_key) {
+  JpegErrorHandler error_handler{status};
+  CipherHeader header;
+  std::vector<uint8_t> thumbnail;
+  std::vector<uint8_t> new_thumbnail;
+
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
+  }
+
+  // prepare decompress struct, keeping the cipher header and the thumbnail
+  struct jpeg_decompress_struct dinfo;
+  createDecompressStruct(dinfo, error_handler, source);
+  saveCipherHeader(&dinfo);
+  jpeg_save_markers(&dinfo, THUMBNAIL_MARKER, 0xFFFF);
+  jpeg_read_header(&dinfo, true);
+
+  // reject a wrong old key before doing any expensive work
+  checkCipherHeader(&dinfo, header, old_key);
+  if (header.engine != CIPHER_ENGINE_CHAOTIC_GMP) {
+    jpegFail((j_common_ptr) &dinfo, "Unsupported cipher engine");
+  }
+  const CipherLevel level = (CipherLevel) header.level;
+
+  if (extractThumbnailMarker(&dinfo, thumbnail)) {
+    transcryptJpegBuffer(
+        status,
+        std::move(thumbnail),
+        new_thumbnail,
+        level,
+        old_key,
+        new_key);
+    jpegJumpOnFailure((j_common_ptr) &dinfo);
+  }
+
+  // create compress struct
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
+
+  jvirt_barray_ptr *src_coefs = jpeg_read_coefficients(&dinfo);
+  jpeg_copy_critical_parameters(&dinfo, &cinfo);
+
+  transcryptCoefficients(&dinfo, src_coefs, level, old_key, new_key);
+
+  jpeg_write_coefficients(&cinfo, src_coefs);
+  // markers can only be written once jpeg_write_coefficients emitted SOI
+  jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
+
+  initCipherHeader(header, CIPHER_ENGINE_CHAOTIC_GMP, level, new_key);
+  writeCipherHeader(&cinfo, header);
+  writeThumbnailMarker(&cinfo, new_thumbnail);
+
+  LOGD("transcryptJpeg finished");
+
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+}
+
+} } } }
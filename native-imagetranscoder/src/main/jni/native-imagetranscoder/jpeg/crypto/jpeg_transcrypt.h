@@ -0,0 +1,36 @@
+#ifndef FRESCO_JPEG_TRANSCRYPT_H
+#define FRESCO_JPEG_TRANSCRYPT_H
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "jpeg/jpeg_status.h"
+#include "jpeg_crypto.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace crypto {
+
+/**
+ * Re-encrypts a jpeg produced by encryptJpeg with a new key.
+ *
+ * <p> The output matches decryptJpeg with the old key followed by
+ * encryptJpeg with the new key, but coefficients are read and written only
+ * once: the old decryption and the new encryption are composed into a
+ * single block mapping which is then applied in one pass. The encryption
+ * level is kept and an embedded thumbnail is re-encrypted as well.
+ *
+ * <p> A wrong old key is rejected before any coefficient is read.
+ */
+void transcryptJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    const CryptoKey& old_key,
+    const CryptoKey& new_key);
+
+} } } }
+
+#endif //FRESCO_JPEG_TRANSCRYPT_H
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <type_traits>
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+
+#include "jpeg_cancellation.h"
+#include "jpeg_error_handler.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+static thread_local const JpegCancellationToken* tCurrentToken = nullptr;
+
+/**
+ * Progress monitor of a struct, checking the token current at its creation.
+ *
+ * <p> This is not a c++ class because the only purpose of the monitor is to
+ * be used with libjpeg which is a c library.
+ */
+struct CancellationMonitor {
+  struct jpeg_progress_mgr public_fields;
+  const JpegCancellationToken* token;
+};
+
+static_assert(
+    std::is_standard_layout<CancellationMonitor>::value,
+    "CancellationMonitor has to be type of standard layout");
+static_assert(
+    offsetof(CancellationMonitor, public_fields) == 0,
+    "offset of CancellationMonitor.public_fields should be 0");
+
+const JpegCancellationToken* setCurrentCancellationToken(
+    const JpegCancellationToken* token) {
+  const JpegCancellationToken* previous = tCurrentToken;
+  tCurrentToken = token;
+  return previous;
+}
+
+const JpegCancellationToken* getCurrentCancellationToken() {
+  return tCurrentToken;
+}
+
+bool isCurrentOperationCancelled() {
+  return tCurrentToken != nullptr && tCurrentToken->isCancelled();
+}
+
+static void checkCancellation(j_common_ptr cinfo) {
+  CancellationMonitor* monitor = (CancellationMonitor*) cinfo->progress;
+  if (monitor->token->isCancelled()) {
+    ERREXIT(cinfo, kJpegErrorCancelled);
+  }
+}
+
+void installCancellationMonitor(j_common_ptr cinfo) {
+  installCancellationMonitor(cinfo, tCurrentToken);
+}
+
+void installCancellationMonitor(
+    j_common_ptr cinfo,
+    const JpegCancellationToken* token) {
+  if (token == nullptr) {
+    return;
+  }
+  CancellationMonitor* monitor = (CancellationMonitor*)
+      (*cinfo->mem->alloc_small)(
+          cinfo,
+          JPOOL_PERMANENT,
+          sizeof(CancellationMonitor));
+  monitor->public_fields.progress_monitor = checkCancellation;
+  monitor->token = token;
+  cinfo->progress = &monitor->public_fields;
+}
+
+void jpegThrowIfCancelled(j_common_ptr cinfo) {
+  if (isCurrentOperationCancelled()) {
+    ERREXIT(cinfo, kJpegErrorCancelled);
+  }
+}
+
+} } }
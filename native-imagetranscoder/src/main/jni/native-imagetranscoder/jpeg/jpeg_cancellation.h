@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_CANCELLATION_H_
+#define _JPEG_CANCELLATION_H_
+
+#include <atomic>
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Flag set from any thread to ask the operations given it to stop.
+ *
+ * <p> Operations only look at the flag between steps of their work, so
+ * they stop shortly after, not right away.
+ */
+class JpegCancellationToken {
+ public:
+  JpegCancellationToken() : cancelled_(false) {}
+
+  void cancel() {
+    cancelled_.store(true, std::memory_order_relaxed);
+  }
+
+  bool isCancelled() const {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<bool> cancelled_;
+};
+
+/**
+ * Makes token the one checked by the structs created on the calling thread
+ * until the returned previous token is set back. The token must outlive
+ * those structs.
+ *
+ * @param token the token, or nullptr for none
+ */
+const JpegCancellationToken* setCurrentCancellationToken(
+    const JpegCancellationToken* token);
+
+/**
+ * Returns the current token of the calling thread, nullptr for none. Work
+ * handed to other threads takes it along, see installCancellationMonitor.
+ */
+const JpegCancellationToken* getCurrentCancellationToken();
+
+/**
+ * Returns true if the current token of the calling thread is cancelled.
+ */
+bool isCurrentOperationCancelled();
+
+/**
+ * Makes libjpeg check the current token of the calling thread once per
+ * row of MCUs or call to read / write scanlines, and fail with
+ * kJpegErrorCancelled through the error handler of the struct once it is
+ * cancelled. Does nothing if there is no current token.
+ *
+ * <p> Must be called after jpeg_create_*, the monitor lives in the
+ * permanent pool of the struct.
+ */
+void installCancellationMonitor(j_common_ptr cinfo);
+
+/**
+ * Like installCancellationMonitor, checking given token instead of the one
+ * of the calling thread. For structs driven by worker threads on behalf of
+ * another thread.
+ */
+void installCancellationMonitor(
+    j_common_ptr cinfo,
+    const JpegCancellationToken* token);
+
+/**
+ * Fails with kJpegErrorCancelled through the error handler of cinfo if the
+ * current token of the calling thread is cancelled. Used between steps not
+ * run by libjpeg.
+ */
+void jpegThrowIfCancelled(j_common_ptr cinfo);
+
+} } }
+
+#endif /* _JPEG_CANCELLATION_H_ */
@@ -6,23 +6,31 @@
  */
 
 #include <algorithm>
+#include <condition_variable>
 #include <iterator>
+#include <mutex>
+#include <vector>
 
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <setjmp.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 extern "C" {
   #include "transupp.h"
 }
 
 #include "decoded_image.h"
-#include "exceptions_handler.h"
 #include "logging.h"
+#include "jpeg_cancellation.h"
 #include "jpeg_error_handler.h"
+#include "jpeg_markers.h"
 #include "jpeg_memory_io.h"
-#include "jpeg_stream_wrappers.h"
+#include "jpeg_quality.h"
+#include "jpeg_resampler.h"
+#include "jpeg_restart.h"
+#include "task_pool.h"
 #include "transformations.h"
 #include "jpeg_codec.h"
 
@@ -82,29 +90,31 @@ static void writeMetadata(
       jpeg_metadata_writer);
 }
 
-void encodeJpegIntoOutputStream(
-    JNIEnv* env,
+int encodeJpeg(
+    JpegStatus& status,
     DecodedImage& decoded_image,
-    jobject os,
-    int quality) {
+    struct jpeg_destination_mgr& destination,
+    int quality,
+    int source_quality) {
   // jpeg does not support alpha channel
-  THROW_AND_RETURN_IF(
+  FAIL_AND_RETURNVAL_IF(
       decoded_image.getPixelFormat() != PixelFormat::RGB,
-      "Wrong pixel format for jpeg encoding");
+      "Wrong pixel format for jpeg encoding",
+      0);
 
   struct jpeg_compress_struct cinfo;
+  const int output_quality = clampJpegQuality(quality, source_quality);
 
   // set up error handling
-  JpegErrorHandler error_handler{env};
+  JpegErrorHandler error_handler{status};
   error_handler.setCompressStruct(cinfo);
   if (setjmp(error_handler.setjmpBuffer)) {
-    return;
+    return 0;
   }
 
-  // set up OutputStream as jpeg codec destination
   jpeg_create_compress(&cinfo);
-  JpegOutputStreamWrapper os_wrapper{env, os};
-  cinfo.dest = &(os_wrapper.public_fields);
+  installCancellationMonitor((j_common_ptr) &cinfo);
+  cinfo.dest = &destination;
 
   // set up image properties
   cinfo.image_width = decoded_image.getWidth();
@@ -113,7 +123,7 @@ void encodeJpegIntoOutputStream(
   cinfo.in_color_space = JCS_RGB;
 
   jpeg_set_defaults(&cinfo);
-  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_set_quality(&cinfo, output_quality, TRUE);
   jpeg_start_compress(&cinfo, TRUE);
 
   writeMetadata(cinfo, decoded_image);
@@ -123,7 +133,7 @@ void encodeJpegIntoOutputStream(
   const int stride = decoded_image.getStride();
   while (cinfo.next_scanline < cinfo.image_height) {
     if (jpeg_write_scanlines(&cinfo, &row_pointer, 1) != 1) {
-      jpegSafeThrow(
+      jpegFail(
           (j_common_ptr) &cinfo,
           "Could not write scanline");
     }
@@ -132,6 +142,7 @@ void encodeJpegIntoOutputStream(
 
   jpeg_finish_compress(&cinfo);
   jpeg_destroy_compress(&cinfo);
+  return output_quality;
 }
 
 /**
@@ -160,19 +171,21 @@ JXFORM_CODE getTransformForRotationType(RotationType rotation_type) {
 }
 
 /**
- * Initializes decompress struct.
+ * Creates decompress struct without reading the header.
  *
- * <p> Sets source and error handling.
+ * <p> Sets source and error handling, and checks the cancellation token of
+ * the calling thread.
  *
  * <p> Sets decompress parameters to optimize decode time.
  */
-void initDecompressStruct(
+void createDecompressStruct(
     struct jpeg_decompress_struct& dinfo,
     JpegErrorHandler& error_handler,
     struct jpeg_source_mgr& source) {
   memset(&dinfo, 0, sizeof(struct jpeg_decompress_struct));
   error_handler.setDecompressStruct(dinfo);
   jpeg_create_decompress(&dinfo);
+  installCancellationMonitor((j_common_ptr) &dinfo);
 
   // DCT method, one of JDCT_FASTEST, JDCT_IFAST, JDCT_ISLOW or JDCT_FLOAT
   dinfo.dct_method = JDCT_IFAST;
@@ -188,13 +201,49 @@ void initDecompressStruct(
   dinfo.enable_2pass_quant = FALSE;
 
   dinfo.src = &source;
+}
+
+/**
+ * Initializes decompress struct.
+ *
+ * <p> Sets source and error handling.
+ *
+ * <p> Sets decompress parameters to optimize decode time.
+ */
+void initDecompressStruct(
+    struct jpeg_decompress_struct& dinfo,
+    JpegErrorHandler& error_handler,
+    struct jpeg_source_mgr& source) {
+  createDecompressStruct(dinfo, error_handler, source);
+  jpeg_read_header(&dinfo, true);
+}
+
+/**
+ * Initializes decompress struct, keeping the markers selected by
+ * marker_policy for jcopy_markers_execute.
+ *
+ * @param rotation_type rotation the image is going to be transformed by
+ */
+static void initDecompressStruct(
+    struct jpeg_decompress_struct& dinfo,
+    JpegErrorHandler& error_handler,
+    struct jpeg_source_mgr& source,
+    MarkerPolicy marker_policy,
+    RotationType rotation_type) {
+  createDecompressStruct(dinfo, error_handler, source);
+  saveMarkers(dinfo, marker_policy);
   jpeg_read_header(&dinfo, true);
+  filterMarkers(
+      dinfo,
+      marker_policy,
+      rotation_type != RotationType::ROTATE_0);
 }
 
 /**
  * Initializes compress struct.
  *
- * <p> Sets destination and error handler.
+ * <p> Sets destination and error handler, and checks the cancellation token
+ * of the calling thread.
  *
  * <p> Sets copies params from given decompress struct
  */
@@ -202,10 +251,12 @@ void initCompressStruct(
     struct jpeg_compress_struct& cinfo,
     struct jpeg_decompress_struct& dinfo,
     JpegErrorHandler& error_handler,
-    struct jpeg_destination_mgr& destination) {
+    struct jpeg_destination_mgr& destination,
+    int restart_rows) {
   memset(&cinfo, 0, sizeof(struct jpeg_compress_struct));
   error_handler.setCompressStruct(cinfo);
   jpeg_create_compress(&cinfo);
+  installCancellationMonitor((j_common_ptr) &cinfo);
   cinfo.dct_method = JDCT_IFAST;
   cinfo.dest = &destination;
   cinfo.image_width = dinfo.output_width;
@@ -213,49 +264,74 @@ void initCompressStruct(
   cinfo.input_components = dinfo.output_components;
   cinfo.in_color_space = dinfo.out_color_space;
   jpeg_set_defaults(&cinfo);
+  cinfo.restart_in_rows = restart_rows;
 }
 
 /**
  * Initialize transform info structure.
  *
  * <p> Transformation is allowed to drop incomplete 8x8 blocks
+ *
+ * <p> If crop_info is given, the rotated image is cropped to it. The crop
+ * offsets are moved left and up to the iMCU grid, and the crop grows so its
+ * right and bottom edges stay where they were requested.
  */
 static void initTransformInfo(
     jpeg_transform_info& xinfo,
     jpeg_decompress_struct& dinfo,
-    RotationType rotation_type) {
+    RotationType rotation_type,
+    const CropInfo* crop_info) {
   memset(&xinfo, 0, sizeof(jpeg_transform_info));
   xinfo.transform = getTransformForRotationType(rotation_type);
   xinfo.trim = true;
+  if (crop_info != nullptr) {
+    xinfo.crop = true;
+    xinfo.crop_xoffset = crop_info->getX();
+    xinfo.crop_xoffset_set = JCROP_POS;
+    xinfo.crop_yoffset = crop_info->getY();
+    xinfo.crop_yoffset_set = JCROP_POS;
+    xinfo.crop_width = crop_info->getWidth();
+    xinfo.crop_width_set = JCROP_POS;
+    xinfo.crop_height = crop_info->getHeight();
+    xinfo.crop_height_set = JCROP_POS;
+  }
   jtransform_request_workspace(&dinfo, &xinfo);
 }
 
 /**
- * Rotates jpeg image.
+ * Rotates and optionally crops jpeg image.
  *
- * <p> Operates on DCT blocks to avoid doing a full decode.
+ * <p> Operates on DCT blocks to avoid doing a full decode. Only the entropy
+ * coding is redone, so there is no generation loss.
  */
-static void rotateJpeg(
-    JNIEnv* env,
+static void transformJpegLossless(
+    JpegStatus& status,
     struct jpeg_source_mgr& source,
     struct jpeg_destination_mgr& destination,
-    RotationType rotation_type) {
-  JpegErrorHandler error_handler{env};
+    RotationType rotation_type,
+    const CropInfo* crop_info,
+    MarkerPolicy marker_policy) {
+  JpegErrorHandler error_handler{status};
   if (setjmp(error_handler.setjmpBuffer)) {
     return;
   }
 
   // prepare decompress struct
   struct jpeg_decompress_struct dinfo;
-  initDecompressStruct(dinfo, error_handler, source);
+  initDecompressStruct(
+      dinfo,
+      error_handler,
+      source,
+      marker_policy,
+      rotation_type);
 
   // create compress struct
   struct jpeg_compress_struct cinfo;
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
 
   // prepare transform struct
   jpeg_transform_info xinfo;
-  initTransformInfo(xinfo, dinfo, rotation_type);
+  initTransformInfo(xinfo, dinfo, rotation_type, crop_info);
 
   // transform
   jvirt_barray_ptr* srccoefs = jpeg_read_coefficients(&dinfo);
@@ -272,100 +348,1856 @@ static void rotateJpeg(
 }
 
 /**
- * Resizes jpeg.
+ * Rotates jpeg image.
  *
- * <p> During the resize, the image is decoded line by line and encoded again.
+ * <p> Operates on DCT blocks to avoid doing a full decode.
  */
-static void resizeJpeg(
-    JNIEnv* env,
+static void rotateJpeg(
+    JpegStatus& status,
     struct jpeg_source_mgr& source,
     struct jpeg_destination_mgr& destination,
-    const ScaleFactor& scale_factor,
-    int quality) {
-  THROW_AND_RETURN_IF(quality < 1, "quality should not be lower than 1");
-  THROW_AND_RETURN_IF(quality > 100, "quality should not be greater than 100");
-  THROW_AND_RETURN_IF(
-      8 % scale_factor.getDenominator() > 0,
-      "wrong scale denominator");
-  THROW_AND_RETURN_IF(
-      scale_factor.getNumerator() < 1,
-      "scale numerator cannot be lower than 1");
-  THROW_AND_RETURN_IF(
-      scale_factor.getNumerator() > 16,
-      "scale numerator cannot be greater than 16");
+    RotationType rotation_type,
+    MarkerPolicy marker_policy) {
+  transformJpegLossless(
+      status,
+      source,
+      destination,
+      rotation_type,
+      nullptr,
+      marker_policy);
+}
 
-  JpegErrorHandler error_handler{env};
-  if (setjmp(error_handler.setjmpBuffer)) {
-    return;
+/**
+ * Output images with at least this many pixels are resized by a decoder and
+ * an encoder running concurrently. Below that the second thread does not
+ * pay off.
+ */
+static const uint64_t kPipelinedResizeMinPixels = 1024 * 1024;
+
+/**
+ * Number of strips the decoder may get ahead of the encoder
+ */
+static const unsigned int kPipelineStripCount = 4;
+
+/**
+ * Lower bound of rows per strip, keeps hand-offs between threads rare
+ */
+static const unsigned int kPipelineMinStripRows = 16;
+
+/**
+ * Decoded images up to this many bytes are rotated in memory while being
+ * resized. Larger ones are encoded first and rotated losslessly from the
+ * encoded image, which needs far less memory.
+ */
+static const uint64_t kFusedRotationMaxBytes = 32 * 1024 * 1024;
+
+/**
+ * Side of the square tiles pixels are rotated in. The decoded rows and
+ * output rows touched by one tile stay in L1 cache.
+ */
+static const unsigned int kRotationTileSize = 32;
+
+/**
+ * Maps output pixels to decoded ones.
+ *
+ * <p> Output pixel (x, y) comes from decoded pixel (x, y), or (y, x) with
+ * swap_axes. Decoded coordinates are then mirrored according to flip_x and
+ * flip_y.
+ */
+struct PixelTransform {
+  bool swap_axes;
+  bool flip_x;
+  bool flip_y;
+};
+
+static PixelTransform getPixelTransform(RotationType rotation_type) {
+  switch (rotation_type) {
+  case RotationType::ROTATE_90:
+    return {true, false, true};
+  case RotationType::ROTATE_180:
+    return {false, true, true};
+  case RotationType::ROTATE_270:
+    return {true, true, false};
+  case RotationType::FLIP_HORIZONTAL:
+    return {false, true, false};
+  case RotationType::FLIP_VERTICAL:
+    return {false, false, true};
+  case RotationType::TRANSPOSE:
+    return {true, false, false};
+  case RotationType::TRANSVERSE:
+    return {true, true, true};
+  case RotationType::ROTATE_0:
+  default:
+    return {false, false, false};
   }
+}
 
-  // prepare decompress struct
-  struct jpeg_decompress_struct dinfo;
-  initDecompressStruct(dinfo, error_handler, source);
-  dinfo.scale_num = scale_factor.getNumerator();
-  dinfo.scale_denom = scale_factor.getDenominator();
-  dinfo.out_color_space = JCS_RGB;
-  (void) jpeg_start_decompress(&dinfo);
+/**
+ * Writes image, transformed by transform, to cinfo, which has started
+ * compressing. strip holds kRotationTileSize rows of the output.
+ *
+ * <p> Rotated scanlines are assembled tile by tile, so reading down the
+ * columns of the decoded image does not miss the cache on every pixel.
+ */
+static void writeTransformedScanlines(
+    struct jpeg_compress_struct& cinfo,
+    JSAMPARRAY image,
+    const PixelTransform& transform,
+    JSAMPARRAY strip) {
+  const int components = cinfo.input_components;
+  const JDIMENSION in_width =
+      transform.swap_axes ? cinfo.image_height : cinfo.image_width;
+  const JDIMENSION in_height =
+      transform.swap_axes ? cinfo.image_width : cinfo.image_height;
 
-  // create compress struct
-  struct jpeg_compress_struct cinfo;
-  initCompressStruct(cinfo, dinfo, error_handler, destination);
-  jpeg_set_quality(&cinfo, quality, false);
+  for (JDIMENSION y0 = 0; y0 < cinfo.image_height; y0 += kRotationTileSize) {
+    const JDIMENSION rows =
+        std::min<JDIMENSION>(kRotationTileSize, cinfo.image_height - y0);
+    for (JDIMENSION x0 = 0; x0 < cinfo.image_width; x0 += kRotationTileSize) {
+      const JDIMENSION x1 =
+          std::min<JDIMENSION>(x0 + kRotationTileSize, cinfo.image_width);
+      for (JDIMENSION y = y0; y < y0 + rows; y++) {
+        JSAMPROW out = strip[y - y0] + (size_t) x0 * components;
+        if (transform.swap_axes) {
+          // output row y is decoded column in_x
+          const JDIMENSION in_x = transform.flip_x ? in_width - 1 - y : y;
+          const size_t offset = (size_t) in_x * components;
+          for (JDIMENSION x = x0; x < x1; x++) {
+            const JDIMENSION in_y = transform.flip_y ? in_height - 1 - x : x;
+            memcpy(out, image[in_y] + offset, components);
+            out += components;
+          }
+        } else {
+          const JSAMPLE* in_row =
+              image[transform.flip_y ? in_height - 1 - y : y];
+          for (JDIMENSION x = x0; x < x1; x++) {
+            const JDIMENSION in_x = transform.flip_x ? in_width - 1 - x : x;
+            memcpy(out, in_row + (size_t) in_x * components, components);
+            out += components;
+          }
+        }
+      }
+    }
+    (void) jpeg_write_scanlines(&cinfo, strip, rows);
+  }
+}
+
+/**
+ * Scanlines fed to the encoder: the decoded ones, or the decoded ones
+ * resampled to the size of the output.
+ */
+struct ScanlineReader {
+  struct jpeg_decompress_struct& dinfo;
+  JpegResampler* resampler;       // nullptr if decoded rows are encoded as is
+  JSAMPARRAY input_row;           // decoded row fed to the resampler
+  JDIMENSION output_height;
+  JDIMENSION rows_read;
+};
+
+static bool hasMoreScanlines(const ScanlineReader& reader) {
+  return reader.rows_read < reader.output_height;
+}
+
+/**
+ * Reads up to max_lines output scanlines into rows.
+ *
+ * @return number of scanlines read
+ */
+static JDIMENSION readScanlines(
+    ScanlineReader& reader,
+    JSAMPARRAY rows,
+    JDIMENSION max_lines) {
+  JDIMENSION lines = 0;
+  if (reader.resampler == nullptr) {
+    lines = jpeg_read_scanlines(&reader.dinfo, rows, max_lines);
+  } else {
+    while (lines < max_lines &&
+        reader.rows_read + lines < reader.output_height) {
+      jpeg_read_scanlines(&reader.dinfo, reader.input_row, 1);
+      if (reader.resampler->pushRow(reader.input_row[0], rows[lines])) {
+        lines++;
+      }
+    }
+  }
+  reader.rows_read += lines;
+  return lines;
+}
+
+/**
+ * Encoder fed by a scanline pipeline, one strip at a time on whichever
+ * thread claimed it.
+ */
+struct PipelineEncoder {
+  struct jpeg_compress_struct* cinfo;
+  JpegResampler* resampler;       // nullptr if strips are encoded as is
+  JSAMPARRAY resampled_row;
+  // unrotated rows collected to be written transformed once all are there,
+  // nullptr if rows are encoded as they come
+  JSAMPARRAY image;
+  JDIMENSION image_rows;
+  JSAMPARRAY rotation_strip;      // kRotationTileSize rows of the output
+  PixelTransform transform;
+  JpegWorkerErrorHandler error_handler;
+  bool succeeded;
+};
+
+/**
+ * Ring of scanline strips handed over from the decoder to the encoders.
+ * Every encoder reads every strip.
+ */
+struct ScanlinePipeline {
+  std::mutex mutex;
+  std::condition_variable strip_ready;
+  std::condition_variable strip_free;
+
+  JSAMPARRAY strips[kPipelineStripCount];
+  JDIMENSION strip_rows[kPipelineStripCount];
+  JDIMENSION rows_per_strip;
+
+  // strips handed over / given back by each encoder so far, guarded by mutex
+  unsigned int produced = 0;
+  std::vector<unsigned int> consumed;
+  // encoders some thread is working on / that finished compressing
+  std::vector<bool> claimed;
+  std::vector<bool> finished;
+  // encode tasks submitted to the pool that have not started yet
+  size_t queued_tasks = 0;
+  bool decoder_done = false;
+  bool aborted = false;
+
+  explicit ScanlinePipeline(size_t encoders) :
+      consumed(encoders, 0),
+      claimed(encoders, false),
+      finished(encoders, false) {}
+
+  /**
+   * Number of strips all encoders are done with
+   */
+  unsigned int released() const {
+    return *std::min_element(consumed.begin(), consumed.end());
+  }
+
+  bool allFinished() const {
+    return std::find(finished.begin(), finished.end(), false) ==
+        finished.end();
+  }
+
+  /**
+   * Finds an encoder with a strip to encode, or compression to finish, that
+   * no thread is working on. Starts looking at first, so threads tend to
+   * stick to one encoder. Called with mutex held.
+   *
+   * @return index of the encoder, -1 if there is none
+   */
+  int claimableEncoder(size_t first) const {
+    if (aborted) {
+      return -1;
+    }
+    for (size_t n = 0; n < consumed.size(); n++) {
+      const size_t i = (first + n) % consumed.size();
+      if (!claimed[i] && !finished[i] &&
+          (consumed[i] < produced || decoder_done)) {
+        return (int) i;
+      }
+    }
+    return -1;
+  }
+};
+
+/**
+ * Allocates pipeline strips from the pool of dinfo. Each strip holds whole
+ * output buffers of libjpeg, so reads do not go through its internal single
+ * row buffering.
+ *
+ * @return rows per strip
+ */
+static JDIMENSION allocStrips(
+    struct jpeg_decompress_struct& dinfo,
+    size_t row_stride,
+    JSAMPARRAY* strips) {
+  const JDIMENSION outbuf_rows = dinfo.rec_outbuf_height;
+  const JDIMENSION rows_per_strip =
+      (kPipelineMinStripRows + outbuf_rows - 1) / outbuf_rows * outbuf_rows;
+  for (unsigned int i = 0; i < kPipelineStripCount; i++) {
+    strips[i] = (*dinfo.mem->alloc_sarray)(
+        (j_common_ptr) &dinfo,
+        JPOOL_IMAGE,
+        row_stride,
+        rows_per_strip);
+  }
+  return rows_per_strip;
+}
+
+/**
+ * Encodes the strip in slot of the pipeline, or finishes compression if
+ * slot is negative. Runs on whichever thread claimed the encoder, so errors
+ * are only recorded in its worker error handler.
+ *
+ * @return false if libjpeg failed
+ */
+static bool encodeStrip(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder& encoder,
+    int slot) {
+  struct jpeg_compress_struct& cinfo = *encoder.cinfo;
+  if (setjmp(encoder.error_handler.setjmpBuffer)) {
+    return false;
+  }
+
+  if (slot < 0) {
+    if (encoder.image != nullptr) {
+      writeTransformedScanlines(
+          cinfo,
+          encoder.image,
+          encoder.transform,
+          encoder.rotation_strip);
+    }
+    jpeg_finish_compress(&cinfo);
+  } else if (encoder.resampler == nullptr && encoder.image == nullptr) {
+    (void) jpeg_write_scanlines(
+        &cinfo,
+        pipeline.strips[slot],
+        pipeline.strip_rows[slot]);
+  } else if (encoder.resampler == nullptr) {
+    const size_t row_stride = cinfo.input_components *
+        (size_t) (encoder.transform.swap_axes
+            ? cinfo.image_height
+            : cinfo.image_width);
+    for (JDIMENSION row = 0; row < pipeline.strip_rows[slot]; row++) {
+      memcpy(
+          encoder.image[encoder.image_rows++],
+          pipeline.strips[slot][row],
+          row_stride);
+    }
+  } else {
+    for (JDIMENSION row = 0; row < pipeline.strip_rows[slot]; row++) {
+      JSAMPROW output_row = encoder.image != nullptr
+          ? encoder.image[encoder.image_rows]
+          : encoder.resampled_row[0];
+      if (!encoder.resampler->pushRow(
+          pipeline.strips[slot][row],
+          output_row)) {
+        continue;
+      }
+      if (encoder.image != nullptr) {
+        encoder.image_rows++;
+      } else {
+        (void) jpeg_write_scanlines(&cinfo, encoder.resampled_row, 1);
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Claims an encoder no other thread is working on and encodes one strip
+ * with it, or finishes it. Called and returns with lock held.
+ *
+ * @param first encoder to try first
+ * @return false if no encoder could be claimed
+ */
+static bool runEncoderStep(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder* encoders,
+    size_t first,
+    std::unique_lock<std::mutex>& lock) {
+  const int index = pipeline.claimableEncoder(first);
+  if (index < 0) {
+    return false;
+  }
+  const bool finish = pipeline.consumed[index] == pipeline.produced;
+  const int slot = finish
+      ? -1
+      : (int) (pipeline.consumed[index] % kPipelineStripCount);
+  pipeline.claimed[index] = true;
+
+  lock.unlock();
+  const bool succeeded = encodeStrip(pipeline, encoders[index], slot);
+  lock.lock();
+
+  pipeline.claimed[index] = false;
+  if (!succeeded) {
+    encoders[index].succeeded = false;
+    pipeline.aborted = true;
+  } else if (finish) {
+    pipeline.finished[index] = true;
+  } else {
+    pipeline.consumed[index]++;
+  }
+  pipeline.strip_free.notify_all();
+  pipeline.strip_ready.notify_all();
+  return true;
+}
+
+/**
+ * Encode task of the pool. Encodes strips with any encoder that has some
+ * and returns once there is none left to claim. It never waits for the
+ * decoder, which may be blocked reading a java stream, so it does not park
+ * a worker of the shared pool.
+ *
+ * @param first encoder to try first
+ */
+static void encodeClaimableStrips(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder* encoders,
+    size_t first) {
+  std::unique_lock<std::mutex> lock(pipeline.mutex);
+  pipeline.queued_tasks--;
+  while (runEncoderStep(pipeline, encoders, first, lock)) {
+  }
+}
+
+/**
+ * Tops the encode tasks waiting in the pool up to one per encoder. Called
+ * whenever the decoder hands over a strip, as tasks return rather than wait
+ * for the next one.
+ */
+static void scheduleEncodeTasks(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder* encoders,
+    TaskGroup& encode_tasks) {
+  size_t first;
+  size_t count;
+  {
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    first = pipeline.queued_tasks;
+    count = pipeline.consumed.size() - first;
+    pipeline.queued_tasks += count;
+  }
+  for (size_t i = first; i < first + count; i++) {
+    encode_tasks.run([&pipeline, encoders, i] {
+      encodeClaimableStrips(pipeline, encoders, i);
+    });
+  }
+}
+
+/**
+ * Encodes strips with any encoder that has some until all encoders are
+ * finished or the pipeline is aborted. Runs on the calling thread once
+ * decoding is done, waiting for pool tasks to release the encoders they
+ * claimed.
+ */
+static void encodeRemainingStrips(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder* encoders) {
+  std::unique_lock<std::mutex> lock(pipeline.mutex);
+  while (!pipeline.aborted && !pipeline.allFinished()) {
+    if (!runEncoderStep(pipeline, encoders, 0, lock)) {
+      pipeline.strip_ready.wait(lock);
+    }
+  }
+}
+
+/**
+ * Decodes all scanlines into the strips of the pipeline. Runs on the calling
+ * thread, as the source might read from a java stream.
+ *
+ * <p> While all strips are in use it encodes strips of the encoders that
+ * hold them up, rather than waiting for pool threads that may not get to
+ * run soon.
+ */
+static void decodeStrips(
+    ScanlinePipeline& pipeline,
+    PipelineEncoder* encoders,
+    TaskGroup& encode_tasks,
+    ScanlineReader& reader) {
+  while (hasMoreScanlines(reader)) {
+    unsigned int slot;
+    {
+      std::unique_lock<std::mutex> lock(pipeline.mutex);
+      while (pipeline.produced - pipeline.released() >= kPipelineStripCount &&
+          !pipeline.aborted) {
+        if (!runEncoderStep(pipeline, encoders, 0, lock)) {
+          pipeline.strip_free.wait(lock);
+        }
+      }
+      if (pipeline.aborted) {
+        return;
+      }
+      slot = pipeline.produced % kPipelineStripCount;
+    }
+
+    JDIMENSION rows = 0;
+    while (rows < pipeline.rows_per_strip && hasMoreScanlines(reader)) {
+      rows += readScanlines(
+          reader,
+          pipeline.strips[slot] + rows,
+          pipeline.rows_per_strip - rows);
+    }
+    pipeline.strip_rows[slot] = rows;
+
+    {
+      std::lock_guard<std::mutex> lock(pipeline.mutex);
+      pipeline.produced++;
+    }
+    pipeline.strip_ready.notify_all();
+    scheduleEncodeTasks(pipeline, encoders, encode_tasks);
+  }
+}
+
+/**
+ * Writes buffer to destination the same way libjpeg would.
+ */
+static void writeToDestination(
+    struct jpeg_compress_struct& cinfo,
+    struct jpeg_destination_mgr& destination,
+    const std::vector<uint8_t>& buffer) {
+  cinfo.dest = &destination;
+  (*destination.init_destination)(&cinfo);
+  size_t offset = 0;
+  while (offset < buffer.size()) {
+    if (destination.free_in_buffer == 0 &&
+        !(*destination.empty_output_buffer)(&cinfo)) {
+      jpegFail((j_common_ptr) &cinfo, "Could not write output");
+    }
+    const size_t count =
+        std::min(destination.free_in_buffer, buffer.size() - offset);
+    memcpy(destination.next_output_byte, buffer.data() + offset, count);
+    destination.next_output_byte += count;
+    destination.free_in_buffer -= count;
+    offset += count;
+  }
+  (*destination.term_destination)(&cinfo);
+}
+
+/**
+ * Decodes and encodes scanlines one after another on the calling thread.
+ */
+static void resizeScanlines(
+    ScanlineReader& reader,
+    struct jpeg_compress_struct& cinfo) {
+  struct jpeg_decompress_struct& dinfo = reader.dinfo;
   jpeg_start_compress(&cinfo, true);
 
   jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
-  size_t row_stride = dinfo.output_width * dinfo.output_components;
+  size_t row_stride = cinfo.image_width * cinfo.input_components;
   JSAMPARRAY buffer = (*dinfo.mem->alloc_sarray)
     ((j_common_ptr) &dinfo, JPOOL_IMAGE, row_stride, 1);
-  while (dinfo.output_scanline < dinfo.output_height) {
-    jpeg_read_scanlines(&dinfo, buffer, 1);
+  while (hasMoreScanlines(reader)) {
+    readScanlines(reader, buffer, 1);
     (void) jpeg_write_scanlines(&cinfo, buffer, 1);
   }
 
-  // tear down
   jpeg_finish_compress(&cinfo);
-  jpeg_destroy_decompress(&dinfo);
-  jpeg_destroy_compress(&cinfo);
 }
 
-void transformJpeg(
-    JNIEnv* env,
-    jobject is,
-    jobject os,
-    RotationType rotation_type,
-    const ScaleFactor& scale_factor,
-    int quality) {
-  const bool should_scale = scale_factor.shouldScale();
-  const bool should_rotate = rotation_type != RotationType::ROTATE_0;
-  THROW_AND_RETURN_IF(
-      !should_scale && !should_rotate,
-      "no transformation to perform");
+/**
+ * Decodes scanlines from reader on the calling thread while pool tasks
+ * encode them with the encoders. The calling thread encodes as well when
+ * the pool is busy, so the pipeline never waits for a pool thread. Pool
+ * tasks never wait for the decoder either: they encode the strips handed
+ * over so far and return, and more are submitted with every new strip.
+ *
+ * <p> Encoders must have started compressing. Pool tasks must not call into
+ * java, so encoders have to write to memory.
+ *
+ * <p> Returns normally also on failure, with errors of dinfo recorded in
+ * the status of error_handler and those of encoders in their own
+ * error_handler. Error handling of all structs is back to error_handler.
+ */
+static void runScanlinePipeline(
+    JpegErrorHandler& error_handler,
+    ScanlineReader& reader,
+    size_t row_stride,
+    PipelineEncoder* encoders,
+    size_t encoder_count) {
+  struct jpeg_decompress_struct& dinfo = reader.dinfo;
+  JSAMPARRAY strips[kPipelineStripCount];
+  const JDIMENSION rows_per_strip = allocStrips(dinfo, row_stride, strips);
 
-  JpegInputStreamWrapper is_wrapper{env, is};
-  JpegOutputStreamWrapper os_wrapper{env, os};
-  JpegMemoryDestination mem_destination;
-  JpegMemorySource mem_source;
+  ScanlinePipeline pipeline{encoder_count};
+  std::copy(std::begin(strips), std::end(strips), pipeline.strips);
+  pipeline.rows_per_strip = rows_per_strip;
 
-  if (should_scale) {
-    resizeJpeg(
-        env,
-        is_wrapper.public_fields,
-        should_rotate ?
-            mem_destination.public_fields : os_wrapper.public_fields,
-        scale_factor,
-        quality);
-    RETURN_IF_EXCEPTION_PENDING;
+  // None of the structs may be destroyed while encoders run, so all of
+  // them get handlers that only jump back to where they run
+  JpegErrorHandler decoder_error{*error_handler.status};
+  dinfo.err = &decoder_error.pub;
+  for (size_t i = 0; i < encoder_count; i++) {
+    encoders[i].cinfo->err = &encoders[i].error_handler.pub;
+    encoders[i].succeeded = true;
+  }
+
+  // the calling thread waits for the outputs, hence the priority
+  TaskGroup encode_tasks{TaskPriority::VISIBLE};
+  if (setjmp(decoder_error.setjmpBuffer)) {
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.aborted = true;
+  } else {
+    decodeStrips(pipeline, encoders, encode_tasks, reader);
+    {
+      std::lock_guard<std::mutex> lock(pipeline.mutex);
+      pipeline.decoder_done = true;
+    }
+    scheduleEncodeTasks(pipeline, encoders, encode_tasks);
+  }
+  pipeline.strip_ready.notify_all();
+  encodeRemainingStrips(pipeline, encoders);
+  encode_tasks.wait();
+
+  dinfo.err = &error_handler.pub;
+  for (size_t i = 0; i < encoder_count; i++) {
+    encoders[i].cinfo->err = &error_handler.pub;
+  }
+}
+
+/**
+ * Decodes scanlines on the calling thread while a pool thread encodes
+ * them, so the resize takes about as long as the slower of both.
+ *
+ * <p> The encoder must not call into java, so it encodes into encoded and
+ * the result is copied to destination once it is done, unless destination
+ * is encoded itself. The encoded image is small compared to the decoded
+ * one, which only ever has a few strips in memory.
+ */
+static void resizeScanlinesPipelined(
+    JpegErrorHandler& error_handler,
+    ScanlineReader& reader,
+    struct jpeg_compress_struct& cinfo,
+    struct jpeg_destination_mgr& destination,
+    JpegMemoryDestination& encoded) {
+  struct jpeg_decompress_struct& dinfo = reader.dinfo;
+  cinfo.dest = &encoded.public_fields;
+  jpeg_start_compress(&cinfo, true);
+  jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
+
+  PipelineEncoder encoder{};
+  encoder.cinfo = &cinfo;
+  runScanlinePipeline(
+      error_handler,
+      reader,
+      cinfo.image_width * cinfo.input_components,
+      &encoder,
+      1);
+
+  jpegJumpOnFailure((j_common_ptr) &dinfo);
+  if (!encoder.succeeded) {
+    jpegFail((j_common_ptr) &cinfo, encoder.error_handler.message);
+  }
+
+  if (&destination != &encoded.public_fields) {
+    writeToDestination(cinfo, destination, encoded.buffer);
+  }
+}
+
+/**
+ * Reads all scanlines of reader into memory allocated from the pool of its
+ * decompress struct.
+ */
+static JSAMPARRAY readImage(ScanlineReader& reader, size_t row_stride) {
+  struct jpeg_decompress_struct& dinfo = reader.dinfo;
+  JSAMPARRAY image = (*dinfo.mem->alloc_sarray)(
+      (j_common_ptr) &dinfo,
+      JPOOL_IMAGE,
+      row_stride,
+      reader.output_height);
+  while (hasMoreScanlines(reader)) {
+    readScanlines(
+        reader,
+        image + reader.rows_read,
+        reader.output_height - reader.rows_read);
+  }
+  return image;
+}
+
+/**
+ * Encodes image read by readImage, transformed by transform.
+ */
+static void writeImage(
+    struct jpeg_decompress_struct& dinfo,
+    struct jpeg_compress_struct& cinfo,
+    JSAMPARRAY image,
+    const PixelTransform& transform) {
+  jpeg_start_compress(&cinfo, true);
+  jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
+
+  if (!transform.swap_axes && !transform.flip_x && !transform.flip_y) {
+    while (cinfo.next_scanline < cinfo.image_height) {
+      (void) jpeg_write_scanlines(
+          &cinfo,
+          image + cinfo.next_scanline,
+          cinfo.image_height - cinfo.next_scanline);
+    }
+    jpeg_finish_compress(&cinfo);
+    return;
   }
 
-  if (should_rotate) {
-    if (should_scale) {
-      mem_source.setBuffer(std::move(mem_destination.buffer));
+  JSAMPARRAY strip = (*dinfo.mem->alloc_sarray)(
+      (j_common_ptr) &dinfo,
+      JPOOL_IMAGE,
+      cinfo.image_width * cinfo.input_components,
+      kRotationTileSize);
+  writeTransformedScanlines(cinfo, image, transform, strip);
+  jpeg_finish_compress(&cinfo);
+}
+
+/**
+ * Decodes the whole image, then encodes it rotated.
+ */
+static void rotateScanlines(
+    ScanlineReader& reader,
+    struct jpeg_compress_struct& cinfo,
+    const PixelTransform& transform) {
+  const JDIMENSION decoded_width =
+      transform.swap_axes ? cinfo.image_height : cinfo.image_width;
+  JSAMPARRAY image = readImage(reader, decoded_width * cinfo.input_components);
+  writeImage(reader.dinfo, cinfo, image, transform);
+}
+
+/**
+ * Encodes the image being decompressed by dinfo at width x height, rotated
+ * by rotation_type.
+ *
+ * <p> The image is decoded line by line and encoded again. If width and
+ * height differ from the decoded dimensions, every line is resampled in
+ * between. Large images are decoded and encoded concurrently.
+ *
+ * <p> Rotation is done on the decoded pixels, so scale and rotate cost a
+ * single decode and encode. Images too large to be held decoded are encoded
+ * unrotated into unrotated instead, to be rotated by the caller. Otherwise
+ * unrotated may serve as scratch memory.
+ *
+ * @return false if the image still needs to be rotated
+ */
+static bool encodeResized(
+    JpegErrorHandler& error_handler,
+    struct jpeg_decompress_struct& dinfo,
+    struct jpeg_destination_mgr& destination,
+    JpegMemoryDestination& unrotated,
+    JDIMENSION width,
+    JDIMENSION height,
+    RotationType rotation_type,
+    int quality,
+    int restart_rows) {
+  const bool should_rotate = rotation_type != RotationType::ROTATE_0;
+  const bool fuse_rotation = should_rotate &&
+      (uint64_t) width * height * dinfo.output_components <=
+          kFusedRotationMaxBytes;
+  const PixelTransform transform = getPixelTransform(
+      fuse_rotation ? rotation_type : RotationType::ROTATE_0);
+  struct jpeg_destination_mgr& output =
+      should_rotate && !fuse_rotation ? unrotated.public_fields : destination;
+
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(cinfo, dinfo, error_handler, output, restart_rows);
+  cinfo.image_width = transform.swap_axes ? height : width;
+  cinfo.image_height = transform.swap_axes ? width : height;
+  jpeg_set_quality(&cinfo, quality, false);
+
+  ScanlineReader reader{dinfo, nullptr, nullptr, height, 0};
+  JpegResampler resampler;
+  if (width != dinfo.output_width || height != dinfo.output_height) {
+    resampler.init(
+        (j_common_ptr) &dinfo,
+        dinfo.output_width,
+        dinfo.output_height,
+        width,
+        height,
+        dinfo.output_components);
+    reader.resampler = &resampler;
+    reader.input_row = (*dinfo.mem->alloc_sarray)(
+        (j_common_ptr) &dinfo,
+        JPOOL_IMAGE,
+        dinfo.output_width * dinfo.output_components,
+        1);
+  }
+
+  if (fuse_rotation) {
+    rotateScanlines(reader, cinfo, transform);
+  } else if ((uint64_t) dinfo.output_width * dinfo.output_height >=
+      kPipelinedResizeMinPixels) {
+    resizeScanlinesPipelined(
+        error_handler,
+        reader,
+        cinfo,
+        output,
+        unrotated);
+  } else {
+    resizeScanlines(reader, cinfo);
+  }
+
+  jpeg_destroy_compress(&cinfo);
+  error_handler.cinfoPtr = nullptr;
+  return !should_rotate || fuse_rotation;
+}
+
+/**
+ * Rotates jpeg encoded into mem_destination. Its markers were filtered
+ * already, so all of them are kept.
+ */
+static void rotateJpeg(
+    JpegStatus& status,
+    JpegMemoryDestination& mem_destination,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type) {
+  JpegMemorySource mem_source;
+  mem_source.setBuffer(std::move(mem_destination.buffer));
+  rotateJpeg(
+      status,
+      mem_source.public_fields,
+      destination,
+      rotation_type,
+      MarkerPolicy::ALL);
+}
+
+/**
+ * Resizes jpeg by one of the scale factors supported by libjpeg and
+ * rotates it.
+ *
+ * @return quality the image was encoded with, 0 on error
+ */
+static int resizeJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const ScaleFactor& scale_factor,
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  FAIL_AND_RETURNVAL_IF(
+      restart_rows < 0,
+      "restart interval cannot be negative",
+      0);
+  FAIL_AND_RETURNVAL_IF(quality < 1, "quality should not be lower than 1", 0);
+  FAIL_AND_RETURNVAL_IF(
+      quality > 100,
+      "quality should not be greater than 100",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      8 % scale_factor.getDenominator() > 0,
+      "wrong scale denominator",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() < 1,
+      "scale numerator cannot be lower than 1",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() > 16,
+      "scale numerator cannot be greater than 16",
+      0);
+
+  JpegMemoryDestination unrotated;
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return 0;
+  }
+
+  // prepare decompress struct
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(
+      dinfo,
+      error_handler,
+      source,
+      marker_policy,
+      rotation_type);
+  const int output_quality =
+      clampJpegQuality(quality, estimateJpegQuality(dinfo));
+  dinfo.scale_num = scale_factor.getNumerator();
+  dinfo.scale_denom = scale_factor.getDenominator();
+  dinfo.out_color_space = JCS_RGB;
+  (void) jpeg_start_decompress(&dinfo);
+
+  const bool rotated = encodeResized(
+      error_handler,
+      dinfo,
+      destination,
+      unrotated,
+      dinfo.output_width,
+      dinfo.output_height,
+      rotation_type,
+      output_quality,
+      restart_rows);
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+
+  if (!rotated) {
+    rotateJpeg(status, unrotated, destination, rotation_type);
+  }
+  return output_quality;
+}
+
+/**
+ * Returns the smallest numerator of a libjpeg n/8 scale factor that decodes
+ * the image at no less than target_size.
+ */
+static unsigned int getDCTScaleNumerator(
+    const struct jpeg_decompress_struct& dinfo,
+    const TargetSize& target_size) {
+  for (unsigned int numerator = 1; numerator < 8; numerator++) {
+    // libjpeg rounds scaled dimensions up
+    const JDIMENSION width = (dinfo.image_width * numerator + 7) / 8;
+    const JDIMENSION height = (dinfo.image_height * numerator + 7) / 8;
+    if (width >= (JDIMENSION) target_size.getWidth() &&
+        height >= (JDIMENSION) target_size.getHeight()) {
+      return numerator;
+    }
+  }
+  return 8;
+}
+
+/**
+ * Resizes jpeg to exactly target_size and rotates it.
+ *
+ * <p> Most of the reduction is done by the IDCT, decoding at the smallest
+ * n/8 scale that is not smaller than the target. The remaining ratio, at
+ * most 2 unless the aspect ratio changes, is covered by area resampling.
+ *
+ * @return quality the image was encoded with, 0 on error
+ */
+static int resizeJpegToSize(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const TargetSize& target_size,
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  FAIL_AND_RETURNVAL_IF(
+      restart_rows < 0,
+      "restart interval cannot be negative",
+      0);
+  FAIL_AND_RETURNVAL_IF(quality < 1, "quality should not be lower than 1", 0);
+  FAIL_AND_RETURNVAL_IF(
+      quality > 100,
+      "quality should not be greater than 100",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      target_size.getWidth() < 1 || target_size.getHeight() < 1,
+      "target size cannot be lower than 1",
+      0);
+
+  JpegMemoryDestination unrotated;
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return 0;
+  }
+
+  // prepare decompress struct
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(
+      dinfo,
+      error_handler,
+      source,
+      marker_policy,
+      rotation_type);
+  const int output_quality =
+      clampJpegQuality(quality, estimateJpegQuality(dinfo));
+  if ((JDIMENSION) target_size.getWidth() > dinfo.image_width ||
+      (JDIMENSION) target_size.getHeight() > dinfo.image_height) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "target size cannot be greater than image size");
+  }
+  dinfo.scale_num = getDCTScaleNumerator(dinfo, target_size);
+  dinfo.scale_denom = 8;
+  dinfo.out_color_space = JCS_RGB;
+  (void) jpeg_start_decompress(&dinfo);
+
+  const bool rotated = encodeResized(
+      error_handler,
+      dinfo,
+      destination,
+      unrotated,
+      target_size.getWidth(),
+      target_size.getHeight(),
+      rotation_type,
+      output_quality,
+      restart_rows);
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+
+  if (!rotated) {
+    rotateJpeg(status, unrotated, destination, rotation_type);
+  }
+  return output_quality;
+}
+
+int transformJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const ScaleFactor& scale_factor,
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  const bool should_scale = scale_factor.shouldScale();
+  const bool should_rotate = rotation_type != RotationType::ROTATE_0;
+  FAIL_AND_RETURNVAL_IF(
+      !should_scale && !should_rotate,
+      "no transformation to perform",
+      0);
+
+  if (should_scale) {
+    return resizeJpeg(
+        status,
+        source,
+        destination,
+        rotation_type,
+        scale_factor,
+        quality,
+        marker_policy,
+        restart_rows);
+  }
+  rotateJpeg(status, source, destination, rotation_type, marker_policy);
+  return 0;
+}
+
+int transformJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const TargetSize& target_size,
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  return resizeJpegToSize(
+      status,
+      source,
+      destination,
+      rotation_type,
+      target_size,
+      quality,
+      marker_policy,
+      restart_rows);
+}
+
+int transformJpegWithByteLimit(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const ScaleFactor& scale_factor,
+    int max_quality,
+    size_t max_bytes,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  FAIL_AND_RETURNVAL_IF(
+      restart_rows < 0,
+      "restart interval cannot be negative",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      max_quality < 1,
+      "quality should not be lower than 1",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      max_quality > 100,
+      "quality should not be greater than 100",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      8 % scale_factor.getDenominator() > 0,
+      "wrong scale denominator",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() < 1,
+      "scale numerator cannot be lower than 1",
+      0);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() > 16,
+      "scale numerator cannot be greater than 16",
+      0);
+  FAIL_AND_RETURNVAL_IF(max_bytes < 1, "byte limit cannot be lower than 1", 0);
+
+  JpegMemoryDestination attempt;
+  JpegMemoryDestination fitting;
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return 0;
+  }
+
+  // prepare decompress struct
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(
+      dinfo,
+      error_handler,
+      source,
+      marker_policy,
+      rotation_type);
+  const int top_quality =
+      clampJpegQuality(max_quality, estimateJpegQuality(dinfo));
+  dinfo.scale_num = scale_factor.getNumerator();
+  dinfo.scale_denom = scale_factor.getDenominator();
+  dinfo.out_color_space = JCS_RGB;
+  (void) jpeg_start_decompress(&dinfo);
+
+  // decode once, every attempt is encoded from memory
+  ScanlineReader reader{dinfo, nullptr, nullptr, dinfo.output_height, 0};
+  JSAMPARRAY image =
+      readImage(reader, dinfo.output_width * dinfo.output_components);
+  const PixelTransform transform = getPixelTransform(rotation_type);
+
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(
+      cinfo, dinfo, error_handler, attempt.public_fields, restart_rows);
+  if (transform.swap_axes) {
+    std::swap(cinfo.image_width, cinfo.image_height);
+  }
+
+  // binary search for the highest quality that fits, the top one first as
+  // it usually does
+  int quality = 0;
+  int low = 1;
+  int high = top_quality;
+  int candidate = top_quality;
+  while (low <= high) {
+    attempt.buffer.clear();
+    jpeg_set_quality(&cinfo, candidate, false);
+    writeImage(dinfo, cinfo, image, transform);
+    if (attempt.buffer.size() <= max_bytes) {
+      quality = candidate;
+      std::swap(fitting.buffer, attempt.buffer);
+      low = candidate + 1;
+    } else {
+      high = candidate - 1;
+    }
+    candidate = (low + high + 1) / 2;
+  }
+  if (quality == 0) {
+    jpegFail(
+        (j_common_ptr) &cinfo,
+        "image cannot be encoded within byte limit");
+  }
+  writeToDestination(cinfo, destination, fitting.buffer);
+
+  // tear down
+  jpeg_destroy_compress(&cinfo);
+  error_handler.cinfoPtr = nullptr;
+  jpeg_destroy_decompress(&dinfo);
+  return quality;
+}
+
+void cropJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const CropInfo& crop_info,
+    MarkerPolicy marker_policy) {
+  FAIL_AND_RETURN_IF(
+      crop_info.getX() < 0 || crop_info.getY() < 0,
+      "crop offset cannot be negative");
+  FAIL_AND_RETURN_IF(
+      crop_info.getWidth() < 1 || crop_info.getHeight() < 1,
+      "crop size cannot be lower than 1");
+  transformJpegLossless(
+      status,
+      source,
+      destination,
+      rotation_type,
+      &crop_info,
+      marker_policy);
+}
+
+void optimizeJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    bool progressive,
+    bool strip_markers) {
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
+  }
+
+  // prepare decompress struct, markers have to be saved while reading
+  const JCOPY_OPTION copy_option = strip_markers ? JCOPYOPT_NONE : JCOPYOPT_ALL;
+  struct jpeg_decompress_struct dinfo;
+  createDecompressStruct(dinfo, error_handler, source);
+  jcopy_markers_setup(&dinfo, copy_option);
+  (void) jpeg_read_header(&dinfo, true);
+
+  // create compress struct
+  struct jpeg_compress_struct cinfo;
+  initCompressStruct(cinfo, dinfo, error_handler, destination, 0);
+
+  // re-encode the coefficients with image specific huffman tables
+  jvirt_barray_ptr* coefficients = jpeg_read_coefficients(&dinfo);
+  jpeg_copy_critical_parameters(&dinfo, &cinfo);
+  cinfo.optimize_coding = true;
+  if (progressive) {
+    jpeg_simple_progression(&cinfo);
+  }
+  jpeg_write_coefficients(&cinfo, coefficients);
+  jcopy_markers_execute(&dinfo, &cinfo, copy_option);
+
+  // tear down
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  jpeg_destroy_decompress(&dinfo);
+}
+
+int estimateJpegQuality(JpegStatus& status, struct jpeg_source_mgr& source) {
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return 0;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  createDecompressStruct(dinfo, error_handler, source);
+  (void) jpeg_read_header(&dinfo, true);
+  const int quality = estimateJpegQuality(dinfo);
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+  return quality;
+}
+
+/**
+ * Sets the decompress parameters createDecompressStruct sets, which
+ * jpeg_read_header resets to the library defaults.
+ */
+static void setFastDecompressParameters(struct jpeg_decompress_struct& dinfo) {
+  dinfo.dct_method = JDCT_IFAST;
+  dinfo.do_fancy_upsampling = FALSE;
+  dinfo.do_block_smoothing = FALSE;
+}
+
+/**
+ * Decodes all scanlines of dinfo straight into the output, row by row, and
+ * finishes decompression.
+ *
+ * @return false if a scanline could not be read
+ */
+static bool decodeScanlines(
+    struct jpeg_decompress_struct& dinfo,
+    uint8_t* pixels,
+    size_t stride) {
+  (void) jpeg_start_decompress(&dinfo);
+  while (dinfo.output_scanline < dinfo.output_height) {
+    JSAMPROW row = pixels + dinfo.output_scanline * stride;
+    if (jpeg_read_scanlines(&dinfo, &row, 1) != 1) {
+      return false;
+    }
+  }
+  jpeg_finish_decompress(&dinfo);
+  return true;
+}
+
+/**
+ * Reads the header and sets the scale decodeJpeg decodes the image at.
+ */
+static void initDecodeStruct(
+    struct jpeg_decompress_struct& dinfo,
+    JpegErrorHandler& error_handler,
+    struct jpeg_source_mgr& source,
+    const TargetSize& target_size) {
+  initDecompressStruct(dinfo, error_handler, source);
+  setFastDecompressParameters(dinfo);
+  dinfo.scale_num = getDCTScaleNumerator(dinfo, target_size);
+  dinfo.scale_denom = 8;
+}
+
+/**
+ * Validates decode output parameters, fails if they are wrong.
+ */
+static bool checkDecodeOutput(
+    JpegStatus& status,
+    PixelFormat pixel_format,
+    unsigned int width,
+    size_t stride) {
+  FAIL_AND_RETURNVAL_IF(
+      pixel_format != PixelFormat::RGBA &&
+          pixel_format != PixelFormat::RGB_565,
+      "Wrong pixel format for jpeg decoding",
+      false);
+  FAIL_AND_RETURNVAL_IF(
+      stride < (size_t) bytesPerPixel(pixel_format) * width,
+      "stride is too small for the output width",
+      false);
+  return true;
+}
+
+/**
+ * Validates a scale factor of a decode, which can only downscale.
+ */
+static bool checkDecodeScaleFactor(
+    JpegStatus& status,
+    const ScaleFactor& scale_factor) {
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getDenominator() != 8,
+      "wrong scale denominator",
+      false);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() < 1,
+      "scale numerator cannot be lower than 1",
+      false);
+  FAIL_AND_RETURNVAL_IF(
+      scale_factor.getNumerator() > 8,
+      "scale numerator cannot be greater than 8",
+      false);
+  return true;
+}
+
+/**
+ * Sets the output color space of a decode.
+ */
+static void setDecodeOutputFormat(
+    struct jpeg_decompress_struct& dinfo,
+    PixelFormat pixel_format,
+    bool dither) {
+  if (pixel_format == PixelFormat::RGBA) {
+    // alpha is set to 0xFF, which is also correct for premultiplied output
+    dinfo.out_color_space = JCS_EXT_RGBA;
+  } else {
+    dinfo.out_color_space = JCS_RGB565;
+    dinfo.dither_mode = dither ? JDITHER_ORDERED : JDITHER_NONE;
+  }
+}
+
+bool getDecodedJpegSize(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const TargetSize& target_size,
+    unsigned int& width,
+    unsigned int& height) {
+  FAIL_AND_RETURNVAL_IF(
+      target_size.getWidth() < 1 || target_size.getHeight() < 1,
+      "target size cannot be lower than 1",
+      false);
+
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecodeStruct(dinfo, error_handler, source, target_size);
+  jpeg_calc_output_dimensions(&dinfo);
+  width = dinfo.output_width;
+  height = dinfo.output_height;
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+  return true;
+}
+
+bool getDecodedJpegSize(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const ScaleFactor& scale_factor,
+    unsigned int& width,
+    unsigned int& height) {
+  if (!checkDecodeScaleFactor(status, scale_factor)) {
+    return false;
+  }
+
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return false;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(dinfo, error_handler, source);
+  dinfo.scale_num = scale_factor.getNumerator();
+  dinfo.scale_denom = scale_factor.getDenominator();
+  jpeg_calc_output_dimensions(&dinfo);
+  width = dinfo.output_width;
+  height = dinfo.output_height;
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+  return true;
+}
+
+void decodeJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const TargetSize& target_size,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride) {
+  FAIL_AND_RETURN_IF(
+      target_size.getWidth() < 1 || target_size.getHeight() < 1,
+      "target size cannot be lower than 1");
+  if (!checkDecodeOutput(status, pixel_format, width, stride)) {
+    return;
+  }
+
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecodeStruct(dinfo, error_handler, source, target_size);
+  setDecodeOutputFormat(dinfo, pixel_format, dither);
+  jpeg_calc_output_dimensions(&dinfo);
+  if (dinfo.output_width > width || dinfo.output_height > height) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "output is too small for the decoded image");
+  }
+
+  if (!decodeScanlines(dinfo, pixels, stride)) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "Could not read scanline");
+  }
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+}
+
+/**
+ * Decoded images with at least this many pixels are decoded in bands on
+ * multiple threads. Below that starting the threads does not pay off.
+ */
+static const uint64_t kParallelDecodeMinPixels = 1024 * 1024;
+
+/**
+ * Lower bound of rows per band of a parallel decode, in the source image
+ */
+static const unsigned int kParallelDecodeMinBandRows = 128;
+
+/**
+ * Decoder of one restart band on a thread of its own.
+ */
+struct BandDecoder {
+  const RestartBand* band;
+  uint8_t* pixels;                // receives the first row of the band
+  unsigned int width;             // expected output size of the band
+  unsigned int height;
+  // token of the thread that asked for the decode, nullptr for none
+  const JpegCancellationToken* cancellation_token;
+  JpegWorkerErrorHandler error_handler;
+  bool succeeded;
+};
+
+/**
+ * Decodes a band with the output parameters of dinfo. Runs on a worker
+ * thread, so errors are only recorded in the error handler of decoder.
+ *
+ * @return false if libjpeg failed or the band does not fit its rows
+ */
+static bool decodeBand(
+    const struct jpeg_decompress_struct& dinfo,
+    BandDecoder& decoder,
+    size_t stride) {
+  JpegMemorySource source;
+  source.setExternalBuffer(
+      decoder.band->data.data(),
+      decoder.band->data.size());
+
+  struct jpeg_decompress_struct binfo;
+  memset(&binfo, 0, sizeof(struct jpeg_decompress_struct));
+  binfo.err = &decoder.error_handler.pub;
+  if (setjmp(decoder.error_handler.setjmpBuffer)) {
+    jpeg_destroy_decompress(&binfo);
+    return false;
+  }
+  jpeg_create_decompress(&binfo);
+  installCancellationMonitor((j_common_ptr) &binfo, decoder.cancellation_token);
+  binfo.src = &source.public_fields;
+  jpeg_read_header(&binfo, true);
+  setFastDecompressParameters(binfo);
+  binfo.scale_num = dinfo.scale_num;
+  binfo.scale_denom = dinfo.scale_denom;
+  binfo.out_color_space = dinfo.out_color_space;
+  binfo.dither_mode = dinfo.dither_mode;
+  jpeg_calc_output_dimensions(&binfo);
+  const char* error = nullptr;
+  if (binfo.output_width != decoder.width ||
+      binfo.output_height != decoder.height) {
+    error = "restart band does not match the image";
+  } else if (!decodeScanlines(binfo, decoder.pixels, stride)) {
+    error = "Could not read scanline";
+  }
+  if (error != nullptr) {
+    snprintf(
+        decoder.error_handler.message,
+        sizeof(decoder.error_handler.message),
+        "%s",
+        error);
+  }
+
+  jpeg_destroy_decompress(&binfo);
+  return error == nullptr;
+}
+
+void decodeJpegParallel(
+    JpegStatus& status,
+    const uint8_t* data,
+    size_t size,
+    const TargetSize& target_size,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride,
+    unsigned int max_threads) {
+  FAIL_AND_RETURN_IF(
+      target_size.getWidth() < 1 || target_size.getHeight() < 1,
+      "target size cannot be lower than 1");
+  if (!checkDecodeOutput(status, pixel_format, width, stride)) {
+    return;
+  }
+
+  JpegMemorySource source;
+  source.setExternalBuffer(data, size);
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecodeStruct(dinfo, error_handler, source.public_fields, target_size);
+  setDecodeOutputFormat(dinfo, pixel_format, dither);
+  jpeg_calc_output_dimensions(&dinfo);
+  if (dinfo.output_width > width || dinfo.output_height > height) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "output is too small for the decoded image");
+  }
+
+  // the ordered dither pattern repeats every 4 output rows, bands have to
+  // start at a multiple of it to continue the pattern
+  const unsigned int row_alignment =
+      dinfo.dither_mode == JDITHER_ORDERED ? 4 * 8 : 1;
+  std::vector<RestartBand> bands;
+  if (max_threads < 2 ||
+      (uint64_t) dinfo.output_width * dinfo.output_height <
+          kParallelDecodeMinPixels ||
+      !splitRestartBands(
+          data,
+          size,
+          max_threads,
+          kParallelDecodeMinBandRows,
+          row_alignment,
+          bands)) {
+    if (!decodeScanlines(dinfo, pixels, stride)) {
+      jpegFail(
+          (j_common_ptr) &dinfo,
+          "Could not read scanline");
+    }
+    jpeg_destroy_decompress(&dinfo);
+    return;
+  }
+
+  // band rows start at multiples of 8, so their scaled first rows are exact
+  std::vector<BandDecoder> decoders(bands.size());
+  for (size_t i = 0; i < bands.size(); i++) {
+    const unsigned int first_row = bands[i].first_row * dinfo.scale_num / 8;
+    const unsigned int end_row = i + 1 < bands.size()
+        ? bands[i + 1].first_row * dinfo.scale_num / 8
+        : dinfo.output_height;
+    decoders[i].band = &bands[i];
+    decoders[i].pixels = pixels + first_row * stride;
+    decoders[i].width = dinfo.output_width;
+    decoders[i].height = end_row - first_row;
+    decoders[i].cancellation_token = getCurrentCancellationToken();
+    decoders[i].succeeded = false;
+  }
+
+  // pool tasks must not call into java, the first band is decoded on this
+  // thread as well. Someone waits for the pixels, hence the priority.
+  {
+    TaskGroup band_tasks{TaskPriority::VISIBLE};
+    for (size_t i = 1; i < decoders.size(); i++) {
+      band_tasks.run([&dinfo, &decoders, stride, i] {
+        decoders[i].succeeded = decodeBand(dinfo, decoders[i], stride);
+      });
+    }
+    decoders[0].succeeded = decodeBand(dinfo, decoders[0], stride);
+    band_tasks.wait();
+  }
+
+  // a cancelled band fails with a message only, report it as cancelled
+  jpegThrowIfCancelled((j_common_ptr) &dinfo);
+  for (const BandDecoder& decoder : decoders) {
+    if (!decoder.succeeded) {
+      jpegFail((j_common_ptr) &dinfo, decoder.error_handler.message);
+    }
+  }
+
+  // tear down
+  jpeg_destroy_decompress(&dinfo);
+}
+
+void decodeJpegRegion(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const ScaleFactor& scale_factor,
+    const CropInfo& region,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride) {
+  if (!checkDecodeScaleFactor(status, scale_factor) ||
+      !checkDecodeOutput(status, pixel_format, width, stride)) {
+    return;
+  }
+  FAIL_AND_RETURN_IF(
+      region.getX() < 0 || region.getY() < 0,
+      "region offset cannot be lower than 0");
+  FAIL_AND_RETURN_IF(
+      region.getWidth() < 1 || region.getHeight() < 1,
+      "region size cannot be lower than 1");
+  FAIL_AND_RETURN_IF(
+      (unsigned int) region.getWidth() > width ||
+          (unsigned int) region.getHeight() > height,
+      "output is too small for the region");
+
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    return;
+  }
+
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(dinfo, error_handler, source);
+  setFastDecompressParameters(dinfo);
+  dinfo.scale_num = scale_factor.getNumerator();
+  dinfo.scale_denom = scale_factor.getDenominator();
+  setDecodeOutputFormat(dinfo, pixel_format, dither);
+  // jpeg_skip_scanlines of libjpeg-turbo 1.5 mishandles the merged
+  // upsampler used without fancy upsampling. Fancy upsampling is forced on
+  // for every tile, not just the ones skipping rows, so the merged upsampler
+  // is never used and tiles of the same image match at their edges.
+  dinfo.do_fancy_upsampling = TRUE;
+  jpeg_calc_output_dimensions(&dinfo);
+  const JDIMENSION region_x = region.getX();
+  const JDIMENSION region_y = region.getY();
+  const JDIMENSION region_width = region.getWidth();
+  const JDIMENSION region_height = region.getHeight();
+  if (region_x + region_width > dinfo.output_width ||
+      region_y + region_height > dinfo.output_height) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "region does not fit into the decoded image");
+  }
+
+  (void) jpeg_start_decompress(&dinfo);
+
+  // only the iMCU columns intersecting the region are decoded. The crop
+  // is widened to the iMCU grid, its first columns may be left of region.
+  // Upsampling treats the crop edges as image edges, so one more pixel on
+  // each side keeps them out of the region unless it is at the image edge
+  JDIMENSION crop_x = region_x > 0 ? region_x - 1 : 0;
+  const bool ordered_dither = pixel_format == PixelFormat::RGB_565 && dither;
+  if (ordered_dither) {
+    // the 4 pixel dither pattern of a row starts at the left of the crop,
+    // which has to stay at a multiple of 4 of the image. The crop is
+    // widened to it here, jpeg_crop_scanline would not move it
+    const JDIMENSION imcu_width = dinfo.scale_num *
+        (dinfo.num_components == 1 ? 1 : dinfo.max_h_samp_factor);
+    while (crop_x % 4 != 0 || crop_x % imcu_width != 0) {
+      crop_x--;
+    }
+  }
+  JDIMENSION crop_width = std::min(
+      region_x + region_width + 1,
+      dinfo.output_width) - crop_x;
+  jpeg_crop_scanline(&dinfo, &crop_x, &crop_width);
+  const size_t bytes_per_pixel = bytesPerPixel(pixel_format);
+  const size_t skipped_bytes = (region_x - crop_x) * bytes_per_pixel;
+  // the dithered converter also shifts the pattern of rows not starting at
+  // a multiple of 4 bytes, those go through the row buffer
+  const bool aligned_rows =
+      reinterpret_cast<uintptr_t>(pixels) % 4 == 0 && stride % 4 == 0;
+  const bool read_in_place =
+      skipped_bytes == 0 && dinfo.output_width == region_width &&
+      (!ordered_dither || aligned_rows);
+  JSAMPARRAY row_buffer = read_in_place
+      ? nullptr
+      : (*dinfo.mem->alloc_sarray)(
+          (j_common_ptr) &dinfo,
+          JPOOL_IMAGE,
+          dinfo.output_width * bytes_per_pixel,
+          1);
+
+  // rows above the region are entropy decoded only, rows below are not
+  // decoded at all
+  if (region_y > 0 && jpeg_skip_scanlines(&dinfo, region_y) != region_y) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "Could not skip scanlines");
+  }
+  for (JDIMENSION y = 0; y < region_height; y++) {
+    uint8_t* out_row = pixels + y * stride;
+    JSAMPROW row = read_in_place ? out_row : row_buffer[0];
+    if (jpeg_read_scanlines(&dinfo, &row, 1) != 1) {
+      jpegFail(
+          (j_common_ptr) &dinfo,
+          "Could not read scanline");
+    }
+    if (!read_in_place) {
+      memcpy(out_row, row + skipped_bytes, region_width * bytes_per_pixel);
+    }
+  }
+
+  // tear down, aborting the decode of the remaining rows
+  jpeg_destroy_decompress(&dinfo);
+}
+
+void transformJpegMulti(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    RotationType rotation_type,
+    std::vector<JpegResizeSink>& sinks,
+    MarkerPolicy marker_policy,
+    int restart_rows) {
+  FAIL_AND_RETURN_IF(sinks.empty(), "no outputs to write");
+  FAIL_AND_RETURN_IF(restart_rows < 0, "restart interval cannot be negative");
+  int max_width = 0;
+  int max_height = 0;
+  for (const JpegResizeSink& sink : sinks) {
+    FAIL_AND_RETURN_IF(sink.quality < 1, "quality should not be lower than 1");
+    FAIL_AND_RETURN_IF(
+        sink.quality > 100,
+        "quality should not be greater than 100");
+    FAIL_AND_RETURN_IF(
+        sink.target_size.getWidth() < 1 || sink.target_size.getHeight() < 1,
+        "target size cannot be lower than 1");
+    max_width = std::max(max_width, sink.target_size.getWidth());
+    max_height = std::max(max_height, sink.target_size.getHeight());
+  }
+  // set once before setjmp, the accumulators above may live in registers
+  // a longjmp clobbers
+  const TargetSize max_size{max_width, max_height};
+
+  // owned by this frame, so an error jumping back here does not leak them
+  std::vector<struct jpeg_compress_struct> cinfos(sinks.size());
+  std::vector<JpegMemoryDestination> encoded(sinks.size());
+  std::vector<JpegResampler> resamplers(sinks.size());
+  std::vector<PipelineEncoder> encoders(sinks.size());
+  std::vector<bool> created(sinks.size(), false);
+
+  JpegErrorHandler error_handler{status};
+  if (setjmp(error_handler.setjmpBuffer)) {
+    for (size_t i = 0; i < sinks.size(); i++) {
+      if (created[i]) {
+        jpeg_destroy_compress(&cinfos[i]);
+      }
+    }
+    return;
+  }
+
+  // prepare decompress struct
+  struct jpeg_decompress_struct dinfo;
+  initDecompressStruct(
+      dinfo,
+      error_handler,
+      source,
+      marker_policy,
+      rotation_type);
+  if ((JDIMENSION) max_size.getWidth() > dinfo.image_width ||
+      (JDIMENSION) max_size.getHeight() > dinfo.image_height) {
+    jpegFail(
+        (j_common_ptr) &dinfo,
+        "target size cannot be greater than image size");
+  }
+  const int source_quality = estimateJpegQuality(dinfo);
+  dinfo.scale_num = getDCTScaleNumerator(dinfo, max_size);
+  dinfo.scale_denom = 8;
+  dinfo.out_color_space = JCS_RGB;
+  (void) jpeg_start_decompress(&dinfo);
+
+  // one compress struct per output, each with a resampler of its own.
+  // Outputs are rotated in memory as long as all of them held decoded fit
+  // into kFusedRotationMaxBytes, the others are rotated losslessly after
+  const bool should_rotate = rotation_type != RotationType::ROTATE_0;
+  uint64_t fused_rotation_bytes = 0;
+  for (size_t i = 0; i < sinks.size(); i++) {
+    struct jpeg_compress_struct& cinfo = cinfos[i];
+    PipelineEncoder& encoder = encoders[i];
+    const JDIMENSION width = sinks[i].target_size.getWidth();
+    const JDIMENSION height = sinks[i].target_size.getHeight();
+    const uint64_t image_bytes =
+        (uint64_t) width * height * dinfo.output_components;
+    const bool fuse_rotation = should_rotate &&
+        fused_rotation_bytes + image_bytes <= kFusedRotationMaxBytes;
+    encoder.transform = getPixelTransform(
+        fuse_rotation ? rotation_type : RotationType::ROTATE_0);
+
+    initCompressStruct(
+        cinfo, dinfo, error_handler, encoded[i].public_fields, restart_rows);
+    created[i] = true;
+    error_handler.cinfoPtr = nullptr;
+    cinfo.image_width = encoder.transform.swap_axes ? height : width;
+    cinfo.image_height = encoder.transform.swap_axes ? width : height;
+    sinks[i].quality = clampJpegQuality(sinks[i].quality, source_quality);
+    jpeg_set_quality(&cinfo, sinks[i].quality, false);
+
+    // encoders run on pool threads, so all of their memory is allocated
+    // here
+    encoder.cinfo = &cinfo;
+    if (width != dinfo.output_width || height != dinfo.output_height) {
+      resamplers[i].init(
+          (j_common_ptr) &dinfo,
+          dinfo.output_width,
+          dinfo.output_height,
+          width,
+          height,
+          dinfo.output_components);
+      encoder.resampler = &resamplers[i];
+      encoder.resampled_row = (*dinfo.mem->alloc_sarray)(
+          (j_common_ptr) &dinfo,
+          JPOOL_IMAGE,
+          width * dinfo.output_components,
+          1);
+    }
+    if (fuse_rotation) {
+      fused_rotation_bytes += image_bytes;
+      encoder.image = (*dinfo.mem->alloc_sarray)(
+          (j_common_ptr) &dinfo,
+          JPOOL_IMAGE,
+          width * dinfo.output_components,
+          height);
+      encoder.rotation_strip = (*dinfo.mem->alloc_sarray)(
+          (j_common_ptr) &dinfo,
+          JPOOL_IMAGE,
+          cinfo.image_width * dinfo.output_components,
+          kRotationTileSize);
+    }
+
+    jpeg_start_compress(&cinfo, true);
+    jcopy_markers_execute(&dinfo, &cinfo, JCOPYOPT_ALL);
+  }
+
+  ScanlineReader reader{dinfo, nullptr, nullptr, dinfo.output_height, 0};
+  runScanlinePipeline(
+      error_handler,
+      reader,
+      dinfo.output_width * dinfo.output_components,
+      encoders.data(),
+      encoders.size());
+
+  jpegJumpOnFailure((j_common_ptr) &dinfo);
+  for (const PipelineEncoder& encoder : encoders) {
+    if (!encoder.succeeded) {
+      jpegFail((j_common_ptr) &dinfo, encoder.error_handler.message);
+    }
+  }
+
+  // outputs still to be rotated are written once the decoder is torn down
+  for (size_t i = 0; i < sinks.size(); i++) {
+    if (!should_rotate || encoders[i].image != nullptr) {
+      writeToDestination(cinfos[i], *sinks[i].destination, encoded[i].buffer);
+    }
+  }
+
+  // tear down
+  for (size_t i = 0; i < sinks.size(); i++) {
+    jpeg_destroy_compress(&cinfos[i]);
+    created[i] = false;
+  }
+  jpeg_destroy_decompress(&dinfo);
+
+  for (size_t i = 0; i < sinks.size(); i++) {
+    if (should_rotate && encoders[i].image == nullptr) {
+      rotateJpeg(status, encoded[i], *sinks[i].destination, rotation_type);
+      RETURN_IF_FAILED;
     }
-    rotateJpeg(
-        env,
-        should_scale ? mem_source.public_fields : is_wrapper.public_fields,
-        os_wrapper.public_fields,
-        rotation_type);
   }
 }
 
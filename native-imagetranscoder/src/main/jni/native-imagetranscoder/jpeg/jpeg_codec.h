@@ -8,10 +8,13 @@
 #ifndef _JPEG_CODEC_H_
 #define _JPEG_CODEC_H_
 
-#include <jni.h>
+#include <vector>
 
+#include <stdio.h>
 #include <string.h>
 
+#include <jpeglib.h>
+
 #include "jpeg_error_handler.h"
 #include "decoded_image.h"
 #include "transformations.h"
@@ -22,37 +25,302 @@ namespace jpeg {
 
 /**
  * Encodes given image using libjpeg and writtes encoded bytes
- * into provided output stream.
+ * into provided destination.
  *
- * @param env
+ * @param status
  * @param decoded_image
- * @param os output stream to write data to
+ * @param destination receives the encoded image
  * @param quality value passed to jpeg encoder
+ * @param source_quality quality of the jpeg the image was decoded from, as
+ *   returned by estimateJpegQuality, or 0 if unknown. Caps quality
+ * @return quality the image was encoded with, 0 on error
  */
-void encodeJpegIntoOutputStream(
-    JNIEnv* env,
+int encodeJpeg(
+    JpegStatus& status,
     DecodedImage& decoded_image,
-    jobject os,
-    int quality);
+    struct jpeg_destination_mgr& destination,
+    int quality,
+    int source_quality);
 
 /**
- * Downscales and rotates jpeg image
+ * Downscales and rotates jpeg image read from source into destination.
+ *
+ * <p> Scaling and rotating is done in a single decode and encode. Only
+ * images too large to be held decoded are rotated losslessly after
+ * scaling, which may trim partial 8x8 blocks at their edges.
+ *
+ * <p> The image is never encoded at a higher quality than the one
+ * estimated for the source, that would only make it larger.
  *
- * @param env
- * @param is InputStream
- * @param os OutputStream
+ * @param status receives the error of a failed transform
+ * @param source
+ * @param destination
  * @param rotation_type
  * @param scale_factor
- * @param crop_info
- * @param quality
+ * @param quality upper bound of the output quality
+ * @param marker_policy APPn and COM markers to keep
+ * @param restart_rows MCU rows between restart markers of the output, 0
+ *   for none. Restart markers let decodeJpegParallel decode the image on
+ *   multiple threads, at the cost of 2 bytes per marker and a small loss of
+ *   compression at each of them
+ * @return quality the image was encoded with, 0 if it was only rotated
+ *   losslessly or on error
  */
-void transformJpeg(
-    JNIEnv* env,
-    jobject is,
-    jobject os,
+int transformJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
     RotationType rotation_type,
     const ScaleFactor& scale_factor,
-    int quality);
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows);
+
+/**
+ * Resizes jpeg image to exactly target_size and rotates it.
+ *
+ * <p> Unlike the ScaleFactor variant the output size is not limited to the
+ * n/8 ratios of libjpeg. The image is decoded at the closest larger ratio
+ * and resampled to target_size, which must not exceed the image size.
+ */
+int transformJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const TargetSize& target_size,
+    int quality,
+    MarkerPolicy marker_policy,
+    int restart_rows);
+
+/**
+ * Downscales and rotates jpeg image like transformJpeg, encoding it at the
+ * highest quality that keeps the output within max_bytes.
+ *
+ * <p> The image is decoded once and held in memory, rotated scanlines are
+ * assembled from it for every encode. Qualities are binary searched from
+ * max_quality, itself capped at the estimated source quality, so it takes
+ * at most 8 encodes and a single one if the image already fits.
+ *
+ * <p> Fails if the image does not fit even at quality 1.
+ *
+ * @return quality the image was encoded with, 0 on error
+ */
+int transformJpegWithByteLimit(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const ScaleFactor& scale_factor,
+    int max_quality,
+    size_t max_bytes,
+    MarkerPolicy marker_policy,
+    int restart_rows);
+
+/**
+ * Rotates jpeg image and crops it to crop_info, given in pixels of the
+ * rotated image.
+ *
+ * <p> Works on DCT coefficients, so only the entropy coding is redone and
+ * no quality is lost. Therefore the top left corner of the crop is moved to
+ * the closest iMCU boundary (8 or 16 pixels) above and to the left, and the
+ * crop grows so its right and bottom edges stay put.
+ */
+void cropJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    RotationType rotation_type,
+    const CropInfo& crop_info,
+    MarkerPolicy marker_policy);
+
+/**
+ * Recompresses jpeg image losslessly, like jpegtran -optimize.
+ *
+ * <p> DCT coefficients are copied as they are and entropy coded again with
+ * huffman tables optimized for the image, optionally as a progressive jpeg.
+ * Decoded pixels do not change.
+ *
+ * @param progressive whether to write a progressive jpeg, usually smaller
+ *   for images above about 10 KB
+ * @param strip_markers whether to drop all APPn and COM markers, including
+ *   EXIF and ICC profiles
+ */
+void optimizeJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    struct jpeg_destination_mgr& destination,
+    bool progressive,
+    bool strip_markers);
+
+/**
+ * Reads the header of jpeg image and estimates the quality it was encoded
+ * with, see jpeg_quality.h.
+ *
+ * @return 1 - 100, 0 if unknown or on error
+ */
+int estimateJpegQuality(JpegStatus& status, struct jpeg_source_mgr& source);
+
+/**
+ * Reads the header of jpeg image and computes the size decodeJpeg decodes
+ * it at for target_size.
+ *
+ * @return false on error
+ */
+bool getDecodedJpegSize(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const TargetSize& target_size,
+    unsigned int& width,
+    unsigned int& height);
+
+/**
+ * Reads the header of jpeg image and computes the size it is decoded at
+ * with scale_factor, 1/8 - 8/8.
+ *
+ * @return false on error
+ */
+bool getDecodedJpegSize(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const ScaleFactor& scale_factor,
+    unsigned int& width,
+    unsigned int& height);
+
+/**
+ * Decodes jpeg image into a caller provided pixel buffer, e.g. the locked
+ * pixels of a Bitmap.
+ *
+ * <p> Uses the same fast decompress parameters as the transcoder. The image
+ * is downscaled by the IDCT to the smallest n/8 scale that is not smaller
+ * than target_size, it is never upscaled.
+ *
+ * @param pixel_format RGBA or RGB_565
+ * @param dither whether to use ordered dithering, only applies to RGB_565
+ * @param pixels first row of the output
+ * @param width pixels available in each row of the output
+ * @param height rows available in the output
+ * @param stride bytes between the starts of subsequent rows
+ */
+void decodeJpeg(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const TargetSize& target_size,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride);
+
+/**
+ * Decodes jpeg image held in memory like decodeJpeg, using up to
+ * max_threads threads for images with restart markers.
+ *
+ * <p> The image is split at restart markers starting new MCU rows into
+ * horizontal bands, each decoded into the rows of the output it covers as a
+ * task of the shared native task pool. The calling thread decodes the first
+ * band and helps with the others while it waits. Images without suitable
+ * restart markers, and small ones, are decoded on the calling thread. The
+ * bands are copies of the input, so a parallel decode needs about the size
+ * of the input in additional memory.
+ *
+ * @param data encoded image, read from all threads
+ * @param max_threads bands decoded at once at most, including the one of the
+ *     calling thread
+ */
+void decodeJpegParallel(
+    JpegStatus& status,
+    const uint8_t* data,
+    size_t size,
+    const TargetSize& target_size,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride,
+    unsigned int max_threads);
+
+/**
+ * Decodes a region of jpeg image into a caller provided pixel buffer.
+ *
+ * <p> Only the iMCU columns and rows intersecting the region are decoded,
+ * rows above it are only entropy decoded. Memory used by baseline images
+ * is proportional to the width of the region rather than the image.
+ *
+ * @param scale_factor scale the image is decoded at, 1/8 - 8/8
+ * @param region pixels of the image decoded at scale_factor to output
+ * @param pixel_format RGBA or RGB_565
+ * @param dither whether to use ordered dithering, only applies to RGB_565
+ * @param pixels first row of the output, receives the region's top row
+ * @param width pixels available in each row of the output
+ * @param height rows available in the output
+ * @param stride bytes between the starts of subsequent rows
+ */
+void decodeJpegRegion(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    const ScaleFactor& scale_factor,
+    const CropInfo& region,
+    PixelFormat pixel_format,
+    bool dither,
+    uint8_t* pixels,
+    unsigned int width,
+    unsigned int height,
+    size_t stride);
+
+/**
+ * One output of transformJpegMulti.
+ */
+struct JpegResizeSink {
+  TargetSize target_size;
+
+  /**
+   * Requested quality, lowered by transformJpegMulti to the quality the
+   * output was encoded with
+   */
+  int quality;
+  struct jpeg_destination_mgr* destination;
+};
+
+/**
+ * Resizes jpeg image to several target sizes at once, each rotated by
+ * rotation_type.
+ *
+ * <p> The image is decoded only once, at the smallest n/8 scale that is not
+ * smaller than any of the target sizes. Decoded scanlines are fanned out to
+ * one resampling encoder per sink. Encoders run as tasks of the native
+ * thread pool, and on the calling thread while the pool is busy. Outputs are
+ * written to their destinations on the calling thread once all encoders are
+ * done.
+ *
+ * <p> Like transformJpeg, outputs are rotated in memory on the way, at
+ * exactly their target size. Only as many outputs as fit into 32 MB held
+ * decoded, in the order of sinks, are rotated like that. The others are
+ * encoded unrotated and rotated losslessly after, which trims partial iMCUs
+ * at their edges and costs another pass over each of them.
+ */
+void transformJpegMulti(
+    JpegStatus& status,
+    struct jpeg_source_mgr& source,
+    RotationType rotation_type,
+    std::vector<JpegResizeSink>& sinks,
+    MarkerPolicy marker_policy,
+    int restart_rows);
+
+/**
+ * Creates decompress struct without reading the header.
+ *
+ * <p> Sets source and error handling.
+ *
+ * <p> Callers may register marker processors (e.g. jpeg_save_markers)
+ * before calling jpeg_read_header themselves.
+ */
+void createDecompressStruct(
+    struct jpeg_decompress_struct& dinfo,
+    JpegErrorHandler& error_handler,
+    struct jpeg_source_mgr& source);
 
 /**
  * Initializes decompress struct.
@@ -72,12 +340,15 @@ void initDecompressStruct(
  * <p> Sets destination and error handler.
  *
  * <p> Sets copies params from given decompress struct
+ *
+ * <p> Emits a restart marker every restart_rows MCU rows, 0 for none.
  */
 void initCompressStruct(
     struct jpeg_compress_struct& cinfo,
     struct jpeg_decompress_struct& dinfo,
     JpegErrorHandler& error_handler,
-    struct jpeg_destination_mgr& destination);
+    struct jpeg_destination_mgr& destination,
+    int restart_rows);
 
 } } }
 
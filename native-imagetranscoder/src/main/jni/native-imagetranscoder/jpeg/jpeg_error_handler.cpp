@@ -8,20 +8,32 @@
 #include <stdio.h>
 #include <setjmp.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 
-#include "java_globals.h"
 #include "jpeg_error_handler.h"
 
 namespace facebook {
 namespace imagepipeline {
 namespace jpeg {
 
-JpegErrorHandler::JpegErrorHandler(JNIEnv* env)
-    : env(env), dinfoPtr(nullptr), cinfoPtr(nullptr) {
+/**
+ * Messages of the error codes added to those of libjpeg
+ */
+static const char* const kAddonMessages[] = {
+  "Operation cancelled",
+};
+
+static void setAddonMessages(struct jpeg_error_mgr& pub) {
+  pub.addon_message_table = kAddonMessages;
+  pub.first_addon_message = kJpegErrorCancelled;
+  pub.last_addon_message = kJpegErrorCancelled;
+}
+
+JpegErrorHandler::JpegErrorHandler(JpegStatus& status)
+    : status(&status), dinfoPtr(nullptr), cinfoPtr(nullptr) {
   jpeg_std_error(&pub);
-  pub.error_exit = jpegThrow;
+  pub.error_exit = jpegErrorExit;
+  setAddonMessages(pub);
 }
 
 void JpegErrorHandler::setDecompressStruct(jpeg_decompress_struct& dinfo) {
@@ -52,27 +64,42 @@ static void jpegCleanup(JpegErrorHandler* error_handler) {
   longjmp(error_handler->setjmpBuffer, 1);
 }
 
-void jpegThrow(j_common_ptr cinfo) {
-  // create and throw the jpeg-turbo error message
+void jpegErrorExit(j_common_ptr cinfo) {
+  // create and record the jpeg-turbo error message
+  JpegErrorHandler* error_handler = (JpegErrorHandler*) cinfo->err;
   char buffer[JMSG_LENGTH_MAX];
   (*cinfo->err->format_message) (cinfo, buffer);
-  jpegSafeThrow(cinfo, buffer);
+  error_handler->status->fail(cinfo->err->msg_code, buffer);
+  jpegCleanup(error_handler);
 }
 
-void jpegSafeThrow(
+void jpegFail(
     j_common_ptr cinfo,
     const char* msg) {
   JpegErrorHandler* error_handler = (JpegErrorHandler*) cinfo->err;
-
-  if (!error_handler->env->ExceptionCheck()) {
-    error_handler->env->ThrowNew(jRuntimeExceptionclass, msg);
-  }
+  error_handler->status->fail(kJpegErrorFailed, msg);
   jpegCleanup(error_handler);
 }
 
-void jpegJumpOnException(j_common_ptr cinfo) {
+/**
+ * error_exit of JpegWorkerErrorHandler
+ */
+static void jpegWorkerThrow(j_common_ptr cinfo) {
+  JpegWorkerErrorHandler* error_handler = (JpegWorkerErrorHandler*) cinfo->err;
+  (*cinfo->err->format_message) (cinfo, error_handler->message);
+  longjmp(error_handler->setjmpBuffer, 1);
+}
+
+JpegWorkerErrorHandler::JpegWorkerErrorHandler() {
+  jpeg_std_error(&pub);
+  pub.error_exit = jpegWorkerThrow;
+  setAddonMessages(pub);
+  message[0] = '\0';
+}
+
+void jpegJumpOnFailure(j_common_ptr cinfo) {
   JpegErrorHandler* error_handler = (JpegErrorHandler*) cinfo->err;
-  if (error_handler->env->ExceptionCheck()) {
+  if (error_handler->status->failed) {
     jpegCleanup(error_handler);
   }
 }
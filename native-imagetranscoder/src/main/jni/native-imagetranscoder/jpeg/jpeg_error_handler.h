@@ -10,12 +10,14 @@
 
 #include <type_traits>
 
-#include <stdio.h>
 #include <setjmp.h>
+#include <stddef.h>
+#include <stdio.h>
 
-#include <jni.h>
 #include <jpeglib.h>
 
+#include "jpeg_status.h"
+
 namespace facebook {
 namespace imagepipeline {
 namespace jpeg {
@@ -26,9 +28,9 @@ namespace jpeg {
  * <p> By default libjpeg handles errors by terminating running process.
  * This one uses setjmp / longjmp instead.
  *
- * <p> In addition to calling longjmp when error occurs, the error handler
- * will throw instance of RuntimeException encapsulating error message
- * passed by libjpeg.
+ * <p> Before calling longjmp when error occurs, the error handler records
+ * the error message passed by libjpeg in its status and destroys the
+ * structs it is set for.
  *
  * <p> This is not a c++ class because the only purpose of the handler is to
  * be used with libjpeg which is a c library.
@@ -37,18 +39,18 @@ struct JpegErrorHandler {
 
   struct jpeg_error_mgr pub;      // default fields defined by libjpeg
   jmp_buf setjmpBuffer;           // return point
-  JNIEnv* env;                    // JNI environment
+  JpegStatus* status;             // receives the first error
 
   jpeg_decompress_struct* dinfoPtr;
   jpeg_compress_struct* cinfoPtr;
 
   /**
-   * Constructs JpegErrorHanlder with given jni environment.
+   * Constructs JpegErrorHanlder reporting errors to given status.
    *
    * <p> To use it with given compress struct or decompress strunct call
    * one of setDecompressStruct/setCompressStruct methods.
    */
-  JpegErrorHandler(JNIEnv* env);
+  explicit JpegErrorHandler(JpegStatus& status);
 
   /**
    * Sets error handling for jpeg decompressing.
@@ -75,26 +77,50 @@ static_assert(
     "offset of fb_jpeg_error_handler.pub should be 0");
 
 /**
- * Throws RuntimeException with message formatted by libjpeg and jumps
- * to the place pointed by setjmp buffer of associated fb_jpeg_error_handler
+ * Error handler for libjpeg structs driven by a worker thread.
+ *
+ * <p> Worker threads must not touch the status of the calling thread, so
+ * this handler keeps the formatted message and jumps back to setjmpBuffer.
+ * It does not destroy anything either: the struct is still owned by the
+ * calling thread, which reports the failure once the worker is done.
+ */
+struct JpegWorkerErrorHandler {
+
+  struct jpeg_error_mgr pub;      // default fields defined by libjpeg
+  jmp_buf setjmpBuffer;           // return point
+  char message[JMSG_LENGTH_MAX];  // formatted libjpeg error
+
+  JpegWorkerErrorHandler();
+};
+
+static_assert(
+    std::is_standard_layout<JpegWorkerErrorHandler>::value,
+    "JpegWorkerErrorHandler has to be type of standard layout");
+static_assert(
+    offsetof(JpegWorkerErrorHandler, pub) == 0,
+    "offset of JpegWorkerErrorHandler.pub should be 0");
+
+/**
+ * Records the message formatted by libjpeg in the status of the associated
+ * JpegErrorHandler and jumps to the place pointed by its setjmp buffer.
  */
-void jpegThrow(j_common_ptr cinfo);
+void jpegErrorExit(j_common_ptr cinfo);
 
 /**
- * If there is no exception pending, throws RuntimeException initialized
- * with passed message. In any case, returns control to the place poitned
- * by setjmp buffer of associated JpegErrorHandler structure.
+ * Records passed message in the status of the associated JpegErrorHandler,
+ * unless it failed already. In any case, returns control to the place
+ * pointed by setjmp buffer of associated JpegErrorHandler structure.
  */
-void jpegSafeThrow(
+void jpegFail(
     j_common_ptr cinfo,
     const char* msg);
 
 /**
- * Checks for pending java exception and if one occured
- * frees jpeg-turbo resources and jumps to the place pointed by
- * setjmp buffer of associated JpegErrorHandler structure
+ * Checks whether the status of the associated JpegErrorHandler failed,
+ * e.g. in a nested operation sharing it, and if so frees jpeg-turbo
+ * resources and jumps to the place pointed by its setjmp buffer.
  */
-void jpegJumpOnException(j_common_ptr cinfo);
+void jpegJumpOnFailure(j_common_ptr cinfo);
 
 } } }
 
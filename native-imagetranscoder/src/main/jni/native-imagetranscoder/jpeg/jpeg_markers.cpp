@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include "transformations.h"
+#include "jpeg_markers.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+static const int kExifMarker = JPEG_APP0 + 1;
+static const JOCTET kExifId[] = {'E', 'x', 'i', 'f', 0, 0};
+static const unsigned int kExifIdLength = sizeof(kExifId);
+
+static const int kIccMarker = JPEG_APP0 + 2;
+static const JOCTET kIccId[] = "ICC_PROFILE";
+static const unsigned int kIccIdLength = sizeof(kIccId);
+
+/**
+ * Bytes of EXIF markers kept for EXIF_ORIENTATION. IFD0, which holds the
+ * orientation, comes first and is rarely longer than a few hundred bytes.
+ * The rest, including thumbnails, is skipped.
+ */
+static const unsigned int kExifOrientationSearchLength = 1024;
+
+static const uint16_t kExifOrientationTag = 0x0112;
+static const uint16_t kExifShortType = 3;
+static const uint16_t kExifOrientationNormal = 1;
+
+/**
+ * EXIF data holding nothing but the orientation, in big endian byte order:
+ * id, TIFF header, IFD0 with one entry and no next IFD.
+ */
+static const JOCTET kExifOrientationTemplate[] = {
+  'E', 'x', 'i', 'f', 0, 0,
+  'M', 'M', 0, 42, 0, 0, 0, 8,
+  0, 1,
+  0x01, 0x12, 0, 3, 0, 0, 0, 1, 0, 0, 0, 0,
+  0, 0, 0, 0
+};
+
+/**
+ * Offset of the orientation value in kExifOrientationTemplate
+ */
+static const unsigned int kExifOrientationTemplateValue = 24;
+
+static bool hasId(
+    jpeg_saved_marker_ptr marker,
+    int code,
+    const JOCTET* id,
+    unsigned int id_length) {
+  return marker->marker == code &&
+      marker->data_length >= id_length &&
+      memcmp(marker->data, id, id_length) == 0;
+}
+
+static uint16_t readUint16(const JOCTET* data, bool big_endian) {
+  return big_endian ? (data[0] << 8) | data[1] : (data[1] << 8) | data[0];
+}
+
+static uint32_t readUint32(const JOCTET* data, bool big_endian) {
+  return big_endian
+      ? ((uint32_t) readUint16(data, true) << 16) | readUint16(data + 2, true)
+      : ((uint32_t) readUint16(data + 2, false) << 16) | readUint16(data, false);
+}
+
+/**
+ * Looks up the orientation entry in IFD0 of EXIF marker data.
+ *
+ * @param big_endian receives the byte order of the value
+ * @return offset of the 2 byte orientation value in data, 0 if not found
+ */
+static unsigned int findExifOrientation(
+    const JOCTET* data,
+    unsigned int length,
+    bool& big_endian) {
+  if (length < kExifIdLength + 8) {
+    return 0;
+  }
+  const JOCTET* tiff = data + kExifIdLength;
+  const uint32_t tiff_length = length - kExifIdLength;
+  if (tiff[0] == 'M' && tiff[1] == 'M') {
+    big_endian = true;
+  } else if (tiff[0] == 'I' && tiff[1] == 'I') {
+    big_endian = false;
+  } else {
+    return 0;
+  }
+
+  const uint32_t ifd = readUint32(tiff + 4, big_endian);
+  if (ifd > tiff_length - 2) {
+    return 0;
+  }
+  const uint16_t entries = readUint16(tiff + ifd, big_endian);
+  for (uint32_t i = 0; i < entries; i++) {
+    const uint32_t entry = ifd + 2 + i * 12;
+    if (entry + 12 > tiff_length) {
+      break;
+    }
+    if (readUint16(tiff + entry, big_endian) == kExifOrientationTag &&
+        readUint16(tiff + entry + 2, big_endian) == kExifShortType) {
+      return kExifIdLength + entry + 8;
+    }
+  }
+  return 0;
+}
+
+void saveMarkers(
+    struct jpeg_decompress_struct& dinfo,
+    MarkerPolicy marker_policy) {
+  switch (marker_policy) {
+  case MarkerPolicy::EXIF_ORIENTATION:
+    jpeg_save_markers(&dinfo, kExifMarker, kExifOrientationSearchLength);
+    break;
+  case MarkerPolicy::ICC_PROFILE:
+    jpeg_save_markers(&dinfo, kIccMarker, 0xFFFF);
+    break;
+  case MarkerPolicy::ALL:
+    jpeg_save_markers(&dinfo, JPEG_COM, 0xFFFF);
+    for (int code = JPEG_APP0; code < JPEG_APP0 + 16; code++) {
+      jpeg_save_markers(&dinfo, code, 0xFFFF);
+    }
+    break;
+  case MarkerPolicy::NONE:
+  default:
+    break;
+  }
+}
+
+/**
+ * Replaces saved EXIF data by a minimal one holding orientation only.
+ */
+static void setExifOrientationOnly(
+    struct jpeg_decompress_struct& dinfo,
+    jpeg_saved_marker_ptr marker,
+    uint16_t orientation) {
+  JOCTET* data = (JOCTET*) (*dinfo.mem->alloc_small)(
+      (j_common_ptr) &dinfo,
+      JPOOL_IMAGE,
+      sizeof(kExifOrientationTemplate));
+  memcpy(data, kExifOrientationTemplate, sizeof(kExifOrientationTemplate));
+  data[kExifOrientationTemplateValue] = orientation >> 8;
+  data[kExifOrientationTemplateValue + 1] = orientation & 0xFF;
+  marker->data = data;
+  marker->data_length = sizeof(kExifOrientationTemplate);
+  marker->original_length = sizeof(kExifOrientationTemplate);
+}
+
+void filterMarkers(
+    struct jpeg_decompress_struct& dinfo,
+    MarkerPolicy marker_policy,
+    bool orientation_applied) {
+  bool has_orientation = false;
+  jpeg_saved_marker_ptr* link = &dinfo.marker_list;
+  while (*link != nullptr) {
+    jpeg_saved_marker_ptr marker = *link;
+    bool keep = true;
+    if (hasId(marker, kExifMarker, kExifId, kExifIdLength) &&
+        (marker_policy == MarkerPolicy::ALL ||
+            marker_policy == MarkerPolicy::EXIF_ORIENTATION)) {
+      bool big_endian;
+      const unsigned int offset =
+          findExifOrientation(marker->data, marker->data_length, big_endian);
+      const uint16_t orientation =
+          offset > 0 ? readUint16(marker->data + offset, big_endian) : 0;
+      if (marker_policy == MarkerPolicy::ALL) {
+        if (offset > 0 && orientation_applied) {
+          // the value is the first of the 4 bytes reserved for it
+          marker->data[offset] = big_endian ? 0 : kExifOrientationNormal;
+          marker->data[offset + 1] = big_endian ? kExifOrientationNormal : 0;
+        }
+      } else {
+        keep = !has_orientation &&
+            !orientation_applied &&
+            orientation > kExifOrientationNormal &&
+            orientation <= 8;
+        if (keep) {
+          setExifOrientationOnly(dinfo, marker, orientation);
+          has_orientation = true;
+        }
+      }
+    } else if (marker_policy == MarkerPolicy::EXIF_ORIENTATION) {
+      // e.g. XMP, which shares the marker with EXIF
+      keep = false;
+    } else if (marker_policy == MarkerPolicy::ICC_PROFILE) {
+      keep = hasId(marker, kIccMarker, kIccId, kIccIdLength);
+    }
+
+    if (keep) {
+      link = &marker->next;
+    } else {
+      *link = marker->next;
+    }
+  }
+}
+
+} } }
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_MARKERS_H_
+#define _JPEG_MARKERS_H_
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+#include "transformations.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Makes jpeg_read_header keep the markers marker_policy asks for. All other
+ * APPn and COM markers are skipped while reading, without being buffered.
+ *
+ * <p> Has to be called before jpeg_read_header.
+ */
+void saveMarkers(
+    struct jpeg_decompress_struct& dinfo,
+    MarkerPolicy marker_policy);
+
+/**
+ * Trims the markers kept by saveMarkers to what marker_policy allows, so
+ * jcopy_markers_execute writes exactly those.
+ *
+ * <p> With EXIF_ORIENTATION the EXIF data is replaced by a minimal one
+ * holding the orientation only. With ICC_PROFILE other APP2 markers are
+ * dropped.
+ *
+ * <p> Once the pixels were rotated according to the EXIF orientation it
+ * would rotate them once more, so with orientation_applied it is dropped
+ * (EXIF_ORIENTATION) or reset to normal (ALL).
+ *
+ * <p> Has to be called after jpeg_read_header.
+ */
+void filterMarkers(
+    struct jpeg_decompress_struct& dinfo,
+    MarkerPolicy marker_policy,
+    bool orientation_applied);
+
+} } }
+
+#endif /* _JPEG_MARKERS_H_ */
@@ -5,9 +5,11 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <vector>
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <jpeglib.h>
 
@@ -35,8 +37,8 @@ static const unsigned int kBufferSize = 8 * 1024;
  */
 static void memSourceInit(j_decompress_ptr dinfo) {
   JpegMemorySource* src = reinterpret_cast<JpegMemorySource*>(dinfo->src);
-  src->public_fields.next_input_byte = src->buffer.data();
-  src->public_fields.bytes_in_buffer = src->buffer.size();
+  src->public_fields.next_input_byte = src->data;
+  src->public_fields.bytes_in_buffer = src->size;
 }
 
 /*
@@ -102,6 +104,8 @@ JpegMemorySource::JpegMemorySource() {
   public_fields.term_source = memSourceTermSource;
   public_fields.bytes_in_buffer = 0;
   public_fields.next_input_byte = nullptr;
+  data = nullptr;
+  size = 0;
 }
 
 /**
@@ -122,7 +126,7 @@ static void memDestinationInit(j_compress_ptr cinfo) {
       JPOOL_IMAGE,
       kBufferSize * sizeof(JOCTET));
   if (dest->write_memory == nullptr) {
-    jpegSafeThrow(
+    jpegFail(
         (j_common_ptr) cinfo,
         "Failed to allocate memory for libjpeg output buffer.");
   }
@@ -178,4 +182,86 @@ JpegMemoryDestination::JpegMemoryDestination() {
   public_fields.term_destination = memDestinationTerm;
 }
 
+/**
+ * Initialize native buffer destination.
+ *
+ * <p> This function is a callback passed to libjpeg and should not be used
+ * directly.
+ *
+ * <p> Allocates the output buffer unless it is already there, libjpeg then
+ * writes to it directly.
+ */
+static void nativeBufferDestinationInit(j_compress_ptr cinfo) {
+  JpegNativeBufferDestination* dest =
+    reinterpret_cast<JpegNativeBufferDestination*>(cinfo->dest);
+  if (dest->data == nullptr) {
+    dest->data = (uint8_t*) malloc(dest->capacity);
+    if (dest->data == nullptr) {
+      jpegFail(
+          (j_common_ptr) cinfo,
+          "Failed to allocate memory for libjpeg output buffer.");
+    }
+  }
+  dest->size = 0;
+  dest->public_fields.next_output_byte = dest->data;
+  dest->public_fields.free_in_buffer = dest->capacity;
+}
+
+/**
+ * Grow the output buffer.
+ *
+ * <p> This function is a callback passed to libjpeg and should not be used
+ * directly.
+ *
+ * <p> Called when the whole buffer has been written. Instead of flushing it
+ * somewhere the buffer is doubled and libjpeg continues right after the
+ * bytes it already wrote.
+ */
+static boolean nativeBufferDestinationEmptyOutputBuffer(j_compress_ptr cinfo) {
+  JpegNativeBufferDestination* dest =
+    reinterpret_cast<JpegNativeBufferDestination*>(cinfo->dest);
+  const size_t new_capacity = dest->capacity * 2;
+  uint8_t* new_data = (uint8_t*) realloc(dest->data, new_capacity);
+  if (new_data == nullptr) {
+    jpegFail(
+        (j_common_ptr) cinfo,
+        "Failed to grow libjpeg output buffer.");
+  }
+  dest->public_fields.next_output_byte = new_data + dest->capacity;
+  dest->public_fields.free_in_buffer = new_capacity - dest->capacity;
+  dest->data = new_data;
+  dest->capacity = new_capacity;
+  return true;
+}
+
+/**
+ * Terminate native buffer destination.
+ *
+ * <p> This function is a callback passed to libjpeg and should not be used
+ * directly.
+ *
+ * <p> Records how many bytes were written. Nothing is copied.
+ */
+static void nativeBufferDestinationTerm(j_compress_ptr cinfo) {
+  JpegNativeBufferDestination* dest =
+    reinterpret_cast<JpegNativeBufferDestination*>(cinfo->dest);
+  dest->size = dest->capacity - dest->public_fields.free_in_buffer;
+}
+
+JpegNativeBufferDestination::JpegNativeBufferDestination(
+    size_t initial_capacity) {
+  public_fields.init_destination = nativeBufferDestinationInit;
+  public_fields.empty_output_buffer = nativeBufferDestinationEmptyOutputBuffer;
+  public_fields.term_destination = nativeBufferDestinationTerm;
+  public_fields.next_output_byte = nullptr;
+  public_fields.free_in_buffer = 0;
+  data = nullptr;
+  capacity = std::max<size_t>(initial_capacity, kBufferSize);
+  size = 0;
+}
+
+JpegNativeBufferDestination::~JpegNativeBufferDestination() {
+  free(data);
+}
+
 } } }
@@ -11,6 +11,10 @@
 #include <type_traits>
 #include <vector>
 
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
 #include <jpeglib.h>
 
 namespace facebook {
@@ -19,7 +23,7 @@ namespace jpeg {
 
 
 /**
- * Provides jpeg data from std::vector.
+ * Provides jpeg data from std::vector or from memory owned by the caller.
  *
  * <p> This struct is designed to be directly castable to and from
  * jpeg_source_mgr so it can be passed to and from libjpeg.
@@ -33,6 +37,12 @@ struct JpegMemorySource {
   struct jpeg_source_mgr public_fields;
   std::vector<uint8_t> buffer;
 
+  /**
+   * Bytes handed to libjpeg. Either point at buffer or at external memory.
+   */
+  const uint8_t* data;
+  size_t size;
+
   /**
    * Creates jpeg_source_mgr providing bytes from std::vector.
    */
@@ -40,6 +50,19 @@ struct JpegMemorySource {
 
   void setBuffer(std::vector<uint8_t>&& new_buffer) {
     buffer = std::move(new_buffer);
+    data = buffer.data();
+    size = buffer.size();
+  }
+
+  /**
+   * Reads directly from memory that is not owned by the source, e.g. a
+   * NativeMemoryChunk or a direct ByteBuffer. The memory has to stay valid
+   * until the decompress struct is destroyed.
+   */
+  void setExternalBuffer(const uint8_t* external_data, size_t external_size) {
+    buffer.clear();
+    data = external_data;
+    size = external_size;
   }
 };
 
@@ -102,6 +125,65 @@ static_assert(
     "offset of JpegMemoryDestination.public_fields should be 0");
 
 
+/**
+ * Stores libjpeg output in a single growable block of native memory.
+ *
+ * <p> Unlike JpegMemoryDestination libjpeg writes straight into the final
+ * buffer, which is grown by doubling when full. The buffer can be released
+ * to the caller and handed over to Java without being copied.
+ *
+ * <p> This struct is designed to be directly castable to and from
+ * jpeg_destination_mgr so it can be passed to and from libjpeg.
+ */
+struct JpegNativeBufferDestination {
+  struct jpeg_destination_mgr public_fields;
+
+  /**
+   * Allocated with malloc. Owned by this struct until release is called.
+   */
+  uint8_t* data;
+  size_t capacity;
+
+  /**
+   * Number of bytes written, valid once libjpeg terminated the destination
+   */
+  size_t size;
+
+  /**
+   * Creates jpeg_destination_mgr storing output bytes in native memory.
+   *
+   * @param initial_capacity size of the first allocation. A good estimate
+   *   (e.g. input size) avoids growing the buffer later.
+   */
+  explicit JpegNativeBufferDestination(size_t initial_capacity);
+
+  ~JpegNativeBufferDestination();
+
+  /**
+   * Gives up ownership of the written bytes. The caller has to free them.
+   */
+  uint8_t* release() {
+    uint8_t* released = data;
+    data = nullptr;
+    capacity = 0;
+    return released;
+  }
+};
+
+/**
+ * We cast pointers of type struct jpeg_destination_mgr* pointing to public_fields
+ * to a pointer of type struct JpegNativeBufferDestination* and expect that we
+ * obtain a valid pointer to enclosing structure. Assertions below ensure that
+ * this assumption is always true.
+ */
+static_assert(
+    std::is_standard_layout<JpegNativeBufferDestination>::value,
+    "JpegNativeBufferDestination has to be type of standard layout");
+static_assert(
+    offsetof(JpegNativeBufferDestination, public_fields) == 0,
+    "offset of JpegNativeBufferDestination.public_fields should be 0");
+
+
 } } }
 
 #endif /* JPEG_MEMORY_IO_H */
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <jpeglib.h>
+#include <jerror.h>
+extern "C" {
+#include <jmemsys.h>
+}
+
+#include "jpeg_memory_manager.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Bytes in front of every block, keeping the capacity of the block. Keeps
+ * the alignment of malloc.
+ */
+static const size_t kBlockHeaderSize = 16;
+
+/**
+ * Upper bound of the bytes cached by each thread
+ */
+static const size_t kArenaMaxBytes = 4 * 1024 * 1024;
+
+/**
+ * Larger blocks, e.g. whole image buffers, are given back to the system
+ * right away.
+ */
+static const size_t kArenaMaxBlockBytes = 1024 * 1024;
+
+/**
+ * Upper bound of the blocks cached by each thread, keeps lookups cheap
+ */
+static const size_t kArenaMaxBlocks = 32;
+
+static std::atomic<size_t> gMemoryLimit{0};
+
+static std::mutex gBackingStoreMutex;
+static std::string gBackingStoreDirectory;
+
+void setJpegMemoryLimit(size_t max_bytes) {
+  gMemoryLimit.store(max_bytes);
+}
+
+void setJpegBackingStoreDirectory(const std::string& directory) {
+  std::lock_guard<std::mutex> lock(gBackingStoreMutex);
+  gBackingStoreDirectory = directory;
+}
+
+static std::string getBackingStoreDirectory() {
+  std::lock_guard<std::mutex> lock(gBackingStoreMutex);
+  return gBackingStoreDirectory;
+}
+
+/**
+ * Blocks freed by libjpeg on one thread, handed out again to allocations
+ * on the same thread.
+ *
+ * <p> A block is reused for requests of at least half its capacity, so
+ * the pools of libjpeg, which come in a few fixed sizes, find a block of
+ * the previous image while little memory is wasted on others.
+ */
+class BlockArena {
+ public:
+  BlockArena() {
+    blocks_.reserve(kArenaMaxBlocks);
+  }
+
+  ~BlockArena() {
+    for (uint8_t* block : blocks_) {
+      free(block);
+    }
+  }
+
+  void* allocate(size_t size) {
+    size_t best = blocks_.size();
+    for (size_t i = 0; i < blocks_.size(); i++) {
+      const size_t capacity = getCapacity(blocks_[i]);
+      if (capacity >= size && capacity / 2 <= size &&
+          (best == blocks_.size() || capacity < getCapacity(blocks_[best]))) {
+        best = i;
+      }
+    }
+
+    uint8_t* block;
+    if (best < blocks_.size()) {
+      block = blocks_[best];
+      blocks_[best] = blocks_.back();
+      blocks_.pop_back();
+      cached_bytes_ -= getCapacity(block);
+    } else {
+      block = (uint8_t*) malloc(kBlockHeaderSize + size);
+      if (block == nullptr) {
+        return nullptr;
+      }
+      memcpy(block, &size, sizeof(size_t));
+    }
+    return block + kBlockHeaderSize;
+  }
+
+  void release(void* object) {
+    uint8_t* block = (uint8_t*) object - kBlockHeaderSize;
+    const size_t capacity = getCapacity(block);
+    if (capacity > kArenaMaxBlockBytes ||
+        cached_bytes_ + capacity > kArenaMaxBytes ||
+        blocks_.size() == kArenaMaxBlocks) {
+      free(block);
+      return;
+    }
+    blocks_.push_back(block);
+    cached_bytes_ += capacity;
+  }
+
+ private:
+  static size_t getCapacity(const uint8_t* block) {
+    size_t capacity;
+    memcpy(&capacity, block, sizeof(size_t));
+    return capacity;
+  }
+
+  std::vector<uint8_t*> blocks_;
+  size_t cached_bytes_ = 0;
+};
+
+static thread_local BlockArena tBlockArena;
+
+/**
+ * Pool memory held by libjpeg on this thread, and the most of it since
+ * resetJpegMemoryPeak.
+ */
+static thread_local size_t tAllocatedBytes = 0;
+static thread_local size_t tPeakBytes = 0;
+
+void resetJpegMemoryPeak() {
+  tPeakBytes = tAllocatedBytes;
+}
+
+size_t getJpegMemoryPeak() {
+  return tPeakBytes;
+}
+
+static void* allocateBlock(size_t size) {
+  void* object = tBlockArena.allocate(size);
+  if (object != nullptr) {
+    tAllocatedBytes += size;
+    if (tAllocatedBytes > tPeakBytes) {
+      tPeakBytes = tAllocatedBytes;
+    }
+  }
+  return object;
+}
+
+static void releaseBlock(void* object, size_t size) {
+  tAllocatedBytes -= size;
+  tBlockArena.release(object);
+}
+
+/**
+ * Reads from / writes to the temporary file of a backing store.
+ */
+static void seekBackingStore(
+    j_common_ptr cinfo,
+    backing_store_ptr info,
+    long file_offset) {
+  if (fseek(info->temp_file, file_offset, SEEK_SET) != 0) {
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+  }
+}
+
+static void readBackingStore(
+    j_common_ptr cinfo,
+    backing_store_ptr info,
+    void* buffer_address,
+    long file_offset,
+    long byte_count) {
+  seekBackingStore(cinfo, info, file_offset);
+  if (fread(buffer_address, 1, byte_count, info->temp_file) !=
+      (size_t) byte_count) {
+    ERREXIT(cinfo, JERR_TFILE_READ);
+  }
+}
+
+static void writeBackingStore(
+    j_common_ptr cinfo,
+    backing_store_ptr info,
+    void* buffer_address,
+    long file_offset,
+    long byte_count) {
+  seekBackingStore(cinfo, info, file_offset);
+  if (fwrite(buffer_address, 1, byte_count, info->temp_file) !=
+      (size_t) byte_count) {
+    ERREXIT(cinfo, JERR_TFILE_WRITE);
+  }
+}
+
+static void closeBackingStore(j_common_ptr /* cinfo */, backing_store_ptr info) {
+  fclose(info->temp_file);
+  info->temp_file = nullptr;
+}
+
+} } }
+
+using facebook::imagepipeline::jpeg::allocateBlock;
+using facebook::imagepipeline::jpeg::closeBackingStore;
+using facebook::imagepipeline::jpeg::getBackingStoreDirectory;
+using facebook::imagepipeline::jpeg::gMemoryLimit;
+using facebook::imagepipeline::jpeg::readBackingStore;
+using facebook::imagepipeline::jpeg::releaseBlock;
+using facebook::imagepipeline::jpeg::writeBackingStore;
+
+/*
+ * jmemsys.h implementation used by jmemmgr.c of libjpeg-turbo
+ */
+extern "C" {
+
+void* jpeg_get_small(j_common_ptr /* cinfo */, size_t sizeofobject) {
+  return allocateBlock(sizeofobject);
+}
+
+void jpeg_free_small(
+    j_common_ptr /* cinfo */,
+    void* object,
+    size_t sizeofobject) {
+  releaseBlock(object, sizeofobject);
+}
+
+void* jpeg_get_large(j_common_ptr /* cinfo */, size_t sizeofobject) {
+  return allocateBlock(sizeofobject);
+}
+
+void jpeg_free_large(
+    j_common_ptr /* cinfo */,
+    void* object,
+    size_t sizeofobject) {
+  releaseBlock(object, sizeofobject);
+}
+
+/**
+ * Memory virtual arrays may use, libjpeg swaps the rest of them to the
+ * backing store.
+ */
+size_t jpeg_mem_available(
+    j_common_ptr cinfo,
+    size_t /* min_bytes_needed */,
+    size_t max_bytes_needed,
+    size_t already_allocated) {
+  const size_t limit = cinfo->mem->max_memory_to_use;
+  if (limit == 0) {
+    return max_bytes_needed;
+  }
+  return limit > already_allocated ? limit - already_allocated : 0;
+}
+
+/**
+ * Opens an unlinked temporary file in the backing store directory, which
+ * goes away once closed, even if the process dies.
+ */
+void jpeg_open_backing_store(
+    j_common_ptr cinfo,
+    backing_store_ptr info,
+    long /* total_bytes_needed */) {
+  const std::string directory = getBackingStoreDirectory();
+  if (directory.empty()) {
+    ERREXIT(cinfo, JERR_NO_BACKING_STORE);
+  }
+
+  std::string path = directory + "/jpeg_backing_store_XXXXXX";
+  const int fd = mkstemp(&path[0]);
+  snprintf(info->temp_name, sizeof(info->temp_name), "%s", path.c_str());
+  if (fd < 0) {
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+  }
+  unlink(path.c_str());
+  info->temp_file = fdopen(fd, "w+b");
+  if (info->temp_file == nullptr) {
+    close(fd);
+    ERREXITS(cinfo, JERR_TFILE_CREATE, info->temp_name);
+  }
+
+  info->read_backing_store = readBackingStore;
+  info->write_backing_store = writeBackingStore;
+  info->close_backing_store = closeBackingStore;
+}
+
+long jpeg_mem_init(j_common_ptr /* cinfo */) {
+  return (long) gMemoryLimit.load();
+}
+
+void jpeg_mem_term(j_common_ptr /* cinfo */) {
+}
+
+}
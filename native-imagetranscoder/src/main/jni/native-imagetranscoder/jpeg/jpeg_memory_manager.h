@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_MEMORY_MANAGER_H_
+#define _JPEG_MEMORY_MANAGER_H_
+
+#include <string>
+
+#include <stddef.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Configuration of the system dependent part of the libjpeg memory manager
+ * (jmemsys.h), which replaces jmemnobs.c of libjpeg-turbo.
+ *
+ * <p> Pool blocks freed by libjpeg are kept in a cache of the freeing
+ * thread and handed out again to the next struct created on it, so
+ * transcoding one image after another does not go back to malloc for every
+ * pool.
+ *
+ * <p> Virtual arrays, e.g. the coefficients read by jpeg_read_coefficients,
+ * are held in memory only up to the memory limit. The rest of them is
+ * swapped to a temporary file in the backing store directory.
+ */
+
+/**
+ * Sets max_memory_to_use of structs created from now on, 0 for no limit,
+ * the default. Only bounds the memory of virtual arrays, the fixed buffers
+ * of libjpeg and scanline buffers of the caller are allocated regardless.
+ */
+void setJpegMemoryLimit(size_t max_bytes);
+
+/**
+ * Sets the directory temporary files of the backing store are created in,
+ * e.g. the cache directory of the app. Without one, images exceeding the
+ * memory limit fail to decode.
+ */
+void setJpegBackingStoreDirectory(const std::string& directory);
+
+/**
+ * Starts tracking the peak of the pool memory libjpeg holds on the calling
+ * thread from the memory it holds now.
+ */
+void resetJpegMemoryPeak();
+
+/**
+ * Returns the most pool memory libjpeg held on the calling thread since the
+ * last call to resetJpegMemoryPeak, counting the bytes it requested.
+ */
+size_t getJpegMemoryPeak();
+
+} } }
+
+#endif /* _JPEG_MEMORY_MANAGER_H_ */
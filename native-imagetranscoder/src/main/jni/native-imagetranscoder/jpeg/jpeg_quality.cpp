@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_quality.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Example tables from section K.1 of the jpeg spec, in natural order, the
+ * same ones jpeg_set_quality scales.
+ */
+static const unsigned int kStdLuminanceQuantTable[DCTSIZE2] = {
+  16, 11, 10, 16, 24, 40, 51, 61,
+  12, 12, 14, 19, 26, 58, 60, 55,
+  14, 13, 16, 24, 40, 57, 69, 56,
+  14, 17, 22, 29, 51, 87, 80, 62,
+  18, 22, 37, 56, 68, 109, 103, 77,
+  24, 35, 55, 64, 81, 104, 113, 92,
+  49, 64, 78, 87, 103, 121, 120, 101,
+  72, 92, 95, 98, 112, 100, 103, 99
+};
+
+static const unsigned int kStdChrominanceQuantTable[DCTSIZE2] = {
+  17, 18, 24, 47, 99, 99, 99, 99,
+  18, 21, 26, 66, 99, 99, 99, 99,
+  24, 26, 56, 99, 99, 99, 99, 99,
+  47, 66, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99,
+  99, 99, 99, 99, 99, 99, 99, 99
+};
+
+/**
+ * Sum of absolute differences between table and std_table scaled by
+ * scale_factor, the way jpeg_add_quant_table scales it.
+ */
+static unsigned int getQuantTableDistance(
+    const JQUANT_TBL& table,
+    const unsigned int* std_table,
+    int scale_factor) {
+  unsigned int distance = 0;
+  for (int i = 0; i < DCTSIZE2; i++) {
+    long expected = ((long) std_table[i] * scale_factor + 50L) / 100L;
+    expected = std::min(std::max(expected, 1L), 32767L);
+    // encoders forcing baseline tables cap entries at 255
+    if (expected > 255 && table.quantval[i] <= 255) {
+      expected = 255;
+    }
+    distance += labs(expected - (long) table.quantval[i]);
+  }
+  return distance;
+}
+
+int estimateJpegQuality(const struct jpeg_decompress_struct& dinfo) {
+  if (dinfo.num_components < 1) {
+    return 0;
+  }
+  const JQUANT_TBL* luminance =
+      dinfo.quant_tbl_ptrs[dinfo.comp_info[0].quant_tbl_no];
+  if (luminance == nullptr) {
+    return 0;
+  }
+  const JQUANT_TBL* chrominance = nullptr;
+  if (dinfo.num_components >= 3 &&
+      dinfo.comp_info[1].quant_tbl_no != dinfo.comp_info[0].quant_tbl_no) {
+    chrominance = dinfo.quant_tbl_ptrs[dinfo.comp_info[1].quant_tbl_no];
+  }
+
+  // several qualities can give the same tables, take the lowest of them
+  int best_quality = 0;
+  unsigned int best_distance = 0;
+  for (int quality = 1; quality <= 100; quality++) {
+    const int scale_factor = jpeg_quality_scaling(quality);
+    unsigned int distance =
+        getQuantTableDistance(*luminance, kStdLuminanceQuantTable, scale_factor);
+    if (chrominance != nullptr) {
+      distance += getQuantTableDistance(
+          *chrominance,
+          kStdChrominanceQuantTable,
+          scale_factor);
+    }
+    if (best_quality == 0 || distance < best_distance) {
+      best_quality = quality;
+      best_distance = distance;
+    }
+  }
+  return best_quality;
+}
+
+int clampJpegQuality(int quality, int source_quality) {
+  return source_quality > 0 ? std::min(quality, source_quality) : quality;
+}
+
+} } }
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_QUALITY_H_
+#define _JPEG_QUALITY_H_
+
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Estimates the IJG quality setting the image was encoded with.
+ *
+ * <p> Compares the quantization tables read by jpeg_read_header with the
+ * scaled example tables of the jpeg spec that libjpeg and most other
+ * encoders use, and returns the quality whose tables are closest. For
+ * encoders using tables of their own it is only an approximation.
+ *
+ * @return 1 - 100, or 0 if the header has no quantization tables
+ */
+int estimateJpegQuality(const struct jpeg_decompress_struct& dinfo);
+
+/**
+ * Returns quality, lowered to source_quality if that is known and lower.
+ *
+ * <p> Encoding at a higher quality than the source was encoded with makes
+ * the output larger without making it look any better.
+ */
+int clampJpegQuality(int quality, int source_quality);
+
+} } }
+
+#endif /* _JPEG_QUALITY_H_ */
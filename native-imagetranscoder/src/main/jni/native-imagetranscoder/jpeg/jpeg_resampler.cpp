@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include "jpeg_resampler.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Fixed point precision of filter weights
+ */
+static const unsigned int kResamplerWeightBits = 14;
+
+/**
+ * Fractional bits kept between the horizontal and the vertical pass
+ */
+static const unsigned int kResamplerRowBits = 8;
+
+static void* allocImage(j_common_ptr cinfo, size_t size) {
+  return (*cinfo->mem->alloc_large)(cinfo, JPOOL_IMAGE, size);
+}
+
+/**
+ * Computes area filter taps for scaling in_length pixels to out_length.
+ *
+ * <p> Measured in units of 1 / (in_length * out_length), output pixel o
+ * covers [o * in_length, (o + 1) * in_length) and input pixel i covers
+ * [i * out_length, (i + 1) * out_length). The weight of an input pixel is
+ * the overlap of both divided by in_length.
+ */
+static void initAxis(
+    j_common_ptr cinfo,
+    JpegResamplerAxis& axis,
+    JDIMENSION in_length,
+    JDIMENSION out_length) {
+  axis.max_taps = (in_length + out_length - 1) / out_length + 1;
+  axis.start = (JDIMENSION*) allocImage(cinfo, out_length * sizeof(JDIMENSION));
+  axis.taps = (JDIMENSION*) allocImage(cinfo, out_length * sizeof(JDIMENSION));
+  axis.weights = (uint16_t*) allocImage(
+      cinfo,
+      (size_t) out_length * axis.max_taps * sizeof(uint16_t));
+
+  const uint64_t total = 1 << kResamplerWeightBits;
+  for (JDIMENSION o = 0; o < out_length; o++) {
+    const uint64_t begin = (uint64_t) o * in_length;
+    const uint64_t end = begin + in_length;
+    const JDIMENSION first = begin / out_length;
+    const JDIMENSION last = (end - 1) / out_length;
+    uint16_t* weights = axis.weights + (size_t) o * axis.max_taps;
+
+    uint64_t sum = 0;
+    unsigned int largest = 0;
+    for (JDIMENSION i = first; i <= last; i++) {
+      const uint64_t overlap =
+          std::min<uint64_t>((uint64_t) (i + 1) * out_length, end) -
+          std::max<uint64_t>((uint64_t) i * out_length, begin);
+      const unsigned int tap = i - first;
+      weights[tap] = (overlap * total + in_length / 2) / in_length;
+      sum += weights[tap];
+      if (weights[tap] > weights[largest]) {
+        largest = tap;
+      }
+    }
+    // rounding must not make the image darker or brighter
+    weights[largest] += total - sum;
+
+    axis.start[o] = first;
+    axis.taps[o] = last - first + 1;
+  }
+}
+
+void JpegResampler::init(
+    j_common_ptr cinfo,
+    JDIMENSION in_width,
+    JDIMENSION in_height,
+    JDIMENSION out_width,
+    JDIMENSION out_height,
+    int components) {
+  this->in_width = in_width;
+  this->in_height = in_height;
+  this->out_width = out_width;
+  this->out_height = out_height;
+  this->components = components;
+
+  initAxis(cinfo, columns, in_width, out_width);
+  initAxis(cinfo, rows, in_height, out_height);
+
+  const size_t row_samples = (size_t) out_width * components;
+  row_buffer = (uint16_t*) allocImage(cinfo, row_samples * sizeof(uint16_t));
+  current_sums = (uint32_t*) allocImage(cinfo, row_samples * sizeof(uint32_t));
+  next_sums = (uint32_t*) allocImage(cinfo, row_samples * sizeof(uint32_t));
+  memset(current_sums, 0, row_samples * sizeof(uint32_t));
+  memset(next_sums, 0, row_samples * sizeof(uint32_t));
+
+  next_in_row = 0;
+  next_out_row = 0;
+}
+
+/**
+ * Horizontal pass over one input row.
+ */
+static void resampleRow(
+    const JpegResamplerAxis& columns,
+    JDIMENSION out_width,
+    int components,
+    JSAMPROW in_row,
+    uint16_t* out) {
+  for (JDIMENSION o = 0; o < out_width; o++) {
+    const JSAMPLE* in = in_row + (size_t) columns.start[o] * components;
+    const uint16_t* weights = columns.weights + (size_t) o * columns.max_taps;
+    const unsigned int taps = columns.taps[o];
+    for (int c = 0; c < components; c++) {
+      uint32_t sum = 0;
+      for (unsigned int t = 0; t < taps; t++) {
+        sum += (uint32_t) weights[t] * in[t * components + c];
+      }
+      out[c] = sum >> (kResamplerWeightBits - kResamplerRowBits);
+    }
+    out += components;
+  }
+}
+
+/**
+ * Vertical pass: adds a horizontally resampled row to an output row.
+ * Plain loop over contiguous samples, left for the compiler to vectorize.
+ */
+static void accumulateRow(
+    uint32_t* sums,
+    const uint16_t* row,
+    uint32_t weight,
+    size_t samples) {
+  for (size_t i = 0; i < samples; i++) {
+    sums[i] += weight * row[i];
+  }
+}
+
+bool JpegResampler::pushRow(JSAMPROW in_row, JSAMPROW out_row) {
+  const size_t row_samples = (size_t) out_width * components;
+  const JDIMENSION in_index = next_in_row++;
+
+  resampleRow(columns, out_width, components, in_row, row_buffer);
+
+  const JDIMENSION y = next_out_row;
+  const JDIMENSION first = rows.start[y];
+  accumulateRow(
+      current_sums,
+      row_buffer,
+      rows.weights[(size_t) y * rows.max_taps + in_index - first],
+      row_samples);
+
+  // the row may straddle the boundary to the next output row
+  if (y + 1 < out_height && in_index >= rows.start[y + 1]) {
+    accumulateRow(
+        next_sums,
+        row_buffer,
+        rows.weights[
+            (size_t) (y + 1) * rows.max_taps + in_index - rows.start[y + 1]],
+        row_samples);
+  }
+
+  if (in_index != first + rows.taps[y] - 1) {
+    return false;
+  }
+
+  const unsigned int shift = kResamplerWeightBits + kResamplerRowBits;
+  const uint32_t rounding = 1 << (shift - 1);
+  for (size_t i = 0; i < row_samples; i++) {
+    out_row[i] = (JSAMPLE) std::min<uint32_t>(
+        (current_sums[i] + rounding) >> shift,
+        MAXJSAMPLE);
+  }
+
+  std::swap(current_sums, next_sums);
+  memset(next_sums, 0, row_samples * sizeof(uint32_t));
+  next_out_row++;
+  return true;
+}
+
+} } }
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_RESAMPLER_H_
+#define _JPEG_RESAMPLER_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Filter taps of one resampled dimension.
+ *
+ * <p> Output pixel i is the weighted sum of taps input pixels starting at
+ * start[i], with weights at weights[i * max_taps]. Weights of an output
+ * pixel add up to 1 << 14.
+ */
+struct JpegResamplerAxis {
+  JDIMENSION* start;
+  JDIMENSION* taps;
+  uint16_t* weights;
+  unsigned int max_taps;
+};
+
+/**
+ * Streaming area resampler for interleaved 8 bit scanlines.
+ *
+ * <p> Downscales by an arbitrary ratio, averaging every input pixel
+ * according to how much of it an output pixel covers. Input rows are pushed
+ * one by one, so only a handful of rows are kept in memory at any time.
+ *
+ * <p> All memory comes from the JPOOL_IMAGE pool of the libjpeg struct
+ * passed to init, so it is released together with that struct, also when
+ * libjpeg bails out with longjmp.
+ */
+struct JpegResampler {
+  JDIMENSION in_width;
+  JDIMENSION in_height;
+  JDIMENSION out_width;
+  JDIMENSION out_height;
+  int components;
+
+  JpegResamplerAxis columns;
+  JpegResamplerAxis rows;
+
+  /**
+   * Current input row scaled horizontally, 8 fractional bits
+   */
+  uint16_t* row_buffer;
+
+  /**
+   * Output rows being accumulated. An input row contributes to at most two
+   * of them when downscaling.
+   */
+  uint32_t* current_sums;
+  uint32_t* next_sums;
+
+  JDIMENSION next_in_row;
+  JDIMENSION next_out_row;
+
+  /**
+   * Prepares resampling from in_width x in_height to out_width x out_height.
+   * Output dimensions must not exceed input ones.
+   */
+  void init(
+      j_common_ptr cinfo,
+      JDIMENSION in_width,
+      JDIMENSION in_height,
+      JDIMENSION out_width,
+      JDIMENSION out_height,
+      int components);
+
+  /**
+   * Consumes next input row.
+   *
+   * @param out_row receives the next output row once it is complete
+   * @return true if out_row was written, false if it needs more input
+   */
+  bool pushRow(JSAMPROW in_row, JSAMPROW out_row);
+};
+
+} } }
+
+#endif /* _JPEG_RESAMPLER_H_ */
@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "jpeg_restart.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+static const uint8_t kMarkerPrefix = 0xFF;
+static const uint8_t kMarkerSOF0 = 0xC0;
+static const uint8_t kMarkerSOF1 = 0xC1;
+static const uint8_t kMarkerSOF15 = 0xCF;
+static const uint8_t kMarkerDHT = 0xC4;
+static const uint8_t kMarkerDAC = 0xCC;
+static const uint8_t kMarkerRST0 = 0xD0;
+static const uint8_t kMarkerRST7 = 0xD7;
+static const uint8_t kMarkerSOI = 0xD8;
+static const uint8_t kMarkerEOI = 0xD9;
+static const uint8_t kMarkerSOS = 0xDA;
+static const uint8_t kMarkerDRI = 0xDD;
+
+/**
+ * Frame and scan parameters of the image, read from its headers.
+ */
+struct RestartHeader {
+  size_t height_offset = 0;   // offset of the height field of SOF
+  size_t header_size = 0;     // bytes up to the end of SOS
+  unsigned int width = 0;
+  unsigned int height = 0;
+  unsigned int mcu_width = 0;
+  unsigned int mcu_height = 0;
+  unsigned int restart_interval = 0;
+};
+
+static unsigned int readUInt16(const uint8_t* data) {
+  return (data[0] << 8) | data[1];
+}
+
+/**
+ * Reads SOF, parsing the MCU size the way libjpeg does: a scan of a single
+ * component has one block per MCU, an interleaved one the blocks of all
+ * components at their sampling factors.
+ *
+ * @param segment start of the length field of the marker
+ */
+static bool readFrameHeader(
+    const uint8_t* data,
+    size_t segment,
+    unsigned int length,
+    RestartHeader& header,
+    unsigned int& components) {
+  if (length < 8) {
+    return false;
+  }
+  header.height_offset = segment + 3;
+  header.height = readUInt16(data + segment + 3);
+  header.width = readUInt16(data + segment + 5);
+  components = data[segment + 7];
+  if (header.width == 0 || header.height == 0 || components == 0 ||
+      length != 8 + 3 * components) {
+    return false;
+  }
+
+  unsigned int max_h_samp = 0;
+  unsigned int max_v_samp = 0;
+  for (unsigned int i = 0; i < components; i++) {
+    const uint8_t sampling = data[segment + 8 + 3 * i + 1];
+    const unsigned int h_samp = sampling >> 4;
+    const unsigned int v_samp = sampling & 0x0F;
+    if (h_samp == 0 || v_samp == 0) {
+      return false;
+    }
+    max_h_samp = std::max(max_h_samp, h_samp);
+    max_v_samp = std::max(max_v_samp, v_samp);
+  }
+  header.mcu_width = components == 1 ? 8 : 8 * max_h_samp;
+  header.mcu_height = components == 1 ? 8 : 8 * max_v_samp;
+  return true;
+}
+
+/**
+ * Reads the markers up to the end of SOS.
+ *
+ * @return false unless the image is a single scan huffman coded image
+ */
+static bool readHeaders(
+    const uint8_t* data,
+    size_t size,
+    RestartHeader& header) {
+  if (size < 4 || data[0] != kMarkerPrefix || data[1] != kMarkerSOI) {
+    return false;
+  }
+
+  unsigned int components = 0;
+  size_t position = 2;
+  while (true) {
+    if (position >= size || data[position] != kMarkerPrefix) {
+      return false;
+    }
+    // any number of fill bytes may precede a marker
+    while (position < size && data[position] == kMarkerPrefix) {
+      position++;
+    }
+    if (position + 2 >= size) {
+      return false;
+    }
+    const uint8_t marker = data[position++];
+    const unsigned int length = readUInt16(data + position);
+    if (length < 2 || position + length > size) {
+      return false;
+    }
+
+    if (marker == kMarkerSOF0 || marker == kMarkerSOF1) {
+      if (header.height_offset != 0 ||
+          !readFrameHeader(data, position, length, header, components)) {
+        return false;
+      }
+    } else if (marker >= kMarkerSOF0 && marker <= kMarkerSOF15 &&
+        marker != kMarkerDHT && marker != kMarkerDAC) {
+      // progressive, lossless, hierarchical or arithmetic coding
+      return false;
+    } else if (marker == kMarkerDRI) {
+      if (length != 4) {
+        return false;
+      }
+      header.restart_interval = readUInt16(data + position + 2);
+    } else if (marker == kMarkerSOS) {
+      // interleaved scans cover all components, others only one of them
+      if (header.height_offset == 0 || length < 3 ||
+          data[position + 2] != components) {
+        return false;
+      }
+      header.header_size = position + length;
+      return true;
+    } else if (marker == kMarkerEOI) {
+      return false;
+    }
+    position += length;
+  }
+}
+
+/**
+ * Finds the restart intervals of the entropy coded data, which has to end
+ * with EOI.
+ *
+ * @param intervals [start, end) offsets of every interval
+ */
+static bool findRestartIntervals(
+    const uint8_t* data,
+    size_t size,
+    size_t position,
+    std::vector<std::pair<size_t, size_t>>& intervals) {
+  size_t interval_start = position;
+  while (true) {
+    const uint8_t* prefix = (const uint8_t*) memchr(
+        data + position,
+        kMarkerPrefix,
+        size - position);
+    if (prefix == nullptr) {
+      return false;
+    }
+    position = prefix - data;
+    if (position + 1 >= size) {
+      return false;
+    }
+
+    const uint8_t marker = data[position + 1];
+    if (marker == 0x00) {
+      // stuffed 0xFF data byte
+      position += 2;
+    } else if (marker == kMarkerPrefix) {
+      // fill byte
+      position++;
+    } else if (marker >= kMarkerRST0 && marker <= kMarkerRST7) {
+      if ((size_t) (marker - kMarkerRST0) != intervals.size() % 8) {
+        return false;
+      }
+      intervals.emplace_back(interval_start, position);
+      position += 2;
+      interval_start = position;
+    } else if (marker == kMarkerEOI) {
+      intervals.emplace_back(interval_start, position);
+      return true;
+    } else {
+      return false;
+    }
+  }
+}
+
+/**
+ * Builds a standalone image of intervals [first, last) of the source
+ * image, renumbering their restart markers from RST0.
+ */
+static void buildBand(
+    const uint8_t* data,
+    const RestartHeader& header,
+    const std::vector<std::pair<size_t, size_t>>& intervals,
+    size_t first,
+    size_t last,
+    RestartBand& band) {
+  size_t size = header.header_size + 2 * (last - first);
+  for (size_t i = first; i < last; i++) {
+    size += intervals[i].second - intervals[i].first;
+  }
+  std::vector<uint8_t>& band_data = band.data;
+  band_data.reserve(size);
+  band_data.insert(band_data.end(), data, data + header.header_size);
+  band_data[header.height_offset] = (uint8_t) (band.rows >> 8);
+  band_data[header.height_offset + 1] = (uint8_t) band.rows;
+
+  for (size_t i = first; i < last; i++) {
+    band_data.insert(
+        band_data.end(),
+        data + intervals[i].first,
+        data + intervals[i].second);
+    band_data.push_back(kMarkerPrefix);
+    band_data.push_back(i + 1 < last
+        ? (uint8_t) (kMarkerRST0 + (i - first) % 8)
+        : kMarkerEOI);
+  }
+}
+
+bool splitRestartBands(
+    const uint8_t* data,
+    size_t size,
+    unsigned int max_bands,
+    unsigned int min_band_rows,
+    unsigned int row_alignment,
+    std::vector<RestartBand>& bands) {
+  bands.clear();
+  RestartHeader header;
+  if (!readHeaders(data, size, header) || header.restart_interval == 0) {
+    return false;
+  }
+
+  const unsigned int band_count = std::min(
+      max_bands,
+      header.height / std::max(min_band_rows, 1u));
+  if (band_count < 2) {
+    return false;
+  }
+
+  std::vector<std::pair<size_t, size_t>> intervals;
+  if (!findRestartIntervals(data, size, header.header_size, intervals)) {
+    return false;
+  }
+  const uint64_t mcus_per_row =
+      (header.width + header.mcu_width - 1) / header.mcu_width;
+  const uint64_t mcu_rows =
+      (header.height + header.mcu_height - 1) / header.mcu_height;
+  const uint64_t restart_interval = header.restart_interval;
+  if (intervals.size() !=
+      (mcus_per_row * mcu_rows + restart_interval - 1) / restart_interval) {
+    return false;
+  }
+
+  // start a band at the first interval starting an MCU row at or below
+  // each of band_count evenly spaced rows
+  std::vector<size_t> band_starts{0};
+  std::vector<unsigned int> band_rows{0};
+  unsigned int next_band = 1;
+  for (size_t i = 1; i < intervals.size() && next_band < band_count; i++) {
+    const uint64_t mcus = i * restart_interval;
+    if (mcus % mcus_per_row != 0) {
+      continue;
+    }
+    const unsigned int row =
+        (unsigned int) (mcus / mcus_per_row * header.mcu_height);
+    if (row % row_alignment != 0 ||
+        row - band_rows.back() < min_band_rows ||
+        row < (uint64_t) header.height * next_band / band_count) {
+      continue;
+    }
+    band_starts.push_back(i);
+    band_rows.push_back(row);
+    while (next_band < band_count &&
+        row >= (uint64_t) header.height * next_band / band_count) {
+      next_band++;
+    }
+  }
+  if (band_starts.size() < 2) {
+    return false;
+  }
+
+  band_starts.push_back(intervals.size());
+  band_rows.push_back(header.height);
+  bands.resize(band_starts.size() - 1);
+  for (size_t i = 0; i < bands.size(); i++) {
+    bands[i].first_row = band_rows[i];
+    bands[i].rows = band_rows[i + 1] - band_rows[i];
+    buildBand(
+        data,
+        header,
+        intervals,
+        band_starts[i],
+        band_starts[i + 1],
+        bands[i]);
+  }
+  return true;
+}
+
+} } }
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_RESTART_H_
+#define _JPEG_RESTART_H_
+
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Horizontal band of a jpeg image that can be decoded on its own.
+ */
+struct RestartBand {
+  /**
+   * Complete jpeg image of the band: the headers of the source image with
+   * the height of the band, followed by its restart intervals.
+   */
+  std::vector<uint8_t> data;
+
+  /**
+   * First row of the band in the source image
+   */
+  unsigned int first_row;
+
+  /**
+   * Rows of the band
+   */
+  unsigned int rows;
+};
+
+/**
+ * Splits a baseline jpeg image with restart markers into at most max_bands
+ * horizontal bands at restart markers that start a new MCU row.
+ *
+ * <p> The entropy coder starts over at every restart marker, so bands
+ * decode to exactly the rows of the source image they cover as long as
+ * upsampling does not look at neighbouring rows.
+ *
+ * <p> Only single scan images using huffman coding can be split. The whole
+ * entropy coded data is validated, so every band is known to end in a
+ * complete restart interval.
+ *
+ * @param min_band_rows rows every band but the last has at least
+ * @param row_alignment rows every band starts at a multiple of
+ * @return false if the image has no suitable restart markers, in which case
+ *   bands is left empty
+ */
+bool splitRestartBands(
+    const uint8_t* data,
+    size_t size,
+    unsigned int max_bands,
+    unsigned int min_band_rows,
+    unsigned int row_alignment,
+    std::vector<RestartBand>& bands);
+
+} } }
+
+#endif /* _JPEG_RESTART_H_ */
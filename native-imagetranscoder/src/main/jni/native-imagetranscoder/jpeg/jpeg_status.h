@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _JPEG_STATUS_H_
+#define _JPEG_STATUS_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+
+/**
+ * Error code of an operation aborted through its cancellation token, past
+ * the codes of libjpeg. Raised with ERREXIT like those, so the error
+ * handlers format it.
+ */
+static const int kJpegErrorCancelled = 1000;
+
+/**
+ * Error code of failures detected outside of libjpeg, e.g. invalid
+ * arguments or a wrong key.
+ */
+static const int kJpegErrorFailed = 1001;
+
+/**
+ * Outcome of an operation of the jpeg core, which reports errors here
+ * instead of throwing. The JNI methods turn a failed status into a java
+ * exception, other callers check it themselves.
+ *
+ * <p> Only the first failure is kept, the ones it causes while the
+ * operation unwinds are of no interest.
+ */
+struct JpegStatus {
+  bool failed;
+  // libjpeg message code, kJpegErrorCancelled or kJpegErrorFailed
+  int code;
+  char message[JMSG_LENGTH_MAX];
+
+  JpegStatus() : failed(false), code(0) {
+    message[0] = '\0';
+  }
+
+  void fail(int error_code, const char* error_message) {
+    if (failed) {
+      return;
+    }
+    failed = true;
+    code = error_code;
+    strncpy(message, error_message, sizeof(message) - 1);
+    message[sizeof(message) - 1] = '\0';
+  }
+
+  bool isCancelled() const {
+    return failed && code == kJpegErrorCancelled;
+  }
+};
+
+} } }
+
+/**
+ * Counterparts of the macros of exceptions_handler.h for the jpeg core,
+ * recording the failure in the JpegStatus named status of the caller.
+ */
+#define FAIL_AND_RETURN_IF(condition, message)                          \
+  do {                                                                  \
+    if (condition) {                                                    \
+      status.fail(facebook::imagepipeline::jpeg::kJpegErrorFailed,      \
+          message);                                                     \
+      return;                                                           \
+    }                                                                   \
+  } while (0)
+
+#define FAIL_AND_RETURNVAL_IF(condition, message, return_value)         \
+  do {                                                                  \
+    if (condition) {                                                    \
+      status.fail(facebook::imagepipeline::jpeg::kJpegErrorFailed,      \
+          message);                                                     \
+      return return_value;                                              \
+    }                                                                   \
+  } while (0)
+
+#define RETURN_IF_FAILED                                                \
+  do {                                                                  \
+    if (status.failed) {                                                \
+      return;                                                           \
+    }                                                                   \
+  } while (0)
+
+#define RETURNVAL_IF_FAILED(return_value)                               \
+  do {                                                                  \
+    if (status.failed) {                                                \
+      return return_value;                                              \
+    }                                                                   \
+  } while (0)
+
+#endif /* _JPEG_STATUS_H_ */
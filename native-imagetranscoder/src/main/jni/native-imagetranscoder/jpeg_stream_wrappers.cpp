@@ -12,7 +12,7 @@
 #include <jerror.h>
 
 #include "java_globals.h"
-#include "jpeg_error_handler.h"
+#include "jpeg/jpeg_error_handler.h"
 #include "jpeg_stream_wrappers.h"
 
 namespace facebook {
@@ -24,6 +24,16 @@ namespace jpeg {
  */
 static const unsigned int kStreamBufferSize = 8 * 1024;
 
+/**
+ * Fails the operation of cinfo if the last call into java threw. The java
+ * exception stays pending and is what the JNI method ends with.
+ */
+static void jumpOnJavaException(JNIEnv* env, j_common_ptr cinfo) {
+  if (env->ExceptionCheck()) {
+    jpegFail(cinfo, "Exception in java stream");
+  }
+}
+
 /**
  * initialize input stream
  */
@@ -32,13 +42,13 @@ static void isInitSource(j_decompress_ptr dinfo) {
   JNIEnv* env = src->env;
   src->start = true;
   src->javaBuffer = env->NewByteArray(kStreamBufferSize);
-  jpegJumpOnException((j_common_ptr) dinfo);
+  jumpOnJavaException(env, (j_common_ptr) dinfo);
   src->buffer = (JOCTET*) (*dinfo->mem->alloc_small)(
       (j_common_ptr) dinfo,
       JPOOL_PERMANENT,
       kStreamBufferSize * sizeof(JOCTET));
   if (src->buffer == nullptr) {
-    jpegSafeThrow(
+    jpegFail(
         (j_common_ptr) dinfo,
         "Failed to allocate memory for read buffer");
   }
@@ -54,7 +64,7 @@ static boolean isFillInputBuffer(j_decompress_ptr dinfo) {
       src->inputStream,
       midInputStreamRead,
       src->javaBuffer);
-  jpegJumpOnException((j_common_ptr) dinfo);
+  jumpOnJavaException(env, (j_common_ptr) dinfo);
 
   if (nbytes <= 0) {
     if (src->start) {
@@ -69,7 +79,7 @@ static boolean isFillInputBuffer(j_decompress_ptr dinfo) {
         0,
         kStreamBufferSize,
         (jbyte*) src->buffer);
-    jpegJumpOnException((j_common_ptr) dinfo);
+    jumpOnJavaException(env, (j_common_ptr) dinfo);
   }
   src->public_fields.next_input_byte = src->buffer;
   src->public_fields.bytes_in_buffer = nbytes;
@@ -96,7 +106,7 @@ static void isSkipInputData(j_decompress_ptr dinfo, long num_bytes) {
           src->inputStream,
           midInputStreamSkip,
           (jlong) to_skip);
-      jpegJumpOnException((j_common_ptr) dinfo);
+      jumpOnJavaException(env, (j_common_ptr) dinfo);
       src->public_fields.next_input_byte = nullptr;
       src->public_fields.bytes_in_buffer = 0;
     }
@@ -134,11 +144,11 @@ static void osInitDestination(j_compress_ptr cinfo) {
   // allocate java byte array
   dest->javaBuffer = env->NewByteArray(kStreamBufferSize);
   if (dest->javaBuffer == NULL) {
-      jpegSafeThrow(
+      jpegFail(
           (j_common_ptr) cinfo,
           "Failed to allocate memory for java byte buffer.");
   }
-  jpegJumpOnException((j_common_ptr) cinfo);
+  jumpOnJavaException(env, (j_common_ptr) cinfo);
 
   // allocate the output buffer --- it will be released when done with image
   dest->buffer = (JOCTET *) (*cinfo->mem->alloc_small)(
@@ -146,7 +156,7 @@ static void osInitDestination(j_compress_ptr cinfo) {
       JPOOL_IMAGE,
       kStreamBufferSize * sizeof(JOCTET));
   if (dest->buffer == NULL) {
-    jpegSafeThrow(
+    jpegFail(
         (j_common_ptr) cinfo,
         "Failed to allocate memory for byte buffer.");
   }
@@ -166,12 +176,12 @@ static boolean osEmptyOutputBuffer(j_compress_ptr cinfo) {
       0,
       kStreamBufferSize,
       (jbyte*) dest->buffer);
-  jpegJumpOnException((j_common_ptr) cinfo);
+  jumpOnJavaException(env, (j_common_ptr) cinfo);
   env->CallVoidMethod(
       dest->outputStream,
       midOutputStreamWrite,
       dest->javaBuffer);
-  jpegJumpOnException((j_common_ptr) cinfo);
+  jumpOnJavaException(env, (j_common_ptr) cinfo);
   dest->public_fields.next_output_byte = dest->buffer;
   dest->public_fields.free_in_buffer = kStreamBufferSize;
   return true;
@@ -192,14 +202,14 @@ static void osTermDestination(j_compress_ptr cinfo) {
         0,
         datacount,
         (jbyte*) dest->buffer);
-    jpegJumpOnException((j_common_ptr) cinfo);
+    jumpOnJavaException(env, (j_common_ptr) cinfo);
     env->CallVoidMethod(
         dest->outputStream,
         midOutputStreamWriteWithBounds,
         dest->javaBuffer,
         0,
         datacount);
-    jpegJumpOnException((j_common_ptr) cinfo);
+    jumpOnJavaException(env, (j_common_ptr) cinfo);
   }
 }
 
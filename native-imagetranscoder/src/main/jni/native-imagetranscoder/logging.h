@@ -8,11 +8,58 @@
 #ifndef _LOGGING_H_
 #define _LOGGING_H_
 
+#ifdef __ANDROID__
+
 #include <android/log.h>
 
-#define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
-#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
-#define LOGW(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
-#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOG_PRINT(priority, ...) \
+  __android_log_print((priority), LOG_TAG, __VA_ARGS__)
+
+#else
+
+#include <stdio.h>
+
+/**
+ * Host builds of the jpeg core, see CMakeLists.txt, log to stderr. The
+ * priorities have the values of android_LogPriority.
+ */
+enum {
+  ANDROID_LOG_VERBOSE = 2,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+};
+
+#define LOG_PRINT(priority, ...) \
+  do { \
+    fprintf(stderr, LOG_TAG ": " __VA_ARGS__); \
+    fputc('\n', stderr); \
+  } while (0)
+
+#endif
+
+/**
+ * Lowest priority logged, one of the ANDROID_LOG_* values. Calls below it
+ * are compiled out, e.g. with -DLOG_LEVEL=ANDROID_LOG_INFO in release
+ * builds. LOGV, used inside per block and per pixel loops, is off unless
+ * LOG_LEVEL is lowered to ANDROID_LOG_VERBOSE.
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL ANDROID_LOG_DEBUG
+#endif
+
+#define LOG_AT(priority, ...) \
+  do { \
+    if ((priority) >= (LOG_LEVEL)) { \
+      LOG_PRINT((priority), __VA_ARGS__); \
+    } \
+  } while (0)
+
+#define LOGV(...) LOG_AT(ANDROID_LOG_VERBOSE, __VA_ARGS__)
+#define LOGD(...) LOG_AT(ANDROID_LOG_DEBUG, __VA_ARGS__)
+#define LOGI(...) LOG_AT(ANDROID_LOG_INFO, __VA_ARGS__)
+#define LOGW(...) LOG_AT(ANDROID_LOG_ERROR, __VA_ARGS__)
+#define LOGE(...) LOG_AT(ANDROID_LOG_ERROR, __VA_ARGS__)
 
 #endif /* _LOGGING_H_ */
@@ -7,56 +7,81 @@
 
 #include <algorithm>
 
-#include <jni.h>
-
-#include "exceptions_handler.h"
-#include "java_globals.h"
 #include "transformations.h"
 
 namespace facebook {
 namespace imagepipeline {
 
-RotationType getRotationTypeFromDegrees(JNIEnv* env, uint16_t degrees) {
+bool getRotationTypeFromDegrees(
+    uint16_t degrees,
+    RotationType& rotation_type) {
   switch (degrees) {
   case 0:
-    return RotationType::ROTATE_0;
+    rotation_type = RotationType::ROTATE_0;
+    return true;
   case 90:
-    return RotationType::ROTATE_90;
+    rotation_type = RotationType::ROTATE_90;
+    return true;
   case 180:
-    return RotationType::ROTATE_180;
+    rotation_type = RotationType::ROTATE_180;
+    return true;
   case 270:
-    return RotationType::ROTATE_270;
+    rotation_type = RotationType::ROTATE_270;
+    return true;
   default:
-    THROW_AND_RETURNVAL_IF(
-        true,
-        "wrong rotation angle",
-        RotationType::ROTATE_0);
+    return false;
   }
 }
 
-RotationType getRotationTypeFromRawExifOrientation(JNIEnv* env, uint16_t exif_orientation) {
+bool getRotationTypeFromRawExifOrientation(
+    uint16_t exif_orientation,
+    RotationType& rotation_type) {
   switch (exif_orientation) {
   case 1:
-    return RotationType::ROTATE_0;
+    rotation_type = RotationType::ROTATE_0;
+    return true;
   case 6:
-    return RotationType::ROTATE_90;
+    rotation_type = RotationType::ROTATE_90;
+    return true;
   case 3:
-    return RotationType::ROTATE_180;
+    rotation_type = RotationType::ROTATE_180;
+    return true;
   case 8:
-    return RotationType::ROTATE_270;
+    rotation_type = RotationType::ROTATE_270;
+    return true;
   case 2:
-    return RotationType::FLIP_HORIZONTAL;
+    rotation_type = RotationType::FLIP_HORIZONTAL;
+    return true;
   case 4:
-    return RotationType::FLIP_VERTICAL;
+    rotation_type = RotationType::FLIP_VERTICAL;
+    return true;
   case 5:
-    return RotationType::TRANSPOSE;
+    rotation_type = RotationType::TRANSPOSE;
+    return true;
   case 7:
-    return RotationType::TRANSVERSE;
+    rotation_type = RotationType::TRANSVERSE;
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool getMarkerPolicy(int marker_policy, MarkerPolicy& policy) {
+  switch (marker_policy) {
+  case 0:
+    policy = MarkerPolicy::NONE;
+    return true;
+  case 1:
+    policy = MarkerPolicy::EXIF_ORIENTATION;
+    return true;
+  case 2:
+    policy = MarkerPolicy::ICC_PROFILE;
+    return true;
+  case 3:
+    policy = MarkerPolicy::ALL;
+    return true;
   default:
-    THROW_AND_RETURNVAL_IF(
-        true,
-        "wrong exif orientation",
-        RotationType::ROTATE_0);
+    return false;
   }
 }
 
@@ -10,8 +10,6 @@
 
 #include <stdint.h>
 
-#include <jni.h>
-
 namespace facebook {
 namespace imagepipeline {
 
@@ -31,13 +29,36 @@ enum class RotationType {
 
 /**
  * Transforms degrees into RotationType
+ *
+ * @return false if degrees is not one of 0, 90, 180 and 270
  */
-RotationType getRotationTypeFromDegrees(JNIEnv* env, uint16_t degrees);
+bool getRotationTypeFromDegrees(uint16_t degrees, RotationType& rotation_type);
 
 /**
  * Transforms raw EXIF orientation values into RotationType
+ *
+ * @return false if exif_orientation is not one of 1 - 8
+ */
+bool getRotationTypeFromRawExifOrientation(
+    uint16_t exif_orientation,
+    RotationType& rotation_type);
+
+/**
+ * APPn and COM markers of the source image kept in transformed images.
  */
-RotationType getRotationTypeFromRawExifOrientation(JNIEnv* env, uint16_t exif_orientation);
+enum class MarkerPolicy {
+  NONE,
+  EXIF_ORIENTATION,
+  ICC_PROFILE,
+  ALL
+};
+
+/**
+ * Transforms values of the MARKER_POLICY_* java constants into MarkerPolicy
+ *
+ * @return false if marker_policy is none of them
+ */
+bool getMarkerPolicy(int marker_policy, MarkerPolicy& policy);
 
 /**
  * Scale factor to be used for resizing.
@@ -71,6 +92,58 @@ class ScaleFactor {
   const uint8_t denominator_;
 };
 
+/**
+ * Exact size to be used for resizing, in pixels of the unrotated image.
+ */
+class TargetSize {
+ public:
+  TargetSize(int width, int height)
+  : width_(width), height_(height) {}
+
+  int getWidth() const {
+    return width_;
+  }
+
+  int getHeight() const {
+    return height_;
+  }
+
+ private:
+  const int width_;
+  const int height_;
+};
+
+/**
+ * Region to crop to, in pixels of the rotated image.
+ */
+class CropInfo {
+ public:
+  CropInfo(int x, int y, int width, int height)
+  : x_(x), y_(y), width_(width), height_(height) {}
+
+  int getX() const {
+    return x_;
+  }
+
+  int getY() const {
+    return y_;
+  }
+
+  int getWidth() const {
+    return width_;
+  }
+
+  int getHeight() const {
+    return height_;
+  }
+
+ private:
+  const int x_;
+  const int y_;
+  const int width_;
+  const int height_;
+};
+
 } }
 
 #endif /* TRANSFORMATIONS_H */
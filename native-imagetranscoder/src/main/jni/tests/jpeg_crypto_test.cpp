@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Tests of the jpeg crypto: round trips at every cipher level, and
+ * transcryptJpeg against a decrypt and encrypt pair.
+ */
+
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <gtest/gtest.h>
+#include <jpeglib.h>
+
+#include "decoded_image.h"
+#include "test_images.h"
+#include "jpeg/crypto/jpeg_crypto.h"
+#include "jpeg/crypto/jpeg_decrypt.h"
+#include "jpeg/crypto/jpeg_encrypt.h"
+#include "jpeg/crypto/jpeg_transcrypt.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+
+using facebook::imagepipeline::PixelFormat;
+using namespace facebook::imagepipeline::jpeg;
+using namespace facebook::imagepipeline::jpeg::crypto;
+using namespace facebook::imagepipeline::jpeg::test;
+
+namespace {
+
+const CryptoKey kKey{"5.55555555555555555556e-1", "3.577777777777777777e0"};
+const CryptoKey kNewKey{"2.71828182845904523536e-1", "3.699999999999999999e0"};
+
+const int kCipherLevels[] = {
+    CIPHER_LEVEL_DC, CIPHER_LEVEL_DC_SIGNS, CIPHER_LEVEL_FULL};
+
+std::vector<uint8_t> encrypt(
+    const std::vector<uint8_t>& plaintext,
+    const CryptoKey& key,
+    int level) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(plaintext.data(), plaintext.size());
+  JpegMemoryDestination destination;
+  encryptJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      key,
+      level,
+      0,
+      nullptr);
+  EXPECT_FALSE(status.failed) << status.message;
+  return std::move(destination.buffer);
+}
+
+std::vector<uint8_t> decrypt(
+    const std::vector<uint8_t>& ciphertext,
+    const CryptoKey& key) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(ciphertext.data(), ciphertext.size());
+  JpegMemoryDestination destination;
+  decryptJpeg(
+      status, source.public_fields, destination.public_fields, key, nullptr);
+  EXPECT_FALSE(status.failed) << status.message;
+  return std::move(destination.buffer);
+}
+
+std::vector<uint8_t> transcrypt(
+    const std::vector<uint8_t>& ciphertext,
+    const CryptoKey& old_key,
+    const CryptoKey& new_key) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(ciphertext.data(), ciphertext.size());
+  JpegMemoryDestination destination;
+  transcryptJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      old_key,
+      new_key);
+  EXPECT_FALSE(status.failed) << status.message;
+  return std::move(destination.buffer);
+}
+
+class JpegCryptoTest : public ::testing::TestWithParam<int> {
+ protected:
+  static void SetUpTestCase() {
+    plaintext_ = new std::vector<uint8_t>(encodeSyntheticJpeg(517, 389, 90));
+  }
+
+  static void TearDownTestCase() {
+    delete plaintext_;
+    plaintext_ = nullptr;
+  }
+
+  static std::vector<uint8_t>* plaintext_;
+};
+
+std::vector<uint8_t>* JpegCryptoTest::plaintext_ = nullptr;
+
+TEST_P(JpegCryptoTest, EncryptDecryptRoundTrip) {
+  const std::vector<uint8_t> ciphertext = encrypt(*plaintext_, kKey, GetParam());
+  const std::vector<uint8_t> decrypted = decrypt(ciphertext, kKey);
+  ASSERT_FALSE(ciphertext.empty());
+  ASSERT_FALSE(decrypted.empty());
+
+  unsigned int width, height;
+  unsigned int cipher_width, cipher_height;
+  unsigned int decrypted_width, decrypted_height;
+  const std::vector<uint8_t> expected =
+      decode(*plaintext_, PixelFormat::RGBA, false, width, height);
+  const std::vector<uint8_t> scrambled = decode(
+      ciphertext, PixelFormat::RGBA, false, cipher_width, cipher_height);
+  const std::vector<uint8_t> actual = decode(
+      decrypted, PixelFormat::RGBA, false, decrypted_width, decrypted_height);
+  EXPECT_EQ(width, cipher_width);
+  EXPECT_EQ(height, cipher_height);
+  EXPECT_NE(expected, scrambled);
+  EXPECT_EQ(width, decrypted_width);
+  EXPECT_EQ(height, decrypted_height);
+  EXPECT_TRUE(expected == actual);
+}
+
+TEST_P(JpegCryptoTest, TranscryptMatchesDecryptThenEncrypt) {
+  const std::vector<uint8_t> ciphertext = encrypt(*plaintext_, kKey, GetParam());
+  const std::vector<uint8_t> transcrypted =
+      transcrypt(ciphertext, kKey, kNewKey);
+  const std::vector<uint8_t> reencrypted =
+      encrypt(decrypt(ciphertext, kKey), kNewKey, GetParam());
+  ASSERT_FALSE(transcrypted.empty());
+
+  // the salt of the cipher header is random per image, so the ciphertexts
+  // differ. What they decrypt to does not
+  EXPECT_TRUE(decrypt(transcrypted, kNewKey) == decrypt(reencrypted, kNewKey));
+
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(transcrypted.data(), transcrypted.size());
+  JpegMemoryDestination destination;
+  decryptJpeg(
+      status, source.public_fields, destination.public_fields, kKey, nullptr);
+  EXPECT_TRUE(status.failed);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    CipherLevels,
+    JpegCryptoTest,
+    ::testing::ValuesIn(kCipherLevels));
+
+} // namespace
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Tests of the decoders: decodeJpegParallel and decodeJpegRegion against the
+ * serial full decode they have to match byte for byte.
+ */
+
+#include <ostream>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+#include <jpeglib.h>
+
+#include "decoded_image.h"
+#include "test_images.h"
+#include "transformations.h"
+#include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+
+using facebook::imagepipeline::CropInfo;
+using facebook::imagepipeline::MarkerPolicy;
+using facebook::imagepipeline::PixelFormat;
+using facebook::imagepipeline::RotationType;
+using facebook::imagepipeline::ScaleFactor;
+using facebook::imagepipeline::bytesPerPixel;
+using namespace facebook::imagepipeline::jpeg;
+using namespace facebook::imagepipeline::jpeg::test;
+
+namespace {
+
+/**
+ * Full decode at scale_factor with the parameters decodeJpegRegion decodes
+ * with, straight on libjpeg so that it shares no code with it.
+ */
+std::vector<uint8_t> decodeLikeRegion(
+    const std::vector<uint8_t>& jpeg,
+    const ScaleFactor& scale_factor,
+    PixelFormat pixel_format,
+    bool dither,
+    unsigned int& width,
+    unsigned int& height) {
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_error_mgr error_manager;
+  dinfo.err = jpeg_std_error(&error_manager);
+  jpeg_create_decompress(&dinfo);
+  jpeg_mem_src(&dinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.dct_method = JDCT_IFAST;
+  dinfo.do_fancy_upsampling = TRUE;
+  dinfo.do_block_smoothing = FALSE;
+  dinfo.scale_num = scale_factor.getNumerator();
+  dinfo.scale_denom = scale_factor.getDenominator();
+  if (pixel_format == PixelFormat::RGBA) {
+    dinfo.out_color_space = JCS_EXT_RGBA;
+  } else {
+    dinfo.out_color_space = JCS_RGB565;
+    dinfo.dither_mode = dither ? JDITHER_ORDERED : JDITHER_NONE;
+  }
+  jpeg_start_decompress(&dinfo);
+  width = dinfo.output_width;
+  height = dinfo.output_height;
+  // output_components is 3 for JCS_RGB565, which has 2 bytes per pixel
+  const size_t stride = (size_t) width * bytesPerPixel(pixel_format);
+  std::vector<uint8_t> pixels(stride * height);
+  // the dithered RGB_565 converter shifts its pattern on rows that do not
+  // start at a multiple of 4 bytes, the row buffer of a vector is aligned
+  std::vector<uint8_t> row_buffer(stride);
+  JSAMPROW row = row_buffer.data();
+  while (dinfo.output_scanline < height) {
+    uint8_t* out_row = &pixels[dinfo.output_scanline * stride];
+    jpeg_read_scanlines(&dinfo, &row, 1);
+    memcpy(out_row, row, stride);
+  }
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  return pixels;
+}
+
+struct DecodeFormat {
+  PixelFormat pixel_format;
+  bool dither;
+};
+
+void PrintTo(const DecodeFormat& format, std::ostream* out) {
+  *out << (format.pixel_format == PixelFormat::RGBA ? "RGBA" : "RGB_565")
+       << (format.dither ? " dithered" : "");
+}
+
+const DecodeFormat kDecodeFormats[] = {
+    {PixelFormat::RGBA, false},
+    {PixelFormat::RGB_565, false},
+    {PixelFormat::RGB_565, true},
+};
+
+class JpegParallelDecodeTest : public ::testing::TestWithParam<DecodeFormat> {
+ protected:
+  /**
+   * 1280x1024 with a restart interval every iMCU row, large enough for the
+   * parallel decode to split it into bands.
+   */
+  static void SetUpTestCase() {
+    const std::vector<uint8_t> source_jpeg = encodeSyntheticJpeg(2560, 2048, 90);
+    JpegStatus status;
+    JpegMemorySource source;
+    source.setExternalBuffer(source_jpeg.data(), source_jpeg.size());
+    JpegMemoryDestination destination;
+    transformJpeg(
+        status,
+        source.public_fields,
+        destination.public_fields,
+        RotationType::ROTATE_0,
+        ScaleFactor{4, 8},
+        85,
+        MarkerPolicy::NONE,
+        1);
+    ASSERT_FALSE(status.failed) << status.message;
+    jpeg_ = new std::vector<uint8_t>(std::move(destination.buffer));
+  }
+
+  static void TearDownTestCase() {
+    delete jpeg_;
+    jpeg_ = nullptr;
+  }
+
+  static std::vector<uint8_t>* jpeg_;
+};
+
+std::vector<uint8_t>* JpegParallelDecodeTest::jpeg_ = nullptr;
+
+TEST_P(JpegParallelDecodeTest, MatchesSerialDecode) {
+  const DecodeFormat format = GetParam();
+  unsigned int width, height;
+  const std::vector<uint8_t> expected =
+      decode(*jpeg_, format.pixel_format, format.dither, width, height);
+  ASSERT_GE((size_t) width * height, 1024u * 1024u);
+
+  const size_t stride = expected.size() / height;
+  std::vector<uint8_t> actual(expected.size());
+  JpegStatus status;
+  decodeJpegParallel(
+      status,
+      jpeg_->data(),
+      jpeg_->size(),
+      kFullSize,
+      format.pixel_format,
+      format.dither,
+      actual.data(),
+      width,
+      height,
+      stride,
+      4);
+  ASSERT_FALSE(status.failed) << status.message;
+  EXPECT_TRUE(expected == actual);
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Formats,
+    JpegParallelDecodeTest,
+    ::testing::ValuesIn(kDecodeFormats));
+
+class JpegRegionDecodeTest : public ::testing::TestWithParam<DecodeFormat> {
+ protected:
+  static void SetUpTestCase() {
+    jpeg_ = new std::vector<uint8_t>(encodeSyntheticJpeg(723, 541, 90));
+  }
+
+  static void TearDownTestCase() {
+    delete jpeg_;
+    jpeg_ = nullptr;
+  }
+
+  /**
+   * Decodes region at scale_factor and compares it with the same rectangle
+   * of the full decode.
+   */
+  static void expectRegionOfFullDecode(
+      const ScaleFactor& scale_factor,
+      const CropInfo& region) {
+    const DecodeFormat format = GetParam();
+    unsigned int width, height;
+    const std::vector<uint8_t> full = decodeLikeRegion(
+        *jpeg_,
+        scale_factor,
+        format.pixel_format,
+        format.dither,
+        width,
+        height);
+    const size_t bytes_per_pixel = bytesPerPixel(format.pixel_format);
+    const size_t stride = region.getWidth() * bytes_per_pixel;
+    std::vector<uint8_t> actual(stride * region.getHeight());
+    JpegStatus status;
+    JpegMemorySource source;
+    source.setExternalBuffer(jpeg_->data(), jpeg_->size());
+    decodeJpegRegion(
+        status,
+        source.public_fields,
+        scale_factor,
+        region,
+        format.pixel_format,
+        format.dither,
+        actual.data(),
+        region.getWidth(),
+        region.getHeight(),
+        stride);
+    ASSERT_FALSE(status.failed) << status.message;
+
+    for (int y = 0; y < region.getHeight(); ++y) {
+      const uint8_t* expected_row = &full[
+          ((size_t) (region.getY() + y) * width + region.getX()) *
+          bytes_per_pixel];
+      ASSERT_EQ(0, memcmp(expected_row, &actual[y * stride], stride))
+          << "row " << y << " of " << region.getWidth() << "x"
+          << region.getHeight() << "+" << region.getX() << "+"
+          << region.getY() << " at " << (int) scale_factor.getNumerator()
+          << "/" << (int) scale_factor.getDenominator();
+    }
+  }
+
+  static std::vector<uint8_t>* jpeg_;
+};
+
+std::vector<uint8_t>* JpegRegionDecodeTest::jpeg_ = nullptr;
+
+TEST_P(JpegRegionDecodeTest, MatchesCropOfFullDecode) {
+  expectRegionOfFullDecode(ScaleFactor{8, 8}, CropInfo{37, 53, 301, 211});
+  expectRegionOfFullDecode(ScaleFactor{8, 8}, CropInfo{0, 0, 64, 48});
+  expectRegionOfFullDecode(ScaleFactor{8, 8}, CropInfo{600, 400, 123, 141});
+  expectRegionOfFullDecode(ScaleFactor{4, 8}, CropInfo{19, 27, 150, 101});
+  expectRegionOfFullDecode(ScaleFactor{4, 8}, CropInfo{300, 200, 62, 71});
+  expectRegionOfFullDecode(ScaleFactor{3, 8}, CropInfo{41, 23, 97, 60});
+  expectRegionOfFullDecode(ScaleFactor{1, 8}, CropInfo{3, 5, 40, 30});
+}
+
+TEST_P(JpegRegionDecodeTest, WholeImage) {
+  expectRegionOfFullDecode(ScaleFactor{8, 8}, CropInfo{0, 0, 723, 541});
+}
+
+INSTANTIATE_TEST_CASE_P(
+    Formats,
+    JpegRegionDecodeTest,
+    ::testing::ValuesIn(kDecodeFormats));
+
+} // namespace
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+/*
+ * Tests of the transcoder: the quality estimated for the source, the search
+ * for the quality fitting a byte limit, the markers each policy keeps, and
+ * several outputs from one decode.
+ */
+
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <gtest/gtest.h>
+#include <jpeglib.h>
+
+#include "decoded_image.h"
+#include "test_images.h"
+#include "transformations.h"
+#include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_quality.h"
+#include "jpeg/jpeg_status.h"
+
+using facebook::imagepipeline::MarkerPolicy;
+using facebook::imagepipeline::RotationType;
+using facebook::imagepipeline::ScaleFactor;
+using facebook::imagepipeline::TargetSize;
+using namespace facebook::imagepipeline::jpeg;
+using namespace facebook::imagepipeline::jpeg::test;
+
+namespace {
+
+const int kStartOfScanMarker = 0xDA;
+
+/**
+ * Reads the size of jpeg from its header.
+ */
+void getJpegSize(
+    const std::vector<uint8_t>& jpeg,
+    unsigned int& width,
+    unsigned int& height) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  EXPECT_TRUE(getDecodedJpegSize(
+      status, source.public_fields, kFullSize, width, height))
+      << status.message;
+}
+
+/**
+ * Estimates the quality of jpeg from the tables read by jpeg_read_header.
+ */
+int estimateQuality(const std::vector<uint8_t>& jpeg) {
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_error_mgr error_manager;
+  dinfo.err = jpeg_std_error(&error_manager);
+  jpeg_create_decompress(&dinfo);
+  jpeg_mem_src(&dinfo, jpeg.data(), jpeg.size());
+  jpeg_read_header(&dinfo, TRUE);
+  const int quality = estimateJpegQuality(dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  return quality;
+}
+
+/**
+ * Downscales and rotates jpeg with transformJpeg.
+ *
+ * @param encoded_quality receives the quality the output was encoded with
+ */
+std::vector<uint8_t> transcodeScaled(
+    const std::vector<uint8_t>& jpeg,
+    RotationType rotation_type,
+    const ScaleFactor& scale_factor,
+    int quality,
+    MarkerPolicy marker_policy,
+    int& encoded_quality) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  JpegMemoryDestination destination;
+  encoded_quality = transformJpeg(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      rotation_type,
+      scale_factor,
+      quality,
+      marker_policy,
+      0);
+  EXPECT_FALSE(status.failed) << status.message;
+  return std::move(destination.buffer);
+}
+
+/**
+ * Downscales jpeg with transformJpegWithByteLimit.
+ *
+ * @param encoded_quality receives the quality the output was encoded with
+ */
+std::vector<uint8_t> transcodeWithByteLimit(
+    const std::vector<uint8_t>& jpeg,
+    const ScaleFactor& scale_factor,
+    int max_quality,
+    size_t max_bytes,
+    JpegStatus& status,
+    int& encoded_quality) {
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  JpegMemoryDestination destination;
+  encoded_quality = transformJpegWithByteLimit(
+      status,
+      source.public_fields,
+      destination.public_fields,
+      RotationType::ROTATE_0,
+      scale_factor,
+      max_quality,
+      max_bytes,
+      MarkerPolicy::NONE,
+      0);
+  return std::move(destination.buffer);
+}
+
+/**
+ * An APPn or COM marker: its code and the data following the length.
+ */
+struct Marker {
+  int code;
+  std::vector<uint8_t> data;
+
+  bool operator==(const Marker& other) const {
+    return code == other.code && data == other.data;
+  }
+};
+
+void PrintTo(const Marker& marker, std::ostream* out) {
+  *out << "marker 0x" << std::hex << marker.code << std::dec << " of "
+       << marker.data.size() << " bytes";
+}
+
+Marker makeMarker(int code, const std::string& id, const std::string& body) {
+  Marker marker{code, std::vector<uint8_t>(id.begin(), id.end())};
+  marker.data.push_back(0);
+  marker.data.insert(marker.data.end(), body.begin(), body.end());
+  return marker;
+}
+
+/**
+ * Returns jpeg with markers inserted right after its SOI.
+ */
+std::vector<uint8_t> insertMarkers(
+    const std::vector<uint8_t>& jpeg,
+    const std::vector<Marker>& markers) {
+  std::vector<uint8_t> result(jpeg.begin(), jpeg.begin() + 2);
+  for (const Marker& marker : markers) {
+    const size_t length = marker.data.size() + 2;
+    result.push_back(0xFF);
+    result.push_back((uint8_t) marker.code);
+    result.push_back((uint8_t) (length >> 8));
+    result.push_back((uint8_t) length);
+    result.insert(result.end(), marker.data.begin(), marker.data.end());
+  }
+  result.insert(result.end(), jpeg.begin() + 2, jpeg.end());
+  return result;
+}
+
+/**
+ * Reads the APP1, APP2 and COM markers in front of the first SOS of jpeg.
+ */
+std::vector<Marker> readMarkers(const std::vector<uint8_t>& jpeg) {
+  std::vector<Marker> markers;
+  size_t offset = 2;
+  while (offset + 4 <= jpeg.size() && jpeg[offset] == 0xFF) {
+    const int code = jpeg[offset + 1];
+    const size_t length = (jpeg[offset + 2] << 8) | jpeg[offset + 3];
+    if (code == kStartOfScanMarker || offset + 2 + length > jpeg.size()) {
+      break;
+    }
+    if (code == JPEG_APP0 + 1 || code == JPEG_APP0 + 2 || code == JPEG_COM) {
+      markers.push_back(Marker{
+          code,
+          std::vector<uint8_t>(
+              jpeg.begin() + offset + 4,
+              jpeg.begin() + offset + 2 + length)});
+    }
+    offset += 2 + length;
+  }
+  return markers;
+}
+
+TEST(JpegQualityTest, EstimatesEncodedQuality) {
+  for (int quality : {10, 25, 50, 75, 90, 95, 100}) {
+    EXPECT_EQ(quality, estimateQuality(encodeSyntheticJpeg(64, 48, quality)));
+  }
+}
+
+TEST(JpegQualityTest, ClampsToSourceQuality) {
+  EXPECT_EQ(60, clampJpegQuality(95, 60));
+  EXPECT_EQ(50, clampJpegQuality(50, 60));
+  EXPECT_EQ(95, clampJpegQuality(95, 0));
+}
+
+class JpegTranscodeTest : public ::testing::Test {
+ protected:
+  static void SetUpTestCase() {
+    jpeg_ = new std::vector<uint8_t>(encodeSyntheticJpeg(1500, 1000, 95));
+  }
+
+  static void TearDownTestCase() {
+    delete jpeg_;
+    jpeg_ = nullptr;
+  }
+
+  static std::vector<uint8_t> transcode(
+      RotationType rotation_type,
+      const TargetSize& target_size,
+      int quality) {
+    JpegStatus status;
+    JpegMemorySource source;
+    source.setExternalBuffer(jpeg_->data(), jpeg_->size());
+    JpegMemoryDestination destination;
+    transformJpeg(
+        status,
+        source.public_fields,
+        destination.public_fields,
+        rotation_type,
+        target_size,
+        quality,
+        MarkerPolicy::NONE,
+        0);
+    EXPECT_FALSE(status.failed) << status.message;
+    return std::move(destination.buffer);
+  }
+
+  /**
+   * Transcodes to sizes at once, each at quality 60 + 10 * its index.
+   */
+  static std::vector<std::vector<uint8_t>> transcodeMulti(
+      RotationType rotation_type,
+      const std::vector<TargetSize>& sizes) {
+    std::vector<JpegMemoryDestination> destinations(sizes.size());
+    std::vector<JpegResizeSink> sinks;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      sinks.push_back(JpegResizeSink{
+          sizes[i], 60 + 10 * (int) i, &destinations[i].public_fields});
+    }
+    JpegStatus status;
+    JpegMemorySource source;
+    source.setExternalBuffer(jpeg_->data(), jpeg_->size());
+    transformJpegMulti(
+        status,
+        source.public_fields,
+        rotation_type,
+        sinks,
+        MarkerPolicy::NONE,
+        0);
+    EXPECT_FALSE(status.failed) << status.message;
+    std::vector<std::vector<uint8_t>> outputs;
+    for (JpegMemoryDestination& destination : destinations) {
+      outputs.push_back(std::move(destination.buffer));
+    }
+    return outputs;
+  }
+
+  static std::vector<uint8_t>* jpeg_;
+};
+
+std::vector<uint8_t>* JpegTranscodeTest::jpeg_ = nullptr;
+
+TEST_F(JpegTranscodeTest, NeverEncodesAboveSourceQuality) {
+  int encoded_quality;
+  const std::vector<uint8_t> clamped = transcodeScaled(
+      *jpeg_,
+      RotationType::ROTATE_0,
+      ScaleFactor{4, 8},
+      100,
+      MarkerPolicy::NONE,
+      encoded_quality);
+  EXPECT_EQ(95, encoded_quality);
+  EXPECT_EQ(95, estimateQuality(clamped));
+
+  const std::vector<uint8_t> lowered = transcodeScaled(
+      *jpeg_,
+      RotationType::ROTATE_90,
+      ScaleFactor{4, 8},
+      70,
+      MarkerPolicy::NONE,
+      encoded_quality);
+  EXPECT_EQ(70, encoded_quality);
+  EXPECT_EQ(70, estimateQuality(lowered));
+}
+
+TEST_F(JpegTranscodeTest, ByteLimitPicksHighestQualityThatFits) {
+  const ScaleFactor scale_factor{4, 8};
+  int encoded_quality;
+  for (int limit_quality : {20, 62, 85}) {
+    const size_t max_bytes = transcodeScaled(
+        *jpeg_,
+        RotationType::ROTATE_0,
+        scale_factor,
+        limit_quality,
+        MarkerPolicy::NONE,
+        encoded_quality).size();
+    JpegStatus status;
+    int quality;
+    const std::vector<uint8_t> output = transcodeWithByteLimit(
+        *jpeg_, scale_factor, 90, max_bytes, status, quality);
+    ASSERT_FALSE(status.failed) << status.message;
+    EXPECT_GE(quality, limit_quality);
+    EXPECT_LE(output.size(), max_bytes);
+    if (quality < 90) {
+      EXPECT_GT(
+          transcodeScaled(
+              *jpeg_,
+              RotationType::ROTATE_0,
+              scale_factor,
+              quality + 1,
+              MarkerPolicy::NONE,
+              encoded_quality).size(),
+          max_bytes)
+          << "quality " << quality + 1 << " fits too";
+    }
+    EXPECT_TRUE(
+        transcodeScaled(
+            *jpeg_,
+            RotationType::ROTATE_0,
+            scale_factor,
+            quality,
+            MarkerPolicy::NONE,
+            encoded_quality) == output)
+        << "quality " << quality;
+  }
+}
+
+TEST_F(JpegTranscodeTest, ByteLimitKeepsTopQualityIfItFits) {
+  JpegStatus status;
+  int quality;
+  transcodeWithByteLimit(
+      *jpeg_, ScaleFactor{4, 8}, 100, jpeg_->size(), status, quality);
+  ASSERT_FALSE(status.failed) << status.message;
+  EXPECT_EQ(95, quality);
+}
+
+TEST_F(JpegTranscodeTest, ByteLimitFailsIfNothingFits) {
+  JpegStatus status;
+  int quality;
+  transcodeWithByteLimit(
+      *jpeg_, ScaleFactor{4, 8}, 90, 256, status, quality);
+  EXPECT_TRUE(status.failed);
+  EXPECT_EQ(0, quality);
+}
+
+TEST(JpegMarkerTest, KeepsMarkersOfPolicy) {
+  // little endian IFD0 with the orientation, 6, and a make
+  const Marker exif = makeMarker(
+      JPEG_APP0 + 1,
+      "Exif",
+      std::string(
+          "\0II*\0\x08\0\0\0\x02\0"
+          "\x12\x01\x03\0\x01\0\0\0\x06\0\0\0"
+          "\x0f\x01\x02\0\x04\0\0\0Test"
+          "\0\0\0\0",
+          37));
+  const size_t exif_orientation = 24;
+  ASSERT_EQ(6, exif.data[exif_orientation]);
+  Marker exif_normal = exif;
+  exif_normal.data[exif_orientation] = 1;
+  // what EXIF_ORIENTATION keeps: big endian IFD0 with the orientation only
+  const Marker exif_orientation_only = makeMarker(
+      JPEG_APP0 + 1,
+      "Exif",
+      std::string(
+          "\0MM\0*\0\0\0\x08\0\x01"
+          "\x01\x12\0\x03\0\0\0\x01\0\x06\0\0"
+          "\0\0\0\0",
+          27));
+  const Marker xmp = makeMarker(
+      JPEG_APP0 + 1, "http://ns.adobe.com/xap/1.0/", "<x:xmpmeta/>");
+  const Marker icc = makeMarker(
+      JPEG_APP0 + 2, "ICC_PROFILE", std::string("\x01\x01profile", 9));
+  const Marker comment = makeMarker(JPEG_COM, "comment", "");
+  const std::vector<uint8_t> jpeg = insertMarkers(
+      encodeSyntheticJpeg(320, 240, 90), {exif, xmp, icc, comment});
+  ASSERT_EQ(4u, readMarkers(jpeg).size());
+
+  const struct {
+    MarkerPolicy marker_policy;
+    RotationType rotation_type;
+    std::vector<Marker> expected;
+  } cases[] = {
+      {MarkerPolicy::NONE, RotationType::ROTATE_0, {}},
+      {MarkerPolicy::EXIF_ORIENTATION,
+          RotationType::ROTATE_0,
+          {exif_orientation_only}},
+      {MarkerPolicy::EXIF_ORIENTATION, RotationType::ROTATE_90, {}},
+      {MarkerPolicy::ICC_PROFILE, RotationType::ROTATE_0, {icc}},
+      {MarkerPolicy::ICC_PROFILE, RotationType::ROTATE_90, {icc}},
+      {MarkerPolicy::ALL, RotationType::ROTATE_0, {exif, xmp, icc, comment}},
+      {MarkerPolicy::ALL,
+          RotationType::ROTATE_90,
+          {exif_normal, xmp, icc, comment}},
+  };
+  for (const auto& test_case : cases) {
+    int encoded_quality;
+    const std::vector<uint8_t> output = transcodeScaled(
+        jpeg,
+        test_case.rotation_type,
+        ScaleFactor{4, 8},
+        80,
+        test_case.marker_policy,
+        encoded_quality);
+    EXPECT_EQ(test_case.expected, readMarkers(output))
+        << "policy " << (int) test_case.marker_policy << " rotated by "
+        << (int) test_case.rotation_type;
+  }
+}
+
+TEST_F(JpegTranscodeTest, MultiMatchesSingleTranscodes) {
+  const std::vector<TargetSize> sizes(3, TargetSize{1080, 720});
+  for (RotationType rotation_type :
+      {RotationType::ROTATE_0, RotationType::ROTATE_90,
+          RotationType::ROTATE_180, RotationType::TRANSVERSE}) {
+    const std::vector<std::vector<uint8_t>> outputs =
+        transcodeMulti(rotation_type, sizes);
+    ASSERT_EQ(sizes.size(), outputs.size());
+    for (size_t i = 0; i < sizes.size(); i++) {
+      EXPECT_TRUE(
+          transcode(rotation_type, sizes[i], 60 + 10 * (int) i) == outputs[i])
+          << "output " << i << " rotated by " << (int) rotation_type;
+    }
+  }
+}
+
+TEST_F(JpegTranscodeTest, MultiRotatesToExactSizes) {
+  // none of these is a multiple of the 16 pixel iMCU
+  const std::vector<TargetSize> sizes{
+      TargetSize{1080, 720}, TargetSize{601, 401}, TargetSize{99, 67}};
+  const std::vector<std::vector<uint8_t>> outputs =
+      transcodeMulti(RotationType::ROTATE_90, sizes);
+  ASSERT_EQ(sizes.size(), outputs.size());
+  for (size_t i = 0; i < sizes.size(); i++) {
+    unsigned int width, height;
+    getJpegSize(outputs[i], width, height);
+    EXPECT_EQ((unsigned int) sizes[i].getHeight(), width);
+    EXPECT_EQ((unsigned int) sizes[i].getWidth(), height);
+  }
+}
+
+} // namespace
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "test_images.h"
+
+#include <algorithm>
+
+#include <math.h>
+
+#include <gtest/gtest.h>
+
+#include "jpeg/jpeg_codec.h"
+#include "jpeg/jpeg_memory_io.h"
+#include "jpeg/jpeg_status.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace test {
+
+const TargetSize kFullSize{1 << 16, 1 << 16};
+
+std::vector<uint8_t> encodeSyntheticJpeg(
+    unsigned int width,
+    unsigned int height,
+    int quality) {
+  uint8_t* pixels = new uint8_t[(size_t) width * height * 3];
+  uint32_t noise = 2463534242u;
+  uint8_t* pixel = pixels;
+  for (unsigned int y = 0; y < height; ++y) {
+    for (unsigned int x = 0; x < width; ++x) {
+      noise ^= noise << 13;
+      noise ^= noise >> 17;
+      noise ^= noise << 5;
+      int grain = (int) (noise & 15) - 8;
+      int edge = ((x / 96 + y / 64) & 1) ? 40 : 0;
+      double ring = sin((x * (double) x + y * (double) y) / (width * 24.0));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (x * 200 / width) + edge + grain));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (y * 200 / height) + grain));
+      *pixel++ = (uint8_t) std::min(255, std::max(0,
+          (int) (128 + 100 * ring) - edge + grain));
+    }
+  }
+  DecodedImage image{
+      pixels_t{pixels, [](uint8_t* pixels) { delete[] pixels; }},
+      PixelFormat::RGB,
+      width,
+      height,
+      std::vector<uint8_t>()};
+  JpegStatus status;
+  JpegMemoryDestination destination;
+  encodeJpeg(status, image, destination.public_fields, quality, 0);
+  EXPECT_FALSE(status.failed) << status.message;
+  return std::move(destination.buffer);
+}
+
+std::vector<uint8_t> decode(
+    const std::vector<uint8_t>& jpeg,
+    PixelFormat pixel_format,
+    bool dither,
+    unsigned int& width,
+    unsigned int& height) {
+  JpegStatus status;
+  JpegMemorySource source;
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  EXPECT_TRUE(getDecodedJpegSize(
+      status, source.public_fields, kFullSize, width, height))
+      << status.message;
+  const size_t stride = (size_t) width * bytesPerPixel(pixel_format);
+  std::vector<uint8_t> pixels(stride * height);
+  source.setExternalBuffer(jpeg.data(), jpeg.size());
+  decodeJpeg(
+      status,
+      source.public_fields,
+      kFullSize,
+      pixel_format,
+      dither,
+      pixels.data(),
+      width,
+      height,
+      stride);
+  EXPECT_FALSE(status.failed) << status.message;
+  return pixels;
+}
+
+} } } }
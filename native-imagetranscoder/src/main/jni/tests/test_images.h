@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _TEST_IMAGES_H_
+#define _TEST_IMAGES_H_
+
+#include <vector>
+
+#include <stdint.h>
+
+#include "decoded_image.h"
+#include "transformations.h"
+
+namespace facebook {
+namespace imagepipeline {
+namespace jpeg {
+namespace test {
+
+/**
+ * Target size no image is larger than, decodes at full size
+ */
+extern const TargetSize kFullSize;
+
+/**
+ * Encodes width x height RGB pixels of gradients with some texture, hard
+ * edges and rings, so that every cipher level, quality and upsampling path
+ * has something to get wrong. The pixels only depend on the size.
+ */
+std::vector<uint8_t> encodeSyntheticJpeg(
+    unsigned int width,
+    unsigned int height,
+    int quality);
+
+/**
+ * Decodes jpeg at full size with decodeJpeg.
+ */
+std::vector<uint8_t> decode(
+    const std::vector<uint8_t>& jpeg,
+    PixelFormat pixel_format,
+    bool dither,
+    unsigned int& width,
+    unsigned int& height);
+
+} } } }
+
+#endif /* _TEST_IMAGES_H_ */
@@ -2,6 +2,8 @@ LOCAL_PATH:= $(call my-dir)
 
 JPEGTURBO_CFLAGS := -DJPEG_LIB_VERSION=80 -Wno-attributes
 
+# jmemnobs.c is left out, native-imagetranscoder implements jmemsys.h in
+# jpeg/jpeg_memory_manager.cpp
 JPEGTURBO_SRC_FILES := \
 	jcapimin.c jcapistd.c jccoefct.c jccolor.c \
 	jcdctmgr.c jchuff.c jcinit.c jcmainct.c jcmarker.c jcmaster.c \
@@ -12,7 +14,7 @@ JPEGTURBO_SRC_FILES := \
 	jfdctflt.c jfdctfst.c jfdctint.c jidctflt.c jidctfst.c jidctint.c \
 	jidctred.c jquant1.c jquant2.c jutils.c jmemmgr.c \
 	jaricom.c jcarith.c jdarith.c \
-	transupp.c jmemnobs.c
+	transupp.c
 
 # switch between SIMD supported and non supported architectures
 ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.DoNotStrip;
+import com.facebook.common.internal.Preconditions;
+
+/**
+ * Thread pool shared by the native libraries of Fresco, so work they run in parallel does not
+ * start more threads than there are cores.
+ *
+ * <p>Workers pick tasks of the most urgent priority first and steal queued tasks from each other
+ * when they run out of work.
+ */
+@DoNotStrip
+public class NativeTaskPool {
+
+  /** Needed for what is on screen right now */
+  public static final int PRIORITY_VISIBLE = 0;
+
+  /** Likely needed soon */
+  public static final int PRIORITY_PREFETCH = 1;
+
+  /** May wait for all other tasks */
+  public static final int PRIORITY_BACKGROUND = 2;
+
+  public static final int PRIORITY_COUNT = 3;
+
+  static {
+    NativeTaskPoolSoLoader.ensure();
+  }
+
+  /**
+   * Sets the number of worker threads, by default one per core. Has to be called before any native
+   * library submitted work, e.g. while the application starts.
+   *
+   * @return false if the pool was already started with the default size
+   */
+  public static boolean setThreadCount(final int threadCount) {
+    Preconditions.checkArgument(threadCount > 0);
+    return nativeSetThreadCount(threadCount);
+  }
+
+  /** Returns a snapshot of the counters of the pool. */
+  public static NativeTaskPoolStats getStats() {
+    final NativeTaskPoolStats stats = new NativeTaskPoolStats();
+    nativeGetStats(stats.mValues);
+    return stats;
+  }
+
+  @DoNotStrip
+  private static native boolean nativeSetThreadCount(int threadCount);
+
+  @DoNotStrip
+  private static native void nativeGetStats(long[] values);
+}
@@ -0,0 +1,26 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.soloader.nativeloader.NativeLoader;
+
+/**
+ * Single place responsible for ensuring that libfresco-taskpool.so is loaded. Native libraries
+ * using the pool call this before loading themselves, old versions of Android do not resolve
+ * their dependency on it otherwise.
+ */
+public class NativeTaskPoolSoLoader {
+  private static boolean sInitialized;
+
+  public static synchronized void ensure() {
+    if (!sInitialized) {
+      NativeLoader.loadLibrary("fresco-taskpool");
+      sInitialized = true;
+    }
+  }
+}
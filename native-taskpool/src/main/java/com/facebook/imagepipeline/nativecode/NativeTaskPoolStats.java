@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+package com.facebook.imagepipeline.nativecode;
+
+import com.facebook.common.internal.Preconditions;
+
+/** Counters of the {@link NativeTaskPool}, as returned by {@link NativeTaskPool#getStats}. */
+public class NativeTaskPoolStats {
+
+  private static final int THREAD_COUNT = 0;
+  private static final int QUEUED_TASKS = 1;
+  private static final int COMPLETED_TASKS = QUEUED_TASKS + NativeTaskPool.PRIORITY_COUNT;
+  private static final int STOLEN_TASKS = COMPLETED_TASKS + 1;
+  private static final int BUSY_TIME = COMPLETED_TASKS + 2;
+
+  /** Counters as written by native code */
+  final long[] mValues = new long[BUSY_TIME + 1];
+
+  NativeTaskPoolStats() {}
+
+  /** Worker threads of the pool, 0 if no work was submitted yet */
+  public int getThreadCount() {
+    return (int) mValues[THREAD_COUNT];
+  }
+
+  /** Tasks of given priority waiting to run */
+  public int getQueuedTaskCount(int priority) {
+    Preconditions.checkArgument(priority >= 0 && priority < NativeTaskPool.PRIORITY_COUNT);
+    return (int) mValues[QUEUED_TASKS + priority];
+  }
+
+  /** Tasks run since the pool started */
+  public long getCompletedTaskCount() {
+    return mValues[COMPLETED_TASKS];
+  }
+
+  /** Tasks a worker took from the queue of another one */
+  public long getStolenTaskCount() {
+    return mValues[STOLEN_TASKS];
+  }
+
+  /** Time all workers together spent running tasks */
+  public long getBusyTimeNanos() {
+    return mValues[BUSY_TIME];
+  }
+}
@@ -0,0 +1,26 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+#
+# This source code is licensed under the MIT license found in the
+# LICENSE file in the root directory of this source tree.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := fresco-taskpool
+LOCAL_SRC_FILES := \
+	fresco_task_pool.cpp \
+	init.cpp \
+	NativeTaskPool.cpp
+
+CXX11_FLAGS := -std=c++11
+LOCAL_CFLAGS += $(CXX11_FLAGS)
+LOCAL_CFLAGS += -DLOG_TAG=\"libfresco-taskpool\"
+LOCAL_CFLAGS += -fvisibility=hidden
+LOCAL_CFLAGS += $(FRESCO_CPP_CFLAGS)
+LOCAL_EXPORT_CPPFLAGS := $(CXX11_FLAGS)
+# only fresco_task_pool.h and task_pool.h are meant for other libraries
+LOCAL_EXPORT_C_INCLUDES := $(LOCAL_PATH)
+LOCAL_LDLIBS := -llog
+LOCAL_LDFLAGS += $(FRESCO_CPP_LDFLAGS)
+
+include $(BUILD_SHARED_LIBRARY)
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <type_traits>
+
+#include <jni.h>
+
+#include "fresco_task_pool.h"
+#include "logging.h"
+#include "NativeTaskPool.h"
+
+/**
+ * Layout of the array filled by nativeGetStats, keep in sync with
+ * NativeTaskPoolStats
+ */
+enum {
+  STATS_THREAD_COUNT = 0,
+  STATS_QUEUED_TASKS = 1,
+  STATS_COMPLETED_TASKS = STATS_QUEUED_TASKS + FRESCO_TASK_PRIORITY_COUNT,
+  STATS_STOLEN_TASKS,
+  STATS_BUSY_TIME_NS,
+  STATS_COUNT,
+};
+
+static jboolean NativeTaskPool_nativeSetThreadCount(
+    JNIEnv* /* env */,
+    jclass /* clzz */,
+    jint thread_count) {
+  return fresco_task_pool_set_thread_count(thread_count) ? JNI_TRUE : JNI_FALSE;
+}
+
+static void NativeTaskPool_nativeGetStats(
+    JNIEnv* env,
+    jclass /* clzz */,
+    jlongArray values_array) {
+  if (env->GetArrayLength(values_array) < STATS_COUNT) {
+    LOGE("stats array is too small");
+    return;
+  }
+  fresco_task_pool_stats stats;
+  fresco_task_pool_get_stats(&stats);
+  jlong values[STATS_COUNT];
+  values[STATS_THREAD_COUNT] = stats.thread_count;
+  for (int i = 0; i < FRESCO_TASK_PRIORITY_COUNT; i++) {
+    values[STATS_QUEUED_TASKS + i] = stats.queued_tasks[i];
+  }
+  values[STATS_COMPLETED_TASKS] = stats.completed_tasks;
+  values[STATS_STOLEN_TASKS] = stats.stolen_tasks;
+  values[STATS_BUSY_TIME_NS] = stats.busy_time_ns;
+  env->SetLongArrayRegion(values_array, 0, STATS_COUNT, values);
+}
+
+static JNINativeMethod gNativeTaskPoolMethods[] = {
+  { "nativeSetThreadCount",
+      "(I)Z",
+      (void*) NativeTaskPool_nativeSetThreadCount },
+  { "nativeGetStats",
+      "([J)V",
+      (void*) NativeTaskPool_nativeGetStats },
+};
+
+bool registerNativeTaskPoolMethods(JNIEnv* env) {
+  auto nativeTaskPoolClass = env->FindClass(
+      "com/facebook/imagepipeline/nativecode/NativeTaskPool");
+  if (nativeTaskPoolClass == nullptr) {
+    LOGE("could not find NativeTaskPool class");
+    return false;
+  }
+
+  auto result = env->RegisterNatives(
+      nativeTaskPoolClass,
+      gNativeTaskPoolMethods,
+      std::extent<decltype(gNativeTaskPoolMethods)>::value);
+
+  if (result != 0) {
+    LOGE("could not register NativeTaskPool methods");
+    return false;
+  }
+
+  return true;
+}
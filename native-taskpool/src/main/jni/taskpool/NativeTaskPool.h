@@ -0,0 +1,15 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _NATIVE_TASK_POOL_H_
+#define _NATIVE_TASK_POOL_H_
+
+#include <jni.h>
+
+bool registerNativeTaskPoolMethods(JNIEnv* env);
+
+#endif /* _NATIVE_TASK_POOL_H_ */
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "fresco_task_pool.h"
+
+namespace {
+
+struct Task {
+  fresco_task_function function;
+  void* arg;
+};
+
+typedef std::deque<Task> TaskQueue;
+
+/**
+ * Queues of one worker. The worker pushes and pops at the back, thieves
+ * take from the front.
+ */
+struct WorkerQueues {
+  std::mutex mutex;
+  TaskQueue queues[FRESCO_TASK_PRIORITY_COUNT];
+};
+
+class WorkStealingPool {
+ public:
+  explicit WorkStealingPool(unsigned int thread_count);
+
+  void submit(int priority, const Task& task);
+  bool runPendingTask(int lowest_priority);
+  void getStats(fresco_task_pool_stats& stats);
+
+ private:
+  void runWorker(int index);
+  bool takeTask(int lowest_priority, int self, Task& task);
+  void runTask(const Task& task);
+
+  std::vector<std::unique_ptr<WorkerQueues>> worker_queues_;
+
+  // tasks submitted from outside of the pool
+  std::mutex shared_mutex_;
+  TaskQueue shared_queues_[FRESCO_TASK_PRIORITY_COUNT];
+
+  std::mutex sleep_mutex_;
+  std::condition_variable task_available_;
+  std::atomic<int> pending_tasks_;
+  // index of the worker to steal from first, spreads the thieves
+  std::atomic<unsigned int> next_victim_;
+
+  std::atomic<int> queued_tasks_[FRESCO_TASK_PRIORITY_COUNT];
+  std::atomic<int64_t> completed_tasks_;
+  std::atomic<int64_t> stolen_tasks_;
+  std::atomic<int64_t> busy_time_ns_;
+};
+
+// index of the calling thread among the workers, -1 for other threads
+thread_local int tWorkerIndex = -1;
+
+std::mutex gPoolMutex;
+std::atomic<WorkStealingPool*> gPool{nullptr};
+int gThreadCount = 0;
+
+WorkStealingPool& getPool() {
+  WorkStealingPool* pool = gPool.load(std::memory_order_acquire);
+  if (pool == nullptr) {
+    std::lock_guard<std::mutex> lock(gPoolMutex);
+    pool = gPool.load(std::memory_order_relaxed);
+    if (pool == nullptr) {
+      const unsigned int thread_count = gThreadCount > 0
+          ? gThreadCount
+          : std::max(1u, std::thread::hardware_concurrency());
+      // never destroyed, the workers must not be joined while the process
+      // exits
+      pool = new WorkStealingPool(thread_count);
+      gPool.store(pool, std::memory_order_release);
+    }
+  }
+  return *pool;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int thread_count)
+    : pending_tasks_(0),
+      next_victim_(0),
+      completed_tasks_(0),
+      stolen_tasks_(0),
+      busy_time_ns_(0) {
+  for (std::atomic<int>& queued : queued_tasks_) {
+    queued.store(0);
+  }
+  // all queues exist before the first worker may steal from them
+  for (unsigned int i = 0; i < thread_count; i++) {
+    worker_queues_.emplace_back(new WorkerQueues());
+  }
+  for (unsigned int i = 0; i < thread_count; i++) {
+    std::thread([this, i] { runWorker(i); }).detach();
+  }
+}
+
+void WorkStealingPool::submit(int priority, const Task& task) {
+  if (tWorkerIndex >= 0) {
+    WorkerQueues& own = *worker_queues_[tWorkerIndex];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    own.queues[priority].push_back(task);
+  } else {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_queues_[priority].push_back(task);
+  }
+  queued_tasks_[priority]++;
+  pending_tasks_++;
+  {
+    // a worker checks pending_tasks_ under this lock before it sleeps
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+  }
+  task_available_.notify_one();
+}
+
+bool WorkStealingPool::takeTask(int lowest_priority, int self, Task& task) {
+  const int worker_count = worker_queues_.size();
+  for (int priority = 0; priority <= lowest_priority; priority++) {
+    bool found = false;
+    bool stolen = false;
+    if (self >= 0) {
+      WorkerQueues& own = *worker_queues_[self];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      TaskQueue& queue = own.queues[priority];
+      if (!queue.empty()) {
+        task = queue.back();
+        queue.pop_back();
+        found = true;
+      }
+    }
+    if (!found) {
+      std::lock_guard<std::mutex> lock(shared_mutex_);
+      TaskQueue& queue = shared_queues_[priority];
+      if (!queue.empty()) {
+        task = queue.front();
+        queue.pop_front();
+        found = true;
+      }
+    }
+    const int first_victim = next_victim_++ % worker_count;
+    for (int i = 0; !found && i < worker_count; i++) {
+      const int victim = (first_victim + i) % worker_count;
+      if (victim == self) {
+        continue;
+      }
+      WorkerQueues& other = *worker_queues_[victim];
+      std::lock_guard<std::mutex> lock(other.mutex);
+      TaskQueue& queue = other.queues[priority];
+      if (!queue.empty()) {
+        task = queue.front();
+        queue.pop_front();
+        found = stolen = true;
+      }
+    }
+    if (found) {
+      queued_tasks_[priority]--;
+      pending_tasks_--;
+      if (stolen) {
+        stolen_tasks_++;
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::runTask(const Task& task) {
+  const auto start = std::chrono::steady_clock::now();
+  task.function(task.arg);
+  busy_time_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+  completed_tasks_++;
+}
+
+void WorkStealingPool::runWorker(int index) {
+  tWorkerIndex = index;
+  while (true) {
+    Task task;
+    if (takeTask(FRESCO_TASK_PRIORITY_COUNT - 1, index, task)) {
+      runTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    task_available_.wait(lock, [this] { return pending_tasks_ > 0; });
+  }
+}
+
+bool WorkStealingPool::runPendingTask(int lowest_priority) {
+  Task task;
+  if (tWorkerIndex < 0 || !takeTask(lowest_priority, tWorkerIndex, task)) {
+    return false;
+  }
+  runTask(task);
+  return true;
+}
+
+void WorkStealingPool::getStats(fresco_task_pool_stats& stats) {
+  stats.thread_count = worker_queues_.size();
+  for (int priority = 0; priority < FRESCO_TASK_PRIORITY_COUNT; priority++) {
+    // briefly negative while a task is taken as it is submitted
+    stats.queued_tasks[priority] = std::max(0, queued_tasks_[priority].load());
+  }
+  stats.completed_tasks = completed_tasks_;
+  stats.stolen_tasks = stolen_tasks_;
+  stats.busy_time_ns = busy_time_ns_;
+}
+
+bool isValidPriority(int priority) {
+  return priority >= 0 && priority < FRESCO_TASK_PRIORITY_COUNT;
+}
+
+} // namespace
+
+int fresco_task_pool_set_thread_count(int thread_count) {
+  std::lock_guard<std::mutex> lock(gPoolMutex);
+  if (thread_count <= 0 || gPool.load() != nullptr) {
+    return 0;
+  }
+  gThreadCount = thread_count;
+  return 1;
+}
+
+void fresco_task_pool_submit(
+    int priority,
+    fresco_task_function function,
+    void* arg) {
+  getPool().submit(
+      isValidPriority(priority) ? priority : FRESCO_TASK_PRIORITY_BACKGROUND,
+      Task{function, arg});
+}
+
+int fresco_task_pool_run_pending_task(int lowest_priority) {
+  if (!isValidPriority(lowest_priority)) {
+    lowest_priority = FRESCO_TASK_PRIORITY_BACKGROUND;
+  }
+  return getPool().runPendingTask(lowest_priority) ? 1 : 0;
+}
+
+void fresco_task_pool_get_stats(fresco_task_pool_stats* stats) {
+  WorkStealingPool* pool = gPool.load(std::memory_order_acquire);
+  if (pool == nullptr) {
+    *stats = fresco_task_pool_stats();
+    return;
+  }
+  pool->getStats(*stats);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _FRESCO_TASK_POOL_H_
+#define _FRESCO_TASK_POOL_H_
+
+#include <stdint.h>
+
+/**
+ * Work-stealing thread pool shared by all native libraries of Fresco.
+ *
+ * <p> libfresco-taskpool.so holds the only instance of the process, so
+ * libraries running work in parallel share the cores instead of each
+ * starting threads of their own. Every library links the STL statically,
+ * which is why the pool is only reachable through this C interface. C++
+ * code should use the wrappers of task_pool.h.
+ *
+ * <p> Each worker has a queue per priority. Tasks submitted by a worker go
+ * to its own queue and are run newest first, while idle workers steal the
+ * oldest ones of the other queues. Tasks submitted by any other thread go
+ * to a shared queue. A worker always runs a task of the most urgent
+ * priority there is, wherever it is queued.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRESCO_TASK_POOL_EXPORT __attribute__((visibility("default")))
+
+/**
+ * Priorities of tasks, most urgent first. Keep in sync with the PRIORITY_*
+ * constants of NativeTaskPool.
+ */
+enum {
+  // needed for what is on screen right now
+  FRESCO_TASK_PRIORITY_VISIBLE = 0,
+  // likely needed soon
+  FRESCO_TASK_PRIORITY_PREFETCH = 1,
+  // may wait as long as it takes
+  FRESCO_TASK_PRIORITY_BACKGROUND = 2,
+  FRESCO_TASK_PRIORITY_COUNT = 3,
+};
+
+typedef void (*fresco_task_function)(void* arg);
+
+typedef struct fresco_task_pool_stats {
+  // workers of the pool, 0 until it started
+  int32_t thread_count;
+  // tasks waiting to run, per priority
+  int32_t queued_tasks[FRESCO_TASK_PRIORITY_COUNT];
+  // tasks run so far
+  int64_t completed_tasks;
+  // tasks taken from the queue of another worker
+  int64_t stolen_tasks;
+  // time the workers spent running tasks
+  int64_t busy_time_ns;
+} fresco_task_pool_stats;
+
+/**
+ * Sets the number of workers, by default one per core. Only has an effect
+ * before the first task is submitted, returns 0 if it came too late.
+ */
+FRESCO_TASK_POOL_EXPORT int fresco_task_pool_set_thread_count(
+    int thread_count);
+
+/**
+ * Queues function to be called with arg on one of the workers, starting the
+ * pool on first use. The function must not throw.
+ */
+FRESCO_TASK_POOL_EXPORT void fresco_task_pool_submit(
+    int priority,
+    fresco_task_function function,
+    void* arg);
+
+/**
+ * Runs one queued task of at most the given priority on the calling worker,
+ * for tasks waiting on tasks they submitted. Returns 0 if there was none or
+ * if the calling thread is not a worker of the pool: the tasks may be
+ * anybody's, and other threads, Java ones in particular, must not pick them
+ * up.
+ */
+FRESCO_TASK_POOL_EXPORT int fresco_task_pool_run_pending_task(
+    int lowest_priority);
+
+FRESCO_TASK_POOL_EXPORT void fresco_task_pool_get_stats(
+    fresco_task_pool_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _FRESCO_TASK_POOL_H_ */
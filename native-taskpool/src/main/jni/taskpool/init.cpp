@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <jni.h>
+
+#include "logging.h"
+#include "NativeTaskPool.h"
+
+/**
+ * Executed when libfresco-taskpool.so is loaded, registers the native
+ * methods of NativeTaskPool.
+ */
+__attribute__((visibility("default")))
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
+  JNIEnv* env;
+
+  if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+    return -1;
+  }
+
+  if (!registerNativeTaskPoolMethods(env)) {
+    LOGE("could not register NativeTaskPool methods");
+    return -1;
+  }
+
+  return JNI_VERSION_1_6;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef _TASK_POOL_H_
+#define _TASK_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "fresco_task_pool.h"
+
+namespace facebook {
+namespace imagepipeline {
+
+/**
+ * C++ side of the shared pool of fresco_task_pool.h. Everything here is
+ * inline so that std::function objects never cross the boundary of the
+ * library that created them.
+ */
+enum class TaskPriority {
+  VISIBLE = FRESCO_TASK_PRIORITY_VISIBLE,
+  PREFETCH = FRESCO_TASK_PRIORITY_PREFETCH,
+  BACKGROUND = FRESCO_TASK_PRIORITY_BACKGROUND,
+};
+
+static const int kTaskPriorityCount = FRESCO_TASK_PRIORITY_COUNT;
+
+inline void runSubmittedTask(void* arg) {
+  std::unique_ptr<std::function<void()>> task{
+      static_cast<std::function<void()>*>(arg)};
+  (*task)();
+}
+
+/**
+ * Queues task to run on one of the workers of the shared pool.
+ */
+inline void submitTask(TaskPriority priority, std::function<void()> task) {
+  fresco_task_pool_submit(
+      (int) priority,
+      runSubmittedTask,
+      new std::function<void()>(std::move(task)));
+}
+
+/**
+ * Tasks split off some work of the calling thread, which waits for all of
+ * them before it goes on.
+ *
+ * <p> The tasks are kept in a queue of the group, and the pool only gets a
+ * ticket per task that runs the next one of that queue. While waiting, the
+ * calling thread runs the tasks no worker took yet, but never a task of
+ * anybody else: the caller may be a Java thread, which must not end up
+ * running an unrelated job or its callbacks.
+ */
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskPriority priority)
+      : priority_(priority), state_(std::make_shared<State>()) {}
+
+  ~TaskGroup() {
+    wait();
+  }
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  void run(std::function<void()> task) {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->queued_tasks.push_back(std::move(task));
+      state_->pending_tasks++;
+    }
+    // tickets may outlive the group when the waiting thread ran their task
+    std::shared_ptr<State> state = state_;
+    submitTask(priority_, [state] { state->runNextTask(); });
+  }
+
+  /**
+   * Returns once all tasks passed to run completed.
+   */
+  void wait() {
+    while (state_->runNextTask()) {
+    }
+    // the remaining tasks all run on workers already
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->all_done.wait(lock, [this] { return state_->pending_tasks == 0; });
+  }
+
+ private:
+  struct State {
+    std::mutex mutex;
+    std::condition_variable all_done;
+    std::deque<std::function<void()>> queued_tasks;
+    int pending_tasks = 0;
+
+    /**
+     * Runs the oldest queued task, returns false if there was none.
+     */
+    bool runNextTask() {
+      std::function<void()> task;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (queued_tasks.empty()) {
+          return false;
+        }
+        task = std::move(queued_tasks.front());
+        queued_tasks.pop_front();
+      }
+      task();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (--pending_tasks == 0) {
+        all_done.notify_all();
+      }
+      return true;
+    }
+  };
+
+  const TaskPriority priority_;
+  const std::shared_ptr<State> state_;
+};
+
+} }
+
+#endif /* _TASK_POOL_H_ */